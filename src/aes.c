@@ -1,180 +1,1270 @@
-/***************************************************************************
-* Written by Nir Drucker and Shay Gueron
-* AWS Cryptographic Algorithms Group
-* (ndrucker@amazon.com, gueron@amazon.com)
-*
-* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
-*  
-* Licensed under the Apache License, Version 2.0 (the "License").
-* You may not use this file except in compliance with the License.
-* A copy of the License is located at
-*  
-*     http://www.apache.org/licenses/LICENSE-2.0
-*  
-* or in the "license" file accompanying this file. This file is distributed 
-* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
-* express or implied. See the License for the specific language governing 
-* permissions and limitations under the License.
-* The license is detailed in the file LICENSE.txt, and applies to this file.
-* ***************************************************************************/
-
-#include "aes.h"
-#include <string.h>
-
-#include <immintrin.h>
-
-#define AESENC(m, key)         _mm_aesenc_si128(m, key)
-#define AESENCLAST(m, key)     _mm_aesenclast_si128(m, key)
-#define XOR(a, b)              _mm_xor_si128(a, b)
-#define ADD32(a, b)            _mm_add_epi32(a, b)
-#define SHUF8(a, mask)         _mm_shuffle_epi8(a, mask)
-
-#define ZERO256                _mm256_zeroall
-
-#define BSWAP_MASK 0x00010203, 0x04050607, 0x08090a0b, 0x0c0d0e0f
-
-#ifdef VAES
-#define VAESENC(a, key)        _mm512_aesenc_epi128(a, key)
-#define VAESENCLAST(a, key)    _mm512_aesenclast_epi128(a, key)
-#define EXTRACT128(a, imm)     _mm512_extracti64x2_epi64(a, imm)
-#define XOR512(a, b)           _mm512_xor_si512(a,b)
-#define ADD32_512(a, b)        _mm512_add_epi32(a,b)
-#define SHUF8_512(a, mask)     _mm512_shuffle_epi8(a, mask)
-#endif
-
-_INLINE_ __m128i load_m128i(IN const uint8_t *ctr)
-{
-    return _mm_set_epi8(ctr[0],  ctr[1],  ctr[2],  ctr[3],
-                        ctr[4],  ctr[5],  ctr[6],  ctr[7],
-                        ctr[8],  ctr[9],  ctr[10], ctr[11],
-                        ctr[12], ctr[13], ctr[14], ctr[15]);
-}
-
-_INLINE_ __m128i loadr_m128i(IN const uint8_t *ctr)
-{
-    return _mm_setr_epi8(ctr[0],  ctr[1],  ctr[2],  ctr[3],
-                         ctr[4],  ctr[5],  ctr[6],  ctr[7],
-                         ctr[8],  ctr[9],  ctr[10], ctr[11],
-                         ctr[12], ctr[13], ctr[14], ctr[15]);
-}
-
-void aes256_enc(OUT uint8_t *ct,
-                IN const uint8_t *pt,
-                IN const aes256_ks_t *ks) {
-    uint32_t i = 0;
-    __m128i block = loadr_m128i(pt);
-
-    block = XOR(block, ks->keys[0]);
-    for (i = 1; i < AES256_ROUNDS; i++) {
-        block = AESENC(block, ks->keys[i]);
-    }
-    block = AESENCLAST(block, ks->keys[AES256_ROUNDS]);
-
-    _mm_storeu_si128((void*)ct, block);
-
-    // Delete secrets from registers if any.
-    ZERO256();
-}
-
-void aes256_ctr_enc(OUT uint8_t *ct,
-                    IN const uint8_t *ctr,
-                    IN const uint32_t num_blocks,
-                    IN const aes256_ks_t *ks)
-{
-    uint32_t i = 0;
-    __m128i ctr_block = load_m128i(ctr);
-
-    const __m128i bswap_mask = _mm_set_epi32(BSWAP_MASK);
-    const __m128i one = _mm_set_epi32(0,0,0,1);
-
-    __m128i block = SHUF8(ctr_block, bswap_mask);
-
-    for (uint32_t bidx = 0; bidx < num_blocks; bidx++) 
-    {
-        block = XOR(block, ks->keys[0]);
-        for (i = 1; i < AES256_ROUNDS; i++) {
-            block = AESENC(block, ks->keys[i]);
-        }
-        block = AESENCLAST(block, ks->keys[AES256_ROUNDS]);
-
-        //We use memcpy to avoid align casting.
-        _mm_storeu_si128((void*)&ct[16*bidx], block);
-
-        ctr_block = ADD32(ctr_block, one);
-        block = SHUF8(ctr_block, bswap_mask);
-    }
-    
-    // Delete secrets from registers if any.
-    ZERO256();
-}
-
-#ifdef VAES
-
-_INLINE_ void load_ks(OUT __m512i ks512[AES256_ROUNDS + 1], 
-                      IN const aes256_ks_t *ks)
-{
-    for(uint32_t i = 0; i < AES256_ROUNDS + 1; i++)
-    {
-        ks512[i] = _mm512_broadcast_i32x4(ks->keys[i]);
-    }
-}
-
-// NIST 800-90A Table 3, Section 10.2.1 (no derivation function) states that 
-// max_number_of_bits_per_request is min((2^ctr_len - 4) x block_len, 2^19) <= 2^19
-// Therefore the maximal number of blocks (16 bytes) is 2^19/128 = 2^19/2^7 = 2^12 < 2^32
-// Here num_blocks is assumed to be less then 2^32. 
-// It is the caller responsiblity to ensure it.
-void aes256_ctr_enc512(OUT uint8_t *ct,
-                       IN const uint8_t *ctr,
-                       IN const uint32_t num_blocks,
-                       IN const aes256_ks_t *ks)
-{
-    const uint64_t num_par_blocks = num_blocks/4;
-    const uint64_t blocks_rem = num_blocks - (4*(num_par_blocks));
-
-    __m512i ks512[AES256_ROUNDS + 1];
-    load_ks(ks512, ks);
-
-    __m128i single_block = load_m128i(ctr);
-    __m512i ctr_blocks = _mm512_broadcast_i32x4(single_block);
-
-    // Preparing the masks
-    const __m512i bswap_mask = _mm512_set_epi32(BSWAP_MASK, BSWAP_MASK,
-                                                BSWAP_MASK, BSWAP_MASK);
-    const __m512i four = _mm512_set_epi32(0,0,0,4,0,0,0,4,0,0,0,4,0,0,0,4);
-    const __m512i init = _mm512_set_epi32(0,0,0,3,0,0,0,2,0,0,0,1,0,0,0,0);
-
-    // Initialize four parallel counters
-    ctr_blocks = ADD32_512(ctr_blocks, init);
-    __m512i p = SHUF8_512(ctr_blocks, bswap_mask);
-
-    for (uint32_t block_idx = 0; block_idx < num_par_blocks; block_idx++) 
-    {
-        p = XOR512(p, ks512[0]);
-        for (uint32_t i = 1; i < AES256_ROUNDS; i++) 
-        {
-            p = VAESENC(p, ks512[i]);
-        }
-        p = VAESENCLAST(p, ks512[AES256_ROUNDS]);
-
-
-        // We use memcpy to avoid align casting.
-        _mm512_storeu_si512(&ct[PAR_AES_BLOCK_SIZE * block_idx], p);
-
-        // Increase the four counters in parallel
-        ctr_blocks = ADD32_512(ctr_blocks, four);
-        p = SHUF8_512(ctr_blocks, bswap_mask);
-    }
- 
-    if(0 != blocks_rem)
-    {
-        single_block = EXTRACT128(p, 0);
-        aes256_ctr_enc(&ct[PAR_AES_BLOCK_SIZE * num_par_blocks], 
-                       (const uint8_t*)&single_block, blocks_rem, ks);
-    }
-
-    // Delete secrets from registers if any.
-    ZERO256();
-}
-
-#endif //VAES
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#include "aes.h"
+#include <string.h>
+
+#include <immintrin.h>
+
+#define AESENC(m, key)         _mm_aesenc_si128(m, key)
+#define AESENCLAST(m, key)     _mm_aesenclast_si128(m, key)
+#define XOR(a, b)              _mm_xor_si128(a, b)
+#define ADD32(a, b)            _mm_add_epi32(a, b)
+#define SHUF8(a, mask)         _mm_shuffle_epi8(a, mask)
+
+#define ZERO256                _mm256_zeroall
+
+#define BSWAP_MASK 0x00010203, 0x04050607, 0x08090a0b, 0x0c0d0e0f
+
+// The address of block bidx of the optional input buffer in.
+#define OFFSET(in, bidx) ((NULL == (in)) ? NULL : &(in)[AES_BLOCK_SIZE * (bidx)])
+
+// Number of independent blocks the AES-NI CTR kernel keeps in flight. The
+// CTR kernel variants (see AES_DECLARE_CTR_VARIANTS) keep up to
+// CTR_PAR_MAX_BLOCKS.
+#define CTR_PAR_BLOCKS 8
+#define CTR_PAR_MAX_BLOCKS 16
+
+// Number of blocks per instance the AES-NI multi instance kernel keeps in
+// flight (there are AES_X4_LANES instances).
+#define CTR_X4_PAR_BLOCKS 2
+
+// The shuffle mask that broadcasts RotWord of the last word of a round key.
+#define ROT_WORD3_MASK 0x0c0f0e0d
+
+// The vector kernels are compiled for their own targets and are selected at
+// runtime according to the CPU features (see aes_dispatch.c).
+#define TARGET_VAES256 __attribute__((target("avx2,vaes")))
+#define TARGET_VAES512 __attribute__((target("avx2,avx512f,avx512dq,avx512bw,vaes")))
+
+#define VAESENC(a, key)        _mm512_aesenc_epi128(a, key)
+#define VAESENCLAST(a, key)    _mm512_aesenclast_epi128(a, key)
+#define XOR512(a, b)           _mm512_xor_si512(a,b)
+#define ADD32_512(a, b)        _mm512_add_epi32(a,b)
+#define SHUF8_512(a, mask)     _mm512_shuffle_epi8(a, mask)
+
+// _mm256_zeroall clears zmm0-15 only. The VAES (AVX512) kernels may also use
+// zmm16-31, so they delete secrets from all 32 registers with ZERO512.
+#define ZERO512                zero_all512
+
+_INLINE_ TARGET_VAES512 void zero_all512(void)
+{
+    __asm__ volatile(
+        "vpxord %%zmm16, %%zmm16, %%zmm16\n\t"
+        "vpxord %%zmm17, %%zmm17, %%zmm17\n\t"
+        "vpxord %%zmm18, %%zmm18, %%zmm18\n\t"
+        "vpxord %%zmm19, %%zmm19, %%zmm19\n\t"
+        "vpxord %%zmm20, %%zmm20, %%zmm20\n\t"
+        "vpxord %%zmm21, %%zmm21, %%zmm21\n\t"
+        "vpxord %%zmm22, %%zmm22, %%zmm22\n\t"
+        "vpxord %%zmm23, %%zmm23, %%zmm23\n\t"
+        "vpxord %%zmm24, %%zmm24, %%zmm24\n\t"
+        "vpxord %%zmm25, %%zmm25, %%zmm25\n\t"
+        "vpxord %%zmm26, %%zmm26, %%zmm26\n\t"
+        "vpxord %%zmm27, %%zmm27, %%zmm27\n\t"
+        "vpxord %%zmm28, %%zmm28, %%zmm28\n\t"
+        "vpxord %%zmm29, %%zmm29, %%zmm29\n\t"
+        "vpxord %%zmm30, %%zmm30, %%zmm30\n\t"
+        "vpxord %%zmm31, %%zmm31, %%zmm31\n\t"
+        "vzeroall"
+        :
+        :
+        : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6",
+          "xmm7", "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13",
+          "xmm14", "xmm15", "xmm16", "xmm17", "xmm18", "xmm19", "xmm20",
+          "xmm21", "xmm22", "xmm23", "xmm24", "xmm25", "xmm26", "xmm27",
+          "xmm28", "xmm29", "xmm30", "xmm31");
+}
+
+// Number of independent zmm vectors (4 blocks each) the VAES CTR kernel
+// keeps in flight, and the most any CTR kernel variant keeps.
+#define CTR512_PAR_VECS 8
+#define CTR512_PAR_MAX_VECS 16
+
+#define VAESENC256(a, key)     _mm256_aesenc_epi128(a, key)
+#define VAESENCLAST256(a, key) _mm256_aesenclast_epi128(a, key)
+#define XOR256(a, b)           _mm256_xor_si256(a,b)
+#define ADD32_256(a, b)        _mm256_add_epi32(a,b)
+#define SHUF8_256(a, mask)     _mm256_shuffle_epi8(a, mask)
+#define BCAST256(a)            _mm256_broadcastsi128_si256(a)
+
+// Number of independent ymm vectors (2 blocks each) the 256-bit VAES CTR
+// kernel keeps in flight, and the most any CTR kernel variant keeps. Without
+// AVX512 there are only 16 ymm registers.
+#define CTR256_PAR_VECS 8
+#define CTR256_PAR_MAX_VECS 16
+
+_INLINE_ __m128i load_m128i(IN const uint8_t *ctr)
+{
+    return _mm_set_epi8(ctr[0],  ctr[1],  ctr[2],  ctr[3],
+                        ctr[4],  ctr[5],  ctr[6],  ctr[7],
+                        ctr[8],  ctr[9],  ctr[10], ctr[11],
+                        ctr[12], ctr[13], ctr[14], ctr[15]);
+}
+
+_INLINE_ __m128i loadr_m128i(IN const uint8_t *ctr)
+{
+    return _mm_setr_epi8(ctr[0],  ctr[1],  ctr[2],  ctr[3],
+                         ctr[4],  ctr[5],  ctr[6],  ctr[7],
+                         ctr[8],  ctr[9],  ctr[10], ctr[11],
+                         ctr[12], ctr[13], ctr[14], ctr[15]);
+}
+
+_ALWAYS_INLINE_ void aes_enc(OUT uint8_t *ct,
+                             IN const uint8_t *pt,
+                             IN const aes_ks_t *ks,
+                             IN const uint32_t nr) {
+    uint32_t i = 0;
+    __m128i block = loadr_m128i(pt);
+
+    block = XOR(block, ks->keys[0]);
+    for (i = 1; i < nr; i++) {
+        block = AESENC(block, ks->keys[i]);
+    }
+    block = AESENCLAST(block, ks->keys[nr]);
+
+    _mm_storeu_si128((void*)ct, block);
+
+    // Delete secrets from registers if any.
+    ZERO256();
+}
+
+// Encrypt n consecutive counter blocks, starting at *ctr_block, with all n
+// blocks in flight in every round. n is a compile time constant at all call
+// sites, so the loops below are fully unrolled and the blocks stay in
+// registers. If in is not NULL the keystream is XORed with it. If nt is set
+// the blocks are written with non-temporal stores, and ct must be 16 bytes
+// aligned.
+_ALWAYS_INLINE_ void aes_ctr_enc_par(OUT uint8_t *ct,
+                                     IN const uint8_t *in,
+                                     IN OUT __m128i *ctr_block,
+                                     IN const uint32_t n,
+                                     IN const aes_ks_t *ks,
+                                     IN const uint32_t nr,
+                                     IN const uint32_t nt)
+{
+    const __m128i bswap_mask = _mm_set_epi32(BSWAP_MASK);
+    const __m128i one = _mm_set_epi32(0,0,0,1);
+    __m128i blocks[CTR_PAR_MAX_BLOCKS];
+
+    for (uint32_t j = 0; j < n; j++) {
+        blocks[j] = XOR(SHUF8(*ctr_block, bswap_mask), ks->keys[0]);
+        *ctr_block = ADD32(*ctr_block, one);
+    }
+
+    for (uint32_t i = 1; i < nr; i++) {
+        for (uint32_t j = 0; j < n; j++) {
+            blocks[j] = AESENC(blocks[j], ks->keys[i]);
+        }
+    }
+
+    for (uint32_t j = 0; j < n; j++) {
+        blocks[j] = AESENCLAST(blocks[j], ks->keys[nr]);
+        if (NULL != in) {
+            blocks[j] = XOR(blocks[j],
+                            _mm_loadu_si128((const void*)&in[AES_BLOCK_SIZE * j]));
+        }
+
+        //We use storeu to avoid align casting.
+        if (nt) {
+            _mm_stream_si128((void*)&ct[AES_BLOCK_SIZE * j], blocks[j]);
+        } else {
+            _mm_storeu_si128((void*)&ct[AES_BLOCK_SIZE * j], blocks[j]);
+        }
+    }
+}
+
+// The common body of the aes*_ctr_enc and aes*_ctr_xor kernels. in is either
+// NULL or the input of the XOR. nr is the number of rounds of the key size,
+// and par (4, 8 or 16) the number of blocks in flight. nt selects the
+// non-temporal stores of the *_ctr_enc*_nt kernels.
+_ALWAYS_INLINE_ void aes_ctr_blocks(OUT uint8_t *ct,
+                                    IN const uint8_t *in,
+                                    IN const uint8_t *ctr,
+                                    IN const uint32_t num_blocks,
+                                    IN const aes_ks_t *ks,
+                                    IN const uint32_t nr,
+                                    IN const uint32_t par,
+                                    IN const uint32_t nt)
+{
+    uint32_t bidx = 0;
+    __m128i ctr_block = load_m128i(ctr);
+
+    // AESENC has a latency of several cycles but a throughput of one (or
+    // two) per cycle. Keep par independent blocks in flight.
+    for (; bidx + par <= num_blocks; bidx += par)
+    {
+        aes_ctr_enc_par(&ct[AES_BLOCK_SIZE * bidx], OFFSET(in, bidx),
+                        &ctr_block, par, ks, nr, nt);
+    }
+
+    // Tail of less than par blocks.
+    if ((par > 8) && (num_blocks & 8)) {
+        aes_ctr_enc_par(&ct[AES_BLOCK_SIZE * bidx], OFFSET(in, bidx),
+                        &ctr_block, 8, ks, nr, nt);
+        bidx += 8;
+    }
+    if ((par > 4) && (num_blocks & 4)) {
+        aes_ctr_enc_par(&ct[AES_BLOCK_SIZE * bidx], OFFSET(in, bidx),
+                        &ctr_block, 4, ks, nr, nt);
+        bidx += 4;
+    }
+    if (num_blocks & 2) {
+        aes_ctr_enc_par(&ct[AES_BLOCK_SIZE * bidx], OFFSET(in, bidx),
+                        &ctr_block, 2, ks, nr, nt);
+        bidx += 2;
+    }
+    if (num_blocks & 1) {
+        aes_ctr_enc_par(&ct[AES_BLOCK_SIZE * bidx], OFFSET(in, bidx),
+                        &ctr_block, 1, ks, nr, nt);
+    }
+
+    // Order the non-temporal stores before any later store.
+    if (nt) {
+        _mm_sfence();
+    }
+    
+    // Delete secrets from registers if any.
+    ZERO256();
+}
+
+// Encrypt the counter blocks bidx, ..., bidx + n - 1 of the AES_X4_LANES
+// independent instances, i.e., n * AES_X4_LANES blocks in flight.
+_ALWAYS_INLINE_ void aes_ctr_enc_x4_par(IN uint8_t *const ct[AES_X4_LANES],
+                                        IN const uint32_t bidx,
+                                        IN OUT __m128i ctr_block[AES_X4_LANES],
+                                        IN const uint32_t n,
+                                        IN const aes_ks_t *const ks[AES_X4_LANES],
+                                        IN const uint32_t nr)
+{
+    const __m128i bswap_mask = _mm_set_epi32(BSWAP_MASK);
+    const __m128i one = _mm_set_epi32(0,0,0,1);
+    __m128i blocks[CTR_X4_PAR_BLOCKS][AES_X4_LANES];
+
+    for (uint32_t j = 0; j < n; j++) {
+        for (uint32_t l = 0; l < AES_X4_LANES; l++) {
+            blocks[j][l] = XOR(SHUF8(ctr_block[l], bswap_mask), ks[l]->keys[0]);
+            ctr_block[l] = ADD32(ctr_block[l], one);
+        }
+    }
+
+    for (uint32_t i = 1; i < nr; i++) {
+        for (uint32_t j = 0; j < n; j++) {
+            for (uint32_t l = 0; l < AES_X4_LANES; l++) {
+                blocks[j][l] = AESENC(blocks[j][l], ks[l]->keys[i]);
+            }
+        }
+    }
+
+    for (uint32_t j = 0; j < n; j++) {
+        for (uint32_t l = 0; l < AES_X4_LANES; l++) {
+            blocks[j][l] = AESENCLAST(blocks[j][l], ks[l]->keys[nr]);
+            _mm_storeu_si128((void*)&ct[l][AES_BLOCK_SIZE * (bidx + j)],
+                             blocks[j][l]);
+        }
+    }
+}
+
+_ALWAYS_INLINE_ void aes_ctr_blocks_x4(IN uint8_t *const ct[AES_X4_LANES],
+                                       IN const uint8_t *const ctr[AES_X4_LANES],
+                                       IN const uint32_t num_blocks,
+                                       IN const aes_ks_t *const ks[AES_X4_LANES],
+                                       IN const uint32_t nr)
+{
+    __m128i ctr_block[AES_X4_LANES];
+    uint32_t bidx = 0;
+
+    for (uint32_t l = 0; l < AES_X4_LANES; l++) {
+        ctr_block[l] = load_m128i(ctr[l]);
+    }
+
+    for (; bidx + CTR_X4_PAR_BLOCKS <= num_blocks; bidx += CTR_X4_PAR_BLOCKS) {
+        aes_ctr_enc_x4_par(ct, bidx, ctr_block, CTR_X4_PAR_BLOCKS, ks, nr);
+    }
+
+    if (bidx < num_blocks) {
+        aes_ctr_enc_x4_par(ct, bidx, ctr_block, 1, ks, nr);
+    }
+
+    // Delete secrets from registers if any.
+    ZERO256();
+}
+
+// Run AES_BCC_LANES BCC (CBC-MAC) chains over the same num_blocks blocks of
+// data, with the same key. Lane l continues from the chaining value cv[l].
+// Every chain is serial, so a single one leaves AESENC idle for most of its
+// latency; the independent chains are interleaved round by round instead.
+_ALWAYS_INLINE_ void aes_bcc(IN OUT uint8_t cv[AES_BCC_LANES * AES_BLOCK_SIZE],
+                             IN const uint8_t *data,
+                             IN const size_t num_blocks,
+                             IN const aes_ks_t *ks,
+                             IN const uint32_t nr)
+{
+    __m128i chain[AES_BCC_LANES];
+
+    for (uint32_t l = 0; l < AES_BCC_LANES; l++) {
+        chain[l] = _mm_loadu_si128((const void*)&cv[AES_BLOCK_SIZE * l]);
+    }
+
+    for (size_t b = 0; b < num_blocks; b++) {
+        const __m128i block = XOR(_mm_loadu_si128(
+                                      (const void*)&data[AES_BLOCK_SIZE * b]),
+                                  ks->keys[0]);
+
+        for (uint32_t l = 0; l < AES_BCC_LANES; l++) {
+            chain[l] = XOR(chain[l], block);
+        }
+        for (uint32_t i = 1; i < nr; i++) {
+            for (uint32_t l = 0; l < AES_BCC_LANES; l++) {
+                chain[l] = AESENC(chain[l], ks->keys[i]);
+            }
+        }
+        for (uint32_t l = 0; l < AES_BCC_LANES; l++) {
+            chain[l] = AESENCLAST(chain[l], ks->keys[nr]);
+        }
+    }
+
+    for (uint32_t l = 0; l < AES_BCC_LANES; l++) {
+        _mm_storeu_si128((void*)&cv[AES_BLOCK_SIZE * l], chain[l]);
+    }
+
+    // Delete secrets from registers if any.
+    ZERO256();
+}
+
+// Instantiate the CTR encrypt and XOR kernels aes<bits>_ctr_enc<sfx> and
+// aes<bits>_ctr_xor<sfx> of one key size, over the block loop blocks_fn with
+// par blocks or vectors in flight. All the CTR kernels and their variants
+// are generated from here.
+#define CTR_KERNELS(target, bits, sfx, blocks_fn, par)                       \
+    target void aes##bits##_ctr_enc##sfx(OUT uint8_t *ct,                    \
+                                         IN const uint8_t *ctr,              \
+                                         IN const uint32_t num_blocks,       \
+                                         IN const aes_ks_t *ks)              \
+    {                                                                        \
+        blocks_fn(ct, NULL, ctr, num_blocks, ks, AES##bits##_ROUNDS, par, 0);\
+    }                                                                        \
+                                                                             \
+    target void aes##bits##_ctr_xor##sfx(OUT uint8_t *ct,                    \
+                                         IN const uint8_t *pt,               \
+                                         IN const uint8_t *ctr,              \
+                                         IN const uint32_t num_blocks,       \
+                                         IN const aes_ks_t *ks)              \
+    {                                                                        \
+        blocks_fn(ct, pt, ctr, num_blocks, ks, AES##bits##_ROUNDS, par, 0);  \
+    }
+
+// Instantiate the streaming kernel aes<bits>_ctr_enc<sfx>_nt, see CTR_KERNELS.
+#define CTR_NT_KERNEL(target, bits, sfx, blocks_fn, par)                     \
+    target void aes##bits##_ctr_enc##sfx##_nt(OUT uint8_t *ct,               \
+                                              IN const uint8_t *ctr,         \
+                                              IN const uint32_t num_blocks,  \
+                                              IN const aes_ks_t *ks)         \
+    {                                                                        \
+        blocks_fn(ct, NULL, ctr, num_blocks, ks, AES##bits##_ROUNDS, par, 1);\
+    }
+
+// Instantiate the AES-NI kernels of one key size. The number of rounds is a
+// compile time constant in every instance, so all the round loops are fully
+// unrolled.
+#define AES_NI_KERNELS(bits)                                                 \
+    void aes##bits##_enc(OUT uint8_t *ct,                                    \
+                         IN const uint8_t *pt,                               \
+                         IN const aes_ks_t *ks)                              \
+    {                                                                        \
+        aes_enc(ct, pt, ks, AES##bits##_ROUNDS);                             \
+    }                                                                        \
+                                                                             \
+    CTR_KERNELS(, bits, , aes_ctr_blocks, CTR_PAR_BLOCKS)                    \
+    CTR_NT_KERNEL(, bits, , aes_ctr_blocks, CTR_PAR_BLOCKS)                  \
+    CTR_KERNELS(, bits, _i4, aes_ctr_blocks, 4)                              \
+    CTR_KERNELS(, bits, _i16, aes_ctr_blocks, 16)                            \
+                                                                             \
+    void aes##bits##_ctr_enc_x4(IN uint8_t *const ct[AES_X4_LANES],          \
+                                IN const uint8_t *const ctr[AES_X4_LANES],   \
+                                IN const uint32_t num_blocks,                \
+                                IN const aes_ks_t *const ks[AES_X4_LANES])   \
+    {                                                                        \
+        aes_ctr_blocks_x4(ct, ctr, num_blocks, ks, AES##bits##_ROUNDS);      \
+    }                                                                        \
+                                                                             \
+    void aes##bits##_bcc(IN OUT uint8_t cv[AES_BCC_LANES * AES_BLOCK_SIZE],  \
+                         IN const uint8_t *data,                             \
+                         IN const size_t num_blocks,                         \
+                         IN const aes_ks_t *ks)                              \
+    {                                                                        \
+        aes_bcc(cv, data, num_blocks, ks, AES##bits##_ROUNDS);               \
+    }
+
+AES_NI_KERNELS(128)
+AES_NI_KERNELS(192)
+AES_NI_KERNELS(256)
+
+// One step of the AES-256 key schedule: the next round key is the prefix XOR
+// of the words of a (the round key two steps back), XORed with t (the
+// substituted word of the previous round key, broadcast).
+_INLINE_ __m128i ks_step(IN __m128i a, IN const __m128i t)
+{
+    a = XOR(a, _mm_slli_si128(a, 4));
+    a = XOR(a, _mm_slli_si128(a, 8));
+    return XOR(a, t);
+}
+
+// Expand the n keys key[0..n-1] into ks[0..n-1] with the n serial chains
+// interleaved.
+_ALWAYS_INLINE_ void aes256_key_expansion_par(OUT aes256_ks_t *const ks[],
+                                              IN const aes256_key_t *const key[],
+                                              IN const uint32_t n)
+{
+    const __m128i rot_mask = _mm_set1_epi32(ROT_WORD3_MASK);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i rcon = _mm_set1_epi32(1);
+    __m128i k0[AES_KS_BATCH_MAX];
+    __m128i k1[AES_KS_BATCH_MAX];
+
+    for (uint32_t j = 0; j < n; j++) {
+        k0[j] = _mm_loadu_si128((const void*)&key[j]->raw[0]);
+        k1[j] = _mm_loadu_si128((const void*)&key[j]->raw[AES_BLOCK_SIZE]);
+        ks[j]->keys[0] = k0[j];
+        ks[j]->keys[1] = k1[j];
+    }
+
+    for (uint32_t i = 2; i <= AES256_ROUNDS; i += 2) {
+        for (uint32_t j = 0; j < n; j++) {
+            k0[j] = ks_step(k0[j], AESENCLAST(SHUF8(k1[j], rot_mask), rcon));
+            ks[j]->keys[i] = k0[j];
+        }
+        rcon = _mm_slli_epi32(rcon, 1);
+
+        if (AES256_ROUNDS == i) {
+            break;
+        }
+
+        for (uint32_t j = 0; j < n; j++) {
+            k1[j] = ks_step(k1[j],
+                            AESENCLAST(_mm_shuffle_epi32(k0[j], 0xff), zero));
+            ks[j]->keys[i + 1] = k1[j];
+        }
+    }
+}
+
+void aes256_key_expansion_batch(OUT aes256_ks_t *const ks[],
+                                IN const aes256_key_t *const key[],
+                                IN const uint32_t num_keys)
+{
+    uint32_t i = 0;
+
+    for (; i + AES_KS_BATCH_MAX <= num_keys; i += AES_KS_BATCH_MAX) {
+        aes256_key_expansion_par(&ks[i], &key[i], AES_KS_BATCH_MAX);
+    }
+
+    if (num_keys - i >= 4) {
+        aes256_key_expansion_par(&ks[i], &key[i], 4);
+        i += 4;
+    }
+
+    if (num_keys - i >= 2) {
+        aes256_key_expansion_par(&ks[i], &key[i], 2);
+        i += 2;
+    }
+
+    if (i < num_keys) {
+        aes256_key_expansion(ks[i], key[i]);
+    }
+
+    // Delete secrets from registers if any.
+    ZERO256();
+}
+
+// aes256_key_expansion_par for AES-128, whose schedule has a single chain of
+// ten steps per key.
+_ALWAYS_INLINE_ void aes128_key_expansion_par(OUT aes_ks_t *const ks[],
+                                              IN const aes_key_t *const key[],
+                                              IN const uint32_t n)
+{
+    const __m128i rot_mask = _mm_set1_epi32(ROT_WORD3_MASK);
+    __m128i rcon = _mm_set1_epi32(1);
+    __m128i k[AES_KS_BATCH_MAX];
+
+    for (uint32_t j = 0; j < n; j++) {
+        k[j] = _mm_loadu_si128((const void*)key[j]->raw);
+        ks[j]->keys[0] = k[j];
+    }
+
+    for (uint32_t i = 1; i <= AES128_ROUNDS; i++) {
+        // The round constants after 0x80 are reduced modulo the AES
+        // polynomial.
+        if (9 == i) {
+            rcon = _mm_set1_epi32(0x1b);
+        }
+
+        for (uint32_t j = 0; j < n; j++) {
+            k[j] = ks_step(k[j], AESENCLAST(SHUF8(k[j], rot_mask), rcon));
+            ks[j]->keys[i] = k[j];
+        }
+        rcon = _mm_slli_epi32(rcon, 1);
+    }
+}
+
+void aes128_key_expansion(OUT aes_ks_t *ks,
+                          IN const aes_key_t *key)
+{
+    aes128_key_expansion_par(&ks, &key, 1);
+
+    // Delete secrets from registers if any.
+    ZERO256();
+}
+
+void aes128_key_expansion_batch(OUT aes_ks_t *const ks[],
+                                IN const aes_key_t *const key[],
+                                IN const uint32_t num_keys)
+{
+    uint32_t i = 0;
+
+    for (; i + AES_KS_BATCH_MAX <= num_keys; i += AES_KS_BATCH_MAX) {
+        aes128_key_expansion_par(&ks[i], &key[i], AES_KS_BATCH_MAX);
+    }
+
+    switch (num_keys - i) {
+        case 7: aes128_key_expansion_par(&ks[i], &key[i], 7); break;
+        case 6: aes128_key_expansion_par(&ks[i], &key[i], 6); break;
+        case 5: aes128_key_expansion_par(&ks[i], &key[i], 5); break;
+        case 4: aes128_key_expansion_par(&ks[i], &key[i], 4); break;
+        case 3: aes128_key_expansion_par(&ks[i], &key[i], 3); break;
+        case 2: aes128_key_expansion_par(&ks[i], &key[i], 2); break;
+        case 1: aes128_key_expansion_par(&ks[i], &key[i], 1); break;
+        default: break;
+    }
+
+    // Delete secrets from registers if any.
+    ZERO256();
+}
+
+// One step of the AES-192 key schedule, as in the Intel AES-NI white paper:
+// t1 holds the last four words, the low half of t3 the two words before
+// them, and assist is AESKEYGENASSIST of t3.
+_INLINE_ void key192_step(IN OUT __m128i *t1,
+                          IN __m128i assist,
+                          IN OUT __m128i *t3)
+{
+    assist = _mm_shuffle_epi32(assist, 0x55);
+    *t1 = XOR(*t1, _mm_slli_si128(*t1, 4));
+    *t1 = XOR(*t1, _mm_slli_si128(*t1, 8));
+    *t1 = XOR(*t1, assist);
+    *t3 = XOR(*t3, _mm_slli_si128(*t3, 4));
+    *t3 = XOR(*t3, _mm_shuffle_epi32(*t1, 0xff));
+}
+
+// The round constant of AESKEYGENASSIST must be an immediate.
+#define KEY192_STEP(rcon) key192_step(&t1, _mm_aeskeygenassist_si128(t3, rcon), &t3)
+
+// Six words are produced per step, so every other step spans two round keys.
+#define KEY192_SPLIT(i)                                                      \
+    ks->keys[i] = _mm_unpacklo_epi64(ks->keys[i], t1);                       \
+    ks->keys[(i) + 1] = _mm_alignr_epi8(t3, t1, 8)
+
+void aes192_key_expansion(OUT aes_ks_t *ks,
+                          IN const aes_key_t *key)
+{
+    __m128i t1 = _mm_loadu_si128((const void*)key->raw);
+    __m128i t3 = _mm_loadl_epi64((const void*)&key->raw[AES_BLOCK_SIZE]);
+
+    ks->keys[0] = t1;
+    ks->keys[1] = t3;
+    KEY192_STEP(0x01); KEY192_SPLIT(1);
+    KEY192_STEP(0x02); ks->keys[3] = t1; ks->keys[4] = t3;
+    KEY192_STEP(0x04); KEY192_SPLIT(4);
+    KEY192_STEP(0x08); ks->keys[6] = t1; ks->keys[7] = t3;
+    KEY192_STEP(0x10); KEY192_SPLIT(7);
+    KEY192_STEP(0x20); ks->keys[9] = t1; ks->keys[10] = t3;
+    KEY192_STEP(0x40); KEY192_SPLIT(10);
+    KEY192_STEP(0x80); ks->keys[12] = t1;
+
+    // Delete secrets from registers if any.
+    ZERO256();
+}
+
+// The AES-192 schedule is not interleaved, its steps do not align with the
+// round keys.
+void aes192_key_expansion_batch(OUT aes_ks_t *const ks[],
+                                IN const aes_key_t *const key[],
+                                IN const uint32_t num_keys)
+{
+    for (uint32_t i = 0; i < num_keys; i++) {
+        aes192_key_expansion(ks[i], key[i]);
+    }
+}
+
+_ALWAYS_INLINE_ TARGET_VAES512 void load_ks(OUT __m512i ks512[AES_MAX_ROUNDS + 1],
+                                            IN const aes_ks_t *ks,
+                                            IN const uint32_t nr)
+{
+    for(uint32_t i = 0; i < nr + 1; i++)
+    {
+        ks512[i] = _mm512_broadcast_i32x4(ks->keys[i]);
+    }
+}
+
+// Encrypt n_vecs x 4 consecutive counter blocks with all n_vecs vectors in
+// flight in every round. ctr_blocks holds the next four counters (little
+// endian, one per lane) and is advanced by 4 * n_vecs. When mask is not all
+// ones the last vector is stored with it, so that a partial vector of 1-3
+// blocks does not access memory past the end of ct (and in). If in is not
+// NULL the keystream is XORed with it. If nt is set all the vectors are
+// written with non-temporal stores; then mask must be all ones and ct 64
+// bytes aligned.
+_ALWAYS_INLINE_ TARGET_VAES512 void aes_ctr_enc512_par(OUT uint8_t *ct,
+                                           IN const uint8_t *in,
+                                           IN OUT __m512i *ctr_blocks,
+                                           IN const uint32_t n_vecs,
+                                           IN const __mmask8 mask,
+                                           IN const __m512i ks512[AES_MAX_ROUNDS + 1],
+                                           IN const uint32_t nr,
+                                           IN const uint32_t nt)
+{
+    const __m512i bswap_mask = _mm512_set_epi32(BSWAP_MASK, BSWAP_MASK,
+                                                BSWAP_MASK, BSWAP_MASK);
+    const __m512i four = _mm512_set_epi32(0,0,0,4,0,0,0,4,0,0,0,4,0,0,0,4);
+    __m512i p[CTR512_PAR_MAX_VECS];
+
+    // Prepare all the counters ahead with vector adds.
+    for (uint32_t j = 0; j < n_vecs; j++)
+    {
+        p[j] = XOR512(SHUF8_512(*ctr_blocks, bswap_mask), ks512[0]);
+        *ctr_blocks = ADD32_512(*ctr_blocks, four);
+    }
+
+    for (uint32_t i = 1; i < nr; i++)
+    {
+        for (uint32_t j = 0; j < n_vecs; j++)
+        {
+            p[j] = VAESENC(p[j], ks512[i]);
+        }
+    }
+
+    for (uint32_t j = 0; j < n_vecs; j++)
+    {
+        p[j] = VAESENCLAST(p[j], ks512[nr]);
+    }
+
+    if (NULL != in)
+    {
+        for (uint32_t j = 0; j + 1 < n_vecs; j++)
+        {
+            p[j] = XOR512(p[j], _mm512_loadu_si512(&in[PAR_AES_BLOCK_SIZE * j]));
+        }
+        p[n_vecs - 1] = XOR512(p[n_vecs - 1],
+            _mm512_maskz_loadu_epi64(mask, &in[PAR_AES_BLOCK_SIZE * (n_vecs - 1)]));
+    }
+
+    if (nt)
+    {
+        for (uint32_t j = 0; j < n_vecs; j++)
+        {
+            _mm512_stream_si512((void*)&ct[PAR_AES_BLOCK_SIZE * j], p[j]);
+        }
+        return;
+    }
+
+    // We use storeu to avoid align casting.
+    for (uint32_t j = 0; j + 1 < n_vecs; j++)
+    {
+        _mm512_storeu_si512(&ct[PAR_AES_BLOCK_SIZE * j], p[j]);
+    }
+    _mm512_mask_storeu_epi64(&ct[PAR_AES_BLOCK_SIZE * (n_vecs - 1)], mask,
+                             p[n_vecs - 1]);
+}
+
+// NIST 800-90A Table 3, Section 10.2.1 (no derivation function) states that 
+// max_number_of_bits_per_request is min((2^ctr_len - 4) x block_len, 2^19) <= 2^19
+// Therefore the maximal number of blocks (16 bytes) is 2^19/128 = 2^19/2^7 = 2^12 < 2^32
+// Here num_blocks is assumed to be less then 2^32. 
+// It is the caller responsiblity to ensure it.
+// par_vecs (4, 8 or 16) is the number of vectors in flight. With nt,
+// num_blocks must be a multiple of 4 and ct 64 bytes aligned.
+_ALWAYS_INLINE_ TARGET_VAES512 void aes_ctr_blocks512(OUT uint8_t *ct,
+                                       IN const uint8_t *in,
+                                       IN const uint8_t *ctr,
+                                       IN const uint32_t num_blocks,
+                                       IN const aes_ks_t *ks,
+                                       IN const uint32_t nr,
+                                       IN const uint32_t par_vecs,
+                                       IN const uint32_t nt)
+{
+    const __mmask8 full = 0xff;
+    const uint32_t par_blocks = 4 * par_vecs;
+    uint32_t bidx = 0;
+
+    __m512i ks512[AES_MAX_ROUNDS + 1];
+    load_ks(ks512, ks, nr);
+
+    __m128i single_block = load_m128i(ctr);
+    __m512i ctr_blocks = _mm512_broadcast_i32x4(single_block);
+
+    // Initialize four parallel counters
+    const __m512i init = _mm512_set_epi32(0,0,0,3,0,0,0,2,0,0,0,1,0,0,0,0);
+    ctr_blocks = ADD32_512(ctr_blocks, init);
+
+    for (; bidx + par_blocks <= num_blocks; bidx += par_blocks)
+    {
+        aes_ctr_enc512_par(&ct[AES_BLOCK_SIZE * bidx], OFFSET(in, bidx),
+                           &ctr_blocks, par_vecs, full, ks512, nr, nt);
+    }
+
+    // Tail of less than 4 * par_vecs blocks. The full vectors are processed
+    // four at a time, and the last ones together with the last partial one
+    // (if any), which is stored with a mask. Nothing falls back to the single
+    // block kernel.
+    while (num_blocks - bidx >= 16)
+    {
+        aes_ctr_enc512_par(&ct[AES_BLOCK_SIZE * bidx], OFFSET(in, bidx),
+                           &ctr_blocks, 4, full, ks512, nr, nt);
+        bidx += 16;
+    }
+
+    const uint32_t rem = num_blocks - bidx;
+    const uint32_t rem_vecs = (rem + 3) / 4;
+    const __mmask8 mask = (rem & 3) ? (__mmask8)((1U << (2 * (rem & 3))) - 1)
+                                    : full;
+    uint8_t *tail = &ct[AES_BLOCK_SIZE * bidx];
+    const uint8_t *tail_in = OFFSET(in, bidx);
+
+    switch (rem_vecs)
+    {
+        case 4: aes_ctr_enc512_par(tail, tail_in, &ctr_blocks, 4, mask, ks512, nr, nt); break;
+        case 3: aes_ctr_enc512_par(tail, tail_in, &ctr_blocks, 3, mask, ks512, nr, nt); break;
+        case 2: aes_ctr_enc512_par(tail, tail_in, &ctr_blocks, 2, mask, ks512, nr, nt); break;
+        case 1: aes_ctr_enc512_par(tail, tail_in, &ctr_blocks, 1, mask, ks512, nr, nt); break;
+        default: break;
+    }
+
+    if (nt)
+    {
+        _mm_sfence();
+    }
+
+    // Delete secrets from registers if any.
+    ZERO512();
+}
+
+// Place a, b, c, d in the lanes 0, 1, 2, 3 respectively.
+_INLINE_ TARGET_VAES512 __m512i set_lanes512(IN const __m128i a,
+                                             IN const __m128i b,
+                                             IN const __m128i c,
+                                             IN const __m128i d)
+{
+    __m512i r = _mm512_castsi128_si512(a);
+    r = _mm512_inserti32x4(r, b, 1);
+    r = _mm512_inserti32x4(r, c, 2);
+    return _mm512_inserti32x4(r, d, 3);
+}
+
+// Encrypt the counter blocks bidx, ..., bidx + n_vecs - 1 of the four
+// instances. Vector j holds block bidx + j of instance l in lane l, and the
+// round keys of instance l are in lane l of ks512. When n_vecs is 4 the
+// vectors are transposed so that every instance gets one 64 bytes store.
+_ALWAYS_INLINE_ TARGET_VAES512 void aes_ctr_enc512_x4_par(
+                                    IN uint8_t *const ct[AES_X4_LANES],
+                                    IN const uint32_t bidx,
+                                    IN OUT __m512i *ctr_blocks,
+                                    IN const uint32_t n_vecs,
+                                    IN const __m512i ks512[AES_MAX_ROUNDS + 1],
+                                    IN const uint32_t nr)
+{
+    const __m512i bswap_mask = _mm512_set_epi32(BSWAP_MASK, BSWAP_MASK,
+                                                BSWAP_MASK, BSWAP_MASK);
+    const __m512i one = _mm512_set_epi32(0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,1);
+    __m512i p[AES_X4_LANES];
+
+    for (uint32_t j = 0; j < n_vecs; j++)
+    {
+        p[j] = XOR512(SHUF8_512(*ctr_blocks, bswap_mask), ks512[0]);
+        *ctr_blocks = ADD32_512(*ctr_blocks, one);
+    }
+
+    for (uint32_t i = 1; i < nr; i++)
+    {
+        for (uint32_t j = 0; j < n_vecs; j++)
+        {
+            p[j] = VAESENC(p[j], ks512[i]);
+        }
+    }
+
+    for (uint32_t j = 0; j < n_vecs; j++)
+    {
+        p[j] = VAESENCLAST(p[j], ks512[nr]);
+    }
+
+    if (AES_X4_LANES == n_vecs)
+    {
+        // 4x4 transpose of the 128-bit lanes.
+        const __m512i t0 = _mm512_shuffle_i64x2(p[0], p[1], 0x44);
+        const __m512i t1 = _mm512_shuffle_i64x2(p[0], p[1], 0xee);
+        const __m512i t2 = _mm512_shuffle_i64x2(p[2], p[3], 0x44);
+        const __m512i t3 = _mm512_shuffle_i64x2(p[2], p[3], 0xee);
+        p[0] = _mm512_shuffle_i64x2(t0, t2, 0x88);
+        p[1] = _mm512_shuffle_i64x2(t0, t2, 0xdd);
+        p[2] = _mm512_shuffle_i64x2(t1, t3, 0x88);
+        p[3] = _mm512_shuffle_i64x2(t1, t3, 0xdd);
+
+        for (uint32_t l = 0; l < AES_X4_LANES; l++)
+        {
+            _mm512_storeu_si512(&ct[l][AES_BLOCK_SIZE * bidx], p[l]);
+        }
+        return;
+    }
+
+    for (uint32_t j = 0; j < n_vecs; j++)
+    {
+        const uint32_t off = AES_BLOCK_SIZE * (bidx + j);
+        _mm_storeu_si128((void*)&ct[0][off], _mm512_castsi512_si128(p[j]));
+        _mm_storeu_si128((void*)&ct[1][off], _mm512_extracti32x4_epi32(p[j], 1));
+        _mm_storeu_si128((void*)&ct[2][off], _mm512_extracti32x4_epi32(p[j], 2));
+        _mm_storeu_si128((void*)&ct[3][off], _mm512_extracti32x4_epi32(p[j], 3));
+    }
+}
+
+_ALWAYS_INLINE_ TARGET_VAES512 void aes_ctr_blocks512_x4(
+                                    IN uint8_t *const ct[AES_X4_LANES],
+                                    IN const uint8_t *const ctr[AES_X4_LANES],
+                                    IN const uint32_t num_blocks,
+                                    IN const aes_ks_t *const ks[AES_X4_LANES],
+                                    IN const uint32_t nr)
+{
+    __m512i ks512[AES_MAX_ROUNDS + 1];
+    uint32_t bidx = 0;
+
+    // Lane l holds the round keys and the counter of instance l.
+    for (uint32_t i = 0; i < nr + 1; i++)
+    {
+        ks512[i] = set_lanes512(ks[0]->keys[i], ks[1]->keys[i],
+                                ks[2]->keys[i], ks[3]->keys[i]);
+    }
+
+    __m512i ctr_blocks = set_lanes512(load_m128i(ctr[0]), load_m128i(ctr[1]),
+                                      load_m128i(ctr[2]), load_m128i(ctr[3]));
+
+    for (; bidx + AES_X4_LANES <= num_blocks; bidx += AES_X4_LANES)
+    {
+        aes_ctr_enc512_x4_par(ct, bidx, &ctr_blocks, AES_X4_LANES, ks512, nr);
+    }
+
+    switch (num_blocks - bidx)
+    {
+        case 3: aes_ctr_enc512_x4_par(ct, bidx, &ctr_blocks, 3, ks512, nr); break;
+        case 2: aes_ctr_enc512_x4_par(ct, bidx, &ctr_blocks, 2, ks512, nr); break;
+        case 1: aes_ctr_enc512_x4_par(ct, bidx, &ctr_blocks, 1, ks512, nr); break;
+        default: break;
+    }
+
+    // Delete secrets from registers if any.
+    ZERO512();
+}
+
+// Instantiate the VAES (AVX512) kernels of one key size, see AES_NI_KERNELS.
+#define VAES512_KERNELS(bits)                                                \
+    CTR_KERNELS(TARGET_VAES512, bits, 512, aes_ctr_blocks512,                \
+                CTR512_PAR_VECS)                                             \
+    CTR_NT_KERNEL(TARGET_VAES512, bits, 512, aes_ctr_blocks512,              \
+                  CTR512_PAR_VECS)                                           \
+    CTR_KERNELS(TARGET_VAES512, bits, 512_i4, aes_ctr_blocks512, 4)          \
+    CTR_KERNELS(TARGET_VAES512, bits, 512_i16, aes_ctr_blocks512, 16)        \
+                                                                             \
+    TARGET_VAES512 void aes##bits##_ctr_enc512_x4(                           \
+                                IN uint8_t *const ct[AES_X4_LANES],          \
+                                IN const uint8_t *const ctr[AES_X4_LANES],   \
+                                IN const uint32_t num_blocks,                \
+                                IN const aes_ks_t *const ks[AES_X4_LANES])   \
+    {                                                                        \
+        aes_ctr_blocks512_x4(ct, ctr, num_blocks, ks, AES##bits##_ROUNDS);   \
+    }
+
+VAES512_KERNELS(128)
+VAES512_KERNELS(192)
+VAES512_KERNELS(256)
+
+// ks_step on the four lanes of a zmm register.
+_INLINE_ TARGET_VAES512 __m512i ks_step512(IN __m512i a, IN const __m512i t)
+{
+    a = XOR512(a, _mm512_bslli_epi128(a, 4));
+    a = XOR512(a, _mm512_bslli_epi128(a, 8));
+    return XOR512(a, t);
+}
+
+// Store round key i of the 4 * n_vecs keys in r.
+_ALWAYS_INLINE_ TARGET_VAES512 void store_round_keys512(OUT aes256_ks_t *const ks[],
+                                                        IN const uint32_t i,
+                                                        IN const __m512i *r,
+                                                        IN const uint32_t n_vecs)
+{
+    for (uint32_t j = 0; j < n_vecs; j++)
+    {
+        ks[4 * j]->keys[i]     = _mm512_castsi512_si128(r[j]);
+        ks[4 * j + 1]->keys[i] = _mm512_extracti32x4_epi32(r[j], 1);
+        ks[4 * j + 2]->keys[i] = _mm512_extracti32x4_epi32(r[j], 2);
+        ks[4 * j + 3]->keys[i] = _mm512_extracti32x4_epi32(r[j], 3);
+    }
+}
+
+// aes256_key_expansion_par for 4 * n_vecs keys, where vector j holds the keys
+// 4j, ..., 4j + 3 in its lanes.
+_ALWAYS_INLINE_ TARGET_VAES512 void aes256_key_expansion512_par(
+                                    OUT aes256_ks_t *const ks[],
+                                    IN const aes256_key_t *const key[],
+                                    IN const uint32_t n_vecs)
+{
+    const __m512i rot_mask = _mm512_set1_epi32(ROT_WORD3_MASK);
+    const __m512i zero = _mm512_setzero_si512();
+    __m512i rcon = _mm512_set1_epi32(1);
+    __m512i k0[AES_KS_BATCH_MAX / 4];
+    __m512i k1[AES_KS_BATCH_MAX / 4];
+
+    for (uint32_t j = 0; j < n_vecs; j++)
+    {
+        const aes256_key_t *const *k = &key[4 * j];
+        k0[j] = set_lanes512(_mm_loadu_si128((const void*)k[0]->raw),
+                             _mm_loadu_si128((const void*)k[1]->raw),
+                             _mm_loadu_si128((const void*)k[2]->raw),
+                             _mm_loadu_si128((const void*)k[3]->raw));
+        k1[j] = set_lanes512(
+                    _mm_loadu_si128((const void*)&k[0]->raw[AES_BLOCK_SIZE]),
+                    _mm_loadu_si128((const void*)&k[1]->raw[AES_BLOCK_SIZE]),
+                    _mm_loadu_si128((const void*)&k[2]->raw[AES_BLOCK_SIZE]),
+                    _mm_loadu_si128((const void*)&k[3]->raw[AES_BLOCK_SIZE]));
+    }
+
+    store_round_keys512(ks, 0, k0, n_vecs);
+    store_round_keys512(ks, 1, k1, n_vecs);
+
+    for (uint32_t i = 2; i <= AES256_ROUNDS; i += 2)
+    {
+        for (uint32_t j = 0; j < n_vecs; j++)
+        {
+            k0[j] = ks_step512(k0[j],
+                               VAESENCLAST(SHUF8_512(k1[j], rot_mask), rcon));
+        }
+        store_round_keys512(ks, i, k0, n_vecs);
+        rcon = _mm512_slli_epi32(rcon, 1);
+
+        if (AES256_ROUNDS == i)
+        {
+            break;
+        }
+
+        for (uint32_t j = 0; j < n_vecs; j++)
+        {
+            k1[j] = ks_step512(k1[j],
+                        VAESENCLAST(_mm512_shuffle_epi32(k0[j], 0xff), zero));
+        }
+        store_round_keys512(ks, i + 1, k1, n_vecs);
+    }
+}
+
+TARGET_VAES512 void aes256_key_expansion512_batch(OUT aes256_ks_t *const ks[],
+                                                  IN const aes256_key_t *const key[],
+                                                  IN const uint32_t num_keys)
+{
+    uint32_t i = 0;
+
+    for (; i + AES_KS_BATCH_MAX <= num_keys; i += AES_KS_BATCH_MAX)
+    {
+        aes256_key_expansion512_par(&ks[i], &key[i], AES_KS_BATCH_MAX / 4);
+    }
+
+    if (num_keys - i >= 4)
+    {
+        aes256_key_expansion512_par(&ks[i], &key[i], 1);
+        i += 4;
+    }
+
+    // Two keys do not fill a zmm register.
+    if (num_keys - i >= 2)
+    {
+        aes256_key_expansion_par(&ks[i], &key[i], 2);
+        i += 2;
+    }
+
+    if (i < num_keys)
+    {
+        aes256_key_expansion(ks[i], key[i]);
+    }
+
+    // Delete secrets from registers if any.
+    ZERO512();
+}
+
+// Encrypt n_vecs x 2 consecutive counter blocks with all n_vecs vectors in
+// flight in every round. ctr_blocks holds the next two counters (little
+// endian, one per lane) and is advanced by 2 * n_vecs. When half_last is set
+// only the low lane of the last vector is stored (and read from in). The
+// round keys are broadcast from ks in every round rather than copied to the
+// stack. If in is not NULL the keystream is XORed with it. If nt is set the
+// vectors are written with non-temporal stores; then half_last must be 0 and
+// ct 32 bytes aligned.
+_ALWAYS_INLINE_ TARGET_VAES256 void aes_ctr_enc256_par(OUT uint8_t *ct,
+                                           IN const uint8_t *in,
+                                           IN OUT __m256i *ctr_blocks,
+                                           IN const uint32_t n_vecs,
+                                           IN const uint32_t half_last,
+                                           IN const aes_ks_t *ks,
+                                           IN const uint32_t nr,
+                                           IN const uint32_t nt)
+{
+    const __m256i bswap_mask = _mm256_set_epi32(BSWAP_MASK, BSWAP_MASK);
+    const __m256i two = _mm256_set_epi32(0,0,0,2,0,0,0,2);
+    __m256i p[CTR256_PAR_MAX_VECS];
+    __m256i key = BCAST256(ks->keys[0]);
+
+    // Prepare all the counters ahead with vector adds.
+    for (uint32_t j = 0; j < n_vecs; j++)
+    {
+        p[j] = XOR256(SHUF8_256(*ctr_blocks, bswap_mask), key);
+        *ctr_blocks = ADD32_256(*ctr_blocks, two);
+    }
+
+    for (uint32_t i = 1; i < nr; i++)
+    {
+        key = BCAST256(ks->keys[i]);
+        for (uint32_t j = 0; j < n_vecs; j++)
+        {
+            p[j] = VAESENC256(p[j], key);
+        }
+    }
+
+    key = BCAST256(ks->keys[nr]);
+    for (uint32_t j = 0; j < n_vecs; j++)
+    {
+        p[j] = VAESENCLAST256(p[j], key);
+    }
+
+    if (NULL != in)
+    {
+        for (uint32_t j = 0; j + 1 < n_vecs; j++)
+        {
+            p[j] = XOR256(p[j],
+                _mm256_loadu_si256((const void*)&in[2 * AES_BLOCK_SIZE * j]));
+        }
+
+        const uint8_t *last_in = &in[2 * AES_BLOCK_SIZE * (n_vecs - 1)];
+        p[n_vecs - 1] = XOR256(p[n_vecs - 1], half_last ?
+            _mm256_castsi128_si256(_mm_loadu_si128((const void*)last_in)) :
+            _mm256_loadu_si256((const void*)last_in));
+    }
+
+    if (nt)
+    {
+        for (uint32_t j = 0; j < n_vecs; j++)
+        {
+            _mm256_stream_si256((void*)&ct[2 * AES_BLOCK_SIZE * j], p[j]);
+        }
+        return;
+    }
+
+    // We use storeu to avoid align casting.
+    for (uint32_t j = 0; j + 1 < n_vecs; j++)
+    {
+        _mm256_storeu_si256((void*)&ct[2 * AES_BLOCK_SIZE * j], p[j]);
+    }
+
+    uint8_t *last = &ct[2 * AES_BLOCK_SIZE * (n_vecs - 1)];
+    if (half_last)
+    {
+        _mm_storeu_si128((void*)last, _mm256_castsi256_si128(p[n_vecs - 1]));
+    }
+    else
+    {
+        _mm256_storeu_si256((void*)last, p[n_vecs - 1]);
+    }
+}
+
+// See the comment on aes_ctr_blocks512 regarding the bound on num_blocks,
+// par_vecs and nt.
+_ALWAYS_INLINE_ TARGET_VAES256 void aes_ctr_blocks256(OUT uint8_t *ct,
+                                       IN const uint8_t *in,
+                                       IN const uint8_t *ctr,
+                                       IN const uint32_t num_blocks,
+                                       IN const aes_ks_t *ks,
+                                       IN const uint32_t nr,
+                                       IN const uint32_t par_vecs,
+                                       IN const uint32_t nt)
+{
+    const uint32_t par_blocks = 2 * par_vecs;
+    uint32_t bidx = 0;
+
+    __m128i single_block = load_m128i(ctr);
+    __m256i ctr_blocks = BCAST256(single_block);
+
+    // Initialize two parallel counters
+    const __m256i init = _mm256_set_epi32(0,0,0,1,0,0,0,0);
+    ctr_blocks = ADD32_256(ctr_blocks, init);
+
+    for (; bidx + par_blocks <= num_blocks; bidx += par_blocks)
+    {
+        aes_ctr_enc256_par(&ct[AES_BLOCK_SIZE * bidx], OFFSET(in, bidx),
+                           &ctr_blocks, par_vecs, 0, ks, nr, nt);
+    }
+
+    // Tail of less than 2 * par_vecs blocks. As in aes_ctr_blocks512, the
+    // last (possibly half) vector is processed together with the other
+    // remaining vectors.
+    while (num_blocks - bidx >= 8)
+    {
+        aes_ctr_enc256_par(&ct[AES_BLOCK_SIZE * bidx], OFFSET(in, bidx),
+                           &ctr_blocks, 4, 0, ks, nr, nt);
+        bidx += 8;
+    }
+
+    const uint32_t rem = num_blocks - bidx;
+    const uint32_t half = rem & 1;
+    uint8_t *tail = &ct[AES_BLOCK_SIZE * bidx];
+    const uint8_t *tail_in = OFFSET(in, bidx);
+
+    switch ((rem + 1) / 2)
+    {
+        case 4: aes_ctr_enc256_par(tail, tail_in, &ctr_blocks, 4, half, ks, nr, nt); break;
+        case 3: aes_ctr_enc256_par(tail, tail_in, &ctr_blocks, 3, half, ks, nr, nt); break;
+        case 2: aes_ctr_enc256_par(tail, tail_in, &ctr_blocks, 2, half, ks, nr, nt); break;
+        case 1: aes_ctr_enc256_par(tail, tail_in, &ctr_blocks, 1, half, ks, nr, nt); break;
+        default: break;
+    }
+
+    if (nt)
+    {
+        _mm_sfence();
+    }
+
+    // Delete secrets from registers if any.
+    ZERO256();
+}
+
+// Instantiate the VAES (AVX2) kernels of one key size, see AES_NI_KERNELS.
+#define VAES256_KERNELS(bits)                                                \
+    CTR_KERNELS(TARGET_VAES256, bits, 256, aes_ctr_blocks256,                \
+                CTR256_PAR_VECS)                                             \
+    CTR_NT_KERNEL(TARGET_VAES256, bits, 256, aes_ctr_blocks256,              \
+                  CTR256_PAR_VECS)                                           \
+    CTR_KERNELS(TARGET_VAES256, bits, 256_i4, aes_ctr_blocks256, 4)          \
+    CTR_KERNELS(TARGET_VAES256, bits, 256_i16, aes_ctr_blocks256, 16)
+
+VAES256_KERNELS(128)
+VAES256_KERNELS(192)
+VAES256_KERNELS(256)
+
+// ks_step on the two lanes of a ymm register.
+_INLINE_ TARGET_VAES256 __m256i ks_step256(IN __m256i a, IN const __m256i t)
+{
+    a = XOR256(a, _mm256_bslli_epi128(a, 4));
+    a = XOR256(a, _mm256_bslli_epi128(a, 8));
+    return XOR256(a, t);
+}
+
+// Store round key i of the 2 * n_vecs keys in r.
+_ALWAYS_INLINE_ TARGET_VAES256 void store_round_keys256(OUT aes256_ks_t *const ks[],
+                                                        IN const uint32_t i,
+                                                        IN const __m256i *r,
+                                                        IN const uint32_t n_vecs)
+{
+    for (uint32_t j = 0; j < n_vecs; j++)
+    {
+        ks[2 * j]->keys[i]     = _mm256_castsi256_si128(r[j]);
+        ks[2 * j + 1]->keys[i] = _mm256_extracti128_si256(r[j], 1);
+    }
+}
+
+// aes256_key_expansion_par for 2 * n_vecs keys, where vector j holds the keys
+// 2j and 2j + 1 in its lanes.
+_ALWAYS_INLINE_ TARGET_VAES256 void aes256_key_expansion256_par(
+                                    OUT aes256_ks_t *const ks[],
+                                    IN const aes256_key_t *const key[],
+                                    IN const uint32_t n_vecs)
+{
+    const __m256i rot_mask = _mm256_set1_epi32(ROT_WORD3_MASK);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i rcon = _mm256_set1_epi32(1);
+    __m256i k0[AES_KS_BATCH_MAX / 2];
+    __m256i k1[AES_KS_BATCH_MAX / 2];
+
+    for (uint32_t j = 0; j < n_vecs; j++)
+    {
+        const aes256_key_t *const *k = &key[2 * j];
+        k0[j] = _mm256_inserti128_si256(
+                    _mm256_castsi128_si256(
+                        _mm_loadu_si128((const void*)k[0]->raw)),
+                    _mm_loadu_si128((const void*)k[1]->raw), 1);
+        k1[j] = _mm256_inserti128_si256(
+                    _mm256_castsi128_si256(
+                        _mm_loadu_si128((const void*)&k[0]->raw[AES_BLOCK_SIZE])),
+                    _mm_loadu_si128((const void*)&k[1]->raw[AES_BLOCK_SIZE]), 1);
+    }
+
+    store_round_keys256(ks, 0, k0, n_vecs);
+    store_round_keys256(ks, 1, k1, n_vecs);
+
+    for (uint32_t i = 2; i <= AES256_ROUNDS; i += 2)
+    {
+        for (uint32_t j = 0; j < n_vecs; j++)
+        {
+            k0[j] = ks_step256(k0[j],
+                               VAESENCLAST256(SHUF8_256(k1[j], rot_mask), rcon));
+        }
+        store_round_keys256(ks, i, k0, n_vecs);
+        rcon = _mm256_slli_epi32(rcon, 1);
+
+        if (AES256_ROUNDS == i)
+        {
+            break;
+        }
+
+        for (uint32_t j = 0; j < n_vecs; j++)
+        {
+            k1[j] = ks_step256(k1[j],
+                        VAESENCLAST256(_mm256_shuffle_epi32(k0[j], 0xff), zero));
+        }
+        store_round_keys256(ks, i + 1, k1, n_vecs);
+    }
+}
+
+TARGET_VAES256 void aes256_key_expansion256_batch(OUT aes256_ks_t *const ks[],
+                                                  IN const aes256_key_t *const key[],
+                                                  IN const uint32_t num_keys)
+{
+    uint32_t i = 0;
+
+    for (; i + AES_KS_BATCH_MAX <= num_keys; i += AES_KS_BATCH_MAX)
+    {
+        aes256_key_expansion256_par(&ks[i], &key[i], AES_KS_BATCH_MAX / 2);
+    }
+
+    switch ((num_keys - i) / 2)
+    {
+        case 3: aes256_key_expansion256_par(&ks[i], &key[i], 3); i += 6; break;
+        case 2: aes256_key_expansion256_par(&ks[i], &key[i], 2); i += 4; break;
+        case 1: aes256_key_expansion256_par(&ks[i], &key[i], 1); i += 2; break;
+        default: break;
+    }
+
+    if (i < num_keys)
+    {
+        aes256_key_expansion(ks[i], key[i]);
+    }
+
+    // Delete secrets from registers if any.
+    ZERO256();
+}
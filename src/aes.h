@@ -26,25 +26,42 @@
 
 #define MAX_AES_INVOKATION (MASK(32))
 
+#define AES128_KEY_SIZE (16ULL)
+#define AES192_KEY_SIZE (24ULL)
 #define AES256_KEY_SIZE (32ULL)
 #define AES256_KEY_BITS (AES256_KEY_SIZE * 8)
 #define AES_BLOCK_SIZE (16ULL)
+#define AES128_ROUNDS (10ULL)
+#define AES192_ROUNDS (12ULL)
 #define AES256_ROUNDS (14ULL)
+#define AES_MAX_ROUNDS AES256_ROUNDS
 
 #define PAR_AES_BLOCK_SIZE (AES_BLOCK_SIZE*4)
 
-typedef ALIGN(16) struct aes256_key_s {
+// A raw key and a key schedule of any key size. AES-128 and AES-192 use a
+// prefix of them.
+typedef ALIGN(16) struct aes_key_s {
     uint8_t raw[AES256_KEY_SIZE];
-} aes256_key_t;
+} aes_key_t;
 
-typedef ALIGN(16) struct aes256_ks_s {
-    __m128i keys[AES256_ROUNDS + 1];
-} aes256_ks_t;
+typedef ALIGN(16) struct aes_ks_s {
+    __m128i keys[AES_MAX_ROUNDS + 1];
+} aes_ks_t;
+
+typedef aes_key_t aes256_key_t;
+typedef aes_ks_t aes256_ks_t;
 
 // The ks parameter must be 16 bytes aligned!
 EXTERNC void aes256_key_expansion(OUT aes256_ks_t *ks,
                                   IN const aes256_key_t *key);
 
+// The AES-128 and AES-192 key expansions, of the first 16 or 24 bytes of key.
+void aes128_key_expansion(OUT aes_ks_t *ks,
+                          IN const aes_key_t *key);
+
+void aes192_key_expansion(OUT aes_ks_t *ks,
+                          IN const aes_key_t *key);
+
 // Encrypt one 128-bit block ct = E(pt,ks)
 void aes256_enc(OUT uint8_t *ct,
                 IN const uint8_t *pt,
@@ -60,6 +77,120 @@ void aes256_ctr_enc(OUT uint8_t *ct,
                     IN const uint32_t num_blocks,
                     IN const aes256_ks_t *ks);
 
+// Encrypt (XOR) num_blocks 128-bit blocks of pt in CTR mode
+// ct[15:0] = pt[15:0] ^ E(ctr[15:0],ks)
+// ...
+// ct[16*num_blocks - 1:16*(num_blocks-1)] =
+//     pt[16*num_blocks - 1:16*(num_blocks-1)] ^ E(ctr[15:0] + num_blocks - 1,ks)
+// ct and pt may be equal (in place) but must not otherwise overlap.
+void aes256_ctr_xor(OUT uint8_t *ct,
+                    IN const uint8_t *pt,
+                    IN const uint8_t *ctr,
+                    IN const uint32_t num_blocks,
+                    IN const aes256_ks_t *ks);
+
+// The number of independent instances the multi instance kernels process.
+#define AES_X4_LANES 4
+
+// Run aes256_ctr_enc for AES_X4_LANES independent instances at once:
+// lane l encrypts num_blocks counter blocks starting at ctr[l] with ks[l],
+// into ct[l]. The lanes are interleaved, so the latency of one short
+// instance is hidden by the others.
+void aes256_ctr_enc_x4(IN uint8_t *const ct[AES_X4_LANES],
+                       IN const uint8_t *const ctr[AES_X4_LANES],
+                       IN const uint32_t num_blocks,
+                       IN const aes256_ks_t *const ks[AES_X4_LANES]);
+
+// The number of chains the BCC kernels process.
+#define AES_BCC_LANES 3
+
+// Run AES_BCC_LANES BCC chains (SP 800-90Ar1, 10.3.3) with the same key over
+// the same num_blocks 128-bit blocks of data. Lane l starts from the chaining
+// value cv[16*l + 15:16*l] and ends with its BCC output there:
+// cv[l] = E(cv[l] ^ data[15:0],ks)
+// cv[l] = E(cv[l] ^ data[31:16],ks)
+// ...
+void aes256_bcc(IN OUT uint8_t cv[AES_BCC_LANES * AES_BLOCK_SIZE],
+                IN const uint8_t *data,
+                IN const size_t num_blocks,
+                IN const aes256_ks_t *ks);
+
+// The largest number of keys the batched key expansions interleave.
+#define AES_KS_BATCH_MAX 8
+
+// Run aes256_key_expansion(ks[i], key[i]) for i = 0, ..., num_keys - 1. The
+// serial chains of groups of 8, 4 or 2 keys are interleaved, which hides
+// their latency. A single key uses aes256_key_expansion.
+void aes256_key_expansion_batch(OUT aes256_ks_t *const ks[],
+                                IN const aes256_key_t *const key[],
+                                IN const uint32_t num_keys);
+
+// aes256_key_expansion_batch for AES-128 and AES-192. The AES-192 version
+// expands the keys one by one.
+void aes128_key_expansion_batch(OUT aes_ks_t *const ks[],
+                                IN const aes_key_t *const key[],
+                                IN const uint32_t num_keys);
+
+void aes192_key_expansion_batch(OUT aes_ks_t *const ks[],
+                                IN const aes_key_t *const key[],
+                                IN const uint32_t num_keys);
+
+// The common prototypes of the kernels, for all key sizes.
+typedef void (*aes_key_expansion_f)(OUT aes_ks_t *ks,
+                                    IN const aes_key_t *key);
+
+typedef void (*aes_ctr_enc_f)(OUT uint8_t *ct,
+                              IN const uint8_t *ctr,
+                              IN const uint32_t num_blocks,
+                              IN const aes_ks_t *ks);
+
+typedef void (*aes_ctr_xor_f)(OUT uint8_t *ct,
+                              IN const uint8_t *pt,
+                              IN const uint8_t *ctr,
+                              IN const uint32_t num_blocks,
+                              IN const aes_ks_t *ks);
+
+typedef void (*aes_ctr_enc_x4_f)(IN uint8_t *const ct[AES_X4_LANES],
+                                 IN const uint8_t *const ctr[AES_X4_LANES],
+                                 IN const uint32_t num_blocks,
+                                 IN const aes_ks_t *const ks[AES_X4_LANES]);
+
+typedef void (*aes_key_expansion_batch_f)(OUT aes_ks_t *const ks[],
+                                          IN const aes_key_t *const key[],
+                                          IN const uint32_t num_keys);
+
+typedef void (*aes_enc_f)(OUT uint8_t *ct,
+                          IN const uint8_t *pt,
+                          IN const aes_ks_t *ks);
+
+typedef void (*aes_bcc_f)(IN OUT uint8_t cv[AES_BCC_LANES * AES_BLOCK_SIZE],
+                          IN const uint8_t *data,
+                          IN const size_t num_blocks,
+                          IN const aes_ks_t *ks);
+
+// Encrypt num_blocks 128-bit blocks using VAES on 256-bit registers (AVX2)
+// ct[15:0] = E(pt[15:0],ks)
+// ct[31:16] = E(pt[15:0] + 1,ks)
+// ...
+// ct[16*num_blocks - 1:16*(num_blocks-1)] = E(pt[15:0] + num_blocks,ks)
+void aes256_ctr_enc256(OUT uint8_t *ct,
+                       IN const uint8_t *ctr,
+                       IN const uint32_t num_blocks,
+                       IN const aes256_ks_t *ks);
+
+// aes256_ctr_xor using VAES on 256-bit registers (AVX2)
+void aes256_ctr_xor256(OUT uint8_t *ct,
+                       IN const uint8_t *pt,
+                       IN const uint8_t *ctr,
+                       IN const uint32_t num_blocks,
+                       IN const aes256_ks_t *ks);
+
+// aes256_key_expansion_batch using VAES on 256-bit registers (AVX2), two
+// keys per register.
+void aes256_key_expansion256_batch(OUT aes256_ks_t *const ks[],
+                                   IN const aes256_key_t *const key[],
+                                   IN const uint32_t num_keys);
+
 // Encrypt num_blocks 128-bit blocks using VAES (AVX512)
 // ct[15:0] = E(pt[15:0],ks)
 // ct[31:16] = E(pt[15:0] + 1,ks)
@@ -69,3 +200,116 @@ void aes256_ctr_enc512(OUT uint8_t *ct,
                        IN const uint8_t *ctr,
                        IN const uint32_t num_blocks,
                        IN const aes256_ks_t *ks);
+
+// aes256_ctr_xor using VAES (AVX512)
+void aes256_ctr_xor512(OUT uint8_t *ct,
+                       IN const uint8_t *pt,
+                       IN const uint8_t *ctr,
+                       IN const uint32_t num_blocks,
+                       IN const aes256_ks_t *ks);
+
+// aes256_ctr_enc_x4 using VAES (AVX512), with a different key in every lane.
+void aes256_ctr_enc512_x4(IN uint8_t *const ct[AES_X4_LANES],
+                          IN const uint8_t *const ctr[AES_X4_LANES],
+                          IN const uint32_t num_blocks,
+                          IN const aes256_ks_t *const ks[AES_X4_LANES]);
+
+// aes256_key_expansion_batch using VAES (AVX512), four keys per register.
+void aes256_key_expansion512_batch(OUT aes256_ks_t *const ks[],
+                                   IN const aes256_key_t *const key[],
+                                   IN const uint32_t num_keys);
+
+// The AES-128 and AES-192 versions of all the aes256_* functions above. Each
+// one is a separate instance with its number of rounds fixed at compile time.
+#define AES_DECLARE_KERNELS(bits)                                            \
+    void aes##bits##_enc(OUT uint8_t *ct,                                    \
+                         IN const uint8_t *pt,                               \
+                         IN const aes_ks_t *ks);                             \
+    void aes##bits##_ctr_enc(OUT uint8_t *ct,                                \
+                             IN const uint8_t *ctr,                          \
+                             IN const uint32_t num_blocks,                   \
+                             IN const aes_ks_t *ks);                         \
+    void aes##bits##_ctr_xor(OUT uint8_t *ct,                                \
+                             IN const uint8_t *pt,                           \
+                             IN const uint8_t *ctr,                          \
+                             IN const uint32_t num_blocks,                   \
+                             IN const aes_ks_t *ks);                         \
+    void aes##bits##_ctr_enc_x4(IN uint8_t *const ct[AES_X4_LANES],          \
+                                IN const uint8_t *const ctr[AES_X4_LANES],   \
+                                IN const uint32_t num_blocks,                \
+                                IN const aes_ks_t *const ks[AES_X4_LANES]);  \
+    void aes##bits##_bcc(IN OUT uint8_t cv[AES_BCC_LANES * AES_BLOCK_SIZE],  \
+                         IN const uint8_t *data,                             \
+                         IN const size_t num_blocks,                         \
+                         IN const aes_ks_t *ks);                             \
+    void aes##bits##_ctr_enc256(OUT uint8_t *ct,                             \
+                                IN const uint8_t *ctr,                       \
+                                IN const uint32_t num_blocks,                \
+                                IN const aes_ks_t *ks);                      \
+    void aes##bits##_ctr_xor256(OUT uint8_t *ct,                             \
+                                IN const uint8_t *pt,                        \
+                                IN const uint8_t *ctr,                       \
+                                IN const uint32_t num_blocks,                \
+                                IN const aes_ks_t *ks);                      \
+    void aes##bits##_ctr_enc512(OUT uint8_t *ct,                             \
+                                IN const uint8_t *ctr,                       \
+                                IN const uint32_t num_blocks,                \
+                                IN const aes_ks_t *ks);                      \
+    void aes##bits##_ctr_xor512(OUT uint8_t *ct,                             \
+                                IN const uint8_t *pt,                        \
+                                IN const uint8_t *ctr,                       \
+                                IN const uint32_t num_blocks,                \
+                                IN const aes_ks_t *ks);                      \
+    void aes##bits##_ctr_enc512_x4(IN uint8_t *const ct[AES_X4_LANES],       \
+                                   IN const uint8_t *const ctr[AES_X4_LANES],\
+                                   IN const uint32_t num_blocks,             \
+                                   IN const aes_ks_t *const ks[AES_X4_LANES]);
+
+AES_DECLARE_KERNELS(128)
+AES_DECLARE_KERNELS(192)
+
+// The CTR kernel variants with half and twice the number of blocks (AES-NI)
+// or vectors (VAES) in flight of the kernels above, e.g. aes256_ctr_enc_i4,
+// aes256_ctr_xor512_i16. They are generated from the same source and produce
+// the same output, see aes_tune.h.
+#define AES_DECLARE_CTR_VARIANT(bits, sfx)                                   \
+    void aes##bits##_ctr_enc##sfx(OUT uint8_t *ct,                           \
+                                  IN const uint8_t *ctr,                     \
+                                  IN const uint32_t num_blocks,              \
+                                  IN const aes_ks_t *ks);                    \
+    void aes##bits##_ctr_xor##sfx(OUT uint8_t *ct,                           \
+                                  IN const uint8_t *pt,                      \
+                                  IN const uint8_t *ctr,                     \
+                                  IN const uint32_t num_blocks,              \
+                                  IN const aes_ks_t *ks);
+
+#define AES_DECLARE_CTR_VARIANTS(bits)                                       \
+    AES_DECLARE_CTR_VARIANT(bits, _i4)                                       \
+    AES_DECLARE_CTR_VARIANT(bits, _i16)                                      \
+    AES_DECLARE_CTR_VARIANT(bits, 256_i4)                                    \
+    AES_DECLARE_CTR_VARIANT(bits, 256_i16)                                   \
+    AES_DECLARE_CTR_VARIANT(bits, 512_i4)                                    \
+    AES_DECLARE_CTR_VARIANT(bits, 512_i16)
+
+AES_DECLARE_CTR_VARIANTS(128)
+AES_DECLARE_CTR_VARIANTS(192)
+AES_DECLARE_CTR_VARIANTS(256)
+
+// The ctr_enc kernels above with non-temporal (streaming) stores, which write
+// the output to memory without keeping it in the caches, e.g.
+// aes256_ctr_enc512_nt. ct must be 64 bytes aligned and num_blocks a multiple
+// of 4.
+#define AES_DECLARE_CTR_NT_KERNEL(bits, sfx)                                 \
+    void aes##bits##_ctr_enc##sfx##_nt(OUT uint8_t *ct,                      \
+                                       IN const uint8_t *ctr,                \
+                                       IN const uint32_t num_blocks,         \
+                                       IN const aes_ks_t *ks);
+
+#define AES_DECLARE_CTR_NT_KERNELS(bits)                                     \
+    AES_DECLARE_CTR_NT_KERNEL(bits, )                                        \
+    AES_DECLARE_CTR_NT_KERNEL(bits, 256)                                     \
+    AES_DECLARE_CTR_NT_KERNEL(bits, 512)
+
+AES_DECLARE_CTR_NT_KERNELS(128)
+AES_DECLARE_CTR_NT_KERNELS(192)
+AES_DECLARE_CTR_NT_KERNELS(256)
@@ -0,0 +1,207 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#include <stdlib.h>
+#include "aes_dispatch.h"
+
+// The kernels of one key size. There is no VAES AES-128 or AES-192 batched
+// key expansion, the VAES implementations share the AES-NI one. The single
+// block and BCC kernels are latency bound, so all the implementations use the
+// AES-NI ones. All the size classes start with the default CTR kernels.
+#define AES_IMPL(impl_name, features, bits, sfx, x4, ks_batch)               \
+    {                                                                        \
+        .name = impl_name,                                                   \
+        .required = features,                                                \
+        .key_len = AES##bits##_KEY_SIZE,                                     \
+        .key_expansion = aes##bits##_key_expansion,                          \
+        .key_expansion_batch = ks_batch,                                     \
+        .ctr_enc = aes##bits##_ctr_enc##sfx,                                 \
+        .ctr_xor = aes##bits##_ctr_xor##sfx,                                 \
+        .ctr_enc_x4 = aes##bits##_ctr_enc##x4,                               \
+        .enc = aes##bits##_enc,                                              \
+        .bcc = aes##bits##_bcc,                                              \
+        .ctr_enc_variants = { aes##bits##_ctr_enc##sfx##_i4,                 \
+                              aes##bits##_ctr_enc##sfx,                      \
+                              aes##bits##_ctr_enc##sfx##_i16 },              \
+        .ctr_xor_variants = { aes##bits##_ctr_xor##sfx##_i4,                 \
+                              aes##bits##_ctr_xor##sfx,                      \
+                              aes##bits##_ctr_xor##sfx##_i16 },              \
+        .ctr_variant = { AES_CTR_I8, AES_CTR_I8, AES_CTR_I8 },               \
+        .ctr_enc_tuned = { aes##bits##_ctr_enc##sfx,                         \
+                           aes##bits##_ctr_enc##sfx,                         \
+                           aes##bits##_ctr_enc##sfx },                       \
+        .ctr_xor_tuned = { aes##bits##_ctr_xor##sfx,                         \
+                           aes##bits##_ctr_xor##sfx,                         \
+                           aes##bits##_ctr_xor##sfx },                       \
+        .chunk_blocks = 0,                                                   \
+        .ctr_enc_nt = aes##bits##_ctr_enc##sfx##_nt,                         \
+    }
+
+// The whole library is built with -mavx2, so the AES-NI kernels need AVX2 as
+// well.
+#define AESNI_FEATURES (CPU_FEATURE_AESNI | CPU_FEATURE_AVX2)
+
+#define VAES256_FEATURES (CPU_FEATURE_AESNI | CPU_FEATURE_AVX2 | \
+                          CPU_FEATURE_VAES)
+
+#define VAES512_FEATURES (CPU_FEATURE_AESNI | CPU_FEATURE_AVX2 | \
+                          CPU_FEATURE_VAES | CPU_FEATURE_AVX512F | \
+                          CPU_FEATURE_AVX512DQ | CPU_FEATURE_AVX512BW)
+
+// Not const: the autotuner replaces the tuned CTR kernels.
+static aes_impl_t g_impls[AES_IMPL_COUNT][AES_KEY_SIZE_COUNT] = {
+    [AES_IMPL_AESNI] = {
+        [AES_KEY_128] = AES_IMPL("aesni", AESNI_FEATURES, 128, , _x4,
+                                 aes128_key_expansion_batch),
+        [AES_KEY_192] = AES_IMPL("aesni", AESNI_FEATURES, 192, , _x4,
+                                 aes192_key_expansion_batch),
+        [AES_KEY_256] = AES_IMPL("aesni", AESNI_FEATURES, 256, , _x4,
+                                 aes256_key_expansion_batch),
+    },
+    // There is no 256-bit VAES multi instance kernel.
+    [AES_IMPL_VAES256] = {
+        [AES_KEY_128] = AES_IMPL("vaes256", VAES256_FEATURES, 128, 256, _x4,
+                                 aes128_key_expansion_batch),
+        [AES_KEY_192] = AES_IMPL("vaes256", VAES256_FEATURES, 192, 256, _x4,
+                                 aes192_key_expansion_batch),
+        [AES_KEY_256] = AES_IMPL("vaes256", VAES256_FEATURES, 256, 256, _x4,
+                                 aes256_key_expansion256_batch),
+    },
+    [AES_IMPL_VAES512] = {
+        [AES_KEY_128] = AES_IMPL("vaes512", VAES512_FEATURES, 128, 512, 512_x4,
+                                 aes128_key_expansion_batch),
+        [AES_KEY_192] = AES_IMPL("vaes512", VAES512_FEATURES, 192, 512, 512_x4,
+                                 aes192_key_expansion_batch),
+        [AES_KEY_256] = AES_IMPL("vaes512", VAES512_FEATURES, 256, 512, 512_x4,
+                                 aes256_key_expansion512_batch),
+    },
+};
+
+void aes_impl_set_ctr_variant(IN const aes_impl_id_t id,
+                              IN const aes_ctr_class_t cls,
+                              IN const aes_ctr_variant_t variant)
+{
+    if ((id >= AES_IMPL_COUNT) || (cls >= AES_CTR_CLASS_COUNT) ||
+        (variant >= AES_CTR_VARIANT_COUNT))
+    {
+        return;
+    }
+
+    for (uint32_t k = 0; k < AES_KEY_SIZE_COUNT; k++)
+    {
+        aes_impl_t *impl = &g_impls[id][k];
+
+        impl->ctr_variant[cls] = variant;
+        __atomic_store_n(&impl->ctr_enc_tuned[cls],
+                         impl->ctr_enc_variants[variant], __ATOMIC_RELAXED);
+        __atomic_store_n(&impl->ctr_xor_tuned[cls],
+                         impl->ctr_xor_variants[variant], __ATOMIC_RELAXED);
+    }
+}
+
+void aes_impl_set_chunk_blocks(IN const aes_impl_id_t id,
+                               IN const uint32_t chunk_blocks)
+{
+    if (id >= AES_IMPL_COUNT)
+    {
+        return;
+    }
+
+    for (uint32_t k = 0; k < AES_KEY_SIZE_COUNT; k++)
+    {
+        __atomic_store_n(&g_impls[id][k].chunk_blocks, chunk_blocks,
+                         __ATOMIC_RELAXED);
+    }
+}
+
+// The id of the default implementation, or -1 before it was selected.
+static int g_default_id = -1;
+
+const aes_impl_t *aes_impl_get(IN const aes_impl_id_t id,
+                               IN const aes_key_size_t key_size)
+{
+    if ((id >= AES_IMPL_COUNT) || (key_size >= AES_KEY_SIZE_COUNT) ||
+        !cpu_has(g_impls[id][key_size].required))
+    {
+        return NULL;
+    }
+
+    return &g_impls[id][key_size];
+}
+
+const aes_impl_t *aes_impl_by_name(IN const char *name,
+                                   IN const aes_key_size_t key_size)
+{
+    for (uint32_t id = 0; id < AES_IMPL_COUNT; id++)
+    {
+        if (0 == strcmp(name, g_impls[id][AES_KEY_256].name))
+        {
+            return aes_impl_get((aes_impl_id_t)id, key_size);
+        }
+    }
+
+    return NULL;
+}
+
+_INLINE_ int select_default_id(void)
+{
+    const char *env = getenv(AES_IMPL_ENV_VAR);
+
+    const aes_impl_t *impl = NULL;
+
+    if ((NULL != env) && (NULL != (impl = aes_impl_by_name(env, AES_KEY_256))))
+    {
+        return (int)(impl - &g_impls[0][AES_KEY_256]) / AES_KEY_SIZE_COUNT;
+    }
+
+    // The implementations are ordered from the slowest to the fastest.
+    for (int id = AES_IMPL_COUNT - 1; id >= 0; id--)
+    {
+        if (NULL != aes_impl_get((aes_impl_id_t)id, AES_KEY_256))
+        {
+            return id;
+        }
+    }
+
+    // The AES-NI implementation is the baseline of this library.
+    return AES_IMPL_AESNI;
+}
+
+// Run the CPUID/XGETBV checks and pick the default once at load time, so that
+// the generate path never has to.
+__attribute__((constructor)) static void aes_impl_init(void)
+{
+    __atomic_store_n(&g_default_id, select_default_id(), __ATOMIC_RELAXED);
+}
+
+const aes_impl_t *aes_impl_default(IN const aes_key_size_t key_size)
+{
+    int id = __atomic_load_n(&g_default_id, __ATOMIC_RELAXED);
+
+    // Called before the constructor ran. Concurrent callers select the same
+    // id.
+    if (id < 0)
+    {
+        id = select_default_id();
+        __atomic_store_n(&g_default_id, id, __ATOMIC_RELAXED);
+    }
+
+    return &g_impls[id][(key_size < AES_KEY_SIZE_COUNT) ? key_size : AES_KEY_256];
+}
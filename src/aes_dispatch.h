@@ -0,0 +1,157 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#pragma once
+
+#include "aes.h"
+#include "cpu_features.h"
+
+// The environment variable that overrides the default implementation, e.g.
+// CTR_DRBG_KERNEL=aesni for A/B benchmarking. Unknown or unsupported values
+// are ignored.
+#define AES_IMPL_ENV_VAR "CTR_DRBG_KERNEL"
+
+typedef enum
+{
+    AES_IMPL_AESNI=0,
+    AES_IMPL_VAES256,
+    AES_IMPL_VAES512,
+    AES_IMPL_COUNT
+} aes_impl_id_t;
+
+typedef enum
+{
+    AES_KEY_128=0,
+    AES_KEY_192,
+    AES_KEY_256,
+    AES_KEY_SIZE_COUNT
+} aes_key_size_t;
+
+// The CTR kernel variants of every implementation, by the number of blocks
+// (AES-NI) or vectors (VAES) they keep in flight, see
+// AES_DECLARE_CTR_VARIANTS. AES_CTR_I8 is the default.
+typedef enum
+{
+    AES_CTR_I4=0,
+    AES_CTR_I8,
+    AES_CTR_I16,
+    AES_CTR_VARIANT_COUNT
+} aes_ctr_variant_t;
+
+// The request size classes the CTR kernels are tuned for, by the number of
+// blocks of one kernel invocation: the short requests CTR_DRBG_generate
+// produces with a single invocation (256 bytes and the update blocks), up to
+// 4 KiB, and longer ones.
+typedef enum
+{
+    AES_CTR_CLASS_SMALL=0,
+    AES_CTR_CLASS_MEDIUM,
+    AES_CTR_CLASS_LARGE,
+    AES_CTR_CLASS_COUNT
+} aes_ctr_class_t;
+
+#define AES_CTR_SMALL_MAX_BLOCKS  19
+#define AES_CTR_MEDIUM_MAX_BLOCKS 256
+
+// A set of kernels of one key size that target the same CPU generation.
+typedef struct aes_impl_s {
+    const char *name;
+    cpu_features_t required;
+    // The key size in bytes.
+    uint32_t key_len;
+    aes_key_expansion_f key_expansion;
+    aes_key_expansion_batch_f key_expansion_batch;
+    aes_ctr_enc_f ctr_enc;
+    aes_ctr_xor_f ctr_xor;
+    aes_ctr_enc_x4_f ctr_enc_x4;
+    aes_enc_f enc;
+    aes_bcc_f bcc;
+    // All the variants of ctr_enc and ctr_xor, which are the AES_CTR_I8 ones.
+    aes_ctr_enc_f ctr_enc_variants[AES_CTR_VARIANT_COUNT];
+    aes_ctr_xor_f ctr_xor_variants[AES_CTR_VARIANT_COUNT];
+    // The variant of every size class, AES_CTR_I8 unless the autotuner
+    // picked another one (see aes_tune.h), and its kernels.
+    aes_ctr_variant_t ctr_variant[AES_CTR_CLASS_COUNT];
+    aes_ctr_enc_f ctr_enc_tuned[AES_CTR_CLASS_COUNT];
+    aes_ctr_xor_f ctr_xor_tuned[AES_CTR_CLASS_COUNT];
+    // The most blocks of one kernel invocation of a long request, or 0 for
+    // no limit.
+    uint32_t chunk_blocks;
+    // ctr_enc with non-temporal stores, see AES_DECLARE_CTR_NT_KERNELS.
+    aes_ctr_enc_f ctr_enc_nt;
+} aes_impl_t;
+
+_INLINE_ aes_ctr_class_t aes_ctr_class(IN const size_t num_blocks)
+{
+    if (num_blocks <= AES_CTR_SMALL_MAX_BLOCKS)
+    {
+        return AES_CTR_CLASS_SMALL;
+    }
+
+    return (num_blocks <= AES_CTR_MEDIUM_MAX_BLOCKS) ? AES_CTR_CLASS_MEDIUM :
+                                                       AES_CTR_CLASS_LARGE;
+}
+
+// The tuned ctr_enc and ctr_xor kernels of impl for num_blocks blocks. The
+// choice may be replaced while other threads generate (all the variants
+// produce the same output), hence the atomic loads.
+_INLINE_ aes_ctr_enc_f aes_ctr_enc_tuned(IN const aes_impl_t *impl,
+                                         IN const size_t num_blocks)
+{
+    return __atomic_load_n(&impl->ctr_enc_tuned[aes_ctr_class(num_blocks)],
+                           __ATOMIC_RELAXED);
+}
+
+_INLINE_ aes_ctr_xor_f aes_ctr_xor_tuned(IN const aes_impl_t *impl,
+                                         IN const size_t num_blocks)
+{
+    return __atomic_load_n(&impl->ctr_xor_tuned[aes_ctr_class(num_blocks)],
+                           __ATOMIC_RELAXED);
+}
+
+_INLINE_ uint32_t aes_ctr_chunk_blocks(IN const aes_impl_t *impl)
+{
+    return __atomic_load_n(&impl->chunk_blocks, __ATOMIC_RELAXED);
+}
+
+// Returns the implementation with the given id and key size, or NULL if the
+// running CPU does not support it.
+const aes_impl_t *aes_impl_get(IN const aes_impl_id_t id,
+                               IN const aes_key_size_t key_size);
+
+// Returns the implementation with the given name and key size, or NULL if
+// there is no such implementation or the running CPU does not support it.
+const aes_impl_t *aes_impl_by_name(IN const char *name,
+                                   IN const aes_key_size_t key_size);
+
+// Returns the fastest implementation of the given key size the running CPU
+// supports, unless it was overridden by AES_IMPL_ENV_VAR. The choice is made
+// once at startup, and is the same for all key sizes.
+const aes_impl_t *aes_impl_default(IN const aes_key_size_t key_size);
+
+// Installs the CTR kernel variant of the size class cls of all the key sizes
+// of implementation id, see aes_tune.h.
+void aes_impl_set_ctr_variant(IN const aes_impl_id_t id,
+                              IN const aes_ctr_class_t cls,
+                              IN const aes_ctr_variant_t variant);
+
+// Sets the chunk_blocks of all the key sizes of implementation id.
+void aes_impl_set_chunk_blocks(IN const aes_impl_id_t id,
+                               IN const uint32_t chunk_blocks);
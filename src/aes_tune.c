@@ -0,0 +1,499 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#include <cpuid.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <x86intrin.h>
+#include "aes_tune.h"
+
+// The checks run every length up to AES_TUNE_KAT_BLOCKS, which covers all
+// the tail paths of the widest variants. The counter starts 40 blocks before
+// its last 32 bits wrap, as the kernels only increment those.
+#define AES_TUNE_KAT_BLOCKS 80
+#define AES_TUNE_KAT_CTR_WORD 0xffffffd8U
+
+// Every timing is the minimum of AES_TUNE_REPEATS runs of at least
+// AES_TUNE_RUN_BLOCKS blocks.
+#define AES_TUNE_REPEATS 5
+#define AES_TUNE_RUN_BLOCKS 1024
+
+// The chunk lengths tried for long requests (0 is no limit).
+static const uint32_t g_chunk_blocks[] = {0, 1024, AES_CTR_MEDIUM_MAX_BLOCKS};
+
+#define AES_TUNE_NUM_CHUNKS (sizeof(g_chunk_blocks) / sizeof(g_chunk_blocks[0]))
+
+// The interleave factor of every variant, which also names it in the cache.
+static const uint32_t g_interleave[AES_CTR_VARIANT_COUNT] = {4, 8, 16};
+
+static const uint32_t g_tune_blocks[AES_CTR_CLASS_COUNT] = {
+    AES_TUNE_SMALL_BLOCKS, AES_TUNE_MEDIUM_BLOCKS, AES_TUNE_LARGE_BLOCKS};
+
+// The cache file version. Change it when the variants or the classes change.
+#define AES_TUNE_CACHE_VERSION 1
+
+// FIPS-197, Appendix C: the key 000102...1f (a prefix of it for AES-128 and
+// AES-192) and the plaintext 00112233...ff.
+static const uint8_t g_fips197_pt[AES_BLOCK_SIZE] = {
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+    0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+
+static const uint8_t g_fips197_ct[AES_KEY_SIZE_COUNT][AES_BLOCK_SIZE] = {
+    [AES_KEY_128] = {0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+                     0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a},
+    [AES_KEY_192] = {0xdd, 0xa9, 0x7c, 0xa4, 0x86, 0x4c, 0xdf, 0xe0,
+                     0x6e, 0xaf, 0x70, 0xa0, 0xec, 0x0d, 0x71, 0x91},
+    [AES_KEY_256] = {0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf,
+                     0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89},
+};
+
+_INLINE_ void ctr32_set(OUT uint8_t block[AES_BLOCK_SIZE],
+                        IN const uint32_t word)
+{
+    block[AES_BLOCK_SIZE - 4] = (uint8_t)(word >> 24);
+    block[AES_BLOCK_SIZE - 3] = (uint8_t)(word >> 16);
+    block[AES_BLOCK_SIZE - 2] = (uint8_t)(word >> 8);
+    block[AES_BLOCK_SIZE - 1] = (uint8_t)word;
+}
+
+// Checks the variants of one key size. The last block of ct is a guard that
+// the kernels must not write.
+_INLINE_ uint32_t kat_key_size(IN const aes_impl_t *impl,
+                               IN const aes_key_size_t key_size)
+{
+    ALIGN(16) aes_key_t key;
+    ALIGN(16) aes_ks_t ks;
+    uint8_t ctr[AES_BLOCK_SIZE];
+    uint8_t block[AES_BLOCK_SIZE];
+    uint8_t ref[AES_TUNE_KAT_BLOCKS * AES_BLOCK_SIZE];
+    uint8_t pt[AES_TUNE_KAT_BLOCKS * AES_BLOCK_SIZE];
+    uint8_t ct[(AES_TUNE_KAT_BLOCKS + 1) * AES_BLOCK_SIZE];
+    uint32_t passed = 0;
+
+    // First the single block kernel against FIPS-197.
+    for (uint32_t i = 0; i < sizeof(key.raw); i++)
+    {
+        key.raw[i] = (uint8_t)i;
+    }
+    impl->key_expansion(&ks, &key);
+    impl->enc(block, g_fips197_pt, &ks);
+    if (0 != memcmp(block, g_fips197_ct[key_size], sizeof(block)))
+    {
+        return 0;
+    }
+
+    // Then the reference keystream, block by block.
+    for (uint32_t i = 0; i < AES_BLOCK_SIZE; i++)
+    {
+        ctr[i] = (uint8_t)(0xc0 + i);
+    }
+    ctr32_set(ctr, AES_TUNE_KAT_CTR_WORD);
+    memcpy(block, ctr, sizeof(block));
+    for (uint32_t b = 0; b < AES_TUNE_KAT_BLOCKS; b++)
+    {
+        ctr32_set(block, AES_TUNE_KAT_CTR_WORD + b);
+        impl->enc(&ref[AES_BLOCK_SIZE * b], block, &ks);
+    }
+    for (uint32_t i = 0; i < sizeof(pt); i++)
+    {
+        pt[i] = (uint8_t)(i * 13 + 5);
+    }
+
+    for (uint32_t v = 0; v < AES_CTR_VARIANT_COUNT; v++)
+    {
+        int ok = 1;
+
+        for (uint32_t n = 1; ok && (n <= AES_TUNE_KAT_BLOCKS); n++)
+        {
+            const uint32_t len = AES_BLOCK_SIZE * n;
+
+            memset(ct, 0xa5, sizeof(ct));
+            impl->ctr_enc_variants[v](ct, ctr, n, &ks);
+            ok = (0 == memcmp(ct, ref, len)) && (0xa5 == ct[len]) &&
+                 (0xa5 == ct[len + AES_BLOCK_SIZE - 1]);
+
+            memset(ct, 0xa5, sizeof(ct));
+            impl->ctr_xor_variants[v](ct, pt, ctr, n, &ks);
+            for (uint32_t i = 0; ok && (i < len); i++)
+            {
+                ok = ((pt[i] ^ ref[i]) == ct[i]);
+            }
+            ok = ok && (0xa5 == ct[len]) &&
+                 (0xa5 == ct[len + AES_BLOCK_SIZE - 1]);
+        }
+
+        if (ok)
+        {
+            passed |= 1U << v;
+        }
+    }
+
+    secure_clean((uint8_t *)&ks, sizeof(ks));
+    return passed;
+}
+
+uint32_t aes_tune_kat(IN const aes_impl_id_t id)
+{
+    uint32_t passed = (1U << AES_CTR_VARIANT_COUNT) - 1;
+
+    for (uint32_t k = 0; passed && (k < AES_KEY_SIZE_COUNT); k++)
+    {
+        const aes_impl_t *impl = aes_impl_get(id, (aes_key_size_t)k);
+
+        passed = (NULL == impl) ? 0 :
+                 passed & kat_key_size(impl, (aes_key_size_t)k);
+    }
+
+    return passed;
+}
+
+// The minimum cycles of AES_TUNE_REPEATS runs of the keystream of num_blocks
+// blocks, generated with the installed kernels as ctr_drbg_keystream does
+// (in chunks of chunk blocks). If enc is not NULL it is used instead.
+_INLINE_ uint64_t time_keystream(IN const aes_impl_t *impl,
+                                 IN const aes_ctr_enc_f enc,
+                                 IN const uint32_t num_blocks,
+                                 IN const uint32_t chunk,
+                                 IN const aes_ks_t *ks,
+                                 OUT uint8_t *buf)
+{
+    const uint32_t calls = (num_blocks >= AES_TUNE_RUN_BLOCKS) ? 1 :
+                           (AES_TUNE_RUN_BLOCKS / num_blocks);
+    uint8_t ctr[AES_BLOCK_SIZE] = {0};
+    uint64_t best = UINT64_MAX;
+
+    // The first run warms up the caches and the vector units.
+    for (uint32_t r = 0; r <= AES_TUNE_REPEATS; r++)
+    {
+        const uint64_t start = __rdtsc();
+
+        for (uint32_t c = 0; c < calls; c++)
+        {
+            for (uint32_t b = 0; b < num_blocks; )
+            {
+                uint32_t todo = num_blocks - b;
+
+                if ((0 != chunk) && (todo > chunk))
+                {
+                    todo = chunk;
+                }
+
+                if (NULL != enc)
+                {
+                    enc(&buf[AES_BLOCK_SIZE * b], ctr, todo, ks);
+                }
+                else
+                {
+                    aes_ctr_enc_tuned(impl, todo)(&buf[AES_BLOCK_SIZE * b],
+                                                  ctr, todo, ks);
+                }
+                b += todo;
+            }
+        }
+
+        const uint64_t cycles = __rdtsc() - start;
+        if ((r > 0) && (cycles < best))
+        {
+            best = cycles;
+        }
+    }
+
+    return best / calls;
+}
+
+status_t aes_tune_impl(IN const aes_impl_id_t id,
+                       OUT aes_tune_result_t *res)
+{
+    const aes_impl_t *impl = aes_impl_get(id, AES_KEY_256);
+    ALIGN(16) aes_key_t key = {0};
+    ALIGN(16) aes_ks_t ks;
+    uint8_t *buf = NULL;
+
+    memset(res, 0, sizeof(*res));
+    if ((NULL == impl) || (0 == (res->kat_passed = aes_tune_kat(id))) ||
+        (NULL == (buf = malloc(AES_TUNE_LARGE_BLOCKS * AES_BLOCK_SIZE))))
+    {
+        return ERROR;
+    }
+
+    impl->key_expansion(&ks, &key);
+
+    // The kernel variants first, unchunked. The timings of the classes are
+    // independent of each other.
+    for (uint32_t cls = 0; cls < AES_CTR_CLASS_COUNT; cls++)
+    {
+        uint64_t best = UINT64_MAX;
+
+        for (uint32_t v = 0; v < AES_CTR_VARIANT_COUNT; v++)
+        {
+            if (!(res->kat_passed & (1U << v)))
+            {
+                continue;
+            }
+
+            const uint64_t cycles = time_keystream(impl,
+                                                   impl->ctr_enc_variants[v],
+                                                   g_tune_blocks[cls], 0,
+                                                   &ks, buf);
+            if (cycles < best)
+            {
+                best = cycles;
+                res->variant[cls] = (aes_ctr_variant_t)v;
+            }
+        }
+
+        res->cycles_per_block[cls] = (double)best / g_tune_blocks[cls];
+        aes_impl_set_ctr_variant(id, (aes_ctr_class_t)cls, res->variant[cls]);
+    }
+
+    // Then the chunk length of long requests, with the installed variants.
+    uint64_t best = UINT64_MAX;
+    for (uint32_t c = 0; c < AES_TUNE_NUM_CHUNKS; c++)
+    {
+        const uint64_t cycles = time_keystream(impl, NULL,
+                                               AES_TUNE_LARGE_BLOCKS,
+                                               g_chunk_blocks[c], &ks, buf);
+        if (cycles < best)
+        {
+            best = cycles;
+            res->chunk_blocks = g_chunk_blocks[c];
+        }
+    }
+
+    res->cycles_per_block[AES_CTR_CLASS_LARGE] =
+        (double)best / AES_TUNE_LARGE_BLOCKS;
+    aes_impl_set_chunk_blocks(id, res->chunk_blocks);
+
+    free(buf);
+    secure_clean((uint8_t *)&ks, sizeof(ks));
+    return SUCCESS;
+}
+
+status_t aes_tune_apply(IN const aes_impl_id_t id,
+                        IN const aes_tune_result_t *res)
+{
+    const uint32_t passed = aes_tune_kat(id);
+
+    for (uint32_t cls = 0; cls < AES_CTR_CLASS_COUNT; cls++)
+    {
+        if ((res->variant[cls] >= AES_CTR_VARIANT_COUNT) ||
+            !(passed & (1U << res->variant[cls])))
+        {
+            return ERROR;
+        }
+    }
+
+    for (uint32_t cls = 0; cls < AES_CTR_CLASS_COUNT; cls++)
+    {
+        aes_impl_set_ctr_variant(id, (aes_ctr_class_t)cls, res->variant[cls]);
+    }
+    aes_impl_set_chunk_blocks(id, res->chunk_blocks);
+
+    return SUCCESS;
+}
+
+// Identifies the CPU of a cache file: the family, model and stepping, and
+// the features the kernels use.
+_INLINE_ void cpu_signature(OUT char sig[32])
+{
+    uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+    __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+    snprintf(sig, 32, "%08x-%08x", eax, cpu_features());
+}
+
+_INLINE_ int variant_by_interleave(IN const uint32_t interleave)
+{
+    for (int v = 0; v < AES_CTR_VARIANT_COUNT; v++)
+    {
+        if (g_interleave[v] == interleave)
+        {
+            return v;
+        }
+    }
+
+    return -1;
+}
+
+_INLINE_ int chunk_valid(IN const uint32_t chunk)
+{
+    for (uint32_t c = 0; c < AES_TUNE_NUM_CHUNKS; c++)
+    {
+        if (g_chunk_blocks[c] == chunk)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// The cache file is text. The first line holds the version and the CPU
+// signature, and every following line one implementation:
+// <name> <small interleave> <medium interleave> <large interleave> <chunk>
+// Reads the result of every implementation into res, and sets bit id of the
+// returned mask if there is one.
+_INLINE_ uint32_t read_cache(IN const char *path,
+                             OUT aes_tune_result_t res[AES_IMPL_COUNT])
+{
+    char sig[32];
+    char file_sig[32];
+    char name[32];
+    uint32_t version = 0;
+    uint32_t found = 0;
+    uint32_t il[AES_CTR_CLASS_COUNT];
+    uint32_t chunk = 0;
+    FILE *f = fopen(path, "r");
+
+    if (NULL == f)
+    {
+        return 0;
+    }
+
+    cpu_signature(sig);
+    if ((2 != fscanf(f, "ctr_drbg-tune %u %31s\n", &version, file_sig)) ||
+        (AES_TUNE_CACHE_VERSION != version) || (0 != strcmp(sig, file_sig)))
+    {
+        fclose(f);
+        return 0;
+    }
+
+    while (5 == fscanf(f, "%31s %u %u %u %u\n", name, &il[0], &il[1], &il[2],
+                       &chunk))
+    {
+        const aes_impl_t *impl = aes_impl_by_name(name, AES_KEY_256);
+        int ok = (NULL != impl) && chunk_valid(chunk);
+
+        for (uint32_t cls = 0; ok && (cls < AES_CTR_CLASS_COUNT); cls++)
+        {
+            ok = (variant_by_interleave(il[cls]) >= 0);
+        }
+        if (!ok)
+        {
+            continue;
+        }
+
+        for (uint32_t id = 0; id < AES_IMPL_COUNT; id++)
+        {
+            if (impl != aes_impl_get((aes_impl_id_t)id, AES_KEY_256))
+            {
+                continue;
+            }
+
+            memset(&res[id], 0, sizeof(res[id]));
+            for (uint32_t cls = 0; cls < AES_CTR_CLASS_COUNT; cls++)
+            {
+                res[id].variant[cls] =
+                    (aes_ctr_variant_t)variant_by_interleave(il[cls]);
+            }
+            res[id].chunk_blocks = chunk;
+            found |= 1U << id;
+        }
+    }
+
+    fclose(f);
+    return found;
+}
+
+_INLINE_ void write_cache(IN const char *path,
+                          IN const aes_tune_result_t res[AES_IMPL_COUNT],
+                          IN const uint32_t tuned)
+{
+    char sig[32];
+    FILE *f = fopen(path, "w");
+
+    if (NULL == f)
+    {
+        return;
+    }
+
+    cpu_signature(sig);
+    fprintf(f, "ctr_drbg-tune %u %s\n", AES_TUNE_CACHE_VERSION, sig);
+    for (uint32_t id = 0; id < AES_IMPL_COUNT; id++)
+    {
+        if (tuned & (1U << id))
+        {
+            fprintf(f, "%s %u %u %u %u\n",
+                    aes_impl_get((aes_impl_id_t)id, AES_KEY_256)->name,
+                    g_interleave[res[id].variant[AES_CTR_CLASS_SMALL]],
+                    g_interleave[res[id].variant[AES_CTR_CLASS_MEDIUM]],
+                    g_interleave[res[id].variant[AES_CTR_CLASS_LARGE]],
+                    res[id].chunk_blocks);
+        }
+    }
+    fclose(f);
+}
+
+void aes_tune_all(void)
+{
+    const char *env = getenv(AES_TUNE_ENV_VAR);
+    const char *cache = getenv(AES_TUNE_CACHE_ENV_VAR);
+    aes_tune_result_t res[AES_IMPL_COUNT];
+    uint32_t cached = 0;
+    uint32_t tuned = 0;
+    int stale = 0;
+
+    // Tuning is opt-in, so that it does not slow down every process start.
+    const int enabled = (NULL == env) ? (NULL != cache) :
+                                        (0 == strcmp(env, "1"));
+    if (!enabled)
+    {
+        return;
+    }
+
+    if (NULL != cache)
+    {
+        cached = read_cache(cache, res);
+    }
+
+    for (uint32_t id = 0; id < AES_IMPL_COUNT; id++)
+    {
+        if (NULL == aes_impl_get((aes_impl_id_t)id, AES_KEY_256))
+        {
+            continue;
+        }
+
+        // A cached choice is used only if it still passes the checks.
+        if ((cached & (1U << id)) &&
+            (SUCCESS == aes_tune_apply((aes_impl_id_t)id, &res[id])))
+        {
+            tuned |= 1U << id;
+            continue;
+        }
+
+        if (SUCCESS == aes_tune_impl((aes_impl_id_t)id, &res[id]))
+        {
+            tuned |= 1U << id;
+        }
+        stale = 1;
+    }
+
+    if ((NULL != cache) && stale)
+    {
+        write_cache(cache, res, tuned);
+    }
+}
+
+// Before the power-on self-test, so that it runs with the tuned kernels.
+__attribute__((constructor(200))) static void aes_tune_init(void)
+{
+    aes_tune_all();
+}
@@ -0,0 +1,79 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#pragma once
+
+#include "aes_dispatch.h"
+
+// The startup autotuner of the CTR kernels. Every implementation has a few
+// CTR kernel variants (see AES_DECLARE_CTR_VARIANTS), and the fastest one
+// depends on the CPU generation and on the request length. When the library
+// is loaded, the variants of every implementation the CPU supports are
+// checked against the single block kernel, the ones that pass are timed
+// briefly on each size class (see aes_ctr_class_t), and the fastest ones are
+// installed. A variant that fails the checks is never installed. For long
+// requests, the tuner also picks the chunk length (chunk_blocks) of the
+// kernel invocations.
+//
+// Tuning takes a few milliseconds, so it is opt-in. It runs with
+// AES_TUNE_ENV_VAR=1, or, unless AES_TUNE_ENV_VAR=0, when
+// AES_TUNE_CACHE_ENV_VAR names a file that keeps the choices across runs on
+// the same CPU. A valid cache skips the timing (the checks still run).
+// Otherwise, the default kernels are kept.
+#define AES_TUNE_ENV_VAR "CTR_DRBG_TUNE"
+#define AES_TUNE_CACHE_ENV_VAR "CTR_DRBG_TUNE_CACHE"
+
+// The request length the size classes are timed with, in blocks.
+#define AES_TUNE_SMALL_BLOCKS  7
+#define AES_TUNE_MEDIUM_BLOCKS 64
+#define AES_TUNE_LARGE_BLOCKS  4096
+
+typedef struct aes_tune_result_s
+{
+    // Bit v is set if variant v passed the checks at all the key sizes.
+    uint32_t kat_passed;
+    aes_ctr_variant_t variant[AES_CTR_CLASS_COUNT];
+    uint32_t chunk_blocks;
+    // The AES-256 cycles per block of the choice of every size class, 0 if
+    // it was not timed.
+    double cycles_per_block[AES_CTR_CLASS_COUNT];
+} aes_tune_result_t;
+
+// Checks the ctr_enc and ctr_xor variants of implementation id, for all the
+// key sizes, against a FIPS-197 checked single block kernel, for every
+// length up to 80 blocks. Returns the kat_passed mask, or 0 if the CPU does
+// not support id.
+uint32_t aes_tune_kat(IN const aes_impl_id_t id);
+
+// Checks and times the variants of implementation id and installs the
+// fastest one of every size class and the fastest chunk length. Returns
+// ERROR, and installs nothing, if the CPU does not support id or no variant
+// passed the checks.
+status_t aes_tune_impl(IN const aes_impl_id_t id,
+                       OUT aes_tune_result_t *res);
+
+// Installs res for implementation id if its variants passed the checks, as
+// for a cached result.
+status_t aes_tune_apply(IN const aes_impl_id_t id,
+                        IN const aes_tune_result_t *res);
+
+// Tunes all the implementations the CPU supports, if AES_TUNE_ENV_VAR and
+// AES_TUNE_CACHE_ENV_VAR ask for it. It runs at load time.
+void aes_tune_all(void);
@@ -0,0 +1,870 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+// A standalone benchmark of the primitives of the DRBG, the AES kernels and
+// the DRBG functions, with every implementation the CPU supports (or the one
+// given by --impl). For each one
+// it reports the median and the 99th percentile of the time per call, in TSC
+// cycles and in ns, and the TSC cycles per byte. With --counters, it also
+// reports hardware counters per call (see perf_counters.h), the instructions
+// per byte, and the IPC (in core cycles). The results can be written as JSON,
+// and compared with the JSON of an earlier run.
+//
+// Usage: ctr_drbg_bench [--cpu N] [--samples N] [--key-size 128|192|256]
+//                       [--impl NAME] [--filter SUBSTR] [--counters]
+//                       [--json FILE] [--baseline FILE] [--tolerance PCT]
+//                       [--threads N [--duration-ms MS]]
+//                       [--trace kyber|dilithium|tls|FILE [--repeat N]]
+//                       [--mixed BYTES [--duration-ms MS]]
+//                       [--placement BYTES [--duration-ms MS]]
+//
+// --threads switches to the scaling mode of bench_scaling.c, --trace to the
+// replay mode of bench_replay.c, --mixed to the mixed workload mode of
+// bench_mixed.c, --placement to the output placement mode of
+// bench_placement.c.
+
+#define _GNU_SOURCE
+
+#include <cpuid.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bench.h"
+#include "ctr_drbg.h"
+#include "ctr_drbg_self_test.h"
+#include "perf_counters.h"
+
+#define BENCH_DEFAULT_SAMPLES 201
+#define BENCH_DEFAULT_TOLERANCE 5.0
+#define BENCH_DEFAULT_DURATION_MS 100
+
+// A sample times a batch of calls that takes at least this many TSC cycles,
+// so that the overhead of rdtscp is negligible.
+#define BENCH_MIN_SAMPLE_CYCLES 20000
+#define BENCH_MAX_BATCH (1U << 20)
+
+#define BENCH_CALIBRATION_NS 100000000ULL
+#define BENCH_MAX_LEN CTR_DRBG_MAX_GENERATE_LENGTH
+#define BENCH_MAX_RESULTS 128
+#define BENCH_LINE_LEN 1024
+
+typedef struct bench_ctx_s {
+    const aes_impl_t *impl;
+    aes_key_size_t key_size;
+    aes_key_t key;
+    aes_ks_t ks;
+    aes_ks_t ks_batch[AES_KS_BATCH_MAX];
+    aes_ks_t *ks_ptrs[AES_KS_BATCH_MAX];
+    const aes_key_t *key_ptrs[AES_KS_BATCH_MAX];
+    uint8_t *outs_x4[AES_X4_LANES];
+    const uint8_t *ctrs_x4[AES_X4_LANES];
+    const aes_ks_t *ks_x4[AES_X4_LANES];
+    CTR_DRBG_STATE drbg;
+    uint8_t entropy[CTR_DRBG_ENTROPY_LEN];
+    uint8_t ctr[AES_BLOCK_SIZE];
+    uint32_t len;
+    ALIGN(64) uint8_t in[BENCH_MAX_LEN];
+    ALIGN(64) uint8_t out[BENCH_MAX_LEN];
+} bench_ctx_t;
+
+typedef void (*bench_f)(IN OUT bench_ctx_t *ctx);
+
+static bench_ctx_t g_ctx;
+static bench_result_t g_results[BENCH_MAX_RESULTS];
+static uint32_t g_num_results = 0;
+
+bench_result_t *bench_new_result(IN const char *name,
+                                 IN const char *impl,
+                                 IN const uint32_t bytes)
+{
+    if (g_num_results == BENCH_MAX_RESULTS)
+    {
+        return NULL;
+    }
+
+    bench_result_t *r = &g_results[g_num_results++];
+    memset(r, 0, sizeof(*r));
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    snprintf(r->impl, sizeof(r->impl), "%s", impl);
+    r->bytes = bytes;
+
+    return r;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    const uint64_t x = *(const uint64_t *)a;
+    const uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+double bench_quantile(IN OUT uint64_t *s, IN const size_t n, IN const double q)
+{
+    if (0 == n)
+    {
+        return 0;
+    }
+
+    qsort(s, n, sizeof(s[0]), cmp_u64);
+
+    // The nearest rank, ceil(q * n), as the p99 of run().
+    const size_t rank = (size_t)(q * (double)n + 0.999999);
+
+    return (double)s[(0 == rank) ? 0 : rank - 1];
+}
+
+// The TSC frequency in GHz (TSC cycles per ns), measured against
+// CLOCK_MONOTONIC_RAW over BENCH_CALIBRATION_NS.
+static double calibrate_tsc(void)
+{
+    const uint64_t ns0 = bench_now_ns();
+    const uint64_t tsc0 = bench_rdtscp();
+    uint64_t ns1;
+
+    do
+    {
+        ns1 = bench_now_ns();
+    } while (ns1 - ns0 < BENCH_CALIBRATION_NS);
+
+    return (double)(bench_rdtscp() - tsc0) / (double)(ns1 - ns0);
+}
+
+// An invariant TSC runs at a constant rate, regardless of the core frequency
+// and of C-states.
+static int invariant_tsc(void)
+{
+    uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+    return (__get_cpuid_max(0x80000000, NULL) >= 0x80000007) &&
+           __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) &&
+           (edx & (1U << 8));
+}
+
+static void cpu_brand(OUT char brand[49])
+{
+    uint32_t regs[12] = {0};
+
+    brand[0] = '\0';
+    if (__get_cpuid_max(0x80000000, NULL) < 0x80000004)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        __get_cpuid(0x80000002 + i, &regs[4 * i], &regs[4 * i + 1],
+                    &regs[4 * i + 2], &regs[4 * i + 3]);
+    }
+    memcpy(brand, regs, sizeof(regs));
+    brand[48] = '\0';
+
+    // Drop the padding, and quotes that would break the JSON.
+    for (char *p = brand; '\0' != *p; p++)
+    {
+        if (('"' == *p) || ('\\' == *p))
+        {
+            *p = ' ';
+        }
+    }
+    for (size_t n = strlen(brand); (n > 0) && (' ' == brand[n - 1]); n--)
+    {
+        brand[n - 1] = '\0';
+    }
+}
+
+static void bench_key_expansion(IN OUT bench_ctx_t *ctx)
+{
+    ctx->impl->key_expansion(&ctx->ks, &ctx->key);
+}
+
+static void bench_key_expansion_batch(IN OUT bench_ctx_t *ctx)
+{
+    ctx->impl->key_expansion_batch(ctx->ks_ptrs, ctx->key_ptrs,
+                                   AES_KS_BATCH_MAX);
+}
+
+static void bench_enc(IN OUT bench_ctx_t *ctx)
+{
+    ctx->impl->enc(ctx->out, ctx->in, &ctx->ks);
+}
+
+static void bench_ctr_enc(IN OUT bench_ctx_t *ctx)
+{
+    ctx->impl->ctr_enc(ctx->out, ctx->ctr, ctx->len / AES_BLOCK_SIZE,
+                       &ctx->ks);
+}
+
+static void bench_ctr_xor(IN OUT bench_ctx_t *ctx)
+{
+    ctx->impl->ctr_xor(ctx->out, ctx->in, ctx->ctr,
+                       ctx->len / AES_BLOCK_SIZE, &ctx->ks);
+}
+
+// ctx->len bytes in total, over four lanes.
+static void bench_ctr_enc_x4(IN OUT bench_ctx_t *ctx)
+{
+    ctx->impl->ctr_enc_x4(ctx->outs_x4, ctx->ctrs_x4,
+                          ctx->len / (AES_X4_LANES * AES_BLOCK_SIZE),
+                          ctx->ks_x4);
+}
+
+static void bench_init(IN OUT bench_ctx_t *ctx)
+{
+    CTR_DRBG_init_key_size(&ctx->drbg, ctx->key_size, ctx->entropy, NULL, 0);
+}
+
+// The power-on self-test, of every vector with every kernel.
+static void bench_self_test(IN OUT bench_ctx_t *ctx)
+{
+    (void)ctx;
+    CTR_DRBG_self_test();
+}
+
+static void bench_reseed(IN OUT bench_ctx_t *ctx)
+{
+    CTR_DRBG_reseed(&ctx->drbg, ctx->entropy, NULL, 0);
+}
+
+// A request of zero bytes runs the update of step 6 only.
+static void bench_update(IN OUT bench_ctx_t *ctx)
+{
+    CTR_DRBG_generate(&ctx->drbg, ctx->out, 0, NULL, 0);
+}
+
+static void bench_generate(IN OUT bench_ctx_t *ctx)
+{
+    CTR_DRBG_generate(&ctx->drbg, ctx->out, ctx->len, NULL, 0);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+// Run fn as ctx->len bytes benchmark, and append its result.
+static void run(IN const bench_options_t *opt,
+                IN perf_counters_t *pc,
+                IN const char *name,
+                IN const uint32_t len,
+                IN bench_f fn)
+{
+    bench_ctx_t *ctx = &g_ctx;
+
+    if ((NULL != opt->filter) && (NULL == strstr(name, opt->filter)))
+    {
+        return;
+    }
+
+    double *samples = (double *)malloc(opt->samples * sizeof(double));
+    bench_result_t *r = bench_new_result(name, ctx->impl->name, len);
+    if ((NULL == samples) || (NULL == r))
+    {
+        free(samples);
+        return;
+    }
+    ctx->len = len;
+
+    // Find the batch size, which also warms up the caches and the predictors.
+    uint64_t batch = 1;
+    for (;; batch <<= 1)
+    {
+        const uint64_t t0 = bench_rdtscp();
+        for (uint64_t i = 0; i < batch; i++)
+        {
+            fn(ctx);
+        }
+        if ((bench_rdtscp() - t0 >= BENCH_MIN_SAMPLE_CYCLES) ||
+            (batch == BENCH_MAX_BATCH))
+        {
+            break;
+        }
+    }
+    r->batch = batch;
+
+    for (uint32_t s = 0; s < opt->samples; s++)
+    {
+        const uint64_t t0 = bench_rdtscp();
+        for (uint64_t i = 0; i < batch; i++)
+        {
+            fn(ctx);
+        }
+        samples[s] = (double)(bench_rdtscp() - t0) / (double)batch;
+    }
+
+    qsort(samples, opt->samples, sizeof(double), cmp_double);
+    r->median = samples[opt->samples / 2];
+    r->p99 = samples[(99 * opt->samples + 99) / 100 - 1];
+    free(samples);
+
+    // The counters run separately, so that their system calls do not
+    // disturb the timing.
+    if (opt->counters)
+    {
+        const double calls = (double)batch * (double)opt->samples;
+
+        perf_counters_start(pc);
+        for (uint64_t i = 0; i < batch * opt->samples; i++)
+        {
+            fn(ctx);
+        }
+        perf_counters_stop(pc);
+
+        r->has_counters = 1;
+        for (uint32_t i = 0; i < PERF_CNT_COUNT; i++)
+        {
+            r->counters[i] = perf_counter_valid(pc, (perf_counter_id_t)i) ?
+                             pc->value[i] / calls : -1;
+        }
+    }
+}
+
+_INLINE_ double ipc(IN const bench_result_t *r)
+{
+    if (!r->has_counters || (r->counters[PERF_CNT_INSTRUCTIONS] < 0) ||
+        (r->counters[PERF_CNT_CYCLES] <= 0))
+    {
+        return -1;
+    }
+
+    return r->counters[PERF_CNT_INSTRUCTIONS] / r->counters[PERF_CNT_CYCLES];
+}
+
+static void print_result(IN const bench_result_t *r, IN const double ghz)
+{
+    printf("%-20s %-8s %6u B %10.1f cyc %8.1f ns  p99 %10.1f cyc",
+           r->name, r->impl, r->bytes, r->median, r->median / ghz, r->p99);
+    if (0 != r->count)
+    {
+        printf("  p99.9 %10.1f cyc  (%lu calls)", r->p999,
+               (unsigned long)r->count);
+        printf("\n");
+        return;
+    }
+    if (0 != r->bytes)
+    {
+        printf(" %7.3f c/B", r->median / r->bytes);
+    }
+    if (r->has_counters && (r->counters[PERF_CNT_INSTRUCTIONS] >= 0))
+    {
+        printf("  %9.1f insn", r->counters[PERF_CNT_INSTRUCTIONS]);
+        if (0 != r->bytes)
+        {
+            printf(" %6.2f insn/B",
+                   r->counters[PERF_CNT_INSTRUCTIONS] / r->bytes);
+        }
+        if (ipc(r) >= 0)
+        {
+            printf(" IPC %4.2f", ipc(r));
+        }
+    }
+    printf("\n");
+}
+
+// Every result is written on one line, which keeps load_baseline simple.
+static int write_json(IN const bench_options_t *opt,
+                      IN const double ghz,
+                      IN const char *brand,
+                      IN const uint32_t num_counters)
+{
+    FILE *f = (0 == strcmp(opt->json, "-")) ? stdout : fopen(opt->json, "w");
+    if (NULL == f)
+    {
+        printf("ERROR: cannot write %s\n", opt->json);
+        return ERROR;
+    }
+
+    char pinned[16] = "null";
+    if (opt->cpu >= 0)
+    {
+        snprintf(pinned, sizeof(pinned), "%d", opt->cpu);
+    }
+
+    fprintf(f, "{\n  \"host\": {\"cpu\": \"%s\", \"tsc_ghz\": %.4f, "
+               "\"invariant_tsc\": %s, \"pinned_cpu\": %s, "
+               "\"default_impl\": \"%s\", \"key_bits\": %u, "
+               "\"samples\": %u, \"counters\": %u},\n  \"results\": [\n",
+            brand, ghz, invariant_tsc() ? "true" : "false", pinned,
+            aes_impl_default(opt->key_size)->name,
+            8 * aes_impl_default(opt->key_size)->key_len, opt->samples,
+            num_counters);
+
+    for (uint32_t i = 0; i < g_num_results; i++)
+    {
+        const bench_result_t *r = &g_results[i];
+
+        fprintf(f, "    {\"name\": \"%s\", \"impl\": \"%s\", \"bytes\": %u, "
+                   "\"batch\": %lu", r->name, r->impl, r->bytes,
+                (unsigned long)r->batch);
+        bench_json_number(f, "cycles_median", r->median);
+        bench_json_number(f, "cycles_p99", r->p99);
+        bench_json_number(f, "ns_median", r->median / ghz);
+        bench_json_number(f, "ns_p99", r->p99 / ghz);
+        if (0 != r->count)
+        {
+            bench_json_number(f, "cycles_p999", r->p999);
+            bench_json_number(f, "ns_p999", r->p999 / ghz);
+            fprintf(f, ", \"count\": %lu", (unsigned long)r->count);
+        }
+        bench_json_number(f, "cycles_per_byte",
+                    (0 != r->bytes) ? r->median / r->bytes : -1);
+
+        if (r->has_counters)
+        {
+            const double insn = r->counters[PERF_CNT_INSTRUCTIONS];
+
+            for (uint32_t c = 0; c < PERF_CNT_COUNT; c++)
+            {
+                bench_json_number(f, perf_counter_names[c], r->counters[c]);
+            }
+            bench_json_number(f, "instructions_per_byte",
+                        ((0 != r->bytes) && (insn >= 0)) ? insn / r->bytes
+                                                         : -1);
+            bench_json_number(f, "ipc", ipc(r));
+        }
+        fprintf(f, "}%s\n", (i + 1 < g_num_results) ? "," : "");
+    }
+    fprintf(f, "  ]");
+    bench_scaling_json(f);
+    bench_mixed_json(f);
+    fprintf(f, "\n}\n");
+
+    if (stdout != f)
+    {
+        fclose(f);
+    }
+
+    return SUCCESS;
+}
+
+// Copy the string value of "key" in line to out. It returns 0 if there is
+// none.
+_INLINE_ int json_string(OUT char out[BENCH_NAME_LEN],
+                         IN const char *line,
+                         IN const char *key)
+{
+    char pattern[BENCH_NAME_LEN + 8];
+
+    snprintf(pattern, sizeof(pattern), "\"%s\": \"", key);
+    const char *p = strstr(line, pattern);
+    if (NULL == p)
+    {
+        return 0;
+    }
+    p += strlen(pattern);
+
+    const char *end = strchr(p, '"');
+    if ((NULL == end) || (end - p >= BENCH_NAME_LEN))
+    {
+        return 0;
+    }
+    memcpy(out, p, (size_t)(end - p));
+    out[end - p] = '\0';
+
+    return 1;
+}
+
+_INLINE_ int json_double(OUT double *out,
+                         IN const char *line,
+                         IN const char *key)
+{
+    char pattern[BENCH_NAME_LEN + 8];
+
+    snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+    const char *p = strstr(line, pattern);
+
+    return (NULL != p) && (1 == sscanf(p + strlen(pattern), "%lf", out));
+}
+
+// Print a regression and return 1 if cur is more than the tolerance above
+// base.
+_INLINE_ uint32_t check_regression(IN const bench_options_t *opt,
+                                   IN const bench_result_t *r,
+                                   IN const char *what,
+                                   IN const double base,
+                                   IN const double cur)
+{
+    const double change = 100.0 * (cur / base - 1.0);
+
+    if (change <= opt->tolerance)
+    {
+        return 0;
+    }
+
+    printf("REGRESSION: %s %s %u B %s: %.1f -> %.1f cycles (%+.1f%%)\n",
+           r->name, r->impl, r->bytes, what, base, cur, change);
+    return 1;
+}
+
+// Compare the median of every result with the result of the same name,
+// implementation and length in the baseline, and also the p99 and p99.9 of
+// the modes that time every call. A result is a regression if it is more
+// than tolerance percent slower.
+static int compare_baseline(IN const bench_options_t *opt)
+{
+    char line[BENCH_LINE_LEN];
+    uint32_t compared = 0;
+    uint32_t regressions = 0;
+
+    FILE *f = fopen(opt->baseline, "r");
+    if (NULL == f)
+    {
+        printf("ERROR: cannot read %s\n", opt->baseline);
+        return ERROR;
+    }
+
+    while (NULL != fgets(line, sizeof(line), f))
+    {
+        char name[BENCH_NAME_LEN];
+        char impl[BENCH_NAME_LEN];
+        double bytes;
+        double median;
+
+        if (!json_string(name, line, "name") ||
+            !json_string(impl, line, "impl") ||
+            !json_double(&bytes, line, "bytes") ||
+            !json_double(&median, line, "cycles_median"))
+        {
+            continue;
+        }
+
+        for (uint32_t i = 0; i < g_num_results; i++)
+        {
+            const bench_result_t *r = &g_results[i];
+
+            if ((0 != strcmp(r->name, name)) || (0 != strcmp(r->impl, impl)) ||
+                ((double)r->bytes != bytes))
+            {
+                continue;
+            }
+
+            compared++;
+            regressions += check_regression(opt, r, "median", median,
+                                            r->median);
+
+            // The tail of the modes that time every call.
+            double tail;
+            if ((0 != r->count) && json_double(&tail, line, "cycles_p99"))
+            {
+                regressions += check_regression(opt, r, "p99", tail, r->p99);
+            }
+            if ((0 != r->count) && json_double(&tail, line, "cycles_p999"))
+            {
+                regressions += check_regression(opt, r, "p99.9", tail,
+                                                r->p999);
+            }
+        }
+    }
+    fclose(f);
+
+    printf("Compared %u results with %s: %u regressions above %.1f%%.\n",
+           compared, opt->baseline, regressions, opt->tolerance);
+
+    return (0 == regressions) ? SUCCESS : ERROR;
+}
+
+static void usage(void)
+{
+    printf("Usage: ctr_drbg_bench [--cpu N] [--samples N] "
+           "[--key-size 128|192|256]\n"
+           "                      [--impl NAME] [--filter SUBSTR] "
+           "[--counters]\n"
+           "                      [--json FILE|-] [--baseline FILE] "
+           "[--tolerance PCT]\n"
+           "                      [--threads N [--duration-ms MS]]\n"
+           "                      [--trace kyber|dilithium|tls|FILE "
+           "[--repeat N]]\n"
+           "                      [--mixed BYTES [--duration-ms MS]]\n"
+           "                      [--placement BYTES [--duration-ms MS]]\n");
+}
+
+static int parse_options(OUT bench_options_t *opt, IN int argc, IN char *argv[])
+{
+    opt->cpu = -1;
+    opt->samples = BENCH_DEFAULT_SAMPLES;
+    opt->key_size = AES_KEY_256;
+    opt->impl = NULL;
+    opt->filter = NULL;
+    opt->counters = 0;
+    opt->json = NULL;
+    opt->baseline = NULL;
+    opt->tolerance = BENCH_DEFAULT_TOLERANCE;
+    opt->threads = 0;
+    opt->duration_ms = BENCH_DEFAULT_DURATION_MS;
+    opt->trace = NULL;
+    opt->repeat = 0;
+    opt->mixed = 0;
+    opt->placement = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (0 == strcmp(arg, "--counters"))
+        {
+            opt->counters = 1;
+            continue;
+        }
+
+        if (NULL == val)
+        {
+            return ERROR;
+        }
+        i++;
+
+        if (0 == strcmp(arg, "--cpu"))
+        {
+            opt->cpu = atoi(val);
+        }
+        else if (0 == strcmp(arg, "--samples"))
+        {
+            opt->samples = (uint32_t)atoi(val);
+        }
+        else if (0 == strcmp(arg, "--key-size"))
+        {
+            const int bits = atoi(val);
+            if ((128 != bits) && (192 != bits) && (256 != bits))
+            {
+                return ERROR;
+            }
+            opt->key_size = (aes_key_size_t)((bits - 128) / 64);
+        }
+        else if (0 == strcmp(arg, "--impl"))
+        {
+            opt->impl = val;
+        }
+        else if (0 == strcmp(arg, "--filter"))
+        {
+            opt->filter = val;
+        }
+        else if (0 == strcmp(arg, "--json"))
+        {
+            opt->json = val;
+        }
+        else if (0 == strcmp(arg, "--baseline"))
+        {
+            opt->baseline = val;
+        }
+        else if (0 == strcmp(arg, "--tolerance"))
+        {
+            opt->tolerance = atof(val);
+        }
+        else if (0 == strcmp(arg, "--threads"))
+        {
+            opt->threads = (uint32_t)atoi(val);
+        }
+        else if (0 == strcmp(arg, "--duration-ms"))
+        {
+            opt->duration_ms = (uint32_t)atoi(val);
+        }
+        else if (0 == strcmp(arg, "--trace"))
+        {
+            opt->trace = val;
+        }
+        else if (0 == strcmp(arg, "--repeat"))
+        {
+            opt->repeat = (uint32_t)atoi(val);
+        }
+        else if (0 == strcmp(arg, "--mixed"))
+        {
+            opt->mixed = (uint32_t)atoi(val);
+        }
+        else if (0 == strcmp(arg, "--placement"))
+        {
+            opt->placement = (uint32_t)atoi(val);
+        }
+        else
+        {
+            return ERROR;
+        }
+    }
+
+    return ((0 == opt->samples) || (0 == opt->duration_ms)) ? ERROR : SUCCESS;
+}
+
+static void setup_ctx(IN OUT bench_ctx_t *ctx, IN const aes_impl_t *impl)
+{
+    ctx->impl = impl;
+    for (uint32_t i = 0; i < sizeof(ctx->key.raw); i++)
+    {
+        ctx->key.raw[i] = (uint8_t)(7 * i + 1);
+    }
+    impl->key_expansion(&ctx->ks, &ctx->key);
+
+    for (uint32_t l = 0; l < AES_KS_BATCH_MAX; l++)
+    {
+        ctx->ks_ptrs[l] = &ctx->ks_batch[l];
+        ctx->key_ptrs[l] = &ctx->key;
+    }
+    for (uint32_t l = 0; l < AES_X4_LANES; l++)
+    {
+        ctx->outs_x4[l] = &ctx->out[l * (BENCH_MAX_LEN / AES_X4_LANES)];
+        ctx->ctrs_x4[l] = ctx->ctr;
+        ctx->ks_x4[l] = &ctx->ks;
+    }
+}
+
+// Run the benchmarks of the primitives.
+static void run_primitives(IN const bench_options_t *opt,
+                           IN perf_counters_t *pc)
+{
+    static const uint32_t sweep[] = {16, 64, 256, 1024, 4096, 16384, 65536};
+    const uint32_t sweep_len = sizeof(sweep) / sizeof(sweep[0]);
+    bench_ctx_t *ctx = &g_ctx;
+
+    ctx->key_size = opt->key_size;
+    for (uint32_t i = 0; i < sizeof(ctx->entropy); i++)
+    {
+        ctx->entropy[i] = (uint8_t)(3 * i + 5);
+    }
+
+    for (uint32_t id = 0; id < AES_IMPL_COUNT; id++)
+    {
+        const aes_impl_t *impl = aes_impl_get((aes_impl_id_t)id, opt->key_size);
+        if ((NULL == impl) ||
+            ((NULL != opt->impl) && (0 != strcmp(opt->impl, impl->name))))
+        {
+            continue;
+        }
+        setup_ctx(ctx, impl);
+
+        run(opt, pc, "key_expansion", 0, bench_key_expansion);
+        run(opt, pc, "key_expansion_batch", 0, bench_key_expansion_batch);
+        run(opt, pc, "enc", AES_BLOCK_SIZE, bench_enc);
+        for (uint32_t i = 0; i < sweep_len; i++)
+        {
+            run(opt, pc, "ctr_enc", sweep[i], bench_ctr_enc);
+        }
+        run(opt, pc, "ctr_xor", 4096, bench_ctr_xor);
+        run(opt, pc, "ctr_enc_x4", 4096, bench_ctr_enc_x4);
+
+        // CTR_DRBG_init always uses the default implementation (see
+        // AES_IMPL_ENV_VAR), and the self-test all of them; the other
+        // functions use impl.
+        if (impl == aes_impl_default(opt->key_size))
+        {
+            run(opt, pc, "init", 0, bench_init);
+            run(opt, pc, "self_test", 0, bench_self_test);
+        }
+        CTR_DRBG_init_key_size(&ctx->drbg, opt->key_size, ctx->entropy,
+                               NULL, 0);
+        CTR_DRBG_set_impl(&ctx->drbg, impl);
+        run(opt, pc, "reseed", 0, bench_reseed);
+        run(opt, pc, "update", 0, bench_update);
+        for (uint32_t i = 0; i < sweep_len; i++)
+        {
+            run(opt, pc, "generate", sweep[i], bench_generate);
+        }
+        CTR_DRBG_clear(&ctx->drbg);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    perf_counters_t pc;
+    uint32_t num_counters = 0;
+    bench_options_t opt;
+    char brand[49];
+
+    if (SUCCESS != parse_options(&opt, argc, argv))
+    {
+        usage();
+        return ERROR;
+    }
+
+    if ((NULL != opt.impl) && (NULL == aes_impl_by_name(opt.impl, opt.key_size)))
+    {
+        printf("ERROR: no implementation %s on this CPU\n", opt.impl);
+        return ERROR;
+    }
+
+    // The threads of the scaling mode pin themselves.
+    if ((opt.cpu >= 0) && (0 == opt.threads) && !bench_pin(opt.cpu))
+    {
+        printf("ERROR: cannot pin to CPU %d\n", opt.cpu);
+        return ERROR;
+    }
+
+    if (opt.counters)
+    {
+        num_counters = perf_counters_open(&pc);
+        if (0 == num_counters)
+        {
+            printf("perf_event_open is not available, no counters.\n");
+            opt.counters = 0;
+        }
+    }
+
+    cpu_brand(brand);
+    const double ghz = calibrate_tsc();
+    printf("%s, TSC %.3f GHz (%s), %s, %u samples.\n", brand, ghz,
+           invariant_tsc() ? "invariant" : "not invariant",
+           (opt.cpu >= 0) ? "pinned" : "not pinned", opt.samples);
+
+    if (0 != opt.threads)
+    {
+        GUARD(bench_scaling(&opt));
+    }
+    else if (NULL != opt.trace)
+    {
+        GUARD(bench_replay(&opt));
+    }
+    else if (0 != opt.mixed)
+    {
+        GUARD(bench_mixed(&opt));
+    }
+    else if (0 != opt.placement)
+    {
+        GUARD(bench_placement(&opt));
+    }
+    else
+    {
+        run_primitives(&opt, &pc);
+    }
+
+    for (uint32_t i = 0; i < g_num_results; i++)
+    {
+        print_result(&g_results[i], ghz);
+    }
+
+    if (opt.counters)
+    {
+        perf_counters_close(&pc);
+    }
+
+    if ((NULL != opt.json) &&
+        (SUCCESS != write_json(&opt, ghz, brand, num_counters)))
+    {
+        return ERROR;
+    }
+
+    if (NULL != opt.baseline)
+    {
+        return compare_baseline(&opt);
+    }
+
+    return SUCCESS;
+}
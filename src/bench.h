@@ -0,0 +1,147 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#pragma once
+
+// The shared parts of the benchmark modes (bench*.c), which define
+// _GNU_SOURCE before they include this header.
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "aes_dispatch.h"
+#include "perf_counters.h"
+
+#define BENCH_NAME_LEN 32
+
+typedef struct bench_options_s {
+    // The CPU to pin to, or the first one for multi-threaded modes; -1 for
+    // no pinning.
+    int cpu;
+    uint32_t samples;
+    aes_key_size_t key_size;
+    const char *impl;
+    const char *filter;
+    int counters;
+    const char *json;
+    const char *baseline;
+    double tolerance;
+    // The maximal number of threads of the scaling mode, 0 if it is off.
+    uint32_t threads;
+    uint32_t duration_ms;
+    // The trace of the replay mode, NULL if it is off, and the number of
+    // times it is replayed (0 for the default).
+    const char *trace;
+    uint32_t repeat;
+    // The request size of the mixed workload mode, 0 if it is off.
+    uint32_t mixed;
+    // The fill size of the output placement mode, 0 if it is off.
+    uint32_t placement;
+} bench_options_t;
+
+// The result of one benchmark, in the JSON output and compared with the
+// baseline by name, impl and bytes.
+typedef struct bench_result_s {
+    char name[BENCH_NAME_LEN];
+    char impl[BENCH_NAME_LEN];
+    uint32_t bytes;
+    uint64_t batch;
+    // TSC cycles per call.
+    double median;
+    double p99;
+    // The number of calls and the 99.9th percentile, for the modes that
+    // time every call; zero otherwise.
+    uint64_t count;
+    double p999;
+    int has_counters;
+    // Per call. Counters that could not be opened are negative.
+    double counters[PERF_CNT_COUNT];
+} bench_result_t;
+
+// Append a result (bench.c). It returns NULL if there is no room left.
+bench_result_t *bench_new_result(IN const char *name,
+                                 IN const char *impl,
+                                 IN const uint32_t bytes);
+
+// Sort s[0...n-1] and return its q-quantile (nearest rank), or 0 if n is 0.
+double bench_quantile(IN OUT uint64_t *s, IN const size_t n, IN const double q);
+
+_INLINE_ uint64_t bench_rdtscp(void)
+{
+    uint32_t hi, lo;
+    __asm__ __volatile__ ("rdtscp\n\t" : "=a"(lo), "=d"(hi)::"rcx");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+_INLINE_ uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Pin the calling thread to cpu. It returns 1 on success.
+_INLINE_ int bench_pin(IN const int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return (0 == sched_setaffinity(0, sizeof(set), &set));
+}
+
+// Print ", key: v", or null if v is negative (not available).
+_INLINE_ void bench_json_number(IN FILE *f,
+                                IN const char *key,
+                                IN const double v)
+{
+    if (v < 0)
+    {
+        fprintf(f, ", \"%s\": null", key);
+    }
+    else
+    {
+        fprintf(f, ", \"%s\": %.4f", key, v);
+    }
+}
+
+// The trace replay mode (bench_replay.c). Its results are appended with
+// bench_new_result. It returns SUCCESS or ERROR.
+int bench_replay(IN const bench_options_t *opt);
+
+// The mixed workload mode (bench_mixed.c). It returns SUCCESS or ERROR.
+int bench_mixed(IN const bench_options_t *opt);
+
+// Write the mixed workload results as a JSON array member ("mixed": [...]),
+// preceded by a comma. Nothing is written if the mode did not run.
+void bench_mixed_json(IN FILE *f);
+
+// The output placement mode (bench_placement.c). Its results are appended
+// with bench_new_result. It returns SUCCESS or ERROR.
+int bench_placement(IN const bench_options_t *opt);
+
+// The multi-threaded scaling mode (bench_scaling.c). It returns SUCCESS or
+// ERROR.
+int bench_scaling(IN const bench_options_t *opt);
+
+// Write the scaling results as a JSON array member ("scaling": [...]),
+// preceded by a comma. Nothing is written if the mode did not run.
+void bench_scaling_json(IN FILE *f);
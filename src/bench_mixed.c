@@ -0,0 +1,360 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+// The mixed workload mode of the benchmark. The wide kernels (in particular
+// the 512-bit ones) can lower the core frequency, and the lower frequency
+// also slows the scalar code around the DRBG calls, which instruction and
+// cycle counts of the kernels alone do not show. For every implementation,
+// a loop alternates a DRBG call of opt->mixed bytes with a fixed scalar
+// workload for opt->duration_ms, and reports:
+//
+// - The end to end throughput of the loop.
+// - The TSC cycles of the scalar workload within the loop, relative to the
+//   same workload alone. The TSC runs at a constant rate, so a slowdown is
+//   a lower core frequency (or a colder cache).
+// - The recovery time: after a burst of large requests, the time until the
+//   scalar workload runs at its own speed again for MIXED_STABLE_CHUNKS
+//   chunks in a row.
+//
+// The aesni implementation, which does not change the frequency, is the
+// control.
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "ctr_drbg.h"
+
+// The scalar workload, a few us.
+#define MIXED_WORK_ITERS 1000
+#define MIXED_WARMUP_MS 10
+#define MIXED_BASE_SAMPLES 1001
+#define MIXED_MAX_SAMPLES (1U << 20)
+#define MIXED_BURST_MS 2
+#define MIXED_BURST_LEN CTR_DRBG_MAX_GENERATE_LENGTH
+#define MIXED_RECOVERY_MS 10
+#define MIXED_RECOVERED 1.05
+#define MIXED_STABLE_CHUNKS 50
+
+typedef struct mixed_result_s {
+    const char *impl;
+    uint32_t bytes;
+    // TSC cycles of the scalar workload, alone and within the loop.
+    double scalar_base;
+    double scalar_mixed;
+    double iters_per_sec;
+    // Of DRBG output, in GB/s (10^9 bytes per second).
+    double gbps;
+    // In us, or -1 if it did not recover within MIXED_RECOVERY_MS.
+    double recovery_us;
+} mixed_result_t;
+
+static mixed_result_t g_mixed[AES_IMPL_COUNT];
+static uint32_t g_num_mixed = 0;
+
+// Keeps the result of the scalar workload alive.
+static volatile uint64_t g_sink;
+
+// A dependent chain of xorshift* steps, which the compiler cannot
+// vectorize.
+static uint64_t scalar_work(IN uint64_t x)
+{
+    for (uint32_t i = 0; i < MIXED_WORK_ITERS; i++)
+    {
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        x *= 0x2545F4914F6CDD1DULL;
+    }
+
+    return x;
+}
+
+// The median TSC cycles of the scalar workload alone, after MIXED_WARMUP_MS
+// of it to let the frequency settle.
+static double scalar_base(IN OUT uint64_t *s)
+{
+    uint64_t x = 1;
+
+    const uint64_t end = bench_now_ns() + MIXED_WARMUP_MS * 1000000ULL;
+    while (bench_now_ns() < end)
+    {
+        x = scalar_work(x);
+    }
+
+    for (uint32_t i = 0; i < MIXED_BASE_SAMPLES; i++)
+    {
+        const uint64_t t0 = bench_rdtscp();
+        x = scalar_work(x);
+        s[i] = bench_rdtscp() - t0;
+    }
+    g_sink = x;
+
+    return bench_quantile(s, MIXED_BASE_SAMPLES, 0.5);
+}
+
+// Run the mixed loop for opt->duration_ms, and append the latencies of the
+// iterations and of the scalar workload within them.
+static int mixed_loop(IN const bench_options_t *opt,
+                      IN OUT CTR_DRBG_STATE *drbg,
+                      IN OUT uint8_t *out,
+                      IN OUT uint64_t *iter,
+                      IN OUT uint64_t *scalar,
+                      IN OUT mixed_result_t *res)
+{
+    uint64_t x = 1;
+    size_t n = 0;
+    int ok = 1;
+
+    const uint64_t start = bench_now_ns();
+    const uint64_t end = start + opt->duration_ms * 1000000ULL;
+    uint64_t now = start;
+
+    while (ok && (now < end) && (n < MIXED_MAX_SAMPLES))
+    {
+        const uint64_t t0 = bench_rdtscp();
+        ok = CTR_DRBG_generate(drbg, out, opt->mixed, NULL, 0);
+        const uint64_t t1 = bench_rdtscp();
+        x = scalar_work(x);
+        const uint64_t t2 = bench_rdtscp();
+
+        iter[n] = t2 - t0;
+        scalar[n] = t2 - t1;
+        n++;
+
+        if (0 == n % 64)
+        {
+            now = bench_now_ns();
+        }
+    }
+    now = bench_now_ns();
+    g_sink = x;
+
+    if (!ok)
+    {
+        return 0;
+    }
+
+    res->iters_per_sec = 1e9 * n / (double)(now - start);
+    res->gbps = (double)n * opt->mixed / (double)(now - start);
+    res->scalar_mixed = bench_quantile(scalar, n, 0.5);
+
+    bench_result_t *r = bench_new_result("mixed_scalar", res->impl,
+                                         opt->mixed);
+    if (NULL != r)
+    {
+        r->batch = 1;
+        r->count = n;
+        r->median = res->scalar_mixed;
+        r->p99 = bench_quantile(scalar, n, 0.99);
+        r->p999 = bench_quantile(scalar, n, 0.999);
+    }
+
+    r = bench_new_result("mixed_iter", res->impl, opt->mixed);
+    if (NULL != r)
+    {
+        r->batch = 1;
+        r->count = n;
+        r->median = bench_quantile(iter, n, 0.5);
+        r->p99 = bench_quantile(iter, n, 0.99);
+        r->p999 = bench_quantile(iter, n, 0.999);
+    }
+
+    return 1;
+}
+
+// Generate MIXED_BURST_LEN byte requests for MIXED_BURST_MS, then run the
+// scalar workload back to back for MIXED_RECOVERY_MS, and return the time
+// from the end of the burst to the first of MIXED_STABLE_CHUNKS chunks in
+// a row within MIXED_RECOVERED of base.
+static int recovery(IN OUT CTR_DRBG_STATE *drbg,
+                    IN OUT uint8_t *out,
+                    IN OUT uint64_t *ends,
+                    IN const double base,
+                    OUT double *recovery_us)
+{
+    uint64_t x = 1;
+    uint32_t n = 0;
+    uint32_t stable = 0;
+    uint32_t first_stable = 0;
+    int ok = 1;
+
+    const uint64_t burst_end = bench_now_ns() + MIXED_BURST_MS * 1000000ULL;
+    while (ok && (bench_now_ns() < burst_end))
+    {
+        ok = CTR_DRBG_generate(drbg, out, MIXED_BURST_LEN, NULL, 0);
+    }
+    if (!ok)
+    {
+        return 0;
+    }
+
+    // ends[] holds the TSC at the end of every chunk, relative to the end of
+    // the burst; the TSC rate comes from the monotonic clock over the window.
+    const uint64_t ns0 = bench_now_ns();
+    const uint64_t tsc0 = bench_rdtscp();
+    const uint64_t end = ns0 + MIXED_RECOVERY_MS * 1000000ULL;
+    uint64_t prev = tsc0;
+
+    while ((stable < MIXED_STABLE_CHUNKS) && (n < MIXED_MAX_SAMPLES))
+    {
+        x = scalar_work(x);
+        const uint64_t t = bench_rdtscp();
+
+        if ((double)(t - prev) <= MIXED_RECOVERED * base)
+        {
+            first_stable = (0 == stable) ? n : first_stable;
+            stable++;
+        }
+        else
+        {
+            stable = 0;
+        }
+        ends[n++] = t - tsc0;
+        prev = t;
+
+        if ((0 == n % 64) && (bench_now_ns() >= end))
+        {
+            break;
+        }
+    }
+    const double tsc_per_ns = (double)(bench_rdtscp() - tsc0) /
+                              (double)(bench_now_ns() - ns0);
+    g_sink = x;
+
+    if (stable < MIXED_STABLE_CHUNKS)
+    {
+        *recovery_us = -1;
+    }
+    else
+    {
+        // The start of the first stable chunk.
+        *recovery_us = (0 == first_stable) ? 0 :
+                       ends[first_stable - 1] / tsc_per_ns / 1000;
+    }
+
+    return 1;
+}
+
+int bench_mixed(IN const bench_options_t *opt)
+{
+    uint8_t entropy[CTR_DRBG_ENTROPY_LEN];
+    CTR_DRBG_STATE drbg;
+    int ok = 1;
+
+    if (opt->mixed > CTR_DRBG_MAX_GENERATE_LENGTH)
+    {
+        printf("ERROR: --mixed is at most %u bytes\n",
+               CTR_DRBG_MAX_GENERATE_LENGTH);
+        return ERROR;
+    }
+
+    uint8_t *out = (uint8_t *)malloc(CTR_DRBG_MAX_GENERATE_LENGTH);
+    uint64_t *iter = (uint64_t *)malloc(MIXED_MAX_SAMPLES * sizeof(uint64_t));
+    uint64_t *scalar = (uint64_t *)malloc(MIXED_MAX_SAMPLES *
+                                          sizeof(uint64_t));
+    if ((NULL == out) || (NULL == iter) || (NULL == scalar))
+    {
+        free(out);
+        free(iter);
+        free(scalar);
+        return ERROR;
+    }
+
+    for (uint32_t i = 0; i < sizeof(entropy); i++)
+    {
+        entropy[i] = (uint8_t)(3 * i + 5);
+    }
+
+    for (uint32_t id = 0; ok && (id < AES_IMPL_COUNT); id++)
+    {
+        const aes_impl_t *impl = aes_impl_get((aes_impl_id_t)id, opt->key_size);
+        if ((NULL == impl) ||
+            ((NULL != opt->impl) && (0 != strcmp(opt->impl, impl->name))))
+        {
+            continue;
+        }
+
+        mixed_result_t *res = &g_mixed[g_num_mixed];
+        res->impl = impl->name;
+        res->bytes = opt->mixed;
+
+        ok = CTR_DRBG_init_key_size(&drbg, opt->key_size, entropy, NULL, 0);
+        if (ok)
+        {
+            CTR_DRBG_set_impl(&drbg, impl);
+            res->scalar_base = scalar_base(scalar);
+            ok = mixed_loop(opt, &drbg, out, iter, scalar, res) &&
+                 recovery(&drbg, out, iter, res->scalar_base,
+                          &res->recovery_us);
+            CTR_DRBG_clear(&drbg);
+        }
+        if (!ok)
+        {
+            printf("ERROR: the mixed loop of %s failed\n", impl->name);
+            break;
+        }
+        g_num_mixed++;
+
+        printf("%-8s %6u B: %8.3f M iterations/s, %7.3f GB/s, scalar work "
+               "%.0f -> %.0f cycles (%+.1f%%), ", res->impl, res->bytes,
+               res->iters_per_sec / 1e6, res->gbps, res->scalar_base,
+               res->scalar_mixed,
+               100 * (res->scalar_mixed / res->scalar_base - 1));
+        if (res->recovery_us < 0)
+        {
+            printf("no recovery within %u ms\n", MIXED_RECOVERY_MS);
+        }
+        else
+        {
+            printf("recovery %.0f us\n", res->recovery_us);
+        }
+    }
+
+    free(out);
+    free(iter);
+    free(scalar);
+
+    return ok ? SUCCESS : ERROR;
+}
+
+void bench_mixed_json(IN FILE *f)
+{
+    if (0 == g_num_mixed)
+    {
+        return;
+    }
+
+    fprintf(f, ",\n  \"mixed\": [\n");
+    for (uint32_t i = 0; i < g_num_mixed; i++)
+    {
+        const mixed_result_t *r = &g_mixed[i];
+
+        fprintf(f, "    {\"impl\": \"%s\", \"bytes\": %u", r->impl, r->bytes);
+        bench_json_number(f, "iterations_per_sec", r->iters_per_sec);
+        bench_json_number(f, "gbps", r->gbps);
+        bench_json_number(f, "scalar_cycles_base", r->scalar_base);
+        bench_json_number(f, "scalar_cycles_mixed", r->scalar_mixed);
+        bench_json_number(f, "recovery_us", r->recovery_us);
+        fprintf(f, "}%s\n", (i + 1 < g_num_mixed) ? "," : "");
+    }
+    fprintf(f, "  ]");
+}
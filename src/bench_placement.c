@@ -0,0 +1,254 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+// The output placement mode of the benchmark. A cache sensitive workload, a
+// dependent random walk over the cache lines of PLACEMENT_WALK_LEN bytes,
+// alternates with fills of opt->placement bytes by CTR_DRBG_generate_stream,
+// for opt->duration_ms with each placement (see CTR_DRBG_set_placement).
+// For every implementation it reports:
+//
+// - The fill throughput with each placement.
+// - The TSC cycles of a walk after a fill with each placement, relative to
+//   the walk alone (back to back). Fills with regular stores evict the lines
+//   of the walk from the caches the two do not fit in together;
+//   non-temporal stores should leave them there.
+//
+// Running it with a few fill sizes shows the crossover (stream_min_len) of
+// this CPU: the smallest fill that is as fast with non-temporal stores, or
+// that slows the walk down with regular stores.
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "ctr_drbg.h"
+
+// Fits in the L2 cache of current server cores.
+#define PLACEMENT_WALK_LEN (256 * 1024)
+#define PLACEMENT_LINE 64
+#define PLACEMENT_WALK_LINES (PLACEMENT_WALK_LEN / PLACEMENT_LINE)
+#define PLACEMENT_WALK_SAMPLES 1001
+#define PLACEMENT_MAX_SAMPLES (1U << 16)
+
+// Keeps the result of the walk alive.
+static volatile uint32_t g_sink;
+
+// Link the lines of walk into a single random cycle (Sattolo's algorithm):
+// the first word of every line holds the index of the next one, so the
+// loads of a walk depend on each other and defeat the prefetchers.
+static void build_walk(OUT uint32_t *walk)
+{
+    const uint32_t stride = PLACEMENT_LINE / sizeof(uint32_t);
+    uint32_t *perm = (uint32_t *)walk;
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+
+    // The permutation is built in the second words, which are unused.
+    for (uint32_t i = 0; i < PLACEMENT_WALK_LINES; i++)
+    {
+        perm[stride * i + 1] = i;
+    }
+    for (uint32_t i = PLACEMENT_WALK_LINES - 1; i > 0; i--)
+    {
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        const uint32_t j = (uint32_t)((x * 0x2545F4914F6CDD1DULL) >> 33) % i;
+        const uint32_t t = perm[stride * i + 1];
+        perm[stride * i + 1] = perm[stride * j + 1];
+        perm[stride * j + 1] = t;
+    }
+    for (uint32_t i = 0; i < PLACEMENT_WALK_LINES; i++)
+    {
+        const uint32_t from = perm[stride * i + 1];
+        const uint32_t to = perm[stride * ((i + 1) % PLACEMENT_WALK_LINES) + 1];
+        walk[stride * from] = to;
+    }
+}
+
+// The TSC cycles of one walk over all the lines.
+static uint64_t run_walk(IN const uint32_t *walk)
+{
+    const uint32_t stride = PLACEMENT_LINE / sizeof(uint32_t);
+    uint32_t i = 0;
+
+    const uint64_t t0 = bench_rdtscp();
+    for (uint32_t n = 0; n < PLACEMENT_WALK_LINES; n++)
+    {
+        i = walk[stride * i];
+    }
+    const uint64_t t1 = bench_rdtscp();
+    g_sink = i;
+
+    return t1 - t0;
+}
+
+_INLINE_ void add_result(IN const char *name,
+                         IN const char *impl,
+                         IN const uint32_t bytes,
+                         IN OUT uint64_t *s,
+                         IN const size_t n)
+{
+    bench_result_t *r = bench_new_result(name, impl, bytes);
+    if (NULL != r)
+    {
+        r->batch = 1;
+        r->count = n;
+        r->median = bench_quantile(s, n, 0.5);
+        r->p99 = bench_quantile(s, n, 0.99);
+        r->p999 = bench_quantile(s, n, 0.999);
+    }
+}
+
+// Alternate fills of out with placement and walks for opt->duration_ms. It
+// returns the median TSC cycles of the fills and of the walks.
+static int fill_loop(IN const bench_options_t *opt,
+                     IN OUT CTR_DRBG_STATE *drbg,
+                     IN const ctr_drbg_placement_t placement,
+                     IN OUT uint8_t *out,
+                     IN const uint32_t *walk,
+                     IN OUT uint64_t *fill,
+                     IN OUT uint64_t *walks,
+                     OUT double *fill_median,
+                     OUT double *walk_median)
+{
+    static const char *const fill_names[] = {"placement_fill_cache",
+                                             "placement_fill_stream"};
+    static const char *const walk_names[] = {"placement_walk_cache",
+                                             "placement_walk_stream"};
+    size_t n = 0;
+    int ok = 1;
+
+    // The policy applies to fills of any length.
+    CTR_DRBG_set_placement(drbg, placement, 1);
+
+    const uint64_t end = bench_now_ns() + opt->duration_ms * 1000000ULL;
+    while (ok && (n < PLACEMENT_MAX_SAMPLES) &&
+           ((n < 3) || (bench_now_ns() < end)))
+    {
+        run_walk(walk);
+
+        const uint64_t t0 = bench_rdtscp();
+        ok = CTR_DRBG_generate_stream(drbg, out, opt->placement, NULL, 0);
+        fill[n] = bench_rdtscp() - t0;
+        walks[n] = run_walk(walk);
+        n++;
+    }
+    if (!ok)
+    {
+        return 0;
+    }
+
+    *fill_median = bench_quantile(fill, n, 0.5);
+    *walk_median = bench_quantile(walks, n, 0.5);
+    add_result(fill_names[placement], drbg->impl->name, opt->placement,
+               fill, n);
+    add_result(walk_names[placement], drbg->impl->name, PLACEMENT_WALK_LEN,
+               walks, n);
+
+    return 1;
+}
+
+int bench_placement(IN const bench_options_t *opt)
+{
+    uint8_t entropy[CTR_DRBG_ENTROPY_LEN];
+    CTR_DRBG_STATE drbg;
+    int ok = 1;
+
+    uint8_t *out = (uint8_t *)aligned_alloc(PLACEMENT_LINE,
+        (opt->placement + PLACEMENT_LINE - 1) / PLACEMENT_LINE * PLACEMENT_LINE);
+    uint32_t *walk = (uint32_t *)aligned_alloc(PLACEMENT_LINE,
+                                               PLACEMENT_WALK_LEN);
+    uint64_t *fill = (uint64_t *)malloc(PLACEMENT_MAX_SAMPLES *
+                                        sizeof(uint64_t));
+    uint64_t *walks = (uint64_t *)malloc(PLACEMENT_MAX_SAMPLES *
+                                         sizeof(uint64_t));
+    if ((NULL == out) || (NULL == walk) || (NULL == fill) || (NULL == walks))
+    {
+        free(out);
+        free(walk);
+        free(fill);
+        free(walks);
+        return ERROR;
+    }
+
+    // Touch the whole output once, so that the fills do not page fault.
+    memset(out, 0, opt->placement);
+    build_walk(walk);
+
+    for (uint32_t i = 0; i < sizeof(entropy); i++)
+    {
+        entropy[i] = (uint8_t)(3 * i + 5);
+    }
+
+    // The walk alone, back to back, is the baseline.
+    run_walk(walk);
+    for (uint32_t i = 0; i < PLACEMENT_WALK_SAMPLES; i++)
+    {
+        walks[i] = run_walk(walk);
+    }
+    const double alone = bench_quantile(walks, PLACEMENT_WALK_SAMPLES, 0.5);
+    add_result("placement_walk_alone", "none", PLACEMENT_WALK_LEN, walks,
+               PLACEMENT_WALK_SAMPLES);
+
+    for (uint32_t id = 0; ok && (id < AES_IMPL_COUNT); id++)
+    {
+        const aes_impl_t *impl = aes_impl_get((aes_impl_id_t)id, opt->key_size);
+        double fill_cycles[2];
+        double walk_cycles[2];
+
+        if ((NULL == impl) ||
+            ((NULL != opt->impl) && (0 != strcmp(opt->impl, impl->name))))
+        {
+            continue;
+        }
+
+        ok = CTR_DRBG_init_key_size(&drbg, opt->key_size, entropy, NULL, 0);
+        if (ok)
+        {
+            CTR_DRBG_set_impl(&drbg, impl);
+            ok = fill_loop(opt, &drbg, CTR_DRBG_PLACEMENT_CACHE, out, walk,
+                           fill, walks, &fill_cycles[0], &walk_cycles[0]) &&
+                 fill_loop(opt, &drbg, CTR_DRBG_PLACEMENT_STREAM, out, walk,
+                           fill, walks, &fill_cycles[1], &walk_cycles[1]);
+            CTR_DRBG_clear(&drbg);
+        }
+        if (!ok)
+        {
+            printf("ERROR: the fill loop of %s failed\n", impl->name);
+            break;
+        }
+
+        printf("%-8s %9u B fills: cache %.3f / stream %.3f cycles per byte, "
+               "walk %.0f -> %.0f (cache, %+.1f%%) / %.0f (stream, %+.1f%%) "
+               "cycles\n", impl->name, opt->placement,
+               fill_cycles[0] / opt->placement,
+               fill_cycles[1] / opt->placement, alone, walk_cycles[0],
+               100 * (walk_cycles[0] / alone - 1), walk_cycles[1],
+               100 * (walk_cycles[1] / alone - 1));
+    }
+
+    free(out);
+    free(walk);
+    free(fill);
+    free(walks);
+
+    return ok ? SUCCESS : ERROR;
+}
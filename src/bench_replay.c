@@ -0,0 +1,462 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+// The trace replay mode of the benchmark. It replays a sequence of DRBG
+// operations on one instance, times every operation with rdtscp, and
+// reports the p50, p99 and p99.9 latency of each operation and request
+// size. A trace is either built in, or read from a file with one operation
+// per line:
+//
+//   init                       CTR_DRBG_init_key_size
+//   reseed                     CTR_DRBG_reseed
+//   update                     CTR_DRBG_generate of 0 bytes (the update only)
+//   generate LEN [AD_LEN]      CTR_DRBG_generate of LEN bytes, with AD_LEN
+//                              bytes of additional data
+//
+// Empty lines and lines that start with # are ignored.
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "ctr_drbg.h"
+
+// Traces are replayed until at least this many operations were timed,
+// unless --repeat says otherwise; enough for 100 samples above the p99.9 of
+// an operation that makes up all the trace.
+#define REPLAY_DEFAULT_OPS 100000
+#define REPLAY_WARMUP_OPS 1000
+#define REPLAY_OVERHEAD_SAMPLES 1001
+#define REPLAY_MAX_GROUPS 64
+#define REPLAY_LINE_LEN 256
+
+typedef enum
+{
+    OP_INIT=0,
+    OP_RESEED,
+    OP_UPDATE,
+    OP_GENERATE,
+    OP_COUNT
+} replay_op_kind_t;
+
+static const char *const g_op_names[OP_COUNT] = {
+    "init",
+    "reseed",
+    "update",
+    "generate",
+};
+
+typedef struct replay_op_s {
+    replay_op_kind_t kind;
+    uint32_t len;
+    uint32_t ad_len;
+    // The index of the (kind, len) group of the operation.
+    uint32_t group;
+} replay_op_t;
+
+typedef struct trace_s {
+    replay_op_t *ops;
+    size_t n;
+    size_t cap;
+} trace_t;
+
+// The latencies of all the operations of one kind and length.
+typedef struct replay_group_s {
+    replay_op_kind_t kind;
+    uint32_t len;
+    uint64_t *cycles;
+    size_t n;
+    size_t cap;
+} replay_group_t;
+
+static int trace_push(IN OUT trace_t *t,
+                      IN const replay_op_kind_t kind,
+                      IN const uint32_t len,
+                      IN const uint32_t ad_len)
+{
+    if (t->n == t->cap)
+    {
+        const size_t cap = (0 == t->cap) ? 1024 : 2 * t->cap;
+        replay_op_t *ops = (replay_op_t *)realloc(t->ops,
+                                                  cap * sizeof(*ops));
+        if (NULL == ops)
+        {
+            return 0;
+        }
+        t->ops = ops;
+        t->cap = cap;
+    }
+
+    t->ops[t->n].kind = kind;
+    t->ops[t->n].len = len;
+    t->ops[t->n].ad_len = ad_len;
+    t->n++;
+
+    return 1;
+}
+
+// ML-KEM (Kyber) key generation draws the 32 byte seeds d and z, and
+// encapsulation the 32 byte message m. A reseed every 256 rounds.
+static int build_kyber(IN OUT trace_t *t)
+{
+    int ok = 1;
+
+    for (uint32_t i = 0; ok && (t->n < REPLAY_DEFAULT_OPS); i++)
+    {
+        ok = trace_push(t, OP_GENERATE, 32, 0) &&
+             trace_push(t, OP_GENERATE, 32, 0) &&
+             trace_push(t, OP_GENERATE, 32, 0) &&
+             ((0 != (i + 1) % 256) || trace_push(t, OP_RESEED, 0, 0));
+    }
+
+    return ok;
+}
+
+// ML-DSA (Dilithium) key generation draws the 32 byte seed xi, and hedged
+// signing the 32 byte rnd (64 bytes in the round 3 submission). A reseed
+// every 256 rounds.
+static int build_dilithium(IN OUT trace_t *t)
+{
+    int ok = 1;
+
+    for (uint32_t i = 0; ok && (t->n < REPLAY_DEFAULT_OPS); i++)
+    {
+        ok = trace_push(t, OP_GENERATE, 32, 0) &&
+             trace_push(t, OP_GENERATE, (0 == i % 2) ? 32 : 64, 0) &&
+             ((0 != (i + 1) % 256) || trace_push(t, OP_RESEED, 0, 0));
+    }
+
+    return ok;
+}
+
+// TLS handshakes: a 32 byte random, a 48 byte (P-384) ephemeral key and a 64
+// byte hybrid key share seed, with additional data on the latter. Every 8th
+// handshake also takes 2 KiB, every 32nd 16 KiB (e.g., padding, tickets). A
+// reseed every 128 handshakes, and a new instance every 1024.
+static int build_tls(IN OUT trace_t *t)
+{
+    int ok = 1;
+
+    for (uint32_t i = 0; ok && (t->n < REPLAY_DEFAULT_OPS); i++)
+    {
+        ok = ((0 != i % 1024) || trace_push(t, OP_INIT, 0, 0)) &&
+             trace_push(t, OP_GENERATE, 32, 0) &&
+             trace_push(t, OP_GENERATE, 48, 0) &&
+             trace_push(t, OP_GENERATE, 64, 32) &&
+             ((0 != i % 8) || trace_push(t, OP_GENERATE, 2048, 0)) &&
+             ((0 != i % 32) || trace_push(t, OP_GENERATE, 16384, 0)) &&
+             ((0 != (i + 1) % 128) || trace_push(t, OP_RESEED, 0, 0));
+    }
+
+    return ok;
+}
+
+static int load_trace(IN OUT trace_t *t, IN const char *path)
+{
+    char line[REPLAY_LINE_LEN];
+    uint32_t line_num = 0;
+
+    FILE *f = fopen(path, "r");
+    if (NULL == f)
+    {
+        printf("ERROR: cannot read %s\n", path);
+        return 0;
+    }
+
+    while (NULL != fgets(line, sizeof(line), f))
+    {
+        char op[16];
+        unsigned long len = 0;
+        unsigned long ad_len = 0;
+        uint32_t kind = OP_COUNT;
+
+        line_num++;
+        const int fields = sscanf(line, "%15s %lu %lu", op, &len, &ad_len);
+        if ((fields < 1) || ('#' == op[0]))
+        {
+            continue;
+        }
+
+        for (uint32_t k = 0; k < OP_COUNT; k++)
+        {
+            if (0 == strcmp(op, g_op_names[k]))
+            {
+                kind = k;
+            }
+        }
+
+        if ((OP_COUNT == kind) ||
+            ((OP_GENERATE == kind) &&
+             ((fields < 2) || (len > CTR_DRBG_MAX_GENERATE_LENGTH) ||
+              (ad_len > CTR_DRBG_ENTROPY_LEN))) ||
+            !trace_push(t, (replay_op_kind_t)kind, (uint32_t)len,
+                        (uint32_t)ad_len))
+        {
+            printf("ERROR: %s:%u: bad operation\n", path, line_num);
+            fclose(f);
+            return 0;
+        }
+    }
+    fclose(f);
+
+    return 1;
+}
+
+// Assign every operation of t to a group, and allocate the latency arrays
+// for repeat replays. The additional input of the generate calls is capped
+// at seed_len, the most the instance accepts without the derivation
+// function. It returns the number of groups, or 0 on error.
+static uint32_t make_groups(IN OUT trace_t *t,
+                            OUT replay_group_t groups[REPLAY_MAX_GROUPS],
+                            IN const uint32_t repeat,
+                            IN const uint32_t seed_len)
+{
+    uint32_t num_groups = 0;
+
+    for (size_t i = 0; i < t->n; i++)
+    {
+        replay_op_t *op = &t->ops[i];
+        uint32_t g = 0;
+
+        if (op->ad_len > seed_len)
+        {
+            op->ad_len = seed_len;
+        }
+
+        while ((g < num_groups) &&
+               ((groups[g].kind != op->kind) || (groups[g].len != op->len)))
+        {
+            g++;
+        }
+
+        if (g == num_groups)
+        {
+            if (REPLAY_MAX_GROUPS == num_groups)
+            {
+                printf("ERROR: more than %u operation sizes\n",
+                       REPLAY_MAX_GROUPS);
+                return 0;
+            }
+            memset(&groups[g], 0, sizeof(groups[g]));
+            groups[g].kind = op->kind;
+            groups[g].len = op->len;
+            num_groups++;
+        }
+
+        op->group = g;
+        groups[g].cap += repeat;
+    }
+
+    for (uint32_t g = 0; g < num_groups; g++)
+    {
+        groups[g].cycles = (uint64_t *)malloc(groups[g].cap * sizeof(uint64_t));
+        if (NULL == groups[g].cycles)
+        {
+            while (g > 0)
+            {
+                free(groups[--g].cycles);
+            }
+            return 0;
+        }
+    }
+
+    return num_groups;
+}
+
+// The median cost of an empty pair of rdtscp reads, subtracted from the
+// latencies.
+static uint64_t rdtscp_overhead(void)
+{
+    uint64_t s[REPLAY_OVERHEAD_SAMPLES];
+
+    for (uint32_t i = 0; i < REPLAY_OVERHEAD_SAMPLES; i++)
+    {
+        const uint64_t t0 = bench_rdtscp();
+        s[i] = bench_rdtscp() - t0;
+    }
+
+    return (uint64_t)bench_quantile(s, REPLAY_OVERHEAD_SAMPLES, 0.5);
+}
+
+typedef struct replay_ctx_s {
+    CTR_DRBG_STATE drbg;
+    const aes_impl_t *impl;
+    aes_key_size_t key_size;
+    uint8_t entropy[CTR_DRBG_ENTROPY_LEN];
+    uint8_t ad[CTR_DRBG_ENTROPY_LEN];
+    ALIGN(64) uint8_t out[CTR_DRBG_MAX_GENERATE_LENGTH];
+} replay_ctx_t;
+
+_INLINE_ int run_op(IN OUT replay_ctx_t *ctx, IN const replay_op_t *op)
+{
+    switch (op->kind)
+    {
+    case OP_INIT:
+        if (!CTR_DRBG_init_key_size(&ctx->drbg, ctx->key_size, ctx->entropy,
+                                    NULL, 0))
+        {
+            return 0;
+        }
+        if (ctx->impl != ctx->drbg.impl)
+        {
+            CTR_DRBG_set_impl(&ctx->drbg, ctx->impl);
+        }
+        return 1;
+    case OP_RESEED:
+        return CTR_DRBG_reseed(&ctx->drbg, ctx->entropy, NULL, 0);
+    case OP_UPDATE:
+        return CTR_DRBG_generate(&ctx->drbg, ctx->out, 0, NULL, 0);
+    default:
+        return CTR_DRBG_generate(&ctx->drbg, ctx->out, op->len, ctx->ad,
+                                 op->ad_len);
+    }
+}
+
+static int replay(IN const bench_options_t *opt,
+                  IN OUT replay_ctx_t *ctx,
+                  IN OUT trace_t *t,
+                  IN const char *trace_name)
+{
+    replay_group_t groups[REPLAY_MAX_GROUPS];
+    uint32_t repeat = opt->repeat;
+    int ok = 1;
+
+    if (0 == repeat)
+    {
+        repeat = (uint32_t)((REPLAY_DEFAULT_OPS + t->n - 1) / t->n);
+    }
+
+    const uint32_t num_groups =
+        make_groups(t, groups, repeat, (uint32_t)CTR_DRBG_seed_len(&ctx->drbg));
+    ok = (0 != num_groups);
+
+    for (size_t i = 0; ok && (i < REPLAY_WARMUP_OPS) && (i < t->n); i++)
+    {
+        ok = run_op(ctx, &t->ops[i]);
+    }
+
+    const uint64_t overhead = rdtscp_overhead();
+
+    for (uint32_t r = 0; ok && (r < repeat); r++)
+    {
+        for (size_t i = 0; ok && (i < t->n); i++)
+        {
+            const replay_op_t *op = &t->ops[i];
+
+            const uint64_t t0 = bench_rdtscp();
+            ok = run_op(ctx, op);
+            const uint64_t cycles = bench_rdtscp() - t0;
+
+            replay_group_t *g = &groups[op->group];
+            g->cycles[g->n++] = (cycles > overhead) ? cycles - overhead : 0;
+        }
+    }
+
+    if (!ok)
+    {
+        printf("ERROR: the replay of %s failed\n", trace_name);
+    }
+
+    printf("Replayed %lu operations of %s (%s AES-%u) %u times, rdtscp "
+           "overhead of %lu cycles subtracted.\n", (unsigned long)t->n,
+           trace_name, ctx->impl->name, 8 * ctx->impl->key_len, repeat,
+           (unsigned long)overhead);
+
+    for (uint32_t g = 0; g < num_groups; g++)
+    {
+        char name[BENCH_NAME_LEN];
+        bench_result_t *res;
+
+        snprintf(name, sizeof(name), "%s:%s", trace_name,
+                 g_op_names[groups[g].kind]);
+        if (ok && (NULL != (res = bench_new_result(name, ctx->impl->name,
+                                                   groups[g].len))))
+        {
+            res->batch = 1;
+            res->count = groups[g].n;
+            res->median = bench_quantile(groups[g].cycles, groups[g].n, 0.5);
+            res->p99 = bench_quantile(groups[g].cycles, groups[g].n, 0.99);
+            res->p999 = bench_quantile(groups[g].cycles, groups[g].n, 0.999);
+        }
+        free(groups[g].cycles);
+    }
+
+    return ok;
+}
+
+int bench_replay(IN const bench_options_t *opt)
+{
+    trace_t t = {NULL, 0, 0};
+    const char *trace_name = opt->trace;
+    int ok;
+
+    if (0 == strcmp(opt->trace, "kyber"))
+    {
+        ok = build_kyber(&t);
+    }
+    else if (0 == strcmp(opt->trace, "dilithium"))
+    {
+        ok = build_dilithium(&t);
+    }
+    else if (0 == strcmp(opt->trace, "tls"))
+    {
+        ok = build_tls(&t);
+    }
+    else
+    {
+        const char *slash = strrchr(opt->trace, '/');
+        trace_name = (NULL != slash) ? slash + 1 : opt->trace;
+        ok = load_trace(&t, opt->trace);
+    }
+
+    if (!ok || (0 == t.n))
+    {
+        printf("ERROR: no trace to replay\n");
+        free(t.ops);
+        return ERROR;
+    }
+
+    replay_ctx_t *ctx = (replay_ctx_t *)malloc(sizeof(replay_ctx_t));
+    if (NULL == ctx)
+    {
+        free(t.ops);
+        return ERROR;
+    }
+
+    ctx->key_size = opt->key_size;
+    ctx->impl = (NULL != opt->impl) ? aes_impl_by_name(opt->impl,
+                                                       opt->key_size) :
+                                      aes_impl_default(opt->key_size);
+    for (uint32_t i = 0; i < sizeof(ctx->entropy); i++)
+    {
+        ctx->entropy[i] = (uint8_t)(3 * i + 5);
+        ctx->ad[i] = (uint8_t)(7 * i + 2);
+    }
+
+    const replay_op_t init = {OP_INIT, 0, 0, 0};
+    ok = run_op(ctx, &init) && replay(opt, ctx, &t, trace_name);
+
+    CTR_DRBG_clear(&ctx->drbg);
+    free(ctx);
+    free(t.ops);
+
+    return ok ? SUCCESS : ERROR;
+}
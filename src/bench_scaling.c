@@ -0,0 +1,335 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+// The scaling mode of the benchmark. For 1, 2, 4, ... up to opt->threads
+// threads, each pinned to its own CPU (from opt->cpu, or 0, on) and with
+// its own CTR_DRBG_STATE, every thread generates requests of one size into
+// its own output buffer, front to back, for opt->duration_ms. It reports
+// the aggregate throughput and the efficiency per thread, the throughput
+// relative to threads times the single thread throughput of the same
+// configuration.
+//
+// The buffer size sweep shows where the output stops fitting in the caches:
+// for every thread count and request size, the crossover is the smallest
+// buffer whose throughput is below SCALING_MEMORY_BOUND of the throughput
+// with the smallest buffer. From there on, the writes to memory, not AES,
+// limit the throughput.
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "ctr_drbg.h"
+
+#define SCALING_MAX_THREADS 256
+#define SCALING_MEMORY_BOUND 0.9
+#define CACHE_LINE_SIZE 64
+
+static const uint32_t g_req_sizes[] = {256, 4096, 65536};
+// Per thread: within L2, within a share of L3, and beyond.
+static const size_t g_buf_sizes[] = {64 << 10, 512 << 10, 4 << 20, 32 << 20};
+
+#define NUM_REQ_SIZES (sizeof(g_req_sizes) / sizeof(g_req_sizes[0]))
+#define NUM_BUF_SIZES (sizeof(g_buf_sizes) / sizeof(g_buf_sizes[0]))
+
+typedef struct scaling_result_s {
+    uint32_t threads;
+    uint32_t req;
+    size_t buf;
+    // Aggregate, in GB/s (10^9 bytes per second).
+    double gbps;
+    double efficiency;
+} scaling_result_t;
+
+typedef struct scaling_thread_s {
+    pthread_t thread;
+    int cpu;
+    uint32_t id;
+    const aes_impl_t *impl;
+    aes_key_size_t key_size;
+    uint32_t req;
+    size_t buf_size;
+    pthread_mutex_t *gate;
+    pthread_barrier_t *start;
+    const int *stop;
+    uint64_t bytes;
+    int pinned;
+    int ok;
+} ALIGN(CACHE_LINE_SIZE) scaling_thread_t;
+
+// At most log2(SCALING_MAX_THREADS) + 2 thread counts.
+#define MAX_SCALING_RESULTS (10 * NUM_REQ_SIZES * NUM_BUF_SIZES)
+
+static scaling_result_t g_scaling[MAX_SCALING_RESULTS];
+static uint32_t g_num_scaling = 0;
+static int g_pin_warned = 0;
+
+static void *scaling_thread_main(void *arg)
+{
+    scaling_thread_t *t = (scaling_thread_t *)arg;
+    uint8_t entropy[CTR_DRBG_ENTROPY_LEN] = {0};
+    CTR_DRBG_STATE drbg;
+    size_t pos = 0;
+
+    t->pinned = (t->cpu < 0) || bench_pin(t->cpu);
+
+    // The buffer is allocated and touched by its thread, so that its pages
+    // are local to the thread's node and faulted in before the start.
+    uint8_t *buf = (uint8_t *)malloc(t->buf_size);
+    memcpy(entropy, &t->id, sizeof(t->id));
+    t->ok = (NULL != buf) &&
+            CTR_DRBG_init_key_size(&drbg, t->key_size, entropy, NULL, 0);
+    if (t->ok)
+    {
+        CTR_DRBG_set_impl(&drbg, t->impl);
+        memset(buf, 0, t->buf_size);
+    }
+
+    // Wait until run_config has created all the threads (and the barrier).
+    pthread_mutex_lock(t->gate);
+    pthread_mutex_unlock(t->gate);
+    pthread_barrier_wait(t->start);
+
+    while (t->ok && !__atomic_load_n(t->stop, __ATOMIC_RELAXED))
+    {
+        if (pos + t->req > t->buf_size)
+        {
+            pos = 0;
+        }
+        t->ok = CTR_DRBG_generate(&drbg, &buf[pos], t->req, NULL, 0);
+        pos += t->req;
+        t->bytes += t->req;
+    }
+
+    CTR_DRBG_clear(&drbg);
+    free(buf);
+
+    return NULL;
+}
+
+// Run one configuration, and return the aggregate throughput in GB/s, or a
+// negative value on error.
+static double run_config(IN const bench_options_t *opt,
+                         IN const aes_impl_t *impl,
+                         IN OUT scaling_thread_t *threads,
+                         IN const uint32_t num_threads,
+                         IN const uint32_t req,
+                         IN const size_t buf_size)
+{
+    pthread_mutex_t gate = PTHREAD_MUTEX_INITIALIZER;
+    pthread_barrier_t start;
+    int stop = 0;
+    int ok = 1;
+    uint32_t started = 0;
+    const int first_cpu = (opt->cpu >= 0) ? opt->cpu : 0;
+
+    // The barrier is sized once the threads exist, so that the threads that
+    // were started can still be released when pthread_create fails.
+    pthread_mutex_lock(&gate);
+
+    for (; started < num_threads; started++)
+    {
+        scaling_thread_t *t = &threads[started];
+
+        memset(t, 0, sizeof(*t));
+        t->cpu = first_cpu + (int)started;
+        t->id = started;
+        t->impl = impl;
+        t->key_size = opt->key_size;
+        t->req = req;
+        t->buf_size = buf_size;
+        t->gate = &gate;
+        t->start = &start;
+        t->stop = &stop;
+
+        if (0 != pthread_create(&t->thread, NULL, scaling_thread_main, t))
+        {
+            break;
+        }
+    }
+
+    // Release the threads that were started and stop them at once.
+    if (started != num_threads)
+    {
+        printf("ERROR: pthread_create failed\n");
+        stop = 1;
+        ok = 0;
+    }
+
+    pthread_barrier_init(&start, NULL, started + 1);
+    pthread_mutex_unlock(&gate);
+    pthread_barrier_wait(&start);
+    const uint64_t t0 = bench_now_ns();
+
+    const struct timespec ts = {(time_t)(opt->duration_ms / 1000),
+                                (long)(opt->duration_ms % 1000) * 1000000};
+    if (!stop)
+    {
+        nanosleep(&ts, NULL);
+    }
+
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    const uint64_t t1 = bench_now_ns();
+
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < started; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+        bytes += threads[i].bytes;
+        ok &= threads[i].ok;
+        if (!threads[i].pinned && !g_pin_warned)
+        {
+            printf("WARNING: cannot pin to CPU %d, the threads from there on "
+                   "are not pinned\n", threads[i].cpu);
+            g_pin_warned = 1;
+        }
+    }
+    pthread_barrier_destroy(&start);
+    pthread_mutex_destroy(&gate);
+
+    if (!ok && (started == num_threads))
+    {
+        printf("ERROR: CTR_DRBG_generate failed\n");
+    }
+
+    return ok ? (double)bytes / (double)(t1 - t0) : -1;
+}
+
+// 1, 2, 4, ..., and max, then max + 1 to stop.
+_INLINE_ uint32_t next_threads(IN const uint32_t n, IN const uint32_t max)
+{
+    if (n == max)
+    {
+        return max + 1;
+    }
+
+    return (2 * n > max) ? max : 2 * n;
+}
+
+int bench_scaling(IN const bench_options_t *opt)
+{
+    // The single thread throughput of every configuration.
+    double single[NUM_REQ_SIZES][NUM_BUF_SIZES];
+    const aes_impl_t *impl = (NULL != opt->impl) ?
+                             aes_impl_by_name(opt->impl, opt->key_size) :
+                             aes_impl_default(opt->key_size);
+
+    if (opt->threads > SCALING_MAX_THREADS)
+    {
+        printf("ERROR: at most %u threads\n", SCALING_MAX_THREADS);
+        return ERROR;
+    }
+
+    scaling_thread_t *threads = NULL;
+    if (0 != posix_memalign((void **)&threads, CACHE_LINE_SIZE,
+                            opt->threads * sizeof(scaling_thread_t)))
+    {
+        return ERROR;
+    }
+
+    printf("Scaling of CTR_DRBG_generate (%s AES-%u), %u ms per "
+           "configuration.\n", impl->name, 8 * impl->key_len,
+           opt->duration_ms);
+
+    for (uint32_t n = 1; n <= opt->threads; n = next_threads(n, opt->threads))
+    {
+        for (uint32_t r = 0; r < NUM_REQ_SIZES; r++)
+        {
+            double in_cache = 0;
+            size_t crossover = 0;
+
+            for (uint32_t b = 0; b < NUM_BUF_SIZES; b++)
+            {
+                const double gbps = run_config(opt, impl, threads, n,
+                                               g_req_sizes[r], g_buf_sizes[b]);
+                if (gbps < 0)
+                {
+                    free(threads);
+                    return ERROR;
+                }
+
+                if (1 == n)
+                {
+                    single[r][b] = gbps;
+                }
+                if (0 == b)
+                {
+                    in_cache = gbps;
+                }
+                else if ((0 == crossover) &&
+                         (gbps < SCALING_MEMORY_BOUND * in_cache))
+                {
+                    crossover = g_buf_sizes[b];
+                }
+
+                scaling_result_t *res = &g_scaling[g_num_scaling++];
+                res->threads = n;
+                res->req = g_req_sizes[r];
+                res->buf = g_buf_sizes[b];
+                res->gbps = gbps;
+                res->efficiency = gbps / (n * single[r][b]);
+
+                printf("%3u threads %6u B requests %6lu KiB buffers: "
+                       "%7.2f GB/s, %5.1f%% efficiency\n", n, res->req,
+                       (unsigned long)(res->buf >> 10), gbps,
+                       100 * res->efficiency);
+            }
+
+            if (0 == crossover)
+            {
+                printf("%3u threads %6u B requests: AES bound up to %lu KiB "
+                       "buffers\n", n, g_req_sizes[r],
+                       (unsigned long)(g_buf_sizes[NUM_BUF_SIZES - 1] >> 10));
+            }
+            else
+            {
+                printf("%3u threads %6u B requests: memory bound from %lu "
+                       "KiB buffers\n", n, g_req_sizes[r],
+                       (unsigned long)(crossover >> 10));
+            }
+        }
+    }
+
+    free(threads);
+    return SUCCESS;
+}
+
+void bench_scaling_json(IN FILE *f)
+{
+    if (0 == g_num_scaling)
+    {
+        return;
+    }
+
+    fprintf(f, ",\n  \"scaling\": [\n");
+    for (uint32_t i = 0; i < g_num_scaling; i++)
+    {
+        const scaling_result_t *r = &g_scaling[i];
+
+        fprintf(f, "    {\"threads\": %u, \"bytes\": %u, \"buffer\": %lu",
+                r->threads, r->req, (unsigned long)r->buf);
+        bench_json_number(f, "gbps", r->gbps);
+        bench_json_number(f, "efficiency", r->efficiency);
+        fprintf(f, "}%s\n", (i + 1 < g_num_scaling) ? "," : "");
+    }
+    fprintf(f, "  ]");
+}
@@ -0,0 +1,116 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#include <cpuid.h>
+#include "cpu_features.h"
+
+// XCR0 bits: SSE, AVX (ymm upper halves), and opmask/zmm state for AVX512.
+#define XCR0_SSE_AVX     (0x6ULL)
+#define XCR0_AVX512      (0xe6ULL)
+
+#define CPU_FEATURES_INITIALIZED (1U << 31)
+
+static volatile cpu_features_t g_cpu_features = 0;
+
+_INLINE_ uint64_t xgetbv0(void)
+{
+    uint32_t lo, hi;
+    __asm__ __volatile__ ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+_INLINE_ cpu_features_t detect_cpu_features(void)
+{
+    uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+    cpu_features_t f = 0;
+    uint64_t xcr0 = 0;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        return f;
+    }
+
+    if (ecx & bit_AES)
+    {
+        f |= CPU_FEATURE_AESNI;
+    }
+
+    // AVX state must be enabled by the OS before it can be used.
+    if (ecx & bit_OSXSAVE)
+    {
+        xcr0 = xgetbv0();
+    }
+
+    if ((ecx & bit_AVX) && (XCR0_SSE_AVX == (xcr0 & XCR0_SSE_AVX)))
+    {
+        f |= CPU_FEATURE_AVX;
+    }
+
+    if (__get_cpuid_max(0, NULL) < 7)
+    {
+        return f;
+    }
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+    // RDSEED does not depend on any OS enabled state.
+    if (ebx & bit_RDSEED)
+    {
+        f |= CPU_FEATURE_RDSEED;
+    }
+
+    if (!(f & CPU_FEATURE_AVX))
+    {
+        return f;
+    }
+
+    if (ebx & bit_AVX2)
+    {
+        f |= CPU_FEATURE_AVX2;
+    }
+
+    if (ecx & bit_VAES)
+    {
+        f |= CPU_FEATURE_VAES;
+    }
+
+    if (XCR0_AVX512 == (xcr0 & XCR0_AVX512))
+    {
+        if (ebx & bit_AVX512F)  { f |= CPU_FEATURE_AVX512F;  }
+        if (ebx & bit_AVX512DQ) { f |= CPU_FEATURE_AVX512DQ; }
+        if (ebx & bit_AVX512BW) { f |= CPU_FEATURE_AVX512BW; }
+    }
+
+    return f;
+}
+
+cpu_features_t cpu_features(void)
+{
+    cpu_features_t f = g_cpu_features;
+
+    // Benign race: concurrent first callers compute and store the same value.
+    if (!(f & CPU_FEATURES_INITIALIZED))
+    {
+        f = detect_cpu_features() | CPU_FEATURES_INITIALIZED;
+        g_cpu_features = f;
+    }
+
+    return f & ~CPU_FEATURES_INITIALIZED;
+}
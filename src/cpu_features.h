@@ -0,0 +1,46 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include "defs.h"
+
+// The CPU features the kernels depend on. A feature is reported only if
+// both the CPU and the OS (through XCR0) support it.
+#define CPU_FEATURE_AESNI     (1U << 0)
+#define CPU_FEATURE_AVX       (1U << 1)
+#define CPU_FEATURE_AVX2      (1U << 2)
+#define CPU_FEATURE_VAES      (1U << 3)
+#define CPU_FEATURE_AVX512F   (1U << 4)
+#define CPU_FEATURE_AVX512DQ  (1U << 5)
+#define CPU_FEATURE_AVX512BW  (1U << 6)
+#define CPU_FEATURE_RDSEED    (1U << 7)
+
+typedef uint32_t cpu_features_t;
+
+// Returns the features of the running CPU. CPUID and XGETBV are executed
+// once, on the first call, the result is cached afterwards.
+cpu_features_t cpu_features(void);
+
+_INLINE_ int cpu_has(IN const cpu_features_t required)
+{
+    return (required == (cpu_features() & required));
+}
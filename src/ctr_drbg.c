@@ -25,6 +25,8 @@
 
 #include <string.h>
 #include "ctr_drbg.h"
+#include "ctr_drbg_pool.h"
+#include "ctr_drbg_self_test.h"
 
 // Section references in this file refer to SP 800-90Ar1:
 // http://nvlpubs.nist.gov/nistpubs/SpecialPublications/NIST.SP.800-90Ar1.pdf
@@ -32,75 +34,400 @@
 // See table 3.
 static const uint64_t kMaxReseedCount = UINT64_C(1) << 48;
 
+// CTR_DRBG_FUSED_MAX_LEN is the longest request |CTR_DRBG_generate| produces
+// with a single kernel invocation, see there.
+#define CTR_DRBG_FUSED_MAX_LEN 256
+
+size_t CTR_DRBG_seed_len(const CTR_DRBG_STATE *drbg) {
+  return CTR_DRBG_SEED_LEN(drbg->impl->key_len);
+}
+
+// ctr_drbg_update_blocks returns the number of blocks the update function
+// encrypts, see section 10.2.1.2. Only the first |CTR_DRBG_seed_len| bytes of
+// the last one are used for AES-192.
+static size_t ctr_drbg_update_blocks(const CTR_DRBG_STATE *drbg) {
+  return (CTR_DRBG_seed_len(drbg) + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+}
+
 int CTR_DRBG_init(CTR_DRBG_STATE *drbg,
                   const uint8_t entropy[CTR_DRBG_ENTROPY_LEN],
                   const uint8_t *personalization, size_t personalization_len) {
+  return CTR_DRBG_init_key_size(drbg, AES_KEY_256, entropy, personalization,
+                                personalization_len);
+}
+
+int CTR_DRBG_init_key_size(CTR_DRBG_STATE *drbg, aes_key_size_t key_size,
+                           const uint8_t entropy[CTR_DRBG_ENTROPY_LEN],
+                           const uint8_t *personalization,
+                           size_t personalization_len) {
+  // Fail closed, see ctr_drbg_self_test.h.
+  if (key_size >= AES_KEY_SIZE_COUNT || !CTR_DRBG_self_test_passed()) {
+    return 0;
+  }
+
+  const aes_impl_t *impl = aes_impl_default(key_size);
+  const size_t seed_len = CTR_DRBG_SEED_LEN(impl->key_len);
+
   // Section 10.2.1.3.1
-  if (personalization_len > CTR_DRBG_ENTROPY_LEN) {
+  if (personalization_len > seed_len) {
     return 0;
   }
 
   uint8_t seed_material[CTR_DRBG_ENTROPY_LEN];
-  memcpy(seed_material, entropy, CTR_DRBG_ENTROPY_LEN);
+  memcpy(seed_material, entropy, seed_len);
 
   for (size_t i = 0; i < personalization_len; i++) {
     seed_material[i] ^= personalization[i];
   }
 
   // Section 10.2.1.2
-  // kInitMask is the result of encrypting blocks with big-endian value 1, 2
-  // and 3 with the all-zero AES-256 key.
-  static const uint8_t kInitMask[CTR_DRBG_ENTROPY_LEN] = {
-      0x53, 0x0f, 0x8a, 0xfb, 0xc7, 0x45, 0x36, 0xb9, 0xa9, 0x63, 0xb4, 0xf1,
-      0xc4, 0xcb, 0x73, 0x8b, 0xce, 0xa7, 0x40, 0x3d, 0x4d, 0x60, 0x6b, 0x6e,
-      0x07, 0x4e, 0xc5, 0xd3, 0xba, 0xf3, 0x9d, 0x18, 0x72, 0x60, 0x03, 0xca,
-      0x37, 0xa6, 0x2a, 0x74, 0xd1, 0xa2, 0xf5, 0x8e, 0x75, 0x06, 0x35, 0x8e,
+  // kInitMask holds, per key size, the result of encrypting blocks with
+  // big-endian value 1, 2 and 3 with the all-zero key, truncated to seedlen.
+  static const uint8_t kInitMask[AES_KEY_SIZE_COUNT][CTR_DRBG_ENTROPY_LEN] = {
+      [AES_KEY_128] = {
+          0x58, 0xe2, 0xfc, 0xce, 0xfa, 0x7e, 0x30, 0x61, 0x36, 0x7f, 0x1d,
+          0x57, 0xa4, 0xe7, 0x45, 0x5a, 0x03, 0x88, 0xda, 0xce, 0x60, 0xb6,
+          0xa3, 0x92, 0xf3, 0x28, 0xc2, 0xb9, 0x71, 0xb2, 0xfe, 0x78,
+      },
+      [AES_KEY_192] = {
+          0xcd, 0x33, 0xb2, 0x8a, 0xc7, 0x73, 0xf7, 0x4b, 0xa0, 0x0e, 0xd1,
+          0xf3, 0x12, 0x57, 0x24, 0x35, 0x98, 0xe7, 0x24, 0x7c, 0x07, 0xf0,
+          0xfe, 0x41, 0x1c, 0x26, 0x7e, 0x43, 0x84, 0xb0, 0xf6, 0x00, 0x2a,
+          0x34, 0x93, 0xe6, 0x62, 0x35, 0xee, 0x67,
+      },
+      [AES_KEY_256] = {
+          0x53, 0x0f, 0x8a, 0xfb, 0xc7, 0x45, 0x36, 0xb9, 0xa9, 0x63, 0xb4,
+          0xf1, 0xc4, 0xcb, 0x73, 0x8b, 0xce, 0xa7, 0x40, 0x3d, 0x4d, 0x60,
+          0x6b, 0x6e, 0x07, 0x4e, 0xc5, 0xd3, 0xba, 0xf3, 0x9d, 0x18, 0x72,
+          0x60, 0x03, 0xca, 0x37, 0xa6, 0x2a, 0x74, 0xd1, 0xa2, 0xf5, 0x8e,
+          0x75, 0x06, 0x35, 0x8e,
+      },
   };
+  const uint8_t *init_mask = kInitMask[key_size];
 
-  for (size_t i = 0; i < sizeof(kInitMask); i++) {
-    seed_material[i] ^= kInitMask[i];
+  for (size_t i = 0; i < seed_len; i++) {
+    seed_material[i] ^= init_mask[i];
   }
 
-  aes256_key_t key;
-  memcpy(key.raw, seed_material, 32);
-  memcpy(drbg->counter.bytes, seed_material + 32, 16);
+  aes_key_t key;
+  memcpy(key.raw, seed_material, impl->key_len);
+  memcpy(drbg->counter.bytes, seed_material + impl->key_len, 16);
 
-  aes256_key_expansion(&drbg->ks, &key);
+  impl->key_expansion(&drbg->ks, &key);
+  secure_clean(seed_material, sizeof(seed_material));
+  secure_clean(key.raw, sizeof(key.raw));
   drbg->reseed_counter = 1;
+  drbg->impl = impl;
+  drbg->use_df = 0;
+  drbg->placement = CTR_DRBG_PLACEMENT_CACHE;
+  drbg->stream_min_len = CTR_DRBG_STREAM_MIN_LEN;
 
   return 1;
 }
 
-// ctr_inc adds |n| to the last four bytes of |drbg->counter|, treated as a
-// big-endian number.
-static void ctr32_add(CTR_DRBG_STATE *drbg, uint32_t n) {
-  drbg->counter.words[3] =
-      CRYPTO_bswap4(CRYPTO_bswap4(drbg->counter.words[3]) + n);
+// ctr_drbg_df_ctx holds the state of the BCC chains of |ctr_drbg_df|. The
+// chains consume the same input S, which is streamed through |block|, so
+// the input strings need not be concatenated first.
+typedef struct {
+  const aes_impl_t *impl;
+  aes_ks_t ks;
+  uint8_t cv[AES_BCC_LANES * AES_BLOCK_SIZE];
+  uint8_t block[AES_BLOCK_SIZE];
+  size_t pos;
+} ctr_drbg_df_ctx;
+
+static void ctr_drbg_df_update(ctr_drbg_df_ctx *ctx, const uint8_t *in,
+                               size_t len) {
+  if (ctx->pos > 0) {
+    const size_t todo = (len < AES_BLOCK_SIZE - ctx->pos)
+                            ? len
+                            : AES_BLOCK_SIZE - ctx->pos;
+    memcpy(&ctx->block[ctx->pos], in, todo);
+    ctx->pos += todo;
+    in += todo;
+    len -= todo;
+
+    if (ctx->pos < AES_BLOCK_SIZE) {
+      return;
+    }
+    ctx->impl->bcc(ctx->cv, ctx->block, 1, &ctx->ks);
+    ctx->pos = 0;
+  }
+
+  // Full blocks are processed in place.
+  const size_t num_blocks = len / AES_BLOCK_SIZE;
+  if (num_blocks > 0) {
+    ctx->impl->bcc(ctx->cv, in, num_blocks, &ctx->ks);
+    in += num_blocks * AES_BLOCK_SIZE;
+    len -= num_blocks * AES_BLOCK_SIZE;
+  }
+
+  memcpy(ctx->block, in, len);
+  ctx->pos = len;
 }
 
-static int ctr_drbg_update(CTR_DRBG_STATE *drbg, const uint8_t *data,
-                           size_t data_len) {
-  // Per section 10.2.1.2, |data_len| must be |CTR_DRBG_ENTROPY_LEN|. Here, we
-  // allow shorter inputs and right-pad them with zeros. This is equivalent to
-  // the specified algorithm but saves a copy in |CTR_DRBG_generate|.
-  if (data_len > CTR_DRBG_ENTROPY_LEN) {
+// ctr_drbg_df implements Block_Cipher_df (section 10.3.2) with the kernels of
+// |impl|: it writes the |CTR_DRBG_SEED_LEN(impl->key_len)| bytes derived
+// from the concatenation of the |num_inputs| strings |in[i]|, of |in_lens[i]|
+// bytes each, to |out|. All the |AES_BCC_LANES| chains of step 9 run in one
+// kernel invocation. It returns one on success and zero on error.
+static int ctr_drbg_df(const aes_impl_t *impl,
+                       uint8_t out[CTR_DRBG_ENTROPY_LEN],
+                       const uint8_t *const in[], const size_t in_lens[],
+                       size_t num_inputs) {
+  // Step 8: K is a prefix of 0x00, 0x01, ..., 0x1f.
+  static const aes_key_t kDfKey = {{
+      0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a,
+      0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15,
+      0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+  }};
+  static const uint8_t kZeroBlock[AES_BLOCK_SIZE] = {0};
+  static const uint8_t kPad = 0x80;
+  const size_t seed_len = CTR_DRBG_SEED_LEN(impl->key_len);
+
+  // Step 2: L is a 32-bit integer.
+  uint64_t total = 0;
+  for (size_t i = 0; i < num_inputs; i++) {
+    total += in_lens[i];
+    if (total > UINT32_MAX) {
+      return 0;
+    }
+  }
+
+  ctr_drbg_df_ctx ctx;
+  ctx.impl = impl;
+  ctx.pos = 0;
+  impl->key_expansion(&ctx.ks, &kDfKey);
+
+  // Step 9: chain i starts with the block IV = i || 0^96, i.e., from
+  // E(K, IV), which is BCC over a zero block from the chaining value IV.
+  memset(ctx.cv, 0, sizeof(ctx.cv));
+  for (size_t l = 0; l < AES_BCC_LANES; l++) {
+    ctx.cv[AES_BLOCK_SIZE * l + 3] = (uint8_t)l;
+  }
+  impl->bcc(ctx.cv, kZeroBlock, 1, &ctx.ks);
+
+  // Steps 4 and 5: S = L || N || input_string || 0x80, zero padded.
+  const uint8_t header[8] = {
+      (uint8_t)(total >> 24),    (uint8_t)(total >> 16),
+      (uint8_t)(total >> 8),     (uint8_t)total,
+      (uint8_t)(seed_len >> 24), (uint8_t)(seed_len >> 16),
+      (uint8_t)(seed_len >> 8),  (uint8_t)seed_len,
+  };
+  ctr_drbg_df_update(&ctx, header, sizeof(header));
+  for (size_t i = 0; i < num_inputs; i++) {
+    ctr_drbg_df_update(&ctx, in[i], in_lens[i]);
+  }
+  ctr_drbg_df_update(&ctx, &kPad, 1);
+  if (ctx.pos > 0) {
+    ctr_drbg_df_update(&ctx, kZeroBlock, AES_BLOCK_SIZE - ctx.pos);
+  }
+
+  // Steps 10 to 14. Only the first (keylen + outlen) / outlen chains are
+  // used, the rest are free in the pipeline.
+  aes_key_t key;
+  memcpy(key.raw, ctx.cv, impl->key_len);
+  impl->key_expansion(&ctx.ks, &key);
+
+  const uint8_t *x = &ctx.cv[impl->key_len];
+  for (size_t i = 0; i < seed_len; i += AES_BLOCK_SIZE) {
+    impl->enc(&out[i], x, &ctx.ks);
+    x = &out[i];
+  }
+
+  secure_clean((uint8_t *)&ctx, sizeof(ctx));
+  secure_clean(key.raw, sizeof(key.raw));
+
+  return 1;
+}
+
+int CTR_DRBG_init_df(CTR_DRBG_STATE *drbg, aes_key_size_t key_size,
+                     const uint8_t *entropy, size_t entropy_len,
+                     const uint8_t *nonce, size_t nonce_len,
+                     const uint8_t *personalization,
+                     size_t personalization_len) {
+  if (key_size >= AES_KEY_SIZE_COUNT) {
     return 0;
   }
 
-  uint8_t temp[CTR_DRBG_ENTROPY_LEN];
-  for (size_t i = 0; i < CTR_DRBG_ENTROPY_LEN; i += AES_BLOCK_SIZE) {
-    ctr32_add(drbg, 1);
-    aes256_enc(temp + i, drbg->counter.bytes, &drbg->ks);
+  const aes_impl_t *impl = aes_impl_default(key_size);
+  if (entropy_len < impl->key_len || 2 * nonce_len < impl->key_len) {
+    return 0;
+  }
+
+  // Section 10.2.1.3.2: the derived seed material goes through the same
+  // update as the seed material of an instance without the derivation
+  // function.
+  const uint8_t *const in[3] = {entropy, nonce, personalization};
+  const size_t in_lens[3] = {entropy_len, nonce_len, personalization_len};
+  uint8_t seed_material[CTR_DRBG_ENTROPY_LEN];
+
+  const int ok =
+      ctr_drbg_df(impl, seed_material, in, in_lens, 3) &&
+      CTR_DRBG_init_key_size(drbg, key_size, seed_material, NULL, 0);
+  secure_clean(seed_material, sizeof(seed_material));
+  if (!ok) {
+    return 0;
+  }
+
+  drbg->use_df = 1;
+  return 1;
+}
+
+// ctr_add adds |n| to |drbg->counter|, treated as a 128-bit big-endian
+// number. V is a full block counter (ctr_len = blocklen, see 10.2.1).
+static void ctr_add(CTR_DRBG_STATE *drbg, uint64_t n) {
+  uint64_t carry = n;
+  for (size_t i = 4; i-- > 0 && carry != 0;) {
+    carry += CRYPTO_bswap4(drbg->counter.words[i]);
+    drbg->counter.words[i] = CRYPTO_bswap4((uint32_t)carry);
+    carry >>= 32;
   }
+}
+
+// ctr32_left returns the number of counter blocks, starting at V, before the
+// last four bytes of V wrap around.
+static uint64_t ctr32_left(const CTR_DRBG_STATE *drbg) {
+  return (UINT64_C(1) << 32) - CRYPTO_bswap4(drbg->counter.words[3]);
+}
+
+// ctr_drbg_keystream writes |num_blocks| keystream blocks of |drbg|, for the
+// counter values V, V+1, ..., to |out| and adds |num_blocks| to V. If |in| is
+// not NULL, the keystream is XORed with it. If |pool| is not NULL (and |in|
+// is NULL), the blocks are computed by its workers. The kernels only
+// increment the last four bytes of the counter, so a range that wraps them is
+// split, and the carry is propagated in between. Otherwise, a range is split
+// only into the chunks of the autotuner (see aes_tune.h), and every kernel
+// invocation uses the variant tuned for its length.
+static void ctr_drbg_keystream(CTR_DRBG_STATE *drbg, uint8_t *out,
+                               const uint8_t *in, size_t num_blocks,
+                               CTR_DRBG_POOL *pool) {
+  const size_t chunk = aes_ctr_chunk_blocks(drbg->impl);
+
+  while (num_blocks > 0) {
+    const uint64_t left = ctr32_left(drbg);
+    size_t todo = (num_blocks < left) ? num_blocks : (size_t)left;
+
+    if (pool == NULL && chunk != 0 && todo > chunk) {
+      todo = chunk;
+    }
+
+    if (pool != NULL) {
+      CTR_DRBG_pool_ctr_enc(pool, drbg->impl, out, drbg->counter.bytes,
+                            todo, &drbg->ks);
+    } else if (in == NULL) {
+      aes_ctr_enc_tuned(drbg->impl, todo)(out, drbg->counter.bytes, todo,
+                                          &drbg->ks);
+    } else {
+      aes_ctr_xor_tuned(drbg->impl, todo)(out, in, drbg->counter.bytes, todo,
+                                          &drbg->ks);
+      in += todo * AES_BLOCK_SIZE;
+    }
 
+    ctr_add(drbg, todo);
+    out += todo * AES_BLOCK_SIZE;
+    num_blocks -= todo;
+  }
+}
+
+// CTR_DRBG_STREAM_ALIGN is the alignment of the output of the non-temporal
+// kernels, the width of the widest vector store.
+#define CTR_DRBG_STREAM_ALIGN 64
+
+// ctr_drbg_keystream_nt is |ctr_drbg_keystream| without |in| or |pool|, with
+// non-temporal stores. The blocks before the first |CTR_DRBG_STREAM_ALIGN|
+// byte boundary of |out| and after the last one are written by
+// |ctr_drbg_keystream|, and the aligned ones in between by
+// |impl->ctr_enc_nt|. If |out| is not 16 bytes aligned, no block is aligned,
+// and all of them are written by |ctr_drbg_keystream|.
+static void ctr_drbg_keystream_nt(CTR_DRBG_STATE *drbg, uint8_t *out,
+                                  size_t num_blocks) {
+  const size_t vec_blocks = CTR_DRBG_STREAM_ALIGN / AES_BLOCK_SIZE;
+  const size_t misalign = (uintptr_t)out % CTR_DRBG_STREAM_ALIGN;
+
+  if (misalign % AES_BLOCK_SIZE != 0) {
+    ctr_drbg_keystream(drbg, out, NULL, num_blocks, NULL);
+    return;
+  }
+
+  size_t head = (misalign == 0)
+                    ? 0
+                    : (CTR_DRBG_STREAM_ALIGN - misalign) / AES_BLOCK_SIZE;
+  head = (head < num_blocks) ? head : num_blocks;
+  ctr_drbg_keystream(drbg, out, NULL, head, NULL);
+  out += head * AES_BLOCK_SIZE;
+  num_blocks -= head;
+
+  size_t body = num_blocks - num_blocks % vec_blocks;
+  num_blocks -= body;
+  while (body > 0) {
+    const uint64_t left = ctr32_left(drbg);
+    size_t todo = (body < left) ? body : (size_t)left;
+
+    // A vector that wraps the last four bytes of the counter goes through
+    // |ctr_drbg_keystream|, which propagates the carry.
+    todo -= todo % vec_blocks;
+    if (todo == 0) {
+      todo = vec_blocks;
+      ctr_drbg_keystream(drbg, out, NULL, todo, NULL);
+    } else {
+      drbg->impl->ctr_enc_nt(out, drbg->counter.bytes, todo, &drbg->ks);
+      ctr_add(drbg, todo);
+    }
+
+    out += todo * AES_BLOCK_SIZE;
+    body -= todo;
+  }
+
+  ctr_drbg_keystream(drbg, out, NULL, num_blocks, NULL);
+}
+
+// ctr_drbg_streams returns one if |drbg| writes |len| bytes of output with
+// non-temporal stores, see |CTR_DRBG_set_placement|.
+static int ctr_drbg_streams(const CTR_DRBG_STATE *drbg, size_t len) {
+  return drbg->placement == CTR_DRBG_PLACEMENT_STREAM &&
+         len >= drbg->stream_min_len;
+}
+
+// ctr_drbg_new_key completes the update function, given the |temp| keystream
+// of its step 2, up to the key expansion: it XORs |data| into it, installs the
+// new V and writes the new Key to |key|.
+static void ctr_drbg_new_key(CTR_DRBG_STATE *drbg,
+                             uint8_t temp[CTR_DRBG_ENTROPY_LEN],
+                             const uint8_t *data, size_t data_len,
+                             aes_key_t *key) {
   for (size_t i = 0; i < data_len; i++) {
     temp[i] ^= data[i];
   }
 
-  aes256_key_t key;
-  memcpy(key.raw, temp, 32);
-  memcpy(drbg->counter.bytes, temp + 32, 16);
-  aes256_key_expansion(&drbg->ks, &key);
+  memcpy(key->raw, temp, drbg->impl->key_len);
+  memcpy(drbg->counter.bytes, temp + drbg->impl->key_len, 16);
+}
+
+// ctr_drbg_rekey completes the update function, given the |temp| keystream of
+// its step 2: it XORs |data| into it and installs the new Key and V.
+static void ctr_drbg_rekey(CTR_DRBG_STATE *drbg,
+                           uint8_t temp[CTR_DRBG_ENTROPY_LEN],
+                           const uint8_t *data, size_t data_len) {
+  aes_key_t key;
+  ctr_drbg_new_key(drbg, temp, data, data_len, &key);
+  drbg->impl->key_expansion(&drbg->ks, &key);
+}
+
+static int ctr_drbg_update(CTR_DRBG_STATE *drbg, const uint8_t *data,
+                           size_t data_len) {
+  // Per section 10.2.1.2, |data_len| must be |CTR_DRBG_seed_len|. Here, we
+  // allow shorter inputs and right-pad them with zeros. This is equivalent to
+  // the specified algorithm but saves a copy in |CTR_DRBG_generate|.
+  if (data_len > CTR_DRBG_seed_len(drbg)) {
+    return 0;
+  }
+
+  uint8_t temp[CTR_DRBG_ENTROPY_LEN];
+  ctr_add(drbg, 1);
+  ctr_drbg_keystream(drbg, temp, NULL, ctr_drbg_update_blocks(drbg), NULL);
+
+  ctr_drbg_rekey(drbg, temp, data, data_len);
 
   return 1;
 }
@@ -111,13 +438,18 @@ int CTR_DRBG_reseed(CTR_DRBG_STATE *drbg,
                     size_t additional_data_len) {
   // Section 10.2.1.4
   uint8_t entropy_copy[CTR_DRBG_ENTROPY_LEN];
+  const size_t seed_len = CTR_DRBG_seed_len(drbg);
+
+  if (drbg->use_df) {
+    return 0;
+  }
 
   if (additional_data_len > 0) {
-    if (additional_data_len > CTR_DRBG_ENTROPY_LEN) {
+    if (additional_data_len > seed_len) {
       return 0;
     }
 
-    memcpy(entropy_copy, entropy, CTR_DRBG_ENTROPY_LEN);
+    memcpy(entropy_copy, entropy, seed_len);
     for (size_t i = 0; i < additional_data_len; i++) {
       entropy_copy[i] ^= additional_data[i];
     }
@@ -125,7 +457,7 @@ int CTR_DRBG_reseed(CTR_DRBG_STATE *drbg,
     entropy = entropy_copy;
   }
 
-  if (!ctr_drbg_update(drbg, entropy, CTR_DRBG_ENTROPY_LEN)) {
+  if (!ctr_drbg_update(drbg, entropy, seed_len)) {
     return 0;
   }
 
@@ -134,9 +466,41 @@ int CTR_DRBG_reseed(CTR_DRBG_STATE *drbg,
   return 1;
 }
 
-int CTR_DRBG_generate(CTR_DRBG_STATE *drbg, uint8_t *out, size_t out_len,
-                      const uint8_t *additional_data,
-                      size_t additional_data_len) {
+int CTR_DRBG_reseed_df(CTR_DRBG_STATE *drbg, const uint8_t *entropy,
+                       size_t entropy_len, const uint8_t *additional_data,
+                       size_t additional_data_len) {
+  // Section 10.2.1.4.2
+  if (!drbg->use_df || entropy_len < drbg->impl->key_len) {
+    return 0;
+  }
+
+  const uint8_t *const in[2] = {entropy, additional_data};
+  const size_t in_lens[2] = {entropy_len, additional_data_len};
+  uint8_t seed_material[CTR_DRBG_ENTROPY_LEN];
+
+  const int ok =
+      ctr_drbg_df(drbg->impl, seed_material, in, in_lens, 2) &&
+      ctr_drbg_update(drbg, seed_material, CTR_DRBG_seed_len(drbg));
+  secure_clean(seed_material, sizeof(seed_material));
+  if (!ok) {
+    return 0;
+  }
+
+  drbg->reseed_counter = 1;
+
+  return 1;
+}
+
+// ctr_drbg_generate implements |CTR_DRBG_generate| when |in| is NULL and
+// |CTR_DRBG_generate_xor| otherwise, in which case the output is |in| XORed
+// with the generated bits. If |pool| is not NULL (and |in| is NULL), the full
+// blocks of long requests are computed by its workers. If |stream| is set
+// (and |in| and |pool| are NULL), they are written with non-temporal stores.
+static int ctr_drbg_generate(CTR_DRBG_STATE *drbg, uint8_t *out,
+                             const uint8_t *in, size_t out_len,
+                             const uint8_t *additional_data,
+                             size_t additional_data_len,
+                             CTR_DRBG_POOL *pool, int stream) {
   // See 9.3.1
   if (out_len > CTR_DRBG_MAX_GENERATE_LENGTH) {
     return 0;
@@ -147,66 +511,318 @@ int CTR_DRBG_generate(CTR_DRBG_STATE *drbg, uint8_t *out, size_t out_len,
     return 0;
   }
 
+  // See 10.2.1.5.2, step 2.1. The derived string replaces |additional_data|
+  // in both updates.
+  uint8_t derived[CTR_DRBG_ENTROPY_LEN];
+  if (drbg->use_df && additional_data_len != 0) {
+    if (!ctr_drbg_df(drbg->impl, derived, &additional_data,
+                     &additional_data_len, 1)) {
+      secure_clean(derived, sizeof(derived));
+      return 0;
+    }
+    additional_data = derived;
+    additional_data_len = CTR_DRBG_seed_len(drbg);
+  }
+
   if (additional_data_len != 0 &&
       !ctr_drbg_update(drbg, additional_data, additional_data_len)) {
+    secure_clean(derived, sizeof(derived));
     return 0;
   }
 
-  // kChunkSize is used to interact better with the cache. Since the AES-CTR
-  // code assumes that it's encrypting rather than just writing keystream, the
-  // buffer has to be zeroed first. Without chunking, large reads would zero
-  // the whole buffer, flushing the L1 cache, and then do another pass (missing
-  // the cache every time) to “encrypt” it. The code can avoid this by
-  // chunking.
-  static const size_t kChunkSize = 8 * 1024;
-
-  while (out_len >= AES_BLOCK_SIZE) {
-    size_t todo = kChunkSize;
-    if (todo > out_len) {
-      todo = out_len;
-    }
-
-    todo &= ~(AES_BLOCK_SIZE-1);
-
-    const size_t num_blocks = todo / AES_BLOCK_SIZE;
-    if (1) {
-      memset(out, 0, todo);
-      ctr32_add(drbg, 1);
-#ifdef VAES
-      aes256_ctr_enc512(out, drbg->counter.bytes, num_blocks, &drbg->ks);
-#else
-	  aes256_ctr_enc(out, drbg->counter.bytes, num_blocks, &drbg->ks);
-#endif
-      ctr32_add(drbg, num_blocks - 1);
+  // The output blocks and the |update_blocks| blocks of the update in step 6
+  // use consecutive counter values, so they are produced by the same kernel
+  // invocation. This also avoids zeroing |out| and encrypting the partial
+  // last block separately. Requests up to |CTR_DRBG_FUSED_MAX_LEN| bytes are generated
+  // into |buf| with a single invocation; longer requests are written directly
+  // to |out|, and only their tail and the update blocks go to |buf|.
+  const size_t out_blocks = (out_len + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+  const size_t update_blocks = ctr_drbg_update_blocks(drbg);
+  ALIGN(16) uint8_t buf[CTR_DRBG_FUSED_MAX_LEN + CTR_DRBG_ENTROPY_LEN];
+  size_t done_blocks = 0;
+
+  ctr_add(drbg, 1);
+  if (out_len > CTR_DRBG_FUSED_MAX_LEN) {
+    done_blocks = out_len / AES_BLOCK_SIZE;
+    if (stream) {
+      ctr_drbg_keystream_nt(drbg, out, done_blocks);
     } else {
-      for (size_t i = 0; i < todo; i += AES_BLOCK_SIZE) {
-        ctr32_add(drbg, 1);
-        aes256_enc(&out[i], drbg->counter.bytes, &drbg->ks);
-      }
+      ctr_drbg_keystream(drbg, out, in, done_blocks, pool);
+    }
+    out += done_blocks * AES_BLOCK_SIZE;
+    if (in != NULL) {
+      in += done_blocks * AES_BLOCK_SIZE;
     }
-
-    out += todo;
-    out_len -= todo;
   }
 
-  if (out_len > 0) {
-    uint8_t block[AES_BLOCK_SIZE];
-    ctr32_add(drbg, 1);
-    aes256_enc(block, drbg->counter.bytes, &drbg->ks);
+  ctr_drbg_keystream(drbg, buf, NULL, out_blocks - done_blocks + update_blocks,
+                     NULL);
 
-    memcpy(out, block, out_len);
+  const size_t todo = out_len - done_blocks * AES_BLOCK_SIZE;
+  if (in == NULL) {
+    memcpy(out, buf, todo);
+  } else {
+    for (size_t i = 0; i < todo; i++) {
+      out[i] = in[i] ^ buf[i];
+    }
   }
 
   // Right-padding |additional_data| in step 2.2 is handled implicitly by
-  // |ctr_drbg_update|, to save a copy.
-  if (!ctr_drbg_update(drbg, additional_data, additional_data_len)) {
-    return 0;
+  // |ctr_drbg_rekey|, to save a copy. Its length was checked by the first
+  // update above.
+  ctr_drbg_rekey(drbg, &buf[(out_blocks - done_blocks) * AES_BLOCK_SIZE],
+                 additional_data, additional_data_len);
+
+  // The used part of |buf| holds the tail of the output and the new Key
+  // and V.
+  secure_clean(buf, (out_blocks - done_blocks + update_blocks) *
+                        AES_BLOCK_SIZE);
+  if (additional_data == derived) {
+    secure_clean(derived, sizeof(derived));
   }
 
   drbg->reseed_counter++;
   return 1;
 }
 
+int CTR_DRBG_generate(CTR_DRBG_STATE *drbg, uint8_t *out, size_t out_len,
+                      const uint8_t *additional_data,
+                      size_t additional_data_len) {
+  return ctr_drbg_generate(drbg, out, NULL, out_len, additional_data,
+                           additional_data_len, NULL,
+                           ctr_drbg_streams(drbg, out_len));
+}
+
+int CTR_DRBG_generate_pr(CTR_DRBG_STATE *drbg, uint8_t *out, size_t out_len,
+                         const uint8_t *additional_data,
+                         size_t additional_data_len, ENTROPY_POOL *pool) {
+  // See 9.3.1 and 10.2.1.4.1. Check the request before consuming any
+  // entropy.
+  if (pool == NULL || out_len > CTR_DRBG_MAX_GENERATE_LENGTH ||
+      (!drbg->use_df && additional_data_len > CTR_DRBG_seed_len(drbg))) {
+    return 0;
+  }
+
+  // The security strength of the derivation function instances is their key
+  // length, see 10.2.1.4.2.
+  const size_t entropy_len =
+      drbg->use_df ? drbg->impl->key_len : CTR_DRBG_seed_len(drbg);
+  uint8_t entropy[CTR_DRBG_ENTROPY_LEN];
+  int ok = entropy_pool_get(pool, entropy, entropy_len);
+
+  if (ok) {
+    ok = drbg->use_df
+             ? CTR_DRBG_reseed_df(drbg, entropy, entropy_len, additional_data,
+                                  additional_data_len)
+             : CTR_DRBG_reseed(drbg, entropy, additional_data,
+                               additional_data_len);
+  }
+  secure_clean(entropy, sizeof(entropy));
+
+  return ok && ctr_drbg_generate(drbg, out, NULL, out_len, NULL, 0, NULL,
+                                 ctr_drbg_streams(drbg, out_len));
+}
+
+int CTR_DRBG_generate_parallel(CTR_DRBG_STATE *drbg, uint8_t *out,
+                               size_t out_len,
+                               const uint8_t *additional_data,
+                               size_t additional_data_len,
+                               CTR_DRBG_POOL *pool) {
+  return ctr_drbg_generate(drbg, out, NULL, out_len, additional_data,
+                           additional_data_len, pool, 0);
+}
+
+int CTR_DRBG_generate_xor(CTR_DRBG_STATE *drbg, uint8_t *inout, size_t len,
+                          const uint8_t *additional_data,
+                          size_t additional_data_len) {
+  return ctr_drbg_generate(drbg, inout, inout, len, additional_data,
+                           additional_data_len, NULL, 0);
+}
+
+// ctr_drbg_generate_x4 runs |CTR_DRBG_generate|, without additional data,
+// for the |num_lanes| <= |AES_X4_LANES| instances |drbgs[idx[l]]|, through
+// one multi instance kernel invocation. All the requests must be at most
+// |CTR_DRBG_FUSED_MAX_LEN| bytes long, and all the instances must have the
+// same key size. As in |ctr_drbg_generate|, the output
+// and update blocks of every instance are produced together, and the new keys
+// are expanded together.
+static void ctr_drbg_generate_x4(CTR_DRBG_STATE *const drbgs[],
+                                 uint8_t *const outs[],
+                                 const size_t out_lens[],
+                                 const size_t idx[AES_X4_LANES],
+                                 size_t num_lanes) {
+  ALIGN(16) uint8_t buf[AES_X4_LANES][CTR_DRBG_FUSED_MAX_LEN +
+                                      CTR_DRBG_ENTROPY_LEN];
+  uint8_t *ct[AES_X4_LANES];
+  const uint8_t *ctr[AES_X4_LANES];
+  const aes_ks_t *ks[AES_X4_LANES];
+  size_t num_blocks = 0;
+
+  for (size_t l = 0; l < num_lanes; l++) {
+    CTR_DRBG_STATE *drbg = drbgs[idx[l]];
+    const size_t blocks =
+        (out_lens[idx[l]] + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE +
+        ctr_drbg_update_blocks(drbg);
+
+    ctr_add(drbg, 1);
+    if (blocks > num_blocks) {
+      num_blocks = blocks;
+    }
+  }
+
+  // Unused lanes repeat the first instance into their own buffer.
+  for (size_t l = 0; l < AES_X4_LANES; l++) {
+    const CTR_DRBG_STATE *drbg = drbgs[idx[(l < num_lanes) ? l : 0]];
+    ct[l] = buf[l];
+    ctr[l] = drbg->counter.bytes;
+    ks[l] = &drbg->ks;
+  }
+
+  const aes_impl_t *impl = drbgs[idx[0]]->impl;
+  impl->ctr_enc_x4(ct, ctr, num_blocks, ks);
+
+  aes_key_t keys[AES_X4_LANES];
+  const aes_key_t *key_ptrs[AES_X4_LANES];
+  aes_ks_t *ks_ptrs[AES_X4_LANES];
+
+  for (size_t l = 0; l < num_lanes; l++) {
+    CTR_DRBG_STATE *drbg = drbgs[idx[l]];
+    const size_t out_len = out_lens[idx[l]];
+    const size_t out_blocks = (out_len + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+
+    memcpy(outs[idx[l]], buf[l], out_len);
+    ctr_drbg_new_key(drbg, &buf[l][out_blocks * AES_BLOCK_SIZE], NULL, 0,
+                     &keys[l]);
+    key_ptrs[l] = &keys[l];
+    ks_ptrs[l] = &drbg->ks;
+    drbg->reseed_counter++;
+  }
+
+  impl->key_expansion_batch(ks_ptrs, key_ptrs, (uint32_t)num_lanes);
+
+  for (size_t l = 0; l < AES_X4_LANES; l++) {
+    secure_clean(buf[l], num_blocks * AES_BLOCK_SIZE);
+  }
+  secure_clean((uint8_t *)keys, sizeof(keys));
+}
+
+int CTR_DRBG_generate_batch(CTR_DRBG_STATE *const drbgs[],
+                            uint8_t *const outs[], const size_t out_lens[],
+                            size_t n) {
+  // Check all the requests first, so that either all or none of them are
+  // served. See 9.3.1 and 10.2.1.5.1.
+  for (size_t i = 0; i < n; i++) {
+    if (out_lens[i] > CTR_DRBG_MAX_GENERATE_LENGTH ||
+        drbgs[i]->reseed_counter > kMaxReseedCount) {
+      return 0;
+    }
+  }
+
+  size_t idx[AES_X4_LANES];
+  size_t num_lanes = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    const size_t blocks = (out_lens[i] + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE +
+                          ctr_drbg_update_blocks(drbgs[i]);
+
+    // Long requests are throughput bound anyway. The multi instance kernels
+    // do not split their counter ranges, so the rare requests that wrap the
+    // last four bytes of V (after the first increment) are not batched.
+    if (out_lens[i] > CTR_DRBG_FUSED_MAX_LEN ||
+        blocks >= ctr32_left(drbgs[i])) {
+      if (!ctr_drbg_generate(drbgs[i], outs[i], NULL, out_lens[i], NULL, 0,
+                             NULL, 0)) {
+        return 0;
+      }
+      continue;
+    }
+
+    // The lanes of one invocation share the kernels, so an instance of another
+    // key size starts a new group.
+    if (num_lanes > 0 &&
+        drbgs[i]->impl->key_len != drbgs[idx[0]]->impl->key_len) {
+      ctr_drbg_generate_x4(drbgs, outs, out_lens, idx, num_lanes);
+      num_lanes = 0;
+    }
+
+    idx[num_lanes++] = i;
+    if (num_lanes == AES_X4_LANES) {
+      ctr_drbg_generate_x4(drbgs, outs, out_lens, idx, num_lanes);
+      num_lanes = 0;
+    }
+  }
+
+  if (num_lanes > 0) {
+    ctr_drbg_generate_x4(drbgs, outs, out_lens, idx, num_lanes);
+  }
+
+  return 1;
+}
+
+// ctr_drbg_generate_stream implements |CTR_DRBG_generate_stream| when |pool|
+// is NULL and |CTR_DRBG_generate_stream_parallel| otherwise.
+static int ctr_drbg_generate_stream(CTR_DRBG_STATE *drbg, uint8_t *out,
+                                    size_t out_len,
+                                    const uint8_t *additional_data,
+                                    size_t additional_data_len,
+                                    CTR_DRBG_POOL *pool) {
+  // Every request of up to |CTR_DRBG_MAX_GENERATE_LENGTH| bytes counts
+  // towards the reseed interval. Check them all before writing any output.
+  const size_t num_requests =
+      (out_len == 0) ? 1
+                     : (out_len - 1) / CTR_DRBG_MAX_GENERATE_LENGTH + 1;
+  if (drbg->reseed_counter > kMaxReseedCount ||
+      num_requests - 1 > kMaxReseedCount - drbg->reseed_counter) {
+    return 0;
+  }
+
+  // The placement follows the length of the whole output. The workers of
+  // |pool| use regular stores.
+  const int stream = pool == NULL && ctr_drbg_streams(drbg, out_len);
+  do {
+    const size_t todo = (out_len < CTR_DRBG_MAX_GENERATE_LENGTH)
+                            ? out_len
+                            : CTR_DRBG_MAX_GENERATE_LENGTH;
+    if (!ctr_drbg_generate(drbg, out, NULL, todo, additional_data,
+                           additional_data_len, pool, stream)) {
+      return 0;
+    }
+    out += todo;
+    out_len -= todo;
+  } while (out_len > 0);
+
+  return 1;
+}
+
+int CTR_DRBG_generate_stream(CTR_DRBG_STATE *drbg, uint8_t *out,
+                             size_t out_len,
+                             const uint8_t *additional_data,
+                             size_t additional_data_len) {
+  return ctr_drbg_generate_stream(drbg, out, out_len, additional_data,
+                                  additional_data_len, NULL);
+}
+
+int CTR_DRBG_generate_stream_parallel(CTR_DRBG_STATE *drbg, uint8_t *out,
+                                      size_t out_len,
+                                      const uint8_t *additional_data,
+                                      size_t additional_data_len,
+                                      CTR_DRBG_POOL *pool) {
+  return ctr_drbg_generate_stream(drbg, out, out_len, additional_data,
+                                  additional_data_len, pool);
+}
+
+void CTR_DRBG_set_impl(CTR_DRBG_STATE *drbg, const aes_impl_t *impl) {
+  drbg->impl = impl;
+}
+
+void CTR_DRBG_set_placement(CTR_DRBG_STATE *drbg,
+                            ctr_drbg_placement_t placement,
+                            size_t stream_min_len) {
+  drbg->placement = placement;
+  drbg->stream_min_len =
+      (stream_min_len == 0) ? CTR_DRBG_STREAM_MIN_LEN : stream_min_len;
+}
+
 void CTR_DRBG_clear(CTR_DRBG_STATE *drbg) {
   secure_clean((uint8_t*)drbg, sizeof(CTR_DRBG_STATE));
 }
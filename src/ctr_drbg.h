@@ -29,41 +29,112 @@ extern "C" {
 #endif
 
 #include "aes.h"
+#include "aes_dispatch.h"
+#include "entropy_pool.h"
 
-// CTR_DRBG_STATE contains the state of a CTR_DRBG based on AES-256. See SP
-// 800-90Ar1.
+// See ctr_drbg_pool.h.
+typedef struct ctr_drbg_pool_s CTR_DRBG_POOL;
+
+// The placement of the output of long requests. |CTR_DRBG_PLACEMENT_CACHE|,
+// the default, writes it with regular stores, which leave it in the caches
+// for a reader that follows right away. |CTR_DRBG_PLACEMENT_STREAM| writes
+// the output of requests of at least |stream_min_len| bytes with
+// non-temporal stores, which bypass the caches, so that filling a large pool
+// that is read only much later does not evict the working set of the
+// caller. The output is the same. See |CTR_DRBG_set_placement|.
+typedef enum {
+  CTR_DRBG_PLACEMENT_CACHE = 0,
+  CTR_DRBG_PLACEMENT_STREAM,
+} ctr_drbg_placement_t;
+
+// The default |stream_min_len|. Shorter outputs fit in the L2 cache of
+// current server cores, where the regular stores are faster, and are likely
+// to be read from there.
+#define CTR_DRBG_STREAM_MIN_LEN (1024 * 1024)
+
+// CTR_DRBG_STATE contains the state of a CTR_DRBG based on AES-128, AES-192
+// or AES-256. See SP 800-90Ar1. |impl| holds the kernels used by this
+// instance, and thereby its key size; it is set to |aes_impl_default| by
+// |CTR_DRBG_init|. |use_df| is one for instances created by
+// |CTR_DRBG_init_df|, which pass their inputs through the derivation function.
+// |placement| and |stream_min_len| are set by |CTR_DRBG_set_placement|.
 typedef struct {
-  aes256_ks_t ks;
+  aes_ks_t ks;
   union {
     uint8_t bytes[16];
     uint32_t words[4];
   } counter;
   uint64_t reseed_counter;
+  const aes_impl_t *impl;
+  int use_df;
+  ctr_drbg_placement_t placement;
+  size_t stream_min_len;
 } CTR_DRBG_STATE;
 
-// See SP 800-90Ar1, table 3.
+// See SP 800-90Ar1, table 3. |CTR_DRBG_ENTROPY_LEN| is the seed length of
+// AES-256, the longest one; |CTR_DRBG_SEED_LEN| gives the seed length for a
+// key of |key_len| bytes.
 #define CTR_DRBG_ENTROPY_LEN 48
+#define CTR_DRBG_SEED_LEN(key_len) ((key_len) + AES_BLOCK_SIZE)
 #define CTR_DRBG_MAX_GENERATE_LENGTH 65536
 
-// CTR_DRBG_init initialises |*drbg| given |CTR_DRBG_ENTROPY_LEN| bytes of
-// entropy in |entropy| and, optionally, a personalization string up to
-// |CTR_DRBG_ENTROPY_LEN| bytes in length. It returns one on success and zero
-// on error.
+// CTR_DRBG_init initialises |*drbg| as an AES-256 instance given
+// |CTR_DRBG_ENTROPY_LEN| bytes of entropy in |entropy| and, optionally, a
+// personalization string up to |CTR_DRBG_ENTROPY_LEN| bytes in length. It
+// returns one on success and zero on error. All the initialisation functions
+// fail if the power-on self-test failed, see ctr_drbg_self_test.h.
 int CTR_DRBG_init(CTR_DRBG_STATE *drbg,
                   const uint8_t entropy[CTR_DRBG_ENTROPY_LEN],
                   const uint8_t *personalization,
                   size_t personalization_len);
 
-// CTR_DRBG_reseed reseeds |drbg| given |CTR_DRBG_ENTROPY_LEN| bytes of entropy
-// in |entropy| and, optionally, up to |CTR_DRBG_ENTROPY_LEN| bytes of
-// additional data. It returns one on success or zero on error.
+// CTR_DRBG_init_key_size is the same as |CTR_DRBG_init|, except that the
+// instance uses AES with keys of |key_size|. It reads
+// |CTR_DRBG_seed_len(drbg)| bytes of entropy, and the personalization string
+// may be at most that long. It returns one on success and zero on error.
+int CTR_DRBG_init_key_size(CTR_DRBG_STATE *drbg, aes_key_size_t key_size,
+                           const uint8_t entropy[CTR_DRBG_ENTROPY_LEN],
+                           const uint8_t *personalization,
+                           size_t personalization_len);
+
+// CTR_DRBG_init_df initialises |*drbg| as an instance that uses the
+// derivation function (Block_Cipher_df, section 10.3.2) and AES with keys of
+// |key_size|. The entropy input, the nonce and the personalization string may
+// be of any length, as long as their total is less than 2^32 bytes, but
+// |entropy_len| must be at least the key length and |nonce_len| at least half
+// of it (the security strength, see section 8.6.7). It returns one on success
+// and zero on error.
+int CTR_DRBG_init_df(CTR_DRBG_STATE *drbg, aes_key_size_t key_size,
+                     const uint8_t *entropy, size_t entropy_len,
+                     const uint8_t *nonce, size_t nonce_len,
+                     const uint8_t *personalization,
+                     size_t personalization_len);
+
+// CTR_DRBG_seed_len returns the seed length of |drbg| in bytes, i.e., the
+// length of the entropy input of |CTR_DRBG_reseed| and the maximal length of
+// its additional data.
+size_t CTR_DRBG_seed_len(const CTR_DRBG_STATE *drbg);
+
+// CTR_DRBG_reseed reseeds |drbg| given |CTR_DRBG_seed_len(drbg)| bytes of
+// entropy in |entropy| and, optionally, up to |CTR_DRBG_seed_len(drbg)| bytes
+// of additional data. It returns one on success or zero on error, e.g., if
+// |drbg| uses the derivation function.
 int CTR_DRBG_reseed(CTR_DRBG_STATE *drbg,
                     const uint8_t entropy[CTR_DRBG_ENTROPY_LEN],
                     const uint8_t *additional_data,
                     size_t additional_data_len);
 
-// CTR_DRBG_generate processes to up |CTR_DRBG_ENTROPY_LEN| bytes of additional
-// data (if any) and then writes |out_len| random bytes to |out|, where
+// CTR_DRBG_reseed_df reseeds |drbg|, which must have been initialised by
+// |CTR_DRBG_init_df|, given |entropy_len| bytes of entropy (at least the key
+// length) and, optionally, additional data of any length. It returns one on
+// success or zero on error.
+int CTR_DRBG_reseed_df(CTR_DRBG_STATE *drbg, const uint8_t *entropy,
+                       size_t entropy_len, const uint8_t *additional_data,
+                       size_t additional_data_len);
+
+// CTR_DRBG_generate processes to up |CTR_DRBG_seed_len| bytes of additional
+// data (if any; of any length if |drbg| uses the derivation function) and
+// then writes |out_len| random bytes to |out|, where
 // |out_len| <= |CTR_DRBG_MAX_GENERATE_LENGTH|. It returns one on success or
 // zero on error.
 int CTR_DRBG_generate(CTR_DRBG_STATE *drbg, uint8_t *out,
@@ -71,6 +142,88 @@ int CTR_DRBG_generate(CTR_DRBG_STATE *drbg, uint8_t *out,
                       const uint8_t *additional_data,
                       size_t additional_data_len);
 
+// CTR_DRBG_generate_pr is the same as |CTR_DRBG_generate|, with prediction
+// resistance (section 9.3.1): it first reseeds |drbg| with fresh entropy
+// from |pool| and |additional_data|, through |CTR_DRBG_reseed| or
+// |CTR_DRBG_reseed_df|, and then generates without additional data. The
+// entropy input is |CTR_DRBG_seed_len| bytes long, or the key length for
+// instances with the derivation function. The call blocks only if |pool| has
+// run dry (see entropy_pool.h). It returns one on success or zero on error;
+// in particular, it fails if no entropy is available.
+int CTR_DRBG_generate_pr(CTR_DRBG_STATE *drbg, uint8_t *out, size_t out_len,
+                         const uint8_t *additional_data,
+                         size_t additional_data_len, ENTROPY_POOL *pool);
+
+// CTR_DRBG_generate_xor is the same as |CTR_DRBG_generate|, except that the
+// |len| random bytes are XORed into |inout| (e.g. to mask it) in a single
+// pass, rather than written to it. The state of |drbg| is updated exactly as
+// by |CTR_DRBG_generate|. It returns one on success or zero on error.
+int CTR_DRBG_generate_xor(CTR_DRBG_STATE *drbg, uint8_t *inout, size_t len,
+                          const uint8_t *additional_data,
+                          size_t additional_data_len);
+
+// CTR_DRBG_generate_parallel is the same as |CTR_DRBG_generate|, except that
+// the counter range of a long request is split across the worker threads of
+// |pool| (see |CTR_DRBG_pool_new|), which write their parts directly to
+// |out|. The output and the final state are identical to those of
+// |CTR_DRBG_generate|, and the update runs once, on the calling thread. It
+// returns one on success or zero on error.
+int CTR_DRBG_generate_parallel(CTR_DRBG_STATE *drbg, uint8_t *out,
+                               size_t out_len,
+                               const uint8_t *additional_data,
+                               size_t additional_data_len,
+                               CTR_DRBG_POOL *pool);
+
+// CTR_DRBG_generate_stream writes |out_len| random bytes to |out|, with no
+// limit on |out_len|. The output is split into requests of
+// |CTR_DRBG_MAX_GENERATE_LENGTH| bytes (2^19 bits, the limit of table 3), and
+// the update of step 6 runs after each one, exactly as a loop over
+// |CTR_DRBG_generate| would. |additional_data|, if any, is processed by every
+// request. It returns one on success or zero on error, e.g., when the
+// requests would exceed the reseed interval; then no output is written.
+int CTR_DRBG_generate_stream(CTR_DRBG_STATE *drbg, uint8_t *out,
+                             size_t out_len,
+                             const uint8_t *additional_data,
+                             size_t additional_data_len);
+
+// CTR_DRBG_generate_stream_parallel is the same as |CTR_DRBG_generate_stream|,
+// except that every request is computed as by |CTR_DRBG_generate_parallel|,
+// with the workers of |pool|. The output is always written with regular
+// stores.
+int CTR_DRBG_generate_stream_parallel(CTR_DRBG_STATE *drbg, uint8_t *out,
+                                      size_t out_len,
+                                      const uint8_t *additional_data,
+                                      size_t additional_data_len,
+                                      CTR_DRBG_POOL *pool);
+
+// CTR_DRBG_generate_batch runs |CTR_DRBG_generate|, without additional data,
+// for |n| independent instances: it writes |out_lens[i]| random bytes from
+// |drbgs[i]| to |outs[i]|. The instances must be distinct. Short requests
+// (e.g., PQC seeds) of up to four instances are interleaved in one pipeline,
+// with a different key per lane, including their update steps; consecutive
+// instances of the same key size share a pipeline. It returns one on success
+// or zero on error, in which case no instance was used.
+int CTR_DRBG_generate_batch(CTR_DRBG_STATE *const drbgs[],
+                            uint8_t *const outs[], const size_t out_lens[],
+                            size_t n);
+
+// CTR_DRBG_set_impl makes |drbg| use the kernels of |impl|, which must be
+// supported by the running CPU (see |aes_impl_get|) and be of the key size
+// |drbg| was initialised with. It must be called after |CTR_DRBG_init|.
+void CTR_DRBG_set_impl(CTR_DRBG_STATE *drbg, const aes_impl_t *impl);
+
+// CTR_DRBG_set_placement sets the placement of the output of |drbg|. With
+// |CTR_DRBG_PLACEMENT_STREAM|, the requests of |CTR_DRBG_generate| and
+// |CTR_DRBG_generate_pr|, and the whole output of |CTR_DRBG_generate_stream|,
+// of at least |stream_min_len| bytes (0 for |CTR_DRBG_STREAM_MIN_LEN|) are
+// written with non-temporal stores, except for up to 63 bytes at either end
+// to align them (and all of them if |out| is not 16 bytes aligned). The
+// other functions always use regular stores. It must be called after
+// |CTR_DRBG_init|, which sets |CTR_DRBG_PLACEMENT_CACHE|.
+void CTR_DRBG_set_placement(CTR_DRBG_STATE *drbg,
+                            ctr_drbg_placement_t placement,
+                            size_t stream_min_len);
+
 // CTR_DRBG_clear zeroises the state of |drbg|.
 void CTR_DRBG_clear(CTR_DRBG_STATE *drbg);
 
@@ -0,0 +1,124 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#include "ctr_drbg_buffer.h"
+
+int CTR_DRBG_buffer_init(CTR_DRBG_BUFFER *b,
+                         uint8_t *storage, size_t size,
+                         const uint8_t entropy[CTR_DRBG_ENTROPY_LEN],
+                         const uint8_t *personalization,
+                         size_t personalization_len)
+{
+    // CTR_DRBG_buffer_clear is safe to call even if this fails.
+    b->buf = NULL;
+    b->size = 0;
+    b->pos = 0;
+
+    if ((NULL == storage) ||
+        (size < CTR_DRBG_BUFFER_MIN_SIZE) ||
+        (size > CTR_DRBG_BUFFER_MAX_SIZE))
+    {
+        return 0;
+    }
+
+    if (!CTR_DRBG_init(&b->drbg, entropy, personalization,
+                       personalization_len))
+    {
+        return 0;
+    }
+
+    b->buf = storage;
+    b->size = size;
+    b->pos = size;
+
+    return 1;
+}
+
+_INLINE_ void buffer_discard(IN OUT CTR_DRBG_BUFFER *b)
+{
+    secure_clean(&b->buf[b->pos], b->size - b->pos);
+    b->pos = b->size;
+}
+
+int CTR_DRBG_buffer_reseed(CTR_DRBG_BUFFER *b,
+                           const uint8_t entropy[CTR_DRBG_ENTROPY_LEN],
+                           const uint8_t *additional_data,
+                           size_t additional_data_len)
+{
+    buffer_discard(b);
+
+    return CTR_DRBG_reseed(&b->drbg, entropy, additional_data,
+                           additional_data_len);
+}
+
+// Serve len bytes (at most the cached ones) and erase them from the cache.
+_INLINE_ void buffer_serve(OUT uint8_t *out,
+                           IN OUT CTR_DRBG_BUFFER *b,
+                           IN const size_t len)
+{
+    memcpy(out, &b->buf[b->pos], len);
+    secure_clean(&b->buf[b->pos], len);
+    b->pos += len;
+}
+
+int CTR_DRBG_buffer_generate(CTR_DRBG_BUFFER *b, uint8_t *out,
+                             size_t out_len)
+{
+    // The common case: the request is served entirely from the cache.
+    if (out_len <= b->size - b->pos)
+    {
+        buffer_serve(out, b, out_len);
+        return 1;
+    }
+
+    // Requests that are at least as long as the cache gain nothing from it.
+    if (out_len >= b->size)
+    {
+        return CTR_DRBG_generate(&b->drbg, out, out_len, NULL, 0);
+    }
+
+    // Drain the cache, refill it, and serve the rest.
+    const size_t avail = b->size - b->pos;
+    buffer_serve(out, b, avail);
+
+    if (!CTR_DRBG_generate(&b->drbg, b->buf, b->size, NULL, 0))
+    {
+        secure_clean(out, avail);
+        return 0;
+    }
+    b->pos = 0;
+
+    buffer_serve(&out[avail], b, out_len - avail);
+
+    return 1;
+}
+
+void CTR_DRBG_buffer_clear(CTR_DRBG_BUFFER *b)
+{
+    if (NULL != b->buf)
+    {
+        secure_clean(b->buf, b->size);
+    }
+
+    CTR_DRBG_clear(&b->drbg);
+    b->buf = NULL;
+    b->size = 0;
+    b->pos = 0;
+}
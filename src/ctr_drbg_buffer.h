@@ -0,0 +1,81 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#pragma once
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "ctr_drbg.h"
+
+// CTR_DRBG_BUFFER is an optional front end of a CTR_DRBG for small requests.
+// Every |CTR_DRBG_generate| call pays for a full update and a key expansion,
+// regardless of its length. The buffer instead refills |buf| with a single
+// |size| bytes generate call, and serves small requests from it with a
+// memcpy. Served bytes are erased from |buf| immediately.
+//
+// A CTR_DRBG_BUFFER is not thread safe, it is meant to be used as a per
+// thread cache.
+typedef struct {
+    CTR_DRBG_STATE drbg;
+    uint8_t *buf;
+    size_t size;
+    // The bytes in [pos, size) of |buf| were not served yet.
+    size_t pos;
+} CTR_DRBG_BUFFER;
+
+// The size limits of the buffer. A refill is one |CTR_DRBG_generate| call.
+#define CTR_DRBG_BUFFER_MIN_SIZE AES_BLOCK_SIZE
+#define CTR_DRBG_BUFFER_MAX_SIZE CTR_DRBG_MAX_GENERATE_LENGTH
+#define CTR_DRBG_BUFFER_DEFAULT_SIZE 4096
+
+// CTR_DRBG_buffer_init instantiates the DRBG of |b| as |CTR_DRBG_init| does,
+// and makes it use the caller owned |storage| of |size| bytes as its cache.
+// |size| must be in [CTR_DRBG_BUFFER_MIN_SIZE, CTR_DRBG_BUFFER_MAX_SIZE]. The
+// cache is filled on the first request. It returns one on success and zero
+// on error; |CTR_DRBG_buffer_clear| may be called in both cases.
+int CTR_DRBG_buffer_init(CTR_DRBG_BUFFER *b,
+                         uint8_t *storage, size_t size,
+                         const uint8_t entropy[CTR_DRBG_ENTROPY_LEN],
+                         const uint8_t *personalization,
+                         size_t personalization_len);
+
+// CTR_DRBG_buffer_reseed erases the cached bytes, which were generated before
+// the reseed, and reseeds the DRBG of |b| as |CTR_DRBG_reseed| does. It
+// returns one on success or zero on error.
+int CTR_DRBG_buffer_reseed(CTR_DRBG_BUFFER *b,
+                           const uint8_t entropy[CTR_DRBG_ENTROPY_LEN],
+                           const uint8_t *additional_data,
+                           size_t additional_data_len);
+
+// CTR_DRBG_buffer_generate writes |out_len| random bytes to |out|. Requests
+// shorter than the cache are served from it (refilling it when needed),
+// longer requests go directly to |CTR_DRBG_generate|. It returns one on
+// success or zero on error, in which case no bytes are left in |out|.
+int CTR_DRBG_buffer_generate(CTR_DRBG_BUFFER *b, uint8_t *out,
+                             size_t out_len);
+
+// CTR_DRBG_buffer_clear zeroises the cache and the DRBG state of |b|.
+void CTR_DRBG_buffer_clear(CTR_DRBG_BUFFER *b);
+
+#if defined(__cplusplus)
+}  // extern C
+#endif
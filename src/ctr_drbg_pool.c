@@ -0,0 +1,228 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ctr_drbg_pool.h"
+
+struct ctr_drbg_pool_s {
+    pthread_t workers[CTR_DRBG_POOL_MAX_WORKERS];
+    uint32_t num_workers;
+
+    // Serializes the callers of CTR_DRBG_pool_ctr_enc.
+    pthread_mutex_t run_lock;
+
+    // Protects job_gen, busy and stop.
+    pthread_mutex_t lock;
+    pthread_cond_t start_cv;
+    pthread_cond_t done_cv;
+    uint64_t job_gen;
+    // The number of workers that did not finish the current job.
+    uint32_t busy;
+    int stop;
+
+    // The current job. Written before job_gen is incremented.
+    const aes_impl_t *impl;
+    uint8_t *out;
+    uint8_t ctr[AES_BLOCK_SIZE];
+    uint32_t num_blocks;
+    const aes_ks_t *ks;
+    uint32_t num_chunks;
+
+    // The next chunk to claim, updated atomically.
+    ALIGN(64) uint32_t next_chunk;
+};
+
+// Set out to ctr + n, where the last 32 bits are a big-endian counter (as in
+// the CTR kernels).
+_INLINE_ void ctr32_offset(OUT uint8_t out[AES_BLOCK_SIZE],
+                           IN const uint8_t ctr[AES_BLOCK_SIZE],
+                           IN const uint32_t n)
+{
+    uint32_t word;
+
+    memcpy(out, ctr, AES_BLOCK_SIZE);
+    memcpy(&word, &out[AES_BLOCK_SIZE - 4], sizeof(word));
+    word = CRYPTO_bswap4(CRYPTO_bswap4(word) + n);
+    memcpy(&out[AES_BLOCK_SIZE - 4], &word, sizeof(word));
+}
+
+_INLINE_ void run_chunks(IN OUT CTR_DRBG_POOL *pool)
+{
+    uint8_t ctr[AES_BLOCK_SIZE];
+
+    for (;;)
+    {
+        const uint32_t c = __atomic_fetch_add(&pool->next_chunk, 1,
+                                              __ATOMIC_RELAXED);
+        if (c >= pool->num_chunks)
+        {
+            return;
+        }
+
+        const uint32_t first = c * CTR_DRBG_POOL_CHUNK_BLOCKS;
+        const uint32_t left = pool->num_blocks - first;
+        const uint32_t n = (left < CTR_DRBG_POOL_CHUNK_BLOCKS) ?
+                           left : CTR_DRBG_POOL_CHUNK_BLOCKS;
+
+        ctr32_offset(ctr, pool->ctr, first);
+        aes_ctr_enc_tuned(pool->impl, n)(&pool->out[AES_BLOCK_SIZE * first],
+                                         ctr, n, pool->ks);
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    CTR_DRBG_POOL *pool = (CTR_DRBG_POOL *)arg;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        while (!pool->stop && (pool->job_gen == seen))
+        {
+            pthread_cond_wait(&pool->start_cv, &pool->lock);
+        }
+
+        if (pool->stop)
+        {
+            break;
+        }
+
+        seen = pool->job_gen;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_chunks(pool);
+
+        pthread_mutex_lock(&pool->lock);
+        if (0 == --pool->busy)
+        {
+            pthread_cond_signal(&pool->done_cv);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+_INLINE_ void stop_workers(IN OUT CTR_DRBG_POOL *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start_cv);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (uint32_t i = 0; i < pool->num_workers; i++)
+    {
+        pthread_join(pool->workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->done_cv);
+    pthread_cond_destroy(&pool->start_cv);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->run_lock);
+    free(pool);
+}
+
+CTR_DRBG_POOL *CTR_DRBG_pool_new(uint32_t num_workers)
+{
+    if (num_workers > CTR_DRBG_POOL_MAX_WORKERS)
+    {
+        return NULL;
+    }
+
+    CTR_DRBG_POOL *pool = (CTR_DRBG_POOL *)calloc(1, sizeof(*pool));
+    if (NULL == pool)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->run_lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start_cv, NULL);
+    pthread_cond_init(&pool->done_cv, NULL);
+
+    for (; pool->num_workers < num_workers; pool->num_workers++)
+    {
+        if (0 != pthread_create(&pool->workers[pool->num_workers], NULL,
+                                worker_main, pool))
+        {
+            stop_workers(pool);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+void CTR_DRBG_pool_ctr_enc(CTR_DRBG_POOL *pool,
+                           const aes_impl_t *impl,
+                           uint8_t *out,
+                           const uint8_t ctr[AES_BLOCK_SIZE],
+                           uint32_t num_blocks,
+                           const aes_ks_t *ks)
+{
+    if ((NULL == pool) || (0 == pool->num_workers) ||
+        (num_blocks <= CTR_DRBG_POOL_CHUNK_BLOCKS))
+    {
+        aes_ctr_enc_tuned(impl, num_blocks)(out, ctr, num_blocks, ks);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->run_lock);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->impl = impl;
+    pool->out = out;
+    memcpy(pool->ctr, ctr, AES_BLOCK_SIZE);
+    pool->num_blocks = num_blocks;
+    pool->ks = ks;
+    pool->num_chunks = (num_blocks + CTR_DRBG_POOL_CHUNK_BLOCKS - 1) /
+                       CTR_DRBG_POOL_CHUNK_BLOCKS;
+    pool->next_chunk = 0;
+    pool->busy = pool->num_workers;
+    pool->job_gen++;
+    pthread_cond_broadcast(&pool->start_cv);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_chunks(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    while (0 != pool->busy)
+    {
+        pthread_cond_wait(&pool->done_cv, &pool->lock);
+    }
+    pool->ks = NULL;
+    pool->out = NULL;
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_mutex_unlock(&pool->run_lock);
+}
+
+void CTR_DRBG_pool_free(CTR_DRBG_POOL *pool)
+{
+    if (NULL != pool)
+    {
+        stop_workers(pool);
+    }
+}
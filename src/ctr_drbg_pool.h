@@ -0,0 +1,66 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#pragma once
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "ctr_drbg.h"
+
+// CTR_DRBG_POOL is a pool of worker threads that computes the CTR keystream
+// of long requests in parallel. CTR keystream blocks depend only on their
+// counter value, so the counter range of a request is split into chunks of
+// CTR_DRBG_POOL_CHUNK_BLOCKS blocks. The chunks are dynamically
+// self-scheduled: the workers and the calling thread claim the next chunk
+// from a shared atomic cursor until none is left, so faster threads take
+// more chunks. There are no per-worker ranges, and so nothing to steal.
+// Each thread writes its chunks directly to the output. The result is
+// identical to a single kernel call. The type is declared in ctr_drbg.h.
+
+#define CTR_DRBG_POOL_MAX_WORKERS 64
+
+// 4 KiB per chunk: long enough to amortize the claim, short enough to
+// balance a 64 KiB request across a few cores.
+#define CTR_DRBG_POOL_CHUNK_BLOCKS 256
+
+// CTR_DRBG_pool_new starts |num_workers| <= |CTR_DRBG_POOL_MAX_WORKERS|
+// worker threads, in addition to the calling thread. It returns NULL on
+// error.
+CTR_DRBG_POOL *CTR_DRBG_pool_new(uint32_t num_workers);
+
+// CTR_DRBG_pool_ctr_enc computes |impl->ctr_enc(out, ctr, num_blocks, ks)|
+// with the workers of |pool| and the calling thread. Short requests, or a
+// NULL |pool|, run on the calling thread only. Concurrent calls are
+// serialized.
+void CTR_DRBG_pool_ctr_enc(CTR_DRBG_POOL *pool,
+                           const aes_impl_t *impl,
+                           uint8_t *out,
+                           const uint8_t ctr[AES_BLOCK_SIZE],
+                           uint32_t num_blocks,
+                           const aes_ks_t *ks);
+
+// CTR_DRBG_pool_free stops and joins the workers and releases |pool|.
+void CTR_DRBG_pool_free(CTR_DRBG_POOL *pool);
+
+#if defined(__cplusplus)
+}  // extern C
+#endif
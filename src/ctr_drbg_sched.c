@@ -0,0 +1,296 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ctr_drbg_sched.h"
+
+#define CACHE_LINE_SIZE 64
+
+struct ctr_drbg_sched_s {
+    // Owned by the consumer.
+    CTR_DRBG_STATE *cur;
+    uint64_t bytes;
+    uint64_t calls;
+    uint64_t reseeds;
+    CTR_DRBG_RESEED_POLICY policy;
+
+    // Exchanged atomically between the consumer and the helper. pending is
+    // a ready state (or NULL), retired a state the consumer no longer uses
+    // (or NULL).
+    ALIGN(CACHE_LINE_SIZE) CTR_DRBG_STATE *pending;
+    CTR_DRBG_STATE *retired;
+    // Set by the helper when the current state is older than max_age_ms.
+    int age_due;
+    // Set by the helper when the source failed.
+    int failed;
+
+    // Used by the helper only, after CTR_DRBG_sched_new returns.
+    const entropy_source_t *src;
+    aes_key_size_t key_size;
+    size_t entropy_len;
+    uint8_t personalization[CTR_DRBG_ENTROPY_LEN];
+    size_t personalization_len;
+    // The time the current state was taken into use (approximately).
+    struct timespec since;
+
+    // The lock only guards the helper's sleep, so that no wake up is lost.
+    // It is never held while the helper reads entropy or instantiates.
+    pthread_mutex_t lock;
+    pthread_cond_t cv;
+    int stop;
+    pthread_t helper;
+
+    // The current state, and the one that is pending, retired, or being
+    // prepared by the helper.
+    ALIGN(CACHE_LINE_SIZE) CTR_DRBG_STATE states[2];
+};
+
+_INLINE_ int instantiate(IN const CTR_DRBG_SCHED *s,
+                         OUT CTR_DRBG_STATE *drbg)
+{
+    uint8_t entropy[CTR_DRBG_ENTROPY_LEN];
+
+    const int ret = s->src->fill(entropy, s->entropy_len, s->src->ctx) &&
+                    CTR_DRBG_init_key_size(drbg, s->key_size, entropy,
+                                           s->personalization,
+                                           s->personalization_len);
+
+    secure_clean(entropy, sizeof(entropy));
+    return ret;
+}
+
+// Return 1 if now is at or after since + ms. Otherwise, set deadline to
+// since + ms and return 0.
+_INLINE_ int expired(OUT struct timespec *deadline,
+                     IN const struct timespec *since,
+                     IN const uint64_t ms)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    const uint64_t nsec = (uint64_t)since->tv_nsec + (ms % 1000) * 1000000;
+    deadline->tv_sec = since->tv_sec + (time_t)(ms / 1000 + nsec / 1000000000);
+    deadline->tv_nsec = (long)(nsec % 1000000000);
+
+    return (now.tv_sec > deadline->tv_sec) ||
+           ((now.tv_sec == deadline->tv_sec) &&
+            (now.tv_nsec >= deadline->tv_nsec));
+}
+
+static void *helper_main(void *arg)
+{
+    CTR_DRBG_SCHED *s = (CTR_DRBG_SCHED *)arg;
+    CTR_DRBG_STATE *spare = &s->states[1];
+    struct timespec deadline;
+
+    pthread_mutex_lock(&s->lock);
+    while (!s->stop)
+    {
+        CTR_DRBG_STATE *old = __atomic_exchange_n(&s->retired, NULL,
+                                                  __ATOMIC_ACQUIRE);
+        if (NULL != old)
+        {
+            CTR_DRBG_clear(old);
+            spare = old;
+            clock_gettime(CLOCK_MONOTONIC, &s->since);
+            __atomic_store_n(&s->age_due, 0, __ATOMIC_RELAXED);
+        }
+
+        // Prepare the next state as soon as there is memory for it, so that
+        // it is ready when the reseed becomes due.
+        if (NULL != spare)
+        {
+            pthread_mutex_unlock(&s->lock);
+            const int ok = instantiate(s, spare);
+            pthread_mutex_lock(&s->lock);
+
+            if (!ok)
+            {
+                CTR_DRBG_clear(spare);
+                __atomic_store_n(&s->failed, 1, __ATOMIC_RELEASE);
+                break;
+            }
+
+            __atomic_store_n(&s->pending, spare, __ATOMIC_RELEASE);
+            spare = NULL;
+            continue;
+        }
+
+        if ((0 == s->policy.max_age_ms) ||
+            __atomic_load_n(&s->age_due, __ATOMIC_RELAXED))
+        {
+            pthread_cond_wait(&s->cv, &s->lock);
+        }
+        else if (expired(&deadline, &s->since, s->policy.max_age_ms))
+        {
+            __atomic_store_n(&s->age_due, 1, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            pthread_cond_timedwait(&s->cv, &s->lock, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return NULL;
+}
+
+_INLINE_ void release(IN OUT CTR_DRBG_SCHED *s)
+{
+    CTR_DRBG_clear(&s->states[0]);
+    CTR_DRBG_clear(&s->states[1]);
+    secure_clean(s->personalization, sizeof(s->personalization));
+
+    pthread_cond_destroy(&s->cv);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+}
+
+CTR_DRBG_SCHED *CTR_DRBG_sched_new(const entropy_source_t *src,
+                                   aes_key_size_t key_size,
+                                   const CTR_DRBG_RESEED_POLICY *policy,
+                                   const uint8_t *personalization,
+                                   size_t personalization_len)
+{
+    pthread_condattr_t attr;
+    void *p = NULL;
+
+    if ((NULL == src) || (NULL == policy) ||
+        (key_size >= AES_KEY_SIZE_COUNT) ||
+        (personalization_len > CTR_DRBG_ENTROPY_LEN) ||
+        (0 != posix_memalign(&p, CACHE_LINE_SIZE, sizeof(CTR_DRBG_SCHED))))
+    {
+        return NULL;
+    }
+
+    CTR_DRBG_SCHED *s = (CTR_DRBG_SCHED *)p;
+    memset(s, 0, sizeof(*s));
+
+    s->policy = *policy;
+    s->src = src;
+    s->key_size = key_size;
+    s->entropy_len = CTR_DRBG_SEED_LEN(aes_impl_default(key_size)->key_len);
+    if (personalization_len > 0)
+    {
+        memcpy(s->personalization, personalization, personalization_len);
+    }
+    s->personalization_len = personalization_len;
+
+    // The deadlines of max_age_ms must not move with the wall clock.
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s->cv, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&s->lock, NULL);
+
+    s->cur = &s->states[0];
+    clock_gettime(CLOCK_MONOTONIC, &s->since);
+
+    if (!instantiate(s, s->cur) ||
+        (0 != pthread_create(&s->helper, NULL, helper_main, s)))
+    {
+        release(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+// Take the pending state, if there is one, and retire the current state to
+// the helper. It returns 0 only if no new state will come.
+_INLINE_ int switch_state(IN OUT CTR_DRBG_SCHED *s)
+{
+    CTR_DRBG_STATE *next = __atomic_exchange_n(&s->pending, NULL,
+                                               __ATOMIC_ACQUIRE);
+    if (NULL == next)
+    {
+        // The helper is still busy; keep using the current state.
+        return !__atomic_load_n(&s->failed, __ATOMIC_ACQUIRE);
+    }
+
+    CTR_DRBG_STATE *old = s->cur;
+    s->cur = next;
+    s->bytes = 0;
+    s->calls = 0;
+    s->reseeds++;
+
+    __atomic_store_n(&s->retired, old, __ATOMIC_RELEASE);
+
+    // The helper holds the lock only around its sleep.
+    pthread_mutex_lock(&s->lock);
+    pthread_cond_signal(&s->cv);
+    pthread_mutex_unlock(&s->lock);
+
+    return 1;
+}
+
+int CTR_DRBG_sched_generate(CTR_DRBG_SCHED *s, uint8_t *out, size_t out_len,
+                            const uint8_t *additional_data,
+                            size_t additional_data_len)
+{
+    const CTR_DRBG_RESEED_POLICY *policy = &s->policy;
+
+    if (((0 != policy->max_bytes) && (s->bytes >= policy->max_bytes)) ||
+        ((0 != policy->max_calls) && (s->calls >= policy->max_calls)) ||
+        __atomic_load_n(&s->age_due, __ATOMIC_RELAXED))
+    {
+        if (!switch_state(s))
+        {
+            return 0;
+        }
+    }
+
+    if (!CTR_DRBG_generate(s->cur, out, out_len, additional_data,
+                           additional_data_len))
+    {
+        return 0;
+    }
+
+    s->bytes += out_len;
+    s->calls++;
+
+    return 1;
+}
+
+uint64_t CTR_DRBG_sched_reseeds(const CTR_DRBG_SCHED *s)
+{
+    return s->reseeds;
+}
+
+void CTR_DRBG_sched_free(CTR_DRBG_SCHED *s)
+{
+    if (NULL == s)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_signal(&s->cv);
+    pthread_mutex_unlock(&s->lock);
+
+    pthread_join(s->helper, NULL);
+    release(s);
+}
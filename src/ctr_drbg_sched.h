@@ -0,0 +1,84 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#pragma once
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "ctr_drbg.h"
+
+// CTR_DRBG_SCHED reseeds a CTR_DRBG in the background, according to a
+// policy. A helper thread prepares the next state ahead of time: it reads
+// fresh entropy from a source and instantiates a new state with it (SP
+// 800-90Ar1, section 8.6.8, allows a new instantiation in place of a
+// reseed), including its key expansion. It publishes the state through an
+// atomic pointer. When a limit of the policy is reached, the next generate
+// call takes the published state with an atomic exchange and continues with
+// it, and retires the old state to the helper, which erases it and reuses its
+// memory for the state after. A generate call never waits for the entropy
+// source or the key expansion: if no state is published yet (the helper is
+// still busy), it continues with the current one.
+//
+// A CTR_DRBG_SCHED has one consumer, like a CTR_DRBG_BUFFER: concurrent
+// generate calls are not allowed. Use one scheduler per thread.
+typedef struct ctr_drbg_sched_s CTR_DRBG_SCHED;
+
+// The limits of the current state. A reseed is due once the state has
+// generated |max_bytes| bytes, served |max_calls| generate calls, or was
+// published |max_age_ms| milliseconds ago, whichever comes first. A zero
+// field means no limit of that kind.
+typedef struct {
+    uint64_t max_bytes;
+    uint64_t max_calls;
+    uint64_t max_age_ms;
+} CTR_DRBG_RESEED_POLICY;
+
+// CTR_DRBG_sched_new instantiates the first state, of |key_size|, from |src|
+// and starts the helper thread. |src| must outlive the scheduler, and is
+// only called by the helper afterwards. Every state is instantiated with
+// |CTR_DRBG_init_key_size|, with the optional |personalization| of up to
+// |CTR_DRBG_SEED_LEN| bytes, which is copied. It returns NULL on error.
+CTR_DRBG_SCHED *CTR_DRBG_sched_new(const entropy_source_t *src,
+                                   aes_key_size_t key_size,
+                                   const CTR_DRBG_RESEED_POLICY *policy,
+                                   const uint8_t *personalization,
+                                   size_t personalization_len);
+
+// CTR_DRBG_sched_generate switches to the published state if a reseed is
+// due, and then runs |CTR_DRBG_generate| on the current state. It returns
+// one on success or zero on error. If a reseed is due and the source failed,
+// no new state will come, and it fails.
+int CTR_DRBG_sched_generate(CTR_DRBG_SCHED *s, uint8_t *out, size_t out_len,
+                            const uint8_t *additional_data,
+                            size_t additional_data_len);
+
+// CTR_DRBG_sched_reseeds returns the number of state switches so far. It
+// must be called by the consumer.
+uint64_t CTR_DRBG_sched_reseeds(const CTR_DRBG_SCHED *s);
+
+// CTR_DRBG_sched_free stops the helper thread, zeroises all the states and
+// releases |s|.
+void CTR_DRBG_sched_free(CTR_DRBG_SCHED *s);
+
+#if defined(__cplusplus)
+}  // extern C
+#endif
@@ -0,0 +1,599 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#include <pthread.h>
+#include <string.h>
+#include "ctr_drbg_self_test.h"
+
+// The longest inputs of the vectors: the AES-256 seed length, and 512
+// returned bits.
+#define SELF_TEST_MAX_LEN CTR_DRBG_ENTROPY_LEN
+#define SELF_TEST_RETURNED_LEN 64
+
+// The length of the long generate calls: beyond the fused requests and the
+// medium size class, with a partial last block.
+#define SELF_TEST_LONG_LEN (8 * 1024 + 45)
+#define SELF_TEST_LONG_BLOCKS \
+    ((SELF_TEST_LONG_LEN + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE)
+
+typedef enum
+{
+    SELF_TEST_UNTESTED=0,
+    SELF_TEST_RUNNING,
+    SELF_TEST_PASSED,
+    SELF_TEST_FAILED
+} self_test_state_t;
+
+typedef struct self_test_vector_s {
+    aes_key_size_t key_size;
+    int use_df;
+    uint8_t entropy_len;
+    uint8_t nonce_len;
+    uint8_t personalization_len;
+    uint8_t additional_len;
+    uint8_t entropy[SELF_TEST_MAX_LEN];
+    uint8_t nonce[AES_BLOCK_SIZE];
+    uint8_t personalization[SELF_TEST_MAX_LEN];
+    uint8_t entropy_reseed[SELF_TEST_MAX_LEN];
+    uint8_t additional_reseed[SELF_TEST_MAX_LEN];
+    uint8_t additional1[SELF_TEST_MAX_LEN];
+    uint8_t additional2[SELF_TEST_MAX_LEN];
+    // The output of the second generate call.
+    uint8_t returned[SELF_TEST_RETURNED_LEN];
+} self_test_vector_t;
+
+// From KATs/CTR_DRBG_pr_false.txt.
+static const self_test_vector_t g_vectors[] = {
+    // [AES-128 no df] COUNT = 0, no personalization or additional input.
+    {
+        AES_KEY_128, 0, 32, 0, 0, 0,
+        {0xed, 0x1e, 0x7f, 0x21, 0xef, 0x66, 0xea, 0x5d, 0x8e, 0x2a, 0x85, 0xb9,
+         0x33, 0x72, 0x45, 0x44, 0x5b, 0x71, 0xd6, 0x39, 0x3a, 0x4e, 0xec, 0xb0,
+         0xe6, 0x3c, 0x19, 0x3d, 0x0f, 0x72, 0xf9, 0xa9},
+        {0},
+        {0},
+        {0x30, 0x3f, 0xb5, 0x19, 0xf0, 0xa4, 0xe1, 0x7d, 0x6d, 0xf0, 0xb6, 0x42,
+         0x6a, 0xa0, 0xec, 0xb2, 0xa3, 0x60, 0x79, 0xbd, 0x48, 0xbe, 0x47, 0xad,
+         0x2a, 0x8d, 0xbf, 0xe4, 0x8d, 0xa3, 0xef, 0xad},
+        {0},
+        {0},
+        {0},
+        {0xf8, 0x01, 0x11, 0xd0, 0x8e, 0x87, 0x46, 0x72, 0xf3, 0x2f, 0x42, 0x99,
+         0x71, 0x33, 0xa5, 0x21, 0x0f, 0x7a, 0x93, 0x75, 0xe2, 0x2c, 0xea, 0x70,
+         0x58, 0x7f, 0x9c, 0xfa, 0xfe, 0xbe, 0x0f, 0x6a, 0x6a, 0xa2, 0xeb, 0x68,
+         0xe7, 0xdd, 0x91, 0x64, 0x53, 0x6d, 0x53, 0xfa, 0x02, 0x0f, 0xca, 0xb2,
+         0x0f, 0x54, 0xca, 0xdd, 0xfa, 0xb7, 0xd6, 0xd9, 0x1e, 0x5f, 0xfe, 0xc1,
+         0xdf, 0xd8, 0xde, 0xaa}
+    },
+    // [AES-128 no df] COUNT = 0, with personalization and additional input.
+    {
+        AES_KEY_128, 0, 32, 0, 32, 32,
+        {0x28, 0x9e, 0x5c, 0x82, 0x83, 0xcb, 0xd7, 0xdb, 0xe7, 0x07, 0x25, 0x5c,
+         0xb3, 0xcf, 0x29, 0x07, 0xd8, 0xa5, 0xce, 0x5b, 0x34, 0x73, 0x14, 0x96,
+         0x6f, 0x9b, 0x2b, 0xeb, 0xb1, 0xa1, 0xe2, 0x00},
+        {0},
+        {0x7f, 0x7b, 0x59, 0xf2, 0x35, 0x10, 0xb9, 0x76, 0xfe, 0x15, 0x5d, 0x04,
+         0x75, 0x25, 0xc9, 0x4e, 0x2d, 0xac, 0xb3, 0x0d, 0x77, 0xac, 0x8b, 0x09,
+         0x28, 0x15, 0x44, 0xdd, 0x81, 0x5d, 0x52, 0x93},
+        {0x98, 0xc5, 0x22, 0x02, 0x8f, 0x36, 0xfc, 0x6b, 0x85, 0xa8, 0xf3, 0xc0,
+         0x03, 0xef, 0xd4, 0xb1, 0x30, 0xdd, 0x90, 0x18, 0x0e, 0xc8, 0x1c, 0xf7,
+         0xc6, 0x7d, 0x4c, 0x53, 0xd1, 0x0f, 0x00, 0x22},
+        {0xf7, 0xa0, 0x37, 0x83, 0x28, 0xd9, 0x39, 0xf0, 0xf8, 0x52, 0x1e, 0x39,
+         0x40, 0x9d, 0x71, 0x75, 0xd8, 0x73, 0x19, 0xc7, 0x59, 0x7a, 0x90, 0x50,
+         0x41, 0x4f, 0x7a, 0xdc, 0x39, 0x2a, 0x32, 0x8d},
+        {0x19, 0xc2, 0x86, 0xf5, 0xb3, 0x61, 0x94, 0xd1, 0xcc, 0x62, 0xc0, 0x18,
+         0x81, 0x40, 0xbc, 0x9d, 0x61, 0xd2, 0xa9, 0xc5, 0xd8, 0x8b, 0xb5, 0xae,
+         0xbc, 0x22, 0x4b, 0xfb, 0x04, 0xdf, 0xca, 0x83},
+        {0x82, 0x06, 0x50, 0xc3, 0x20, 0x1d, 0x34, 0x7f, 0x5b, 0x20, 0xd3, 0xd2,
+         0x5d, 0x1c, 0x8c, 0x7b, 0xef, 0x4d, 0x9f, 0x66, 0xa5, 0xa0, 0x4c, 0x7d,
+         0xd9, 0xd6, 0x69, 0xe9, 0x51, 0x82, 0xa0, 0xc4},
+        {0x79, 0xa7, 0x9d, 0x44, 0xed, 0xad, 0xa5, 0x8e, 0x3f, 0xc1, 0x2a, 0x4e,
+         0x36, 0xae, 0x90, 0x0e, 0xea, 0xce, 0x29, 0x02, 0x65, 0xf0, 0x12, 0x62,
+         0xf4, 0x0f, 0x29, 0x58, 0xa7, 0x0d, 0xcb, 0xd4, 0xd4, 0x18, 0x5f, 0x70,
+         0x8c, 0x08, 0x8e, 0xde, 0x7f, 0xf8, 0xc8, 0x37, 0x5f, 0x44, 0xf4, 0x01,
+         0x2f, 0x25, 0x12, 0xd3, 0x83, 0x28, 0xa5, 0xdf, 0x17, 0x1a, 0x17, 0x02,
+         0x9d, 0x90, 0xf1, 0x85}
+    },
+    // [AES-192 no df] COUNT = 0, no personalization or additional input.
+    {
+        AES_KEY_192, 0, 40, 0, 0, 0,
+        {0xd6, 0xe1, 0x8f, 0x45, 0x65, 0xfd, 0xf2, 0x82, 0x6d, 0x0d, 0x56, 0x41,
+         0x96, 0x47, 0xc0, 0x20, 0x41, 0x3b, 0x96, 0x32, 0x99, 0xd8, 0xde, 0x2c,
+         0x65, 0x10, 0x27, 0x7f, 0x8c, 0xe9, 0x88, 0xa7, 0xf0, 0xb3, 0xbc, 0x1d,
+         0xf8, 0x5b, 0x15, 0x3f},
+        {0},
+        {0},
+        {0xa8, 0x23, 0xd6, 0x31, 0x1f, 0x9f, 0x66, 0xdf, 0x32, 0x9e, 0x3d, 0x70,
+         0x65, 0xe2, 0x4f, 0xe2, 0x50, 0x7e, 0x6b, 0x9d, 0xbc, 0xc2, 0x28, 0x38,
+         0x48, 0x3f, 0xa7, 0x29, 0xca, 0x51, 0x16, 0xd0, 0x3a, 0x91, 0x02, 0x81,
+         0x39, 0xd7, 0x13, 0x0a},
+        {0},
+        {0},
+        {0},
+        {0x4b, 0xf8, 0x06, 0x69, 0x0a, 0xf1, 0x3d, 0xbc, 0xfd, 0x44, 0x8c, 0x79,
+         0xa3, 0x53, 0x2e, 0x00, 0x0b, 0xca, 0xbc, 0xef, 0x36, 0xf2, 0x64, 0x3f,
+         0x3e, 0x1c, 0x9d, 0xe6, 0x07, 0x10, 0x42, 0x82, 0xf8, 0x1c, 0xd6, 0xcd,
+         0xcf, 0x8d, 0xa8, 0x42, 0x9c, 0x94, 0x10, 0x82, 0x45, 0x11, 0x4d, 0x3d,
+         0xa1, 0x7b, 0x9f, 0x48, 0xbb, 0x07, 0x09, 0x4c, 0x07, 0x3a, 0x94, 0xf5,
+         0xd2, 0xef, 0x9e, 0x30}
+    },
+    // [AES-192 no df] COUNT = 0, with personalization and additional input.
+    {
+        AES_KEY_192, 0, 40, 0, 40, 40,
+        {0x4b, 0x58, 0x27, 0x1b, 0x11, 0x62, 0x37, 0xee, 0xdd, 0x4e, 0x9f, 0xf9,
+         0x36, 0x03, 0x82, 0xa5, 0x9f, 0x3e, 0x2a, 0x17, 0x3d, 0x86, 0x0f, 0x2b,
+         0xbd, 0x8b, 0x2b, 0xac, 0xe1, 0x42, 0xb2, 0x39, 0x5c, 0x67, 0xcf, 0x5a,
+         0x51, 0x3f, 0x06, 0xf3},
+        {0},
+        {0xcf, 0x76, 0xc1, 0x6c, 0xd5, 0xd2, 0x70, 0x70, 0x7e, 0xa9, 0xac, 0xc3,
+         0x97, 0x44, 0xdb, 0x69, 0xbf, 0xac, 0x63, 0xe5, 0x66, 0x25, 0x6f, 0xd6,
+         0x91, 0x7b, 0xf9, 0x81, 0x96, 0x79, 0x84, 0x0f, 0x3f, 0xea, 0x2a, 0xa5,
+         0x35, 0xd8, 0xdf, 0x01},
+        {0x18, 0x67, 0xf3, 0x71, 0xa3, 0x45, 0xee, 0xf9, 0x8b, 0x2d, 0x70, 0xfc,
+         0x19, 0x60, 0x39, 0x78, 0x92, 0x64, 0x5b, 0x7b, 0x29, 0xa4, 0xea, 0xd2,
+         0x52, 0xe8, 0x83, 0x5e, 0x0b, 0x60, 0x06, 0x18, 0xa9, 0xbd, 0x6f, 0xf9,
+         0x97, 0x85, 0xd8, 0x90},
+        {0x6d, 0x44, 0x83, 0x9a, 0xff, 0x8b, 0x71, 0x65, 0xde, 0xeb, 0xd4, 0x89,
+         0xad, 0x08, 0x8e, 0xcb, 0x7d, 0xce, 0xc1, 0x1c, 0x32, 0xb1, 0xe7, 0x47,
+         0xdb, 0xa8, 0xf0, 0xe8, 0xa0, 0xb8, 0x9f, 0x74, 0xa8, 0x4e, 0xa8, 0xa0,
+         0x55, 0x86, 0xfe, 0x9e},
+        {0x42, 0x24, 0x8f, 0xce, 0x09, 0x94, 0xe0, 0xe6, 0x35, 0x04, 0x20, 0x9d,
+         0x62, 0x9a, 0x69, 0x43, 0xeb, 0x3e, 0x2a, 0xd5, 0x12, 0xf0, 0x3f, 0x79,
+         0xcb, 0xd5, 0x10, 0x29, 0x28, 0x39, 0x2b, 0xce, 0x1c, 0xac, 0xbb, 0xa0,
+         0x56, 0xac, 0x6c, 0xa9},
+        {0xbd, 0x52, 0x9b, 0x60, 0x02, 0x73, 0x32, 0x94, 0x23, 0xa5, 0x8d, 0x6f,
+         0x8a, 0x12, 0xbe, 0x0f, 0x17, 0x98, 0x9a, 0x02, 0xe7, 0x3e, 0x34, 0x7b,
+         0xc7, 0xd4, 0x9d, 0x91, 0x69, 0x33, 0x7a, 0x6c, 0xff, 0x7c, 0x07, 0xe8,
+         0xa8, 0x07, 0xa8, 0x0a},
+        {0x02, 0x48, 0x6d, 0x32, 0xcd, 0x55, 0x95, 0x4f, 0x40, 0x6b, 0xa5, 0x57,
+         0x05, 0xf1, 0x46, 0x0d, 0x38, 0x44, 0x39, 0x59, 0x2d, 0xed, 0xe8, 0x1a,
+         0x84, 0xfd, 0xa2, 0x21, 0xfd, 0x45, 0xc0, 0xd6, 0x51, 0xd6, 0x7e, 0xc4,
+         0xa8, 0x1a, 0x8b, 0x40, 0x41, 0x51, 0xa6, 0x43, 0xf3, 0x31, 0xad, 0x05,
+         0x1c, 0xb0, 0x04, 0x35, 0x22, 0x89, 0xde, 0x37, 0xbc, 0xa7, 0x1e, 0x8c,
+         0xc0, 0xa6, 0xae, 0xab}
+    },
+    // [AES-256 no df] COUNT = 0, no personalization or additional input.
+    {
+        AES_KEY_256, 0, 48, 0, 0, 0,
+        {0xe4, 0xbc, 0x23, 0xc5, 0x08, 0x9a, 0x19, 0xd8, 0x6f, 0x41, 0x19, 0xcb,
+         0x3f, 0xa0, 0x8c, 0x0a, 0x49, 0x91, 0xe0, 0xa1, 0xde, 0xf1, 0x7e, 0x10,
+         0x1e, 0x4c, 0x14, 0xd9, 0xc3, 0x23, 0x46, 0x0a, 0x7c, 0x2f, 0xb5, 0x8e,
+         0x0b, 0x08, 0x6c, 0x6c, 0x57, 0xb5, 0x5f, 0x56, 0xca, 0xe2, 0x5b, 0xad},
+        {0},
+        {0},
+        {0xfd, 0x85, 0xa8, 0x36, 0xbb, 0xa8, 0x50, 0x19, 0x88, 0x1e, 0x8c, 0x6b,
+         0xad, 0x23, 0xc9, 0x06, 0x1a, 0xdc, 0x75, 0x47, 0x76, 0x59, 0xac, 0xae,
+         0xa8, 0xe4, 0xa0, 0x1d, 0xfe, 0x07, 0xa1, 0x83, 0x2d, 0xad, 0x1c, 0x13,
+         0x6f, 0x59, 0xd7, 0x0f, 0x86, 0x53, 0xa5, 0xdc, 0x11, 0x86, 0x63, 0xd6},
+        {0},
+        {0},
+        {0},
+        {0xb2, 0xcb, 0x89, 0x05, 0xc0, 0x5e, 0x59, 0x50, 0xca, 0x31, 0x89, 0x50,
+         0x96, 0xbe, 0x29, 0xea, 0x3d, 0x5a, 0x3b, 0x82, 0xb2, 0x69, 0x49, 0x55,
+         0x54, 0xeb, 0x80, 0xfe, 0x07, 0xde, 0x43, 0xe1, 0x93, 0xb9, 0xe7, 0xc3,
+         0xec, 0xe7, 0x3b, 0x80, 0xe0, 0x62, 0xb1, 0xc1, 0xf6, 0x82, 0x02, 0xfb,
+         0xb1, 0xc5, 0x2a, 0x04, 0x0e, 0xa2, 0x47, 0x88, 0x64, 0x29, 0x52, 0x82,
+         0x23, 0x4a, 0xaa, 0xda}
+    },
+    // [AES-256 no df] COUNT = 0, with personalization and additional input.
+    {
+        AES_KEY_256, 0, 48, 0, 48, 48,
+        {0xae, 0x7e, 0xbe, 0x06, 0x29, 0x71, 0xf5, 0xeb, 0x32, 0xe5, 0xb2, 0x14,
+         0x44, 0x75, 0x07, 0x85, 0xde, 0x81, 0x65, 0x95, 0xad, 0x2c, 0xbe, 0x80,
+         0xa2, 0x09, 0xc8, 0xf8, 0xab, 0x04, 0xb5, 0x46, 0x81, 0x66, 0xde, 0x8c,
+         0x6a, 0xe5, 0x22, 0xd8, 0xf1, 0x0b, 0x56, 0x38, 0x6a, 0x3b, 0x42, 0x4f},
+        {0},
+        {0x55, 0x86, 0x0d, 0xae, 0x57, 0xfc, 0xac, 0x29, 0x70, 0x87, 0xc1, 0x37,
+         0xef, 0xb7, 0x96, 0x87, 0x8a, 0x75, 0x86, 0x8f, 0x6e, 0x76, 0x81, 0x11,
+         0x4e, 0x9b, 0x73, 0xed, 0x0c, 0x67, 0xe3, 0xc6, 0x2b, 0xfc, 0x9f, 0x5d,
+         0x77, 0xe8, 0xca, 0xa5, 0x9b, 0xcd, 0xb2, 0x23, 0xf4, 0xff, 0xd2, 0x47},
+        {0xa4, 0x24, 0x07, 0x93, 0x1b, 0xfe, 0xca, 0x70, 0xe6, 0xee, 0x5d, 0xd1,
+         0x97, 0x02, 0x1a, 0x12, 0x95, 0x25, 0x05, 0x1c, 0x07, 0x46, 0x8e, 0x8b,
+         0x25, 0x58, 0x7c, 0x5a, 0xd5, 0x0a, 0xbe, 0x92, 0x04, 0xe8, 0x82, 0xfe,
+         0x84, 0x7b, 0x8f, 0xd4, 0x7c, 0xf7, 0xb4, 0x36, 0x0e, 0x5a, 0xa0, 0x34},
+        {0xee, 0x4c, 0x88, 0xd1, 0xeb, 0x05, 0xf4, 0x85, 0x36, 0x63, 0xea, 0xda,
+         0x50, 0x1d, 0x2f, 0xc4, 0xb4, 0x98, 0x4b, 0x28, 0x3a, 0x88, 0xdb, 0x57,
+         0x9a, 0xf2, 0x11, 0x30, 0x31, 0xe0, 0x3d, 0x9b, 0xc5, 0x70, 0xde, 0x94,
+         0x3d, 0xd1, 0x68, 0x91, 0x8f, 0x3b, 0xa8, 0x06, 0x55, 0x81, 0xfe, 0xa7},
+        {0x4b, 0x4b, 0x03, 0xef, 0x19, 0xb0, 0xf2, 0x59, 0xdc, 0xa2, 0xb3, 0xee,
+         0x3a, 0xe4, 0xcd, 0x86, 0xc3, 0x89, 0x5a, 0x78, 0x4b, 0x3d, 0x8e, 0xee,
+         0x04, 0x3a, 0x20, 0x03, 0xc0, 0x82, 0x89, 0xf8, 0xff, 0xfd, 0xad, 0x14,
+         0x1e, 0x6b, 0x1a, 0xb2, 0x17, 0x4d, 0x8d, 0x5d, 0x79, 0xc1, 0xe5, 0x81},
+        {0x30, 0x62, 0xb3, 0x3f, 0x11, 0x6b, 0x46, 0xe2, 0x0f, 0xe3, 0xc3, 0x54,
+         0x72, 0x6a, 0xe9, 0xb2, 0xa3, 0xa4, 0xc5, 0x19, 0x22, 0xc8, 0x10, 0x78,
+         0x63, 0xcb, 0x86, 0xf1, 0xf0, 0xbd, 0xad, 0x75, 0x54, 0x07, 0x56, 0x59,
+         0xd9, 0x1c, 0x37, 0x1e, 0x2b, 0x11, 0xb1, 0xe8, 0x10, 0x6a, 0x1e, 0xd5},
+        {0x0d, 0x27, 0x05, 0x18, 0xba, 0xea, 0xfa, 0xc1, 0x60, 0xff, 0x1c, 0xb2,
+         0x8c, 0x11, 0xef, 0x68, 0x71, 0x2c, 0x76, 0x4c, 0x0c, 0x01, 0x67, 0x4e,
+         0x6c, 0x9c, 0xa2, 0xcc, 0x9c, 0x7e, 0x0e, 0x8a, 0xcc, 0xfd, 0x3c, 0x75,
+         0x36, 0x35, 0xee, 0x07, 0x00, 0x81, 0xee, 0xe7, 0x62, 0x8a, 0xf6, 0x18,
+         0x7f, 0xbc, 0x28, 0x54, 0xb3, 0xc2, 0x04, 0x46, 0x1a, 0x79, 0x6c, 0xf3,
+         0xf3, 0xfc, 0xb0, 0x92}
+    },
+    // [AES-128 use df] COUNT = 0, with personalization and additional input.
+    {
+        AES_KEY_128, 1, 16, 8, 16, 16,
+        {0xe1, 0x4e, 0xd7, 0x06, 0x4a, 0x97, 0x81, 0x4d, 0xd3, 0x26, 0xb9, 0xa0,
+         0x5b, 0xc4, 0x45, 0x43},
+        {0x87, 0x62, 0x40, 0xc1, 0xf7, 0xde, 0x3d, 0xba},
+        {0x26, 0xcc, 0xf5, 0x68, 0x48, 0xa0, 0x48, 0x72, 0x1d, 0x0a, 0xad, 0x87,
+         0xd6, 0xfc, 0x65, 0xf0},
+        {0x7e, 0xc4, 0xac, 0x66, 0x0f, 0xa0, 0xbb, 0xfa, 0x66, 0xac, 0x38, 0x02,
+         0xe5, 0x11, 0x90, 0x1f},
+        {0x88, 0x35, 0xd2, 0x8e, 0x7f, 0x85, 0xa4, 0xe9, 0x50, 0x87, 0xbd, 0xd1,
+         0xbb, 0x7a, 0xd5, 0x7e},
+        {0x2a, 0x9b, 0xd5, 0x0b, 0xbb, 0x20, 0xfe, 0xfe, 0x24, 0x64, 0x9f, 0x5f,
+         0x80, 0xee, 0xde, 0x66},
+        {0xf7, 0xce, 0x3d, 0x5c, 0x6c, 0x38, 0x1e, 0x56, 0xb2, 0x54, 0x10, 0xc6,
+         0x90, 0x9c, 0x10, 0x74},
+        {0xd2, 0xf3, 0x13, 0x0d, 0x30, 0x9b, 0xed, 0x1d, 0xa6, 0x55, 0x45, 0xb9,
+         0xd7, 0x93, 0xe0, 0x35, 0xfd, 0x25, 0x64, 0x30, 0x3d, 0x1f, 0xdc, 0xfb,
+         0x6c, 0x7f, 0xee, 0x01, 0x95, 0x00, 0xd9, 0xf5, 0xd4, 0x34, 0xfa, 0xb2,
+         0xd3, 0xc8, 0xd1, 0x5e, 0x39, 0xa2, 0x5f, 0x96, 0x5a, 0xaa, 0x80, 0x4c,
+         0x71, 0x41, 0x40, 0x7e, 0x90, 0xc4, 0xa8, 0x6a, 0x6c, 0x8d, 0x30, 0x3c,
+         0xe8, 0x3b, 0xfb, 0x34}
+    },
+    // [AES-192 use df] COUNT = 0, with personalization and additional input.
+    {
+        AES_KEY_192, 1, 24, 16, 32, 32,
+        {0xc4, 0xb1, 0xe6, 0xa9, 0x95, 0x87, 0xea, 0xcd, 0x7e, 0xc8, 0x51, 0x7f,
+         0x40, 0xf9, 0x43, 0x3c, 0xa4, 0x32, 0xce, 0xa8, 0x68, 0x64, 0x33, 0xf0},
+        {0xd0, 0x3a, 0x29, 0xe5, 0x48, 0xe5, 0x8c, 0xa7, 0xcb, 0xf0, 0xac, 0x70,
+         0x7b, 0x14, 0x64, 0xe3},
+        {0x0d, 0xaa, 0xea, 0xd2, 0x17, 0x79, 0xb2, 0xa4, 0x28, 0xd2, 0xb7, 0xfb,
+         0x12, 0xd9, 0xab, 0x83, 0x16, 0x89, 0x9e, 0xdb, 0xe2, 0x6b, 0x54, 0x60,
+         0xde, 0x15, 0x49, 0xc9, 0x9e, 0x47, 0x81, 0xc9},
+        {0x22, 0x29, 0x14, 0x4c, 0x1b, 0x4e, 0xfb, 0x79, 0xab, 0x5f, 0xe0, 0x79,
+         0xcd, 0xa2, 0x6b, 0xc3, 0x3a, 0xcb, 0xb2, 0xa0, 0xa8, 0x7f, 0x64, 0x2c},
+        {0xf1, 0x16, 0xa6, 0x83, 0xca, 0x48, 0x5f, 0xda, 0x84, 0x6a, 0x59, 0x8b,
+         0x8d, 0x9b, 0x07, 0x9e, 0x78, 0xc2, 0x82, 0x82, 0x86, 0xad, 0x53, 0x0b,
+         0xf0, 0x1f, 0x69, 0x3c, 0xc8, 0xaf, 0x9f, 0x84},
+        {0x7c, 0x89, 0xde, 0x35, 0x32, 0x98, 0x93, 0x5b, 0xd2, 0x6a, 0xa1, 0x85,
+         0x17, 0x35, 0x53, 0x13, 0xdf, 0x06, 0x30, 0xda, 0x5f, 0x45, 0xea, 0x02,
+         0x40, 0xe8, 0x09, 0x17, 0x93, 0x63, 0x08, 0x0b},
+        {0xe9, 0x78, 0xb8, 0xfe, 0x56, 0xaf, 0xc9, 0x08, 0xbe, 0xd1, 0x29, 0xa4,
+         0x6d, 0x57, 0xa8, 0x69, 0x8d, 0x66, 0x03, 0x4d, 0x4d, 0xbc, 0xc7, 0xab,
+         0xa3, 0xa3, 0x3d, 0x57, 0x96, 0xfb, 0x75, 0x59},
+        {0x8c, 0xe7, 0xe9, 0x58, 0x9c, 0x29, 0x75, 0xfd, 0x69, 0x89, 0xa4, 0x50,
+         0xaa, 0x65, 0xda, 0x91, 0x14, 0xe5, 0x15, 0x77, 0x7c, 0x97, 0x35, 0x1d,
+         0xa0, 0x37, 0xcc, 0xb7, 0x2d, 0x49, 0x87, 0xeb, 0x69, 0xc6, 0x80, 0x41,
+         0x17, 0x24, 0xed, 0x60, 0x2e, 0x6a, 0xc7, 0x6c, 0xd2, 0xd0, 0x85, 0x72,
+         0x56, 0x16, 0xc9, 0x27, 0x77, 0xa4, 0x66, 0x4d, 0x43, 0xa5, 0x9c, 0x3a,
+         0xe9, 0x94, 0x61, 0x34}
+    },
+    // [AES-256 use df] COUNT = 0, with personalization and additional input.
+    {
+        AES_KEY_256, 1, 32, 16, 32, 32,
+        {0x17, 0x4b, 0x46, 0x25, 0x00, 0x51, 0xa9, 0xe3, 0xd8, 0x0c, 0x56, 0xae,
+         0x71, 0x63, 0xda, 0xfe, 0x7e, 0x54, 0x48, 0x1a, 0x56, 0xca, 0xfd, 0x3b,
+         0x86, 0x25, 0xf9, 0x9b, 0xbb, 0x29, 0xc4, 0x42},
+        {0x98, 0xff, 0xd9, 0x9c, 0x46, 0x6e, 0x0e, 0x94, 0xa4, 0x5d, 0xa7, 0xe0,
+         0xe8, 0x2d, 0xbc, 0x6b},
+        {0x70, 0x95, 0x26, 0x8e, 0x99, 0x93, 0x8b, 0x3e, 0x04, 0x27, 0x34, 0xb9,
+         0x17, 0x6c, 0x9a, 0xa0, 0x51, 0xf0, 0x0a, 0x5f, 0x8d, 0x2a, 0x89, 0xad,
+         0xa2, 0x14, 0xb8, 0x9b, 0xee, 0xf1, 0x8e, 0xbf},
+        {0xe8, 0x8b, 0xe1, 0x96, 0x7c, 0x55, 0x03, 0xf6, 0x5d, 0x23, 0x86, 0x7b,
+         0xbc, 0x89, 0x1b, 0xd6, 0x79, 0xdb, 0x03, 0xb4, 0x87, 0x86, 0x63, 0xf6,
+         0xc8, 0x77, 0x59, 0x2d, 0xf2, 0x5f, 0x0d, 0x9a},
+        {0xcd, 0xf6, 0xad, 0x54, 0x9e, 0x45, 0xb6, 0xaa, 0x5c, 0xd6, 0x7d, 0x02,
+         0x49, 0x31, 0xc3, 0x3c, 0xd1, 0x33, 0xd5, 0x2d, 0x5a, 0xe5, 0x00, 0xc3,
+         0x01, 0x50, 0x20, 0xbe, 0xb3, 0x0d, 0xa0, 0x63},
+        {0xc7, 0x22, 0x8e, 0x90, 0xc6, 0x2f, 0x89, 0x6a, 0x09, 0xe1, 0x16, 0x84,
+         0x53, 0x01, 0x02, 0xf9, 0x26, 0xec, 0x90, 0xa3, 0x25, 0x5f, 0x6c, 0x21,
+         0xb8, 0x57, 0x88, 0x3c, 0x75, 0x80, 0x01, 0x43},
+        {0x76, 0xa9, 0x4f, 0x22, 0x41, 0x78, 0xfe, 0x4c, 0xbf, 0x9e, 0x2b, 0x8a,
+         0xcc, 0x53, 0xc9, 0xdc, 0x3e, 0x50, 0xbb, 0x61, 0x3a, 0xac, 0x89, 0x36,
+         0x60, 0x14, 0x53, 0xcd, 0xa3, 0x29, 0x3b, 0x17},
+        {0x1a, 0x6d, 0x8d, 0xbd, 0x64, 0x20, 0x76, 0xd1, 0x39, 0x16, 0xe5, 0xe2,
+         0x30, 0x38, 0xb6, 0x0b, 0x26, 0x06, 0x1f, 0x13, 0xdd, 0x4e, 0x00, 0x62,
+         0x77, 0xe0, 0x26, 0x86, 0x98, 0xff, 0xb2, 0xc8, 0x7e, 0x45, 0x3b, 0xae,
+         0x12, 0x51, 0x63, 0x1a, 0xc9, 0x0c, 0x70, 0x1a, 0x98, 0x49, 0xd9, 0x33,
+         0x99, 0x5e, 0x8b, 0x02, 0x21, 0xfe, 0x9a, 0xca, 0x19, 0x85, 0xc5, 0x46,
+         0xc2, 0x07, 0x90, 0x27}
+    },
+};
+
+#define SELF_TEST_NUM_VECTORS (sizeof(g_vectors) / sizeof(g_vectors[0]))
+
+static self_test_state_t g_state = SELF_TEST_UNTESTED;
+
+// Signalled when g_state leaves RUNNING, for the threads that wait for the
+// result of the first run.
+static pthread_mutex_t g_state_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_state_cv = PTHREAD_COND_INITIALIZER;
+
+// Set while the calling thread runs the test, whose own instantiations must
+// pass the gate.
+static __thread int g_in_self_test = 0;
+
+// Run v with impl. It returns one if the returned bits match.
+static int run_vector(IN const self_test_vector_t *v,
+                      IN const aes_impl_t *impl)
+{
+    CTR_DRBG_STATE drbg;
+    uint8_t out[SELF_TEST_RETURNED_LEN];
+    int ok;
+
+    if (v->use_df)
+    {
+        ok = CTR_DRBG_init_df(&drbg, v->key_size, v->entropy, v->entropy_len,
+                              v->nonce, v->nonce_len, v->personalization,
+                              v->personalization_len);
+    }
+    else
+    {
+        ok = CTR_DRBG_init_key_size(&drbg, v->key_size, v->entropy,
+                                    v->personalization,
+                                    v->personalization_len);
+    }
+    if (!ok)
+    {
+        return 0;
+    }
+    CTR_DRBG_set_impl(&drbg, impl);
+
+    ok = v->use_df ?
+         CTR_DRBG_reseed_df(&drbg, v->entropy_reseed, v->entropy_len,
+                            v->additional_reseed, v->additional_len) :
+         CTR_DRBG_reseed(&drbg, v->entropy_reseed, v->additional_reseed,
+                         v->additional_len);
+
+    ok = ok &&
+         CTR_DRBG_generate(&drbg, out, sizeof(out), v->additional1,
+                           v->additional_len) &&
+         CTR_DRBG_generate(&drbg, out, sizeof(out), v->additional2,
+                           v->additional_len) &&
+         (0 == memcmp(out, v->returned, sizeof(out)));
+
+    CTR_DRBG_clear(&drbg);
+    secure_clean(out, sizeof(out));
+
+    return ok;
+}
+
+// Add one to v, a 128-bit big-endian number.
+_INLINE_ void ctr_inc(IN OUT uint8_t v[AES_BLOCK_SIZE])
+{
+    for (int i = AES_BLOCK_SIZE - 1; (i >= 0) && (0 == ++v[i]); i--)
+    {
+    }
+}
+
+// Write the len bytes of keystream of the single block kernel of impl for
+// the counter values ctr, ctr + 1, ... (a 128-bit big-endian number) to out.
+static void ref_keystream(OUT uint8_t *out,
+                          IN const size_t len,
+                          IN const uint8_t ctr[AES_BLOCK_SIZE],
+                          IN const aes_ks_t *ks,
+                          IN const aes_impl_t *impl)
+{
+    uint8_t v[AES_BLOCK_SIZE];
+    uint8_t block[AES_BLOCK_SIZE];
+
+    memcpy(v, ctr, sizeof(v));
+    for (size_t pos = 0; pos < len; pos += AES_BLOCK_SIZE)
+    {
+        const size_t n = (len - pos < AES_BLOCK_SIZE) ? len - pos :
+                                                        AES_BLOCK_SIZE;
+
+        impl->enc(block, v, ks);
+        memcpy(&out[pos], block, n);
+        ctr_inc(v);
+    }
+
+    secure_clean(block, sizeof(block));
+}
+
+// For every implementation of key_size, run every CTR kernel variant, and a
+// long generate call with each output placement, on SELF_TEST_LONG_LEN
+// bytes. This covers the long, tuned, chunked and non-temporal paths. The
+// output must match the single block kernel of AES-NI, which the vectors
+// covered. The instances of all the implementations start from the same
+// state, so they share the expected output.
+static int run_long(IN const aes_key_size_t key_size)
+{
+    static const ctr_drbg_placement_t placements[] = {
+        CTR_DRBG_PLACEMENT_CACHE, CTR_DRBG_PLACEMENT_STREAM};
+    const aes_impl_t *ref_impl = aes_impl_get(AES_IMPL_AESNI, key_size);
+    ALIGN(64) uint8_t out[SELF_TEST_LONG_BLOCKS * AES_BLOCK_SIZE];
+    uint8_t ref[SELF_TEST_LONG_BLOCKS * AES_BLOCK_SIZE];
+    CTR_DRBG_STATE drbg[AES_IMPL_COUNT];
+    const aes_impl_t *impls[AES_IMPL_COUNT];
+    uint8_t ctr[AES_BLOCK_SIZE];
+    int ok = 1;
+
+    // Nothing runs without AES-NI.
+    if (NULL == ref_impl)
+    {
+        return 1;
+    }
+
+    for (uint32_t id = 0; id < AES_IMPL_COUNT; id++)
+    {
+        impls[id] = aes_impl_get((aes_impl_id_t)id, key_size);
+        if ((NULL != impls[id]) &&
+            !CTR_DRBG_init_key_size(&drbg[id], key_size,
+                                    g_vectors[0].entropy, NULL, 0))
+        {
+            impls[id] = NULL;
+            ok = 0;
+        }
+        else if (NULL != impls[id])
+        {
+            CTR_DRBG_set_impl(&drbg[id], impls[id]);
+        }
+    }
+
+    // The kernels do not carry out of the last four bytes of the counter, so
+    // it starts far from a wrap of them.
+    memcpy(ctr, drbg[AES_IMPL_AESNI].counter.bytes, sizeof(ctr));
+    ctr[12] = 0;
+    ref_keystream(ref, sizeof(ref), ctr, &drbg[AES_IMPL_AESNI].ks, ref_impl);
+
+    for (uint32_t id = 0; ok && (id < AES_IMPL_COUNT); id++)
+    {
+        for (uint32_t v = 0; (NULL != impls[id]) && ok &&
+                             (v < AES_CTR_VARIANT_COUNT); v++)
+        {
+            impls[id]->ctr_enc_variants[v](out, ctr, SELF_TEST_LONG_BLOCKS,
+                                           &drbg[id].ks);
+            ok = (0 == memcmp(out, ref, sizeof(ref)));
+        }
+    }
+
+    for (uint32_t p = 0; ok && (p < 2); p++)
+    {
+        // Generate starts with V + 1, see 10.2.1.5.1, step 4.
+        memcpy(ctr, drbg[AES_IMPL_AESNI].counter.bytes, sizeof(ctr));
+        ctr_inc(ctr);
+        ref_keystream(ref, SELF_TEST_LONG_LEN, ctr, &drbg[AES_IMPL_AESNI].ks,
+                      ref_impl);
+
+        for (uint32_t id = 0; ok && (id < AES_IMPL_COUNT); id++)
+        {
+            if (NULL == impls[id])
+            {
+                continue;
+            }
+            CTR_DRBG_set_placement(&drbg[id], placements[p], 1);
+            ok = CTR_DRBG_generate(&drbg[id], out, SELF_TEST_LONG_LEN, NULL,
+                                   0) &&
+                 (0 == memcmp(out, ref, SELF_TEST_LONG_LEN));
+        }
+    }
+
+    for (uint32_t id = 0; id < AES_IMPL_COUNT; id++)
+    {
+        if (NULL != impls[id])
+        {
+            CTR_DRBG_clear(&drbg[id]);
+        }
+    }
+    secure_clean(ref, sizeof(ref));
+    secure_clean(out, sizeof(out));
+
+    return ok;
+}
+
+_INLINE_ int run_all(void)
+{
+    int ok = 1;
+
+    for (uint32_t i = 0; ok && (i < SELF_TEST_NUM_VECTORS); i++)
+    {
+        for (uint32_t id = 0; ok && (id < AES_IMPL_COUNT); id++)
+        {
+            const aes_impl_t *impl = aes_impl_get((aes_impl_id_t)id,
+                                                  g_vectors[i].key_size);
+            ok = (NULL == impl) || run_vector(&g_vectors[i], impl);
+        }
+    }
+
+    for (uint32_t k = 0; ok && (k < AES_KEY_SIZE_COUNT); k++)
+    {
+        ok = run_long((aes_key_size_t)k);
+    }
+
+    return ok;
+}
+
+int CTR_DRBG_self_test(void)
+{
+    // A failure is permanent.
+    if (SELF_TEST_FAILED == __atomic_load_n(&g_state, __ATOMIC_ACQUIRE))
+    {
+        return 0;
+    }
+
+    // The first run moves the state to RUNNING. Later runs leave it at
+    // PASSED, so that other threads can still instantiate meanwhile.
+    self_test_state_t state = SELF_TEST_UNTESTED;
+    __atomic_compare_exchange_n(&g_state, &state, SELF_TEST_RUNNING, 0,
+                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+
+    const int nested = g_in_self_test;
+    g_in_self_test = 1;
+    const int ok = run_all();
+    g_in_self_test = nested;
+
+    if (!ok)
+    {
+        __atomic_store_n(&g_state, SELF_TEST_FAILED, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        // Unless a concurrent run failed meanwhile.
+        state = SELF_TEST_RUNNING;
+        __atomic_compare_exchange_n(&g_state, &state, SELF_TEST_PASSED, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    }
+
+    pthread_mutex_lock(&g_state_lock);
+    pthread_cond_broadcast(&g_state_cv);
+    pthread_mutex_unlock(&g_state_lock);
+
+    return ok;
+}
+
+// Wait until the first run of the test is over, and return the state.
+static self_test_state_t wait_result(void)
+{
+    self_test_state_t state;
+
+    pthread_mutex_lock(&g_state_lock);
+    while (SELF_TEST_RUNNING ==
+           (state = __atomic_load_n(&g_state, __ATOMIC_ACQUIRE)))
+    {
+        pthread_cond_wait(&g_state_cv, &g_state_lock);
+    }
+    pthread_mutex_unlock(&g_state_lock);
+
+    return state;
+}
+
+int CTR_DRBG_self_test_passed(void)
+{
+    if (g_in_self_test)
+    {
+        return 1;
+    }
+
+    self_test_state_t state = __atomic_load_n(&g_state, __ATOMIC_ACQUIRE);
+
+    if (SELF_TEST_UNTESTED == state)
+    {
+        CTR_DRBG_self_test();
+        state = __atomic_load_n(&g_state, __ATOMIC_ACQUIRE);
+    }
+
+    // Another thread runs the test for the first time, e.g., the
+    // constructor: wait for its result rather than fail.
+    if (SELF_TEST_RUNNING == state)
+    {
+        state = wait_result();
+    }
+
+    return (SELF_TEST_PASSED == state);
+}
+
+__attribute__((constructor)) static void ctr_drbg_self_test_init(void)
+{
+    CTR_DRBG_self_test_passed();
+}
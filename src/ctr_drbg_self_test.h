@@ -0,0 +1,58 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#pragma once
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "ctr_drbg.h"
+
+// The power-on self-test. A few known-answer vectors of the CAVP files
+// (KATs/), compiled in, run instantiate, reseed and two generate calls,
+// without and with a personalization string and additional input, with and
+// without the derivation function, for every key size and every kernel the
+// CPU supports. Then, every CTR kernel variant and a multi-KiB generate call
+// with each output placement are compared with the single block kernel. The
+// test runs once when the library is loaded, before |main|.
+//
+// It fails closed: until it passed, and for good after it failed,
+// |CTR_DRBG_init_key_size| (and so every function that instantiates a
+// CTR_DRBG) fails, except in the thread that runs the test. Other threads
+// that instantiate while the first run is in progress wait for its result.
+// If an instance is needed before the test ran at load time (e.g., by
+// another constructor), the test runs first.
+
+// CTR_DRBG_self_test runs the test again, e.g., periodically. Other threads
+// can still instantiate while it runs. It returns one if all the answers
+// matched, and zero otherwise, in which case every later instantiation
+// fails. It returns zero right away if a previous run failed.
+int CTR_DRBG_self_test(void);
+
+// CTR_DRBG_self_test_passed returns one if the instantiation functions may
+// run: the test passed, or the calling thread is running it. It runs the
+// test if it did not run yet, and waits for the result if another thread
+// runs it for the first time.
+int CTR_DRBG_self_test_passed(void);
+
+#if defined(__cplusplus)
+}  // extern C
+#endif
@@ -34,6 +34,7 @@
 
 #define ALIGN(n) __attribute__((aligned(n)))
 #define _INLINE_ static inline
+#define _ALWAYS_INLINE_ static inline __attribute__((always_inline))
 
 typedef enum
 {
@@ -0,0 +1,188 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/random.h>
+#include "ctr_drbg_buffer.h"
+#include "drbg_rand.h"
+
+#define CACHE_LINE_SIZE 64
+
+typedef struct drbg_tls_s {
+    CTR_DRBG_BUFFER b;
+    // The fork generation this instance was (re)seeded in.
+    uint64_t fork_gen;
+    ALIGN(CACHE_LINE_SIZE) uint8_t storage[CTR_DRBG_BUFFER_DEFAULT_SIZE];
+} ALIGN(CACHE_LINE_SIZE) drbg_tls_t;
+
+static __thread drbg_tls_t *g_tls = NULL;
+
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_key;
+static int g_key_ok = 0;
+
+// Incremented in the child after fork. Read (not written) on the hot path.
+static volatile uint64_t g_fork_gen = 0;
+
+_INLINE_ int get_entropy(OUT uint8_t *buf, IN const size_t len)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        const ssize_t ret = getrandom(&buf[done], len - done, 0);
+        if (ret < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            return 0;
+        }
+        done += (size_t)ret;
+    }
+
+    return 1;
+}
+
+static void tls_destructor(void *p)
+{
+    drbg_tls_t *tls = (drbg_tls_t *)p;
+
+    g_tls = NULL;
+    CTR_DRBG_buffer_clear(&tls->b);
+    secure_clean((uint8_t *)tls, sizeof(*tls));
+    free(tls);
+}
+
+static void on_fork_child(void)
+{
+    g_fork_gen++;
+}
+
+static void init_once(void)
+{
+    g_key_ok = (0 == pthread_key_create(&g_key, tls_destructor));
+    pthread_atfork(NULL, NULL, on_fork_child);
+}
+
+_INLINE_ drbg_tls_t *tls_new(void)
+{
+    uint8_t entropy[CTR_DRBG_ENTROPY_LEN];
+    void *p = NULL;
+
+    pthread_once(&g_once, init_once);
+    if (!g_key_ok || (0 != posix_memalign(&p, CACHE_LINE_SIZE,
+                                          sizeof(drbg_tls_t))))
+    {
+        return NULL;
+    }
+
+    drbg_tls_t *tls = (drbg_tls_t *)p;
+    tls->fork_gen = g_fork_gen;
+
+    if (!get_entropy(entropy, sizeof(entropy)) ||
+        !CTR_DRBG_buffer_init(&tls->b, tls->storage, sizeof(tls->storage),
+                              entropy, NULL, 0) ||
+        (0 != pthread_setspecific(g_key, tls)))
+    {
+        secure_clean(entropy, sizeof(entropy));
+        secure_clean((uint8_t *)tls, sizeof(*tls));
+        free(tls);
+        return NULL;
+    }
+
+    secure_clean(entropy, sizeof(entropy));
+    return tls;
+}
+
+// Reseed with fresh entropy. Used after fork, so that parent and child do not
+// share an output stream, and when the reseed counter is exhausted.
+_INLINE_ int tls_reseed(IN OUT drbg_tls_t *tls)
+{
+    uint8_t entropy[CTR_DRBG_ENTROPY_LEN];
+    int ret = get_entropy(entropy, sizeof(entropy)) &&
+              CTR_DRBG_buffer_reseed(&tls->b, entropy, NULL, 0);
+
+    secure_clean(entropy, sizeof(entropy));
+    tls->fork_gen = g_fork_gen;
+
+    return ret;
+}
+
+int drbg_rand_bytes(uint8_t *out, size_t out_len)
+{
+    drbg_tls_t *tls = g_tls;
+
+    if (NULL == tls)
+    {
+        if (NULL == (tls = tls_new()))
+        {
+            return 0;
+        }
+        g_tls = tls;
+    }
+
+    if ((tls->fork_gen != g_fork_gen) && !tls_reseed(tls))
+    {
+        return 0;
+    }
+
+    while (out_len > 0)
+    {
+        size_t todo = out_len;
+        if (todo > CTR_DRBG_MAX_GENERATE_LENGTH)
+        {
+            todo = CTR_DRBG_MAX_GENERATE_LENGTH;
+        }
+
+        if (!CTR_DRBG_buffer_generate(&tls->b, out, todo))
+        {
+            // The only expected failure is an exhausted reseed counter.
+            if (!tls_reseed(tls) ||
+                !CTR_DRBG_buffer_generate(&tls->b, out, todo))
+            {
+                return 0;
+            }
+        }
+
+        out += todo;
+        out_len -= todo;
+    }
+
+    return 1;
+}
+
+void drbg_rand_thread_cleanup(void)
+{
+    drbg_tls_t *tls = g_tls;
+
+    if (NULL == tls)
+    {
+        return;
+    }
+
+    pthread_setspecific(g_key, NULL);
+    tls_destructor(tls);
+}
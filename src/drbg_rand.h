@@ -0,0 +1,49 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#pragma once
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A process wide randomness API on top of CTR_DRBG. Every thread lazily gets
+// its own cache line aligned DRBG instance (with a CTR_DRBG_BUFFER front
+// end), seeded from getrandom on its first call and zeroised at thread exit.
+// The hot path takes no locks and touches no shared cache lines, so the
+// throughput scales with the number of cores. Children created by fork are
+// reseeded before they draw their first bytes.
+
+// drbg_rand_bytes writes |out_len| random bytes to |out|. It returns one on
+// success and zero on error (e.g., when getrandom fails).
+int drbg_rand_bytes(uint8_t *out, size_t out_len);
+
+// drbg_rand_thread_cleanup zeroises and releases the DRBG instance of the
+// calling thread. It is called automatically at thread exit, and can be
+// called explicitly (e.g., by the main thread). A later |drbg_rand_bytes|
+// call instantiates a new DRBG.
+void drbg_rand_thread_cleanup(void);
+
+#if defined(__cplusplus)
+}  // extern C
+#endif
@@ -0,0 +1,300 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <errno.h>
+#include <immintrin.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include "cpu_features.h"
+#include "entropy_pool.h"
+
+struct entropy_pool_s {
+    const entropy_source_t *src;
+    size_t buf_size;
+    uint8_t *buf[2];
+
+    // Protects all the fields below.
+    pthread_mutex_t lock;
+    // Signals the filler that the standby buffer is empty, or stop.
+    pthread_cond_t fill_cv;
+    // Signals the consumers that the standby buffer is full, or failed.
+    pthread_cond_t ready_cv;
+
+    // Requests are served from buf[cur][pos...]. buf[cur ^ 1] belongs to
+    // the filler while standby_ready is 0.
+    uint32_t cur;
+    size_t pos;
+    int standby_ready;
+    int failed;
+    int stop;
+    uint64_t stalls;
+
+    pthread_t filler;
+};
+
+static int getrandom_fill(OUT uint8_t *buf, IN size_t len, IN void *ctx)
+{
+    size_t done = 0;
+    (void)ctx;
+
+    while (done < len)
+    {
+        const ssize_t ret = getrandom(&buf[done], len - done, 0);
+        if (ret < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            return 0;
+        }
+        done += (size_t)ret;
+    }
+
+    return 1;
+}
+
+_INLINE_ __attribute__((target("rdseed"))) int
+rdseed64(OUT unsigned long long *val)
+{
+    for (uint32_t i = 0; i < ENTROPY_RDSEED_RETRIES; i++)
+    {
+        if (_rdseed64_step(val))
+        {
+            return 1;
+        }
+        _mm_pause();
+    }
+
+    return 0;
+}
+
+static int rdseed_fill(OUT uint8_t *buf, IN size_t len, IN void *ctx)
+{
+    unsigned long long val;
+    (void)ctx;
+
+    if (!cpu_has(CPU_FEATURE_RDSEED))
+    {
+        return 0;
+    }
+
+    for (size_t i = 0; i < len; i += sizeof(val))
+    {
+        if (!rdseed64(&val))
+        {
+            return 0;
+        }
+        memcpy(&buf[i], &val, (len - i < sizeof(val)) ? len - i : sizeof(val));
+    }
+
+    secure_clean((uint8_t *)&val, sizeof(val));
+    return 1;
+}
+
+const entropy_source_t entropy_source_getrandom = {
+    .name = "getrandom",
+    .fill = getrandom_fill,
+    .ctx = NULL,
+};
+
+const entropy_source_t entropy_source_rdseed = {
+    .name = "rdseed",
+    .fill = rdseed_fill,
+    .ctx = NULL,
+};
+
+static void *filler_main(void *arg)
+{
+    ENTROPY_POOL *pool = (ENTROPY_POOL *)arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->failed)
+    {
+        while (!pool->stop && pool->standby_ready)
+        {
+            pthread_cond_wait(&pool->fill_cv, &pool->lock);
+        }
+
+        if (pool->stop)
+        {
+            break;
+        }
+
+        // No consumer touches the standby buffer before standby_ready is set.
+        uint8_t *standby = pool->buf[pool->cur ^ 1];
+        pthread_mutex_unlock(&pool->lock);
+
+        const int ok = pool->src->fill(standby, pool->buf_size,
+                                       pool->src->ctx);
+
+        pthread_mutex_lock(&pool->lock);
+        if (ok)
+        {
+            pool->standby_ready = 1;
+        }
+        else
+        {
+            pool->failed = 1;
+        }
+        pthread_cond_broadcast(&pool->ready_cv);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+_INLINE_ void release(IN OUT ENTROPY_POOL *pool)
+{
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        if (NULL != pool->buf[i])
+        {
+            secure_clean(pool->buf[i], (uint32_t)pool->buf_size);
+            free(pool->buf[i]);
+        }
+    }
+
+    pthread_cond_destroy(&pool->ready_cv);
+    pthread_cond_destroy(&pool->fill_cv);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+ENTROPY_POOL *entropy_pool_new(IN const entropy_source_t *src,
+                               IN const size_t buf_size)
+{
+    if ((NULL == src) || (0 == buf_size) || (buf_size > UINT32_MAX))
+    {
+        return NULL;
+    }
+
+    ENTROPY_POOL *pool = (ENTROPY_POOL *)calloc(1, sizeof(*pool));
+    if (NULL == pool)
+    {
+        return NULL;
+    }
+
+    pool->src = src;
+    pool->buf_size = buf_size;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->fill_cv, NULL);
+    pthread_cond_init(&pool->ready_cv, NULL);
+
+    pool->buf[0] = (uint8_t *)malloc(buf_size);
+    pool->buf[1] = (uint8_t *)malloc(buf_size);
+
+    // Start full, so that the first requests do not wait.
+    if ((NULL == pool->buf[0]) || (NULL == pool->buf[1]) ||
+        !src->fill(pool->buf[0], buf_size, src->ctx) ||
+        (0 != pthread_create(&pool->filler, NULL, filler_main, pool)))
+    {
+        release(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+int entropy_pool_get(IN OUT ENTROPY_POOL *pool,
+                     OUT uint8_t *out,
+                     IN size_t len)
+{
+    uint8_t *const start = out;
+    const size_t total = len;
+
+    // A pool whose source failed serves nothing, not even the bytes that are
+    // left in the active buffer.
+    pthread_mutex_lock(&pool->lock);
+    int ret = !pool->failed;
+    while (ret && (len > 0))
+    {
+        if (pool->pos == pool->buf_size)
+        {
+            if (!pool->standby_ready && !pool->failed)
+            {
+                pool->stalls++;
+                do
+                {
+                    pthread_cond_wait(&pool->ready_cv, &pool->lock);
+                } while (!pool->standby_ready && !pool->failed);
+            }
+
+            if (!pool->standby_ready)
+            {
+                ret = 0;
+                break;
+            }
+
+            pool->cur ^= 1;
+            pool->pos = 0;
+            pool->standby_ready = 0;
+            pthread_cond_signal(&pool->fill_cv);
+        }
+
+        const size_t left = pool->buf_size - pool->pos;
+        const size_t todo = (len < left) ? len : left;
+        uint8_t *p = &pool->buf[pool->cur][pool->pos];
+
+        memcpy(out, p, todo);
+        secure_clean(p, (uint32_t)todo);
+        pool->pos += todo;
+        out += todo;
+        len -= todo;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    // Do not hand out part of a failed request.
+    if (!ret)
+    {
+        secure_clean(start, (uint32_t)total);
+    }
+
+    return ret;
+}
+
+uint64_t entropy_pool_stalls(IN ENTROPY_POOL *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    const uint64_t stalls = pool->stalls;
+    pthread_mutex_unlock(&pool->lock);
+
+    return stalls;
+}
+
+void entropy_pool_free(IN OUT ENTROPY_POOL *pool)
+{
+    if (NULL == pool)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_signal(&pool->fill_cv);
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_join(pool->filler, NULL);
+    release(pool);
+}
@@ -0,0 +1,86 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#pragma once
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "defs.h"
+
+// An entropy source writes len bytes of full entropy to buf. It returns 1 on
+// success and 0 on failure. ctx is the context of the source.
+typedef int (*entropy_source_f)(OUT uint8_t *buf,
+                                IN size_t len,
+                                IN void *ctx);
+
+typedef struct entropy_source_s {
+    const char *name;
+    entropy_source_f fill;
+    void *ctx;
+} entropy_source_t;
+
+// The getrandom system call (blocks until the kernel pool is initialized).
+extern const entropy_source_t entropy_source_getrandom;
+
+// The RDSEED instruction. It fails on CPUs without RDSEED, and when RDSEED
+// keeps failing (its conditioner is exhausted) for ENTROPY_RDSEED_RETRIES
+// attempts in a row.
+extern const entropy_source_t entropy_source_rdseed;
+
+#define ENTROPY_RDSEED_RETRIES 1024
+
+// ENTROPY_POOL keeps entropy from a source ready for the request path. It
+// holds two buffers: requests are served from the active one while a
+// background thread fills the other. When the active buffer runs out, the
+// buffers are swapped, and the background thread refills the drained one. A
+// request blocks only if both are empty, i.e., if it consumes entropy faster
+// than the source produces it. Served bytes are erased from the buffers.
+typedef struct entropy_pool_s ENTROPY_POOL;
+
+#define ENTROPY_POOL_DEFAULT_SIZE 4096
+
+// Create a pool of two buffers of buf_size bytes each, fed by src, which
+// must outlive the pool. The first buffer is filled before the call returns.
+// It returns NULL on error.
+ENTROPY_POOL *entropy_pool_new(IN const entropy_source_t *src,
+                               IN const size_t buf_size);
+
+// Write len bytes of entropy to out. It returns 1 on success and 0 if the
+// source failed, in which case out is zeroized; a pool whose source failed
+// fails all later requests.
+// Concurrent calls are serialized.
+int entropy_pool_get(IN OUT ENTROPY_POOL *pool,
+                     OUT uint8_t *out,
+                     IN size_t len);
+
+// The number of entropy_pool_get calls that had to wait for the background
+// thread so far.
+uint64_t entropy_pool_stalls(IN ENTROPY_POOL *pool);
+
+// Stop the background thread, erase the buffers and release pool.
+void entropy_pool_free(IN OUT ENTROPY_POOL *pool);
+
+#if defined(__cplusplus)
+}  // extern C
+#endif
@@ -0,0 +1,857 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <immintrin.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ctr_drbg.h"
+#include "kat_runner.h"
+
+// The longest field of the AES sections: 512 returned bits.
+#define KAT_MAX_LEN 64
+#define KAT_MAX_THREADS 32
+#define KAT_LINE_LEN 128
+
+// The states (Key and V) after each step, in the .txt files.
+typedef enum
+{
+    KAT_STEP_INSTANTIATE=0,
+    KAT_STEP_RESEED,
+    KAT_STEP_GEN1,
+    KAT_STEP_GEN2,
+    KAT_STEP_COUNT
+} kat_step_t;
+
+static const char *const g_step_markers[KAT_STEP_COUNT] = {
+    "** INSTANTIATE:",
+    "** RESEED:",
+    "** GENERATE (FIRST CALL):",
+    "** GENERATE (SECOND CALL):",
+};
+
+static const char *const g_key_errors[KAT_STEP_COUNT] = {
+    "Key after INSTANTIATE",
+    "Key after RESEED",
+    "Key after GENERATE (FIRST CALL)",
+    "Key after GENERATE (SECOND CALL)",
+};
+
+static const char *const g_v_errors[KAT_STEP_COUNT] = {
+    "V after INSTANTIATE",
+    "V after RESEED",
+    "V after GENERATE (FIRST CALL)",
+    "V after GENERATE (SECOND CALL)",
+};
+
+// The input fields of a vector, as bits of kat_vector_t.fields.
+typedef enum
+{
+    KAT_F_ENTROPY=0,
+    KAT_F_NONCE,
+    KAT_F_PERS,
+    KAT_F_ENTROPY_RESEED,
+    KAT_F_AD_RESEED,
+    KAT_F_AD1,
+    KAT_F_AD2,
+    KAT_F_RETURNED,
+    KAT_F_COUNT
+} kat_field_t;
+
+#define KAT_ALL_FIELDS ((1U << KAT_F_COUNT) - 1)
+
+typedef struct kat_section_s {
+    char name[KAT_LINE_LEN];
+    uint32_t line;
+    aes_key_size_t key_size;
+    uint32_t key_len;
+    int use_df;
+    // In bytes.
+    uint32_t entropy_len;
+    uint32_t nonce_len;
+    uint32_t pers_len;
+    uint32_t ad_len;
+    uint32_t returned_len;
+} kat_section_t;
+
+typedef struct kat_vector_s {
+    uint32_t section;
+    uint32_t count;
+    uint32_t line;
+    uint32_t fields;
+    // The steps with a Key and a V.
+    uint32_t states;
+    uint8_t in[KAT_F_COUNT][KAT_MAX_LEN];
+    uint8_t key[KAT_STEP_COUNT][AES256_KEY_SIZE];
+    uint8_t v[KAT_STEP_COUNT][AES_BLOCK_SIZE];
+} kat_vector_t;
+
+typedef struct kat_table_s {
+    kat_section_t *sections;
+    uint32_t num_sections;
+    uint32_t sections_cap;
+    kat_vector_t *vectors;
+    uint32_t num_vectors;
+    uint32_t vectors_cap;
+    uint32_t skipped_sections;
+} kat_table_t;
+
+typedef struct kat_job_s {
+    const char *path;
+    const kat_table_t *t;
+    uint32_t next;
+    uint32_t runs;
+    uint32_t failures;
+    pthread_mutex_t print_lock;
+} kat_job_t;
+
+////////////////////////////////////////////////////////////////////////////
+// Hex decoding.
+////////////////////////////////////////////////////////////////////////////
+
+_INLINE_ int hex_digit(IN const char c)
+{
+    if ((c >= '0') && (c <= '9'))
+    {
+        return c - '0';
+    }
+    if ((c >= 'a') && (c <= 'f'))
+    {
+        return c - 'a' + 10;
+    }
+    if ((c >= 'A') && (c <= 'F'))
+    {
+        return c - 'A' + 10;
+    }
+
+    return -1;
+}
+
+// Decode 32 hex digits into 16 bytes. It returns 0 if a digit is invalid.
+_INLINE_ int hex_decode32(OUT uint8_t out[16], IN const char *hex)
+{
+    const __m256i c = _mm256_loadu_si256((const __m256i *)hex);
+
+    // In 8 bits, c - '0' is in [0, 9] exactly for the digits, and
+    // (c | 0x20) - 'a' in [0, 5] exactly for the letters of either case.
+    const __m256i digit = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+    const __m256i alpha = _mm256_sub_epi8(_mm256_or_si256(c,
+                                                   _mm256_set1_epi8(0x20)),
+                                          _mm256_set1_epi8('a'));
+    const __m256i is_digit = _mm256_cmpeq_epi8(
+                        _mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+    const __m256i is_alpha = _mm256_cmpeq_epi8(
+                        _mm256_min_epu8(alpha, _mm256_set1_epi8(5)), alpha);
+
+    if (0xffffffff !=
+        (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(is_digit, is_alpha)))
+    {
+        return 0;
+    }
+
+    // Not _mm256_blendv_epi8, which GCC implements as a signed char compare
+    // that -funsigned-char breaks.
+    const __m256i nibbles = _mm256_or_si256(
+                 _mm256_and_si256(is_digit, digit),
+                 _mm256_andnot_si256(is_digit,
+                             _mm256_add_epi8(alpha, _mm256_set1_epi8(10))));
+
+    // 16 * high + low for every pair of digits, into 16-bit words, then
+    // packed into the low 8 bytes of each lane and gathered.
+    const __m256i words = _mm256_maddubs_epi16(nibbles,
+                                               _mm256_set1_epi16(0x0110));
+    const __m256i bytes = _mm256_permute4x64_epi64(
+                                   _mm256_packus_epi16(words, words), 0xd8);
+    _mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(bytes));
+
+    return 1;
+}
+
+status_t kat_hex_decode(OUT uint8_t *out,
+                        IN const char *hex,
+                        IN const size_t hex_len)
+{
+    size_t i = 0;
+
+    if (0 != hex_len % 2)
+    {
+        return ERROR;
+    }
+
+    for (; i + 32 <= hex_len; i += 32)
+    {
+        if (!hex_decode32(&out[i / 2], &hex[i]))
+        {
+            return ERROR;
+        }
+    }
+
+    for (; i < hex_len; i += 2)
+    {
+        const int hi = hex_digit(hex[i]);
+        const int lo = hex_digit(hex[i + 1]);
+        if ((hi < 0) || (lo < 0))
+        {
+            return ERROR;
+        }
+        out[i / 2] = (uint8_t)(16 * hi + lo);
+    }
+
+    return SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Parsing.
+////////////////////////////////////////////////////////////////////////////
+
+_INLINE_ int is_name(IN const char *name,
+                     IN const size_t len,
+                     IN const char *str)
+{
+    return (strlen(str) == len) && (0 == memcmp(name, str, len));
+}
+
+static kat_section_t *new_section(IN OUT kat_table_t *t)
+{
+    if (t->num_sections == t->sections_cap)
+    {
+        const uint32_t cap = (0 == t->sections_cap) ? 64 : 2 * t->sections_cap;
+        kat_section_t *s = (kat_section_t *)realloc(t->sections,
+                                                    cap * sizeof(*s));
+        if (NULL == s)
+        {
+            return NULL;
+        }
+        t->sections = s;
+        t->sections_cap = cap;
+    }
+
+    kat_section_t *s = &t->sections[t->num_sections++];
+    memset(s, 0, sizeof(*s));
+    return s;
+}
+
+static kat_vector_t *new_vector(IN OUT kat_table_t *t)
+{
+    if (t->num_vectors == t->vectors_cap)
+    {
+        const uint32_t cap = (0 == t->vectors_cap) ? 1024 : 2 * t->vectors_cap;
+        kat_vector_t *v = (kat_vector_t *)realloc(t->vectors,
+                                                  cap * sizeof(*v));
+        if (NULL == v)
+        {
+            return NULL;
+        }
+        t->vectors = v;
+        t->vectors_cap = cap;
+    }
+
+    kat_vector_t *v = &t->vectors[t->num_vectors++];
+    memset(v, 0, sizeof(*v));
+    return v;
+}
+
+// A section header ([AES-256 use df], [NonceLen = 128], ...). cur is the
+// current section, or NULL within a skipped one.
+static status_t parse_header(IN OUT kat_table_t *t,
+                             IN OUT kat_section_t **cur,
+                             IN const char *line,
+                             IN const uint32_t line_num)
+{
+    char mode[4] = {0};
+    char name[32] = {0};
+    char pr[8] = {0};
+    unsigned int bits = 0;
+
+    if ((2 == sscanf(line, "[AES-%u %3s df]", &bits, mode)) &&
+        ((128 == bits) || (192 == bits) || (256 == bits)) &&
+        ((0 == strcmp(mode, "use")) || (0 == strcmp(mode, "no"))))
+    {
+        kat_section_t *s = new_section(t);
+        if (NULL == s)
+        {
+            return ERROR;
+        }
+        snprintf(s->name, sizeof(s->name), "%s", line);
+        s->line = line_num;
+        s->key_size = (aes_key_size_t)((bits - 128) / 64);
+        s->key_len = bits / 8;
+        s->use_df = (0 == strcmp(mode, "use"));
+        *cur = s;
+        return SUCCESS;
+    }
+
+    if (NULL != strstr(line, " df]"))
+    {
+        // E.g., 3KeyTDEA.
+        t->skipped_sections++;
+        *cur = NULL;
+        return SUCCESS;
+    }
+
+    if (1 == sscanf(line, "[PredictionResistance = %7[A-Za-z]]", pr))
+    {
+        if ((NULL != *cur) && (0 != strcmp(pr, "False")))
+        {
+            // Prediction resistance takes its entropy from the pool, not
+            // from the vectors.
+            t->num_sections--;
+            t->skipped_sections++;
+            *cur = NULL;
+        }
+        return SUCCESS;
+    }
+
+    if ((2 != sscanf(line, "[%31[A-Za-z] = %u]", name, &bits)) ||
+        (0 != bits % 8) || (bits / 8 > KAT_MAX_LEN))
+    {
+        return ERROR;
+    }
+    if (NULL == *cur)
+    {
+        return SUCCESS;
+    }
+
+    kat_section_t *s = *cur;
+    if (0 == strcmp(name, "EntropyInputLen"))
+    {
+        s->entropy_len = bits / 8;
+    }
+    else if (0 == strcmp(name, "NonceLen"))
+    {
+        s->nonce_len = bits / 8;
+    }
+    else if (0 == strcmp(name, "PersonalizationStringLen"))
+    {
+        s->pers_len = bits / 8;
+    }
+    else if (0 == strcmp(name, "AdditionalInputLen"))
+    {
+        s->ad_len = bits / 8;
+    }
+    else if (0 == strcmp(name, "ReturnedBitsLen"))
+    {
+        s->returned_len = bits / 8;
+    }
+    else
+    {
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+_INLINE_ uint32_t field_len(IN const kat_section_t *s,
+                            IN const kat_field_t field)
+{
+    switch (field)
+    {
+    case KAT_F_ENTROPY:
+    case KAT_F_ENTROPY_RESEED:
+        return s->entropy_len;
+    case KAT_F_NONCE:
+        return s->nonce_len;
+    case KAT_F_PERS:
+        return s->pers_len;
+    case KAT_F_RETURNED:
+        return s->returned_len;
+    default:
+        return s->ad_len;
+    }
+}
+
+// A "Name = hex" line of the vector v of the section s.
+static status_t parse_value(IN OUT kat_vector_t *v,
+                            IN const kat_section_t *s,
+                            IN const int step,
+                            IN const char *name,
+                            IN const size_t name_len,
+                            IN const char *hex,
+                            IN const size_t hex_len)
+{
+    uint8_t *out;
+    uint32_t len;
+    kat_field_t field = KAT_F_COUNT;
+
+    if (is_name(name, name_len, "Key") || is_name(name, name_len, "V"))
+    {
+        if (step < 0)
+        {
+            return ERROR;
+        }
+        const int is_key = ('K' == name[0]);
+        out = is_key ? v->key[step] : v->v[step];
+        len = is_key ? s->key_len : AES_BLOCK_SIZE;
+        v->states |= is_key ? 0 : (1U << step);
+    }
+    else
+    {
+        if (is_name(name, name_len, "EntropyInput"))
+        {
+            field = KAT_F_ENTROPY;
+        }
+        else if (is_name(name, name_len, "Nonce"))
+        {
+            field = KAT_F_NONCE;
+        }
+        else if (is_name(name, name_len, "PersonalizationString"))
+        {
+            field = KAT_F_PERS;
+        }
+        else if (is_name(name, name_len, "EntropyInputReseed"))
+        {
+            field = KAT_F_ENTROPY_RESEED;
+        }
+        else if (is_name(name, name_len, "AdditionalInputReseed"))
+        {
+            field = KAT_F_AD_RESEED;
+        }
+        else if (is_name(name, name_len, "AdditionalInput"))
+        {
+            field = (v->fields & (1U << KAT_F_AD1)) ? KAT_F_AD2 : KAT_F_AD1;
+        }
+        else if (is_name(name, name_len, "ReturnedBits"))
+        {
+            field = KAT_F_RETURNED;
+        }
+
+        if ((KAT_F_COUNT == field) || (v->fields & (1U << field)))
+        {
+            return ERROR;
+        }
+
+        len = field_len(s, field);
+        out = v->in[field];
+        v->fields |= (1U << field);
+    }
+
+    if (hex_len != 2 * (size_t)len)
+    {
+        return ERROR;
+    }
+
+    return kat_hex_decode(out, hex, hex_len);
+}
+
+// The lengths the DRBG supports without the derivation function.
+_INLINE_ int section_supported(IN const kat_section_t *s)
+{
+    const uint32_t seed_len = CTR_DRBG_SEED_LEN(s->key_len);
+
+    return s->use_df ||
+           ((0 == s->nonce_len) && (s->entropy_len == seed_len) &&
+            (s->pers_len <= seed_len) && (s->ad_len <= seed_len));
+}
+
+static status_t parse(IN const char *path,
+                      IN const char *data,
+                      IN const size_t size,
+                      OUT kat_table_t *t)
+{
+    const char *p = data;
+    const char *end = data + size;
+    kat_section_t *cur = NULL;
+    kat_vector_t *v = NULL;
+    uint32_t line_num = 0;
+    int step = -1;
+
+    while (p < end)
+    {
+        const char *eol = (const char *)memchr(p, '\n', (size_t)(end - p));
+        const char *next = (NULL == eol) ? end : eol + 1;
+        const char *line = p;
+        size_t len = (size_t)(((NULL == eol) ? end : eol) - p);
+        status_t res = SUCCESS;
+
+        p = next;
+        line_num++;
+
+        while ((len > 0) &&
+               ((' ' == line[len - 1]) || ('\r' == line[len - 1]) ||
+                ('\t' == line[len - 1])))
+        {
+            len--;
+        }
+        while ((len > 0) && ((' ' == line[0]) || ('\t' == line[0])))
+        {
+            line++;
+            len--;
+        }
+
+        if ((0 == len) || ('#' == line[0]))
+        {
+            continue;
+        }
+
+        if (('[' == line[0]) || ('*' == line[0]))
+        {
+            char buf[KAT_LINE_LEN];
+            if (len >= sizeof(buf))
+            {
+                res = ERROR;
+            }
+            else
+            {
+                memcpy(buf, line, len);
+                buf[len] = '\0';
+            }
+
+            if ((SUCCESS == res) && ('[' == line[0]))
+            {
+                res = parse_header(t, &cur, buf, line_num);
+                v = NULL;
+            }
+            else if (SUCCESS == res)
+            {
+                step = -1;
+                for (int i = 0; i < KAT_STEP_COUNT; i++)
+                {
+                    step = (0 == strcmp(buf, g_step_markers[i])) ? i : step;
+                }
+                res = (step < 0) ? ERROR : SUCCESS;
+            }
+        }
+        else
+        {
+            const char *eq = (const char *)memchr(line, '=', len);
+            if (NULL == eq)
+            {
+                res = ERROR;
+            }
+            else if (NULL == cur)
+            {
+                // Within a skipped section.
+            }
+            else
+            {
+                size_t name_len = (size_t)(eq - line);
+                const char *hex = eq + 1;
+                size_t hex_len = len - name_len - 1;
+
+                while ((name_len > 0) && (' ' == line[name_len - 1]))
+                {
+                    name_len--;
+                }
+                while ((hex_len > 0) && (' ' == hex[0]))
+                {
+                    hex++;
+                    hex_len--;
+                }
+
+                if (is_name(line, name_len, "COUNT"))
+                {
+                    v = new_vector(t);
+                    res = ((NULL == v) || !section_supported(cur)) ? ERROR :
+                                                                     SUCCESS;
+                    if (SUCCESS == res)
+                    {
+                        v->section = (uint32_t)(cur - t->sections);
+                        v->count = (uint32_t)strtoul(hex, NULL, 10);
+                        v->line = line_num;
+                        step = -1;
+                    }
+                }
+                else
+                {
+                    res = (NULL == v) ? ERROR :
+                          parse_value(v, cur, step, line, name_len, hex,
+                                      hex_len);
+                }
+            }
+        }
+
+        if (SUCCESS != res)
+        {
+            printf("ERROR: %s:%u: cannot parse the line\n", path, line_num);
+            return ERROR;
+        }
+    }
+
+    for (uint32_t i = 0; i < t->num_vectors; i++)
+    {
+        if (KAT_ALL_FIELDS != t->vectors[i].fields)
+        {
+            printf("ERROR: %s:%u: an incomplete vector\n", path,
+                   t->vectors[i].line);
+            return ERROR;
+        }
+    }
+
+    return SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Running.
+////////////////////////////////////////////////////////////////////////////
+
+// It returns the reason of a mismatch, or NULL.
+_INLINE_ const char *check_state(IN const CTR_DRBG_STATE *drbg,
+                                 IN const kat_vector_t *v,
+                                 IN const kat_step_t step)
+{
+    if (0 == (v->states & (1U << step)))
+    {
+        return NULL;
+    }
+    if (0 != memcmp(&drbg->ks, v->key[step], drbg->impl->key_len))
+    {
+        return g_key_errors[step];
+    }
+    if (0 != memcmp(drbg->counter.bytes, v->v[step], AES_BLOCK_SIZE))
+    {
+        return g_v_errors[step];
+    }
+
+    return NULL;
+}
+
+// Run v with impl, and write the output of the first generate call to
+// out1. It returns the reason of a failure, or NULL.
+static const char *run_impl(IN const kat_section_t *s,
+                            IN const kat_vector_t *v,
+                            IN const aes_impl_t *impl,
+                            OUT uint8_t out1[KAT_MAX_LEN])
+{
+    CTR_DRBG_STATE drbg;
+    uint8_t out2[KAT_MAX_LEN];
+    const char *reason = NULL;
+    int ok;
+
+    if (s->use_df)
+    {
+        ok = CTR_DRBG_init_df(&drbg, s->key_size, v->in[KAT_F_ENTROPY],
+                              s->entropy_len, v->in[KAT_F_NONCE],
+                              s->nonce_len, v->in[KAT_F_PERS], s->pers_len);
+    }
+    else
+    {
+        ok = CTR_DRBG_init_key_size(&drbg, s->key_size, v->in[KAT_F_ENTROPY],
+                                    v->in[KAT_F_PERS], s->pers_len);
+    }
+
+    if (!ok)
+    {
+        reason = "INSTANTIATE failed";
+    }
+    else
+    {
+        CTR_DRBG_set_impl(&drbg, impl);
+        reason = check_state(&drbg, v, KAT_STEP_INSTANTIATE);
+    }
+
+    if (NULL == reason)
+    {
+        ok = s->use_df ?
+             CTR_DRBG_reseed_df(&drbg, v->in[KAT_F_ENTROPY_RESEED],
+                                s->entropy_len, v->in[KAT_F_AD_RESEED],
+                                s->ad_len) :
+             CTR_DRBG_reseed(&drbg, v->in[KAT_F_ENTROPY_RESEED],
+                             v->in[KAT_F_AD_RESEED], s->ad_len);
+        reason = ok ? check_state(&drbg, v, KAT_STEP_RESEED) :
+                      "RESEED failed";
+    }
+
+    if (NULL == reason)
+    {
+        ok = CTR_DRBG_generate(&drbg, out1, s->returned_len,
+                               v->in[KAT_F_AD1], s->ad_len);
+        reason = ok ? check_state(&drbg, v, KAT_STEP_GEN1) :
+                      "GENERATE (FIRST CALL) failed";
+    }
+
+    if (NULL == reason)
+    {
+        ok = CTR_DRBG_generate(&drbg, out2, s->returned_len,
+                               v->in[KAT_F_AD2], s->ad_len);
+        reason = ok ? check_state(&drbg, v, KAT_STEP_GEN2) :
+                      "GENERATE (SECOND CALL) failed";
+    }
+
+    if ((NULL == reason) &&
+        (0 != memcmp(out2, v->in[KAT_F_RETURNED], s->returned_len)))
+    {
+        reason = "ReturnedBits";
+    }
+
+    CTR_DRBG_clear(&drbg);
+    return reason;
+}
+
+static void report(IN OUT kat_job_t *job,
+                   IN const kat_vector_t *v,
+                   IN const aes_impl_t *impl,
+                   IN const char *reason,
+                   IN const char *other)
+{
+    const kat_section_t *s = &job->t->sections[v->section];
+
+    pthread_mutex_lock(&job->print_lock);
+    printf("KAT FAILURE: %s:%u %s COUNT = %u, %s: %s%s\n", job->path, v->line,
+           s->name, v->count, impl->name, reason, other);
+    pthread_mutex_unlock(&job->print_lock);
+
+    __atomic_fetch_add(&job->failures, 1, __ATOMIC_RELAXED);
+}
+
+// Run v with every implementation. The first generate call has no returned
+// bits in the files, so its output is compared across the implementations.
+static void run_vector(IN OUT kat_job_t *job, IN const kat_vector_t *v)
+{
+    const kat_section_t *s = &job->t->sections[v->section];
+    const aes_impl_t *ref = NULL;
+    uint8_t ref_out1[KAT_MAX_LEN];
+    uint8_t out1[KAT_MAX_LEN];
+
+    for (uint32_t id = 0; id < AES_IMPL_COUNT; id++)
+    {
+        const aes_impl_t *impl = aes_impl_get((aes_impl_id_t)id, s->key_size);
+        if (NULL == impl)
+        {
+            continue;
+        }
+
+        const char *reason = run_impl(s, v, impl, out1);
+        __atomic_fetch_add(&job->runs, 1, __ATOMIC_RELAXED);
+
+        if (NULL != reason)
+        {
+            report(job, v, impl, reason, "");
+        }
+        else if (NULL == ref)
+        {
+            ref = impl;
+            memcpy(ref_out1, out1, s->returned_len);
+        }
+        else if (0 != memcmp(ref_out1, out1, s->returned_len))
+        {
+            report(job, v, impl, "GENERATE (FIRST CALL) output differs from ",
+                   ref->name);
+        }
+    }
+}
+
+static void *kat_worker(IN void *arg)
+{
+    kat_job_t *job = (kat_job_t *)arg;
+    uint32_t i;
+
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) <
+           job->t->num_vectors)
+    {
+        run_vector(job, &job->t->vectors[i]);
+    }
+
+    return NULL;
+}
+
+// Run the vectors of t on num_threads threads, including the calling one.
+static void run(IN OUT kat_job_t *job, IN uint32_t num_threads)
+{
+    pthread_t threads[KAT_MAX_THREADS];
+    uint32_t num_started = 0;
+
+    if (0 == num_threads)
+    {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = (cpus > 0) ? (uint32_t)cpus : 1;
+    }
+    num_threads = (num_threads > KAT_MAX_THREADS) ? KAT_MAX_THREADS :
+                                                    num_threads;
+
+    // If a thread cannot be created, the others run its share.
+    while ((num_started + 1 < num_threads) &&
+           (0 == pthread_create(&threads[num_started], NULL, kat_worker, job)))
+    {
+        num_started++;
+    }
+
+    kat_worker(job);
+
+    for (uint32_t i = 0; i < num_started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+status_t kat_run_file(IN const char *path,
+                      IN const uint32_t num_threads,
+                      OUT kat_stats_t *stats)
+{
+    kat_table_t t;
+    struct stat st;
+    status_t res;
+
+    memset(&t, 0, sizeof(t));
+    memset(stats, 0, sizeof(*stats));
+
+    const int fd = open(path, O_RDONLY);
+    if ((fd < 0) || (0 != fstat(fd, &st)) || (0 == st.st_size))
+    {
+        printf("ERROR: cannot read %s\n", path);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return ERROR;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map)
+    {
+        printf("ERROR: cannot map %s\n", path);
+        return ERROR;
+    }
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    res = parse(path, (const char *)map, (size_t)st.st_size, &t);
+    munmap(map, (size_t)st.st_size);
+
+    if (SUCCESS == res)
+    {
+        kat_job_t job;
+
+        memset(&job, 0, sizeof(job));
+        job.path = path;
+        job.t = &t;
+        pthread_mutex_init(&job.print_lock, NULL);
+        run(&job, num_threads);
+        pthread_mutex_destroy(&job.print_lock);
+
+        stats->runs = job.runs;
+        stats->failures = job.failures;
+        res = (0 == job.failures) ? SUCCESS : ERROR;
+    }
+
+    stats->sections = t.num_sections;
+    stats->skipped_sections = t.skipped_sections;
+    stats->vectors = t.num_vectors;
+
+    free(t.sections);
+    free(t.vectors);
+
+    return res;
+}
@@ -0,0 +1,54 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#pragma once
+
+// The KAT engine of the tests. It maps a CAVP CTR_DRBG file (.txt, with the
+// intermediate Key and V values, or .rsp, without them) into memory,
+// decodes it into a table of vectors, and runs every AES vector with every
+// implementation the CPU supports, on several threads.
+
+#include <stdint.h>
+#include "defs.h"
+
+typedef struct kat_stats_s {
+    // The AES sections that ran, and the other (e.g., TDEA) ones.
+    uint32_t sections;
+    uint32_t skipped_sections;
+    uint32_t vectors;
+    // Vectors times implementations.
+    uint32_t runs;
+    uint32_t failures;
+} kat_stats_t;
+
+// Decode the hex_len hex digits at hex (upper or lower case) into
+// hex_len / 2 bytes at out. It returns ERROR if hex_len is odd or hex has
+// a character that is not a hex digit.
+status_t kat_hex_decode(OUT uint8_t *out,
+                        IN const char *hex,
+                        IN const size_t hex_len);
+
+// Load the file at path and run its vectors on num_threads threads (0 for
+// one per online CPU). Each failure is printed with its location (the
+// section, the COUNT and the line of the file) and implementation. It
+// returns SUCCESS if the file was parsed and all the runs passed.
+status_t kat_run_file(IN const char *path,
+                      IN const uint32_t num_threads,
+                      OUT kat_stats_t *stats);
@@ -18,8 +18,20 @@
 * The license is detailed in the file LICENSE.txt, and applies to this file.
 * ***************************************************************************/
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "aes_tune.h"
 #include "ctr_drbg.h"
+#include "ctr_drbg_buffer.h"
+#include "ctr_drbg_pool.h"
+#include "ctr_drbg_sched.h"
+#include "ctr_drbg_self_test.h"
+#include "drbg_rand.h"
+#include "kat_runner.h"
 #include "test_utilities.h"
 
 #ifdef PERF
@@ -30,7 +42,7 @@
 // The values belows represents bytes
 // When the name contain the string 'bits' it is only for consistency with NIST KATs
 #define NIST_TEST_COUNT 15
-#define MAX_NONCE_LEN 0
+#define MAX_NONCE_LEN (128/8)
 #define MAX_V_LEN (AES256_KEY_SIZE/2)
 #define MAX_ENTROPY_LEN (MAX_V_LEN + AES256_KEY_SIZE)
 #define MAX_ADITIONAL_INPUT_LEN (512/8)
@@ -53,6 +65,8 @@ _INLINE_ int measure()
     uint8_t  additional_in[1] = {0};
 
     CTR_DRBG_init(&drbg, entropy_in, personalization_string, 0);
+    printf("Using the %s kernels (set %s to override).\n", drbg.impl->name,
+           AES_IMPL_ENV_VAR);
 #ifdef COUNT_INSTRUCTIONS
     MEASURE("CTR_DRBG_generate", CTR_DRBG_generate(&drbg, drbg_out, ( 1 << 10), additional_in, 0););
 #else
@@ -61,6 +75,106 @@ _INLINE_ int measure()
         printf("i=%d: ", i);
         MEASURE("CTR_DRBG_generate", CTR_DRBG_generate(&drbg, drbg_out, i, additional_in, 0););
     }
+
+    ENTROPY_POOL *entropy_pool = entropy_pool_new(&entropy_source_getrandom,
+                                                  ENTROPY_POOL_DEFAULT_SIZE);
+    if (NULL != entropy_pool)
+    {
+        printf("i=%d: ", (int)AES256_KEY_SIZE);
+        MEASURE("CTR_DRBG_generate_pr", CTR_DRBG_generate_pr(&drbg, drbg_out, AES256_KEY_SIZE, additional_in, 0, entropy_pool););
+        printf("The entropy pool stalled %lu times.\n",
+               (unsigned long)entropy_pool_stalls(entropy_pool));
+        entropy_pool_free(entropy_pool);
+    }
+
+    // Reseed every 64 requests; the switches happen during the measurement.
+    const CTR_DRBG_RESEED_POLICY policy = {0, 64, 0};
+    CTR_DRBG_SCHED *sched = CTR_DRBG_sched_new(&entropy_source_getrandom,
+                                               AES_KEY_256, &policy,
+                                               personalization_string, 0);
+    if (NULL != sched)
+    {
+        printf("i=%d: ", (int)AES256_KEY_SIZE);
+        MEASURE("CTR_DRBG_sched_generate", CTR_DRBG_sched_generate(sched, drbg_out, AES256_KEY_SIZE, additional_in, 0););
+        printf("The scheduler reseeded %lu times.\n",
+               (unsigned long)CTR_DRBG_sched_reseeds(sched));
+        CTR_DRBG_sched_free(sched);
+    }
+
+    CTR_DRBG_STATE drbg_df;
+    printf("i=%d: ", (int)(AES256_KEY_SIZE + MAX_NONCE_LEN));
+    MEASURE("CTR_DRBG_init_df", CTR_DRBG_init_df(&drbg_df, AES_KEY_256, entropy_in, AES256_KEY_SIZE, &entropy_in[AES256_KEY_SIZE], MAX_NONCE_LEN, personalization_string, 0););
+    CTR_DRBG_clear(&drbg_df);
+
+    CTR_DRBG_STATE drbg128;
+    CTR_DRBG_init_key_size(&drbg128, AES_KEY_128, entropy_in,
+                           personalization_string, 0);
+    printf("i=%d: ", 1 << 14);
+    MEASURE("CTR_DRBG_generate (AES-128)", CTR_DRBG_generate(&drbg128, drbg_out, 1 << 14, additional_in, 0););
+    CTR_DRBG_clear(&drbg128);
+
+    CTR_DRBG_BUFFER b;
+    uint8_t storage[CTR_DRBG_BUFFER_DEFAULT_SIZE];
+    CTR_DRBG_buffer_init(&b, storage, sizeof(storage), entropy_in,
+                         personalization_string, 0);
+    for(uint32_t i = AES_BLOCK_SIZE ; i <= PAR_AES_BLOCK_SIZE; i <<= 1)
+    {
+        printf("i=%d: ", i);
+        MEASURE("CTR_DRBG_buffer_generate", CTR_DRBG_buffer_generate(&b, drbg_out, i););
+    }
+    CTR_DRBG_buffer_clear(&b);
+
+    // Four instances, 32 bytes each.
+    CTR_DRBG_STATE batch[AES_X4_LANES];
+    CTR_DRBG_STATE *batch_ptrs[AES_X4_LANES];
+    uint8_t *batch_outs[AES_X4_LANES];
+    size_t batch_lens[AES_X4_LANES];
+    for(uint32_t l = 0; l < AES_X4_LANES; l++)
+    {
+        CTR_DRBG_init(&batch[l], entropy_in, personalization_string, 0);
+        batch_ptrs[l] = &batch[l];
+        batch_outs[l] = &drbg_out[l * AES256_KEY_SIZE];
+        batch_lens[l] = AES256_KEY_SIZE;
+    }
+    printf("i=%d: ", (int)(AES_X4_LANES * AES256_KEY_SIZE));
+    MEASURE("CTR_DRBG_generate_batch", CTR_DRBG_generate_batch(batch_ptrs, batch_outs, batch_lens, AES_X4_LANES););
+    for(uint32_t l = 0; l < AES_X4_LANES; l++)
+    {
+        CTR_DRBG_clear(&batch[l]);
+    }
+
+    CTR_DRBG_POOL *pool = CTR_DRBG_pool_new(3);
+    if (NULL != pool)
+    {
+        printf("i=%d: ", 1 << 15);
+        MEASURE("CTR_DRBG_generate_parallel", CTR_DRBG_generate_parallel(&drbg, drbg_out, 1 << 15, additional_in, 0, pool););
+        CTR_DRBG_pool_free(pool);
+    }
+
+    // Eight keys, one by one and batched.
+    aes256_key_t ks_keys[AES_KS_BATCH_MAX] = {0};
+    aes256_ks_t ks[AES_KS_BATCH_MAX];
+    const aes256_key_t *ks_key_ptrs[AES_KS_BATCH_MAX];
+    aes256_ks_t *ks_ptrs[AES_KS_BATCH_MAX];
+    for(uint32_t l = 0; l < AES_KS_BATCH_MAX; l++)
+    {
+        ks_key_ptrs[l] = &ks_keys[l];
+        ks_ptrs[l] = &ks[l];
+    }
+    printf("n=%d: ", AES_KS_BATCH_MAX);
+    MEASURE("aes256_key_expansion",
+            for(uint32_t l = 0; l < AES_KS_BATCH_MAX; l++)
+            {
+                aes256_key_expansion(ks_ptrs[l], ks_key_ptrs[l]);
+            });
+    printf("n=%d: ", AES_KS_BATCH_MAX);
+    MEASURE("aes256_key_expansion_batch", drbg.impl->key_expansion_batch(ks_ptrs, ks_key_ptrs, AES_KS_BATCH_MAX););
+
+    printf("i=%d: ", (int)AES256_KEY_SIZE);
+    MEASURE("drbg_rand_bytes", drbg_rand_bytes(drbg_out, AES256_KEY_SIZE););
+    drbg_rand_thread_cleanup();
+
+    MEASURE("CTR_DRBG_self_test", CTR_DRBG_self_test(););
 #endif
     CTR_DRBG_clear(&drbg);
     
@@ -68,197 +182,1364 @@ _INLINE_ int measure()
 }
 
 #else // PERF
-_INLINE_ int test_ctr_drbg_init(FILE *f, 
-                                CTR_DRBG_STATE *drbg,
-                                const uint32_t entropy_in_len,
-                                const uint32_t nonce_len,
-                                const uint32_t personalization_string_len)
+// The key size of the kernels of |impl|.
+_INLINE_ aes_key_size_t impl_key_size(IN const aes_impl_t *impl)
 {
-    uint32_t count = 0;
-    uint8_t  entropy_in[MAX_ENTROPY_LEN] = {0};
-    uint8_t  nonce[MAX_NONCE_LEN+1] = {0};
-    uint8_t  personalization_string[MAX_PERSONALIZATION_STRING_LEN] = {0};
-    uint8_t  key[AES256_KEY_SIZE] = {0};
-    uint8_t  v[MAX_V_LEN] = {0};
-
-    // Prepare (read txt file)
-    GUARD(read_uint_in_bytes(f, &count, "COUNT = %u\n"));
-    GUARD(read_hex(f, entropy_in, "EntropyInput = ", entropy_in_len));
-    GUARD(read_hex(f, nonce, "Nonce = ", nonce_len));
-    GUARD(read_hex(f, personalization_string, "PersonalizationString = ", 
-                   personalization_string_len));
-
-    GUARD(read_op(f, "** INSTANTIATE:\n"));
-    GUARD(read_hex(f, key, "Key = ", AES256_KEY_SIZE));
-    GUARD(read_hex(f, v,   "V   = ", MAX_V_LEN));
-
-    entropy_t entropy = {{0}};
-    memcpy(entropy.raw, entropy_in, entropy_in_len);
-    memcpy(&entropy.raw[entropy_in_len], nonce, nonce_len);
-
-    // Run
-    CTR_DRBG_init(drbg, entropy.raw, personalization_string, 
-                  personalization_string_len);
-    
-    // Test
-    GUARD(equal((uint8_t*)&drbg->ks, key, AES256_KEY_SIZE));
-    GUARD(equal(drbg->counter.bytes, v, sizeof(drbg->counter)));
+    return (aes_key_size_t)((impl->key_len - AES128_KEY_SIZE) / 8);
+}
+
+// Initialise |drbg| with the key size of |impl|, and make it use |impl|.
+_INLINE_ void init_with_impl(OUT CTR_DRBG_STATE *drbg,
+                             IN const aes_impl_t *impl,
+                             IN const uint8_t entropy[CTR_DRBG_ENTROPY_LEN],
+                             IN const uint8_t *personalization,
+                             IN const size_t personalization_len)
+{
+    CTR_DRBG_init_key_size(drbg, impl_key_size(impl), entropy,
+                           personalization, personalization_len);
+    CTR_DRBG_set_impl(drbg, impl);
+}
+
+// Big-endian increment of the last 32 bits of a counter block.
+_INLINE_ void ref_ctr32_inc(IN OUT uint8_t block[AES_BLOCK_SIZE])
+{
+    for (int j = AES_BLOCK_SIZE - 1; j >= (int)AES_BLOCK_SIZE - 4; j--) {
+        if (0 != ++block[j]) {
+            break;
+        }
+    }
+}
+
+// Big-endian increment of a whole counter block.
+_INLINE_ void ref_ctr128_inc(IN OUT uint8_t block[AES_BLOCK_SIZE])
+{
+    for (int j = AES_BLOCK_SIZE - 1; j >= 0; j--) {
+        if (0 != ++block[j]) {
+            break;
+        }
+    }
+}
+
+// Encrypt one block with the AES-NI single block function of the key size of
+// |impl|.
+_INLINE_ void ref_enc(IN const aes_impl_t *impl,
+                      OUT uint8_t *ct,
+                      IN const uint8_t *pt,
+                      IN const aes_ks_t *ks)
+{
+    switch (impl->key_len) {
+    case AES128_KEY_SIZE:
+        aes128_enc(ct, pt, ks);
+        break;
+    case AES192_KEY_SIZE:
+        aes192_enc(ct, pt, ks);
+        break;
+    default:
+        aes256_enc(ct, pt, ks);
+        break;
+    }
+}
+
+#define MAX_KERNEL_TEST_BLOCKS 131
+
+// Compare all the CTR kernel variants of |impl| against a block by block
+// reference that uses ref_enc, for all lengths up to MAX_KERNEL_TEST_BLOCKS.
+_INLINE_ int test_ctr_kernel(IN const aes_impl_t *impl)
+{
+    const char *name = impl->name;
+    aes_key_t key;
+    aes_ks_t ks;
+    uint8_t ctr[AES_BLOCK_SIZE];
+    uint8_t ref[MAX_KERNEL_TEST_BLOCKS * AES_BLOCK_SIZE];
+    uint8_t ct[MAX_KERNEL_TEST_BLOCKS * AES_BLOCK_SIZE];
+
+    for (uint32_t i = 0; i < sizeof(key.raw); i++) {
+        key.raw[i] = (uint8_t)(i * 7 + 1);
+    }
+    for (uint32_t i = 0; i < sizeof(ctr); i++) {
+        ctr[i] = (uint8_t)(0xa0 + i);
+    }
+    impl->key_expansion(&ks, &key);
+
+    uint8_t block[AES_BLOCK_SIZE];
+    memcpy(block, ctr, sizeof(block));
+    for (uint32_t i = 0; i < MAX_KERNEL_TEST_BLOCKS; i++) {
+        ref_enc(impl, &ref[AES_BLOCK_SIZE * i], block, &ks);
+        ref_ctr32_inc(block);
+    }
+
+    for (uint32_t v = 0; v < AES_CTR_VARIANT_COUNT; v++) {
+        for (uint32_t n = 0; n <= MAX_KERNEL_TEST_BLOCKS; n++) {
+            memset(ct, 0, sizeof(ct));
+            impl->ctr_enc_variants[v](ct, ctr, n, &ks);
+            if ((SUCCESS != equal(ct, ref, AES_BLOCK_SIZE * n)) ||
+                (n < MAX_KERNEL_TEST_BLOCKS && 0 != ct[AES_BLOCK_SIZE * n])) {
+                printf("ERROR: %s variant %u mismatch for %u blocks\n",
+                       name, v, n);
+                return ERROR;
+            }
+
+            // XOR in place into a known pattern.
+            for (uint32_t i = 0; i < sizeof(ct); i++) {
+                ct[i] = (uint8_t)i;
+            }
+            impl->ctr_xor_variants[v](ct, ct, ctr, n, &ks);
+            for (uint32_t i = 0; i < sizeof(ct); i++) {
+                const uint8_t expected = (uint8_t)i ^
+                                         ((i < AES_BLOCK_SIZE * n) ? ref[i] : 0);
+                if (expected != ct[i]) {
+                    printf("ERROR: %s variant %u xor mismatch for %u blocks\n",
+                           name, v, n);
+                    return ERROR;
+                }
+            }
+        }
+    }
 
     return SUCCESS;
 }
 
-_INLINE_ int test_ctr_drbg_reseed(FILE *f,
-                                  CTR_DRBG_STATE *drbg,
-                                  const uint32_t entropy_in_len,
-                                  const uint32_t additional_in_len)
+#define MAX_X4_TEST_BLOCKS 40
+
+// Compare the multi instance CTR kernel of |impl|, lane by lane, against its
+// single instance kernel with a different key and counter per lane. One
+// counter wraps its low 32 bits.
+_INLINE_ int test_ctr_kernel_x4(IN const aes_impl_t *impl)
 {
-    uint8_t  entropy_in_reseed[MAX_ENTROPY_LEN] = {0};
-    uint8_t  additional_in_reseed[MAX_ADITIONAL_INPUT_LEN] = {0};
-    uint8_t  key[AES256_KEY_SIZE] = {0};
-    uint8_t  v[MAX_V_LEN] = {0};
+    const char *name = impl->name;
+    aes_key_t key;
+    aes_ks_t ks[AES_X4_LANES];
+    uint8_t ctr[AES_X4_LANES][AES_BLOCK_SIZE];
+    uint8_t ref[MAX_X4_TEST_BLOCKS * AES_BLOCK_SIZE];
+    uint8_t ct[AES_X4_LANES][(MAX_X4_TEST_BLOCKS + 1) * AES_BLOCK_SIZE];
+    uint8_t *ct_ptrs[AES_X4_LANES];
+    const uint8_t *ctr_ptrs[AES_X4_LANES];
+    const aes_ks_t *ks_ptrs[AES_X4_LANES];
+
+    for (uint32_t l = 0; l < AES_X4_LANES; l++) {
+        for (uint32_t i = 0; i < sizeof(key.raw); i++) {
+            key.raw[i] = (uint8_t)(i * 5 + l * 31 + 1);
+        }
+        for (uint32_t i = 0; i < AES_BLOCK_SIZE; i++) {
+            ctr[l][i] = (uint8_t)(0x10 * l + i);
+        }
+        impl->key_expansion(&ks[l], &key);
+        ct_ptrs[l] = ct[l];
+        ctr_ptrs[l] = ctr[l];
+        ks_ptrs[l] = &ks[l];
+    }
+    memset(&ctr[2][AES_BLOCK_SIZE - 4], 0xff, 4);
 
-    // Prepare
-    GUARD(read_hex(f, entropy_in_reseed, "EntropyInputReseed = ", 
-                   entropy_in_len));
-    GUARD(read_hex(f, additional_in_reseed, "AdditionalInputReseed = ", 
-                   additional_in_len));
+    for (uint32_t n = 0; n <= MAX_X4_TEST_BLOCKS; n++) {
+        memset(ct, 0, sizeof(ct));
+        impl->ctr_enc_x4(ct_ptrs, ctr_ptrs, n, ks_ptrs);
+
+        for (uint32_t l = 0; l < AES_X4_LANES; l++) {
+            impl->ctr_enc(ref, ctr[l], n, &ks[l]);
+            if ((SUCCESS != equal(ct[l], ref, AES_BLOCK_SIZE * n)) ||
+                (0 != ct[l][AES_BLOCK_SIZE * n])) {
+                printf("ERROR: %s x4 mismatch in lane %u for %u blocks\n",
+                       name, l, n);
+                return ERROR;
+            }
+        }
+    }
 
-    GUARD(read_op(f, "** RESEED:\n"));
-    GUARD(read_hex(f, key, "Key = ", AES256_KEY_SIZE));
-    GUARD(read_hex(f, v,   "V   = ", MAX_V_LEN));
-    
-    // Run
-    CTR_DRBG_reseed(drbg, entropy_in_reseed, 
-                    additional_in_reseed, additional_in_len);
-    
-    // Test
-    GUARD(equal((uint8_t*)&drbg->ks, key, AES256_KEY_SIZE));
-    GUARD(equal(drbg->counter.bytes, v, sizeof(drbg->counter)));
     return SUCCESS;
 }
 
-_INLINE_ int test_ctr_drbg_gen1(FILE *f,
-                                CTR_DRBG_STATE *drbg,                                
-                                const uint32_t additional_in_len)
+#define MAX_KS_TEST_KEYS (2 * AES_KS_BATCH_MAX + 3)
+
+// Compare the batched key expansion of |impl| against its single key
+// expansion for every number of keys up to MAX_KS_TEST_KEYS.
+_INLINE_ int test_key_expansion_batch(IN const aes_impl_t *impl)
 {
-    uint8_t additional_in[MAX_ADITIONAL_INPUT_LEN] = {0};
-    uint8_t key[AES256_KEY_SIZE] = {0};
-    uint8_t v[MAX_V_LEN] = {0};
-    uint8_t drbg_out[MAX_RETURNED_BITS_LEN] = {0};
+    const char *name = impl->name;
+    aes_key_t key[MAX_KS_TEST_KEYS];
+    aes_ks_t ks[MAX_KS_TEST_KEYS];
+    aes_ks_t ref;
+    const aes_key_t *key_ptrs[MAX_KS_TEST_KEYS];
+    aes_ks_t *ks_ptrs[MAX_KS_TEST_KEYS];
 
-    // Prepare
-    GUARD(read_hex(f, additional_in, "AdditionalInput = ", additional_in_len));
-    GUARD(read_op(f, "** GENERATE (FIRST CALL):\n"));
-    GUARD(read_hex(f, key, "Key = ", AES256_KEY_SIZE));
-    GUARD(read_hex(f, v,   "V   = ", MAX_V_LEN));
+    for (uint32_t j = 0; j < MAX_KS_TEST_KEYS; j++) {
+        for (uint32_t i = 0; i < sizeof(key[j].raw); i++) {
+            key[j].raw[i] = (uint8_t)(i * 13 + j * 29 + 7);
+        }
+        key_ptrs[j] = &key[j];
+        ks_ptrs[j] = &ks[j];
+    }
 
-    // Run
-    CTR_DRBG_generate(drbg, drbg_out, MAX_RETURNED_BITS_LEN, 
-                      additional_in, additional_in_len);
+    for (uint32_t n = 0; n <= MAX_KS_TEST_KEYS; n++) {
+        memset(ks, 0, sizeof(ks));
+        impl->key_expansion_batch(ks_ptrs, key_ptrs, n);
 
-    // Test
-    GUARD(equal((uint8_t*)&drbg->ks, key, AES256_KEY_SIZE));
-    GUARD(equal(drbg->counter.bytes, v, sizeof(drbg->counter)));
+        for (uint32_t j = 0; j < MAX_KS_TEST_KEYS; j++) {
+            if (j < n) {
+                impl->key_expansion(&ref, &key[j]);
+            } else {
+                memset(&ref, 0, sizeof(ref));
+            }
+
+            if (SUCCESS != equal((uint8_t*)&ks[j], (uint8_t*)&ref,
+                                 sizeof(ref))) {
+                printf("ERROR: %s key expansion mismatch for key %u of %u\n",
+                       name, j, n);
+                return ERROR;
+            }
+        }
+    }
 
     return SUCCESS;
 }
 
-_INLINE_ int test_ctr_drbg_gen2(FILE *f, 
-                                CTR_DRBG_STATE *drbg,
-                                const uint32_t additional_in_len, 
-                                const uint32_t returned_bits_len)
+#define MAX_BCC_TEST_BLOCKS 9
+
+// Compare the BCC kernel of |impl|, lane by lane, against chained single
+// block encryptions, for every number of blocks up to MAX_BCC_TEST_BLOCKS.
+_INLINE_ int test_bcc(IN const aes_impl_t *impl)
 {
-    uint8_t additional_in[MAX_ADITIONAL_INPUT_LEN] = {0};
-    uint8_t key[AES256_KEY_SIZE] = {0};
-    uint8_t v[MAX_V_LEN] = {0};
-    uint8_t returned_bits[MAX_RETURNED_BITS_LEN] = {0};
-    uint8_t drbg_out[MAX_RETURNED_BITS_LEN] = {0};
+    aes_key_t key;
+    aes_ks_t ks;
+    uint8_t data[MAX_BCC_TEST_BLOCKS * AES_BLOCK_SIZE];
+    uint8_t cv[AES_BCC_LANES * AES_BLOCK_SIZE];
+    uint8_t ref[AES_BLOCK_SIZE];
 
-    // Prepare
-    GUARD(read_hex(f, additional_in, "AdditionalInput = ", additional_in_len));
-    GUARD(read_hex(f, returned_bits, "ReturnedBits = ", returned_bits_len));
-    GUARD(read_op(f, "** GENERATE (SECOND CALL):\n"));
-    GUARD(read_hex(f, key, "Key = ", AES256_KEY_SIZE));
-    GUARD(read_hex(f, v,   "V   = ", MAX_V_LEN));
+    for (uint32_t i = 0; i < sizeof(key.raw); i++) {
+        key.raw[i] = (uint8_t)(i * 3 + 4);
+    }
+    for (uint32_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i * 9 + 1);
+    }
+    impl->key_expansion(&ks, &key);
+
+    for (uint32_t n = 0; n <= MAX_BCC_TEST_BLOCKS; n++) {
+        for (uint32_t i = 0; i < sizeof(cv); i++) {
+            cv[i] = (uint8_t)(i + n);
+        }
+        impl->bcc(cv, data, n, &ks);
+
+        for (uint32_t l = 0; l < AES_BCC_LANES; l++) {
+            for (uint32_t i = 0; i < AES_BLOCK_SIZE; i++) {
+                ref[i] = (uint8_t)(AES_BLOCK_SIZE * l + i + n);
+            }
+            for (uint32_t b = 0; b < n; b++) {
+                for (uint32_t i = 0; i < AES_BLOCK_SIZE; i++) {
+                    ref[i] ^= data[AES_BLOCK_SIZE * b + i];
+                }
+                ref_enc(impl, ref, ref, &ks);
+            }
+
+            if (SUCCESS != equal(&cv[AES_BLOCK_SIZE * l], ref, AES_BLOCK_SIZE)) {
+                printf("ERROR: %s BCC mismatch in lane %u for %u blocks\n",
+                       impl->name, l, n);
+                return ERROR;
+            }
+        }
+    }
 
-    // Run
-    CTR_DRBG_generate(drbg, drbg_out, MAX_RETURNED_BITS_LEN, 
-                      additional_in, additional_in_len);
-    
-    // Test
-    GUARD(equal((uint8_t*)&drbg->ks, key, AES256_KEY_SIZE));
-    GUARD(equal(drbg->counter.bytes, v, sizeof(drbg->counter)));
-    GUARD(equal(drbg_out, returned_bits, returned_bits_len));
-    
     return SUCCESS;
 }
 
-_INLINE_ int test_kats()
+// A block by block CTR_DRBG_generate (SP 800-90Ar1, 10.2.1.5.1) without
+// additional input, built on ref_enc only.
+_INLINE_ void ref_generate(IN OUT CTR_DRBG_STATE *drbg,
+                           OUT uint8_t *out,
+                           IN const uint32_t out_len)
+{
+    const aes_impl_t *impl = drbg->impl;
+    uint8_t block[AES_BLOCK_SIZE];
+    uint8_t temp[CTR_DRBG_ENTROPY_LEN];
+    aes_key_t key;
+
+    for (uint32_t i = 0; i < out_len; i += AES_BLOCK_SIZE) {
+        ref_ctr128_inc(drbg->counter.bytes);
+        ref_enc(impl, block, drbg->counter.bytes, &drbg->ks);
+        memcpy(&out[i], block,
+               (out_len - i < AES_BLOCK_SIZE) ? out_len - i : AES_BLOCK_SIZE);
+    }
+
+    for (uint32_t i = 0; i < CTR_DRBG_SEED_LEN(impl->key_len);
+         i += AES_BLOCK_SIZE) {
+        ref_ctr128_inc(drbg->counter.bytes);
+        ref_enc(impl, &temp[i], drbg->counter.bytes, &drbg->ks);
+    }
+
+    memcpy(key.raw, temp, impl->key_len);
+    memcpy(drbg->counter.bytes, &temp[impl->key_len], AES_BLOCK_SIZE);
+    impl->key_expansion(&drbg->ks, &key);
+    drbg->reseed_counter++;
+}
+
+#define MAX_GEN_TEST_LEN (4096 + 3 * AES_BLOCK_SIZE)
+
+// Compare CTR_DRBG_generate against ref_generate for lengths that cover the
+// fused short path, the long path, and partial last blocks.
+_INLINE_ int test_generate_lengths(IN const aes_impl_t *impl)
 {
+    static const uint32_t lens[] = {0, 1, 15, 16, 17, 48, 63, 64, 65, 255,
+                                    256, 257, 271, 272, 1000, 1024, 4095,
+                                    MAX_GEN_TEST_LEN};
     CTR_DRBG_STATE drbg;
+    CTR_DRBG_STATE xor_drbg;
+    CTR_DRBG_STATE ref;
+    uint8_t entropy[CTR_DRBG_ENTROPY_LEN];
+    uint8_t out[MAX_GEN_TEST_LEN];
+    uint8_t xor_out[MAX_GEN_TEST_LEN];
+    uint8_t ref_out[MAX_GEN_TEST_LEN];
+
+    for (uint32_t i = 0; i < sizeof(entropy); i++) {
+        entropy[i] = (uint8_t)(3 * i + 5);
+    }
 
-    pr_t pr;
-    uint32_t entropy_in_len = 0;
-    uint32_t nonce_len = 0;
-    uint32_t personalization_string_len = 0;
-    uint32_t additional_in_len = 0;
-    uint32_t returned_bits_len = 0;
+    init_with_impl(&drbg, impl, entropy, NULL, 0);
+    memcpy(&xor_drbg, &drbg, sizeof(xor_drbg));
+    memcpy(&ref, &drbg, sizeof(ref));
 
-    FILE *txt_fp = fopen("KATs/CTR_DRBG_pr_false.txt", "r"); // read mode
+    for (uint32_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        for (uint32_t j = 0; j < lens[i]; j++) {
+            xor_out[j] = (uint8_t)j;
+        }
 
-    if (NULL == txt_fp)
+        CTR_DRBG_generate(&drbg, out, lens[i], NULL, 0);
+        CTR_DRBG_generate_xor(&xor_drbg, xor_out, lens[i], NULL, 0);
+        ref_generate(&ref, ref_out, lens[i]);
+
+        if ((SUCCESS != equal(out, ref_out, lens[i])) ||
+            (SUCCESS != equal((uint8_t*)&drbg, (uint8_t*)&ref, sizeof(ref)))) {
+            printf("ERROR: CTR_DRBG_generate mismatch for %u bytes\n", lens[i]);
+            return ERROR;
+        }
+
+        for (uint32_t j = 0; j < lens[i]; j++) {
+            xor_out[j] ^= (uint8_t)j;
+        }
+
+        if ((SUCCESS != equal(xor_out, ref_out, lens[i])) ||
+            (SUCCESS != equal((uint8_t*)&xor_drbg, (uint8_t*)&ref, sizeof(ref)))) {
+            printf("ERROR: CTR_DRBG_generate_xor mismatch for %u bytes\n",
+                   lens[i]);
+            return ERROR;
+        }
+    }
+
+    CTR_DRBG_clear(&drbg);
+    CTR_DRBG_clear(&xor_drbg);
+    CTR_DRBG_clear(&ref);
+
+    return SUCCESS;
+}
+
+#define BATCH_TEST_STATES 7
+
+// CTR_DRBG_generate_batch must match CTR_DRBG_generate on each instance, for
+// a batch that mixes short and long requests and leaves a partial group. Every
+// third instance is an AES-256 one, to mix key sizes.
+_INLINE_ int test_generate_batch(IN const aes_impl_t *impl)
+{
+    static const size_t lens[BATCH_TEST_STATES] = {32, 0, 1000, 17, 256,
+                                                   64, 48};
+    CTR_DRBG_STATE drbg[BATCH_TEST_STATES];
+    CTR_DRBG_STATE ref[BATCH_TEST_STATES];
+    CTR_DRBG_STATE *drbg_ptrs[BATCH_TEST_STATES];
+    uint8_t entropy[CTR_DRBG_ENTROPY_LEN];
+    uint8_t out[BATCH_TEST_STATES][1000];
+    uint8_t ref_out[1000];
+    uint8_t *out_ptrs[BATCH_TEST_STATES];
+
+    for (uint32_t i = 0; i < BATCH_TEST_STATES; i++) {
+        for (uint32_t j = 0; j < sizeof(entropy); j++) {
+            entropy[j] = (uint8_t)(j + 11 * i);
+        }
+        if (2 == i % 3) {
+            CTR_DRBG_init(&drbg[i], entropy, NULL, 0);
+        } else {
+            init_with_impl(&drbg[i], impl, entropy, NULL, 0);
+        }
+        memcpy(&ref[i], &drbg[i], sizeof(ref[i]));
+        drbg_ptrs[i] = &drbg[i];
+        out_ptrs[i] = out[i];
+    }
+
+    // Twice, to also check the updated states.
+    for (uint32_t k = 0; k < 2; k++) {
+        if (1 != CTR_DRBG_generate_batch(drbg_ptrs, out_ptrs, lens,
+                                         BATCH_TEST_STATES)) {
+            printf("ERROR: CTR_DRBG_generate_batch failed\n");
+            return ERROR;
+        }
+
+        for (uint32_t i = 0; i < BATCH_TEST_STATES; i++) {
+            CTR_DRBG_generate(&ref[i], ref_out, lens[i], NULL, 0);
+            if ((SUCCESS != equal(out[i], ref_out, (uint32_t)lens[i])) ||
+                (SUCCESS != equal((uint8_t*)&drbg[i], (uint8_t*)&ref[i],
+                                  sizeof(ref[i])))) {
+                printf("ERROR: CTR_DRBG_generate_batch mismatch for "
+                       "instance %u\n", i);
+                return ERROR;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < BATCH_TEST_STATES; i++) {
+        CTR_DRBG_clear(&drbg[i]);
+        CTR_DRBG_clear(&ref[i]);
+    }
+
+    return SUCCESS;
+}
+
+#define POOL_TEST_WORKERS 3
+#define WRAP_TEST_CARRY_BYTES 3
+
+// Start CTR_DRBG_generate (and the batched, parallel and streaming variants)
+// a few blocks before the last 32 bits of V wrap around, and check that the
+// carry propagates into the upper bits as in ref_generate. The requests cover
+// the fused short path, the long path and the update blocks. The streaming
+// output starts at every 16 bytes offset from a 64 bytes boundary, and at a
+// misaligned one.
+_INLINE_ int test_counter_wrap(IN const aes_impl_t *impl)
+{
+    static const uint32_t lens[] = {0, 16, 64, 256, 1000, 4096, 20000};
+    static const uint32_t offsets[] = {1, 2, 3, 4, 5, 17, 300, 1300};
+    static const uint32_t out_offsets[] = {0, 16, 32, 48, 3};
+    ALIGN(64) static uint8_t out[20000 + 64];
+    static uint8_t ref_out[20000];
+    uint8_t entropy[CTR_DRBG_ENTROPY_LEN];
+    CTR_DRBG_STATE drbg;
+    CTR_DRBG_STATE ref;
+    CTR_DRBG_STATE *drbg_ptr = &drbg;
+    uint8_t *out_ptr = out;
+    int res = SUCCESS;
+
+    CTR_DRBG_POOL *pool = CTR_DRBG_pool_new(POOL_TEST_WORKERS);
+    if (NULL == pool) {
+        printf("ERROR: CTR_DRBG_pool_new failed\n");
+        return ERROR;
+    }
+
+    for (uint32_t i = 0; i < sizeof(entropy); i++) {
+        entropy[i] = (uint8_t)(11 * i + 3);
+    }
+
+    for (uint32_t mode = 0; mode < 4; mode++) {
+        for (uint32_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+            for (uint32_t k = 0; k < sizeof(offsets) / sizeof(offsets[0]); k++) {
+                const uint32_t low = 0xffffffff - offsets[k] + 1;
+                const size_t len = lens[i];
+                uint8_t *dst = out;
+
+                init_with_impl(&drbg, impl, entropy, NULL, 0);
+                if (3 == mode) {
+                    CTR_DRBG_set_placement(&drbg, CTR_DRBG_PLACEMENT_STREAM, 1);
+                    dst = &out[out_offsets[k % 5]];
+                }
+
+                // Make the carry run through the upper words too.
+                memset(&drbg.counter.bytes[AES_BLOCK_SIZE - 4 -
+                                           WRAP_TEST_CARRY_BYTES * (k & 1)],
+                       0xff, WRAP_TEST_CARRY_BYTES * (k & 1));
+                drbg.counter.bytes[12] = (uint8_t)(low >> 24);
+                drbg.counter.bytes[13] = (uint8_t)(low >> 16);
+                drbg.counter.bytes[14] = (uint8_t)(low >> 8);
+                drbg.counter.bytes[15] = (uint8_t)low;
+                memcpy(&ref, &drbg, sizeof(ref));
+
+                if (0 == mode) {
+                    CTR_DRBG_generate(&drbg, out, len, NULL, 0);
+                } else if (1 == mode) {
+                    CTR_DRBG_generate_batch(&drbg_ptr, &out_ptr, &len, 1);
+                } else if (2 == mode) {
+                    CTR_DRBG_generate_parallel(&drbg, out, len, NULL, 0, pool);
+                } else {
+                    CTR_DRBG_generate(&drbg, dst, len, NULL, 0);
+                }
+                ref_generate(&ref, ref_out, (uint32_t)len);
+
+                if ((SUCCESS != equal(dst, ref_out, (uint32_t)len)) ||
+                    (SUCCESS != equal((uint8_t*)&drbg, (uint8_t*)&ref,
+                                      sizeof(ref)))) {
+                    printf("ERROR: counter wrap mismatch (mode %u) for %u "
+                           "bytes, %u blocks before the wrap\n", mode,
+                           (uint32_t)len, offsets[k]);
+                    res = ERROR;
+                }
+            }
+        }
+    }
+
+    CTR_DRBG_pool_free(pool);
+    CTR_DRBG_clear(&drbg);
+    CTR_DRBG_clear(&ref);
+
+    return res;
+}
+
+#define STREAM_TEST_LEN (3 * CTR_DRBG_MAX_GENERATE_LENGTH + 100)
+
+// CTR_DRBG_generate_stream must match a loop of maximal CTR_DRBG_generate
+// requests, with the same additional input, also with non-temporal stores
+// (mode 1) and with a pool (mode 2).
+_INLINE_ int test_generate_stream(IN const aes_impl_t *impl)
+{
+    ALIGN(64) static uint8_t out[STREAM_TEST_LEN + AES_BLOCK_SIZE];
+    static uint8_t ref_out[STREAM_TEST_LEN];
+    uint8_t entropy[CTR_DRBG_ENTROPY_LEN];
+    uint8_t additional_in[CTR_DRBG_ENTROPY_LEN];
+    CTR_DRBG_STATE drbg;
+    CTR_DRBG_STATE ref;
+
+    CTR_DRBG_POOL *pool = CTR_DRBG_pool_new(POOL_TEST_WORKERS);
+    if (NULL == pool) {
+        printf("ERROR: CTR_DRBG_pool_new failed\n");
+        return ERROR;
+    }
+
+    for (uint32_t i = 0; i < sizeof(entropy); i++) {
+        entropy[i] = (uint8_t)(13 * i + 1);
+        additional_in[i] = (uint8_t)(3 * i);
+    }
+
+    for (uint32_t mode = 0; mode < 3; mode++) {
+        // The whole output is streamed, but none of the requests alone.
+        const uint32_t placement = (0 == mode) ? CTR_DRBG_PLACEMENT_CACHE
+                                               : CTR_DRBG_PLACEMENT_STREAM;
+        uint8_t *dst = &out[AES_BLOCK_SIZE * (mode & 1)];
+
+        init_with_impl(&drbg, impl, entropy, NULL, 0);
+        CTR_DRBG_set_placement(&drbg, (ctr_drbg_placement_t)placement,
+                               STREAM_TEST_LEN);
+        memcpy(&ref, &drbg, sizeof(ref));
+
+        const size_t ad_len = CTR_DRBG_seed_len(&drbg);
+        if (2 == mode) {
+            CTR_DRBG_generate_stream_parallel(&drbg, dst, STREAM_TEST_LEN,
+                                              additional_in, ad_len, pool);
+        } else {
+            CTR_DRBG_generate_stream(&drbg, dst, STREAM_TEST_LEN,
+                                     additional_in, ad_len);
+        }
+        for (uint32_t i = 0; i < STREAM_TEST_LEN;
+             i += CTR_DRBG_MAX_GENERATE_LENGTH) {
+            const uint32_t todo = (STREAM_TEST_LEN - i < CTR_DRBG_MAX_GENERATE_LENGTH)
+                                  ? STREAM_TEST_LEN - i : CTR_DRBG_MAX_GENERATE_LENGTH;
+            CTR_DRBG_generate(&ref, &ref_out[i], todo, additional_in, ad_len);
+        }
+
+        if ((SUCCESS != equal(dst, ref_out, STREAM_TEST_LEN)) ||
+            (SUCCESS != equal((uint8_t*)&drbg, (uint8_t*)&ref, sizeof(ref)))) {
+            printf("ERROR: CTR_DRBG_generate_stream mismatch (mode %u)\n",
+                   mode);
+            CTR_DRBG_pool_free(pool);
+            return ERROR;
+        }
+    }
+    CTR_DRBG_pool_free(pool);
+
+    // Requests beyond the reseed interval are refused as a whole.
+    drbg.reseed_counter = (UINT64_C(1) << 48) - 1;
+    if (0 != CTR_DRBG_generate_stream(&drbg, out, STREAM_TEST_LEN, NULL, 0)) {
+        printf("ERROR: CTR_DRBG_generate_stream ignored the reseed interval\n");
+        return ERROR;
+    }
+
+    CTR_DRBG_clear(&drbg);
+    CTR_DRBG_clear(&ref);
+
+    return SUCCESS;
+}
+
+// CTR_DRBG_generate_parallel must match CTR_DRBG_generate, with and without
+// additional data, for lengths below, at and above the chunk boundaries.
+_INLINE_ int test_generate_parallel(IN const aes_impl_t *impl)
+{
+    static const uint32_t lens[] = {0, 17, 1000,
+                                    CTR_DRBG_POOL_CHUNK_BLOCKS * AES_BLOCK_SIZE,
+                                    CTR_DRBG_POOL_CHUNK_BLOCKS * AES_BLOCK_SIZE + 1,
+                                    20000, CTR_DRBG_MAX_GENERATE_LENGTH - 1,
+                                    CTR_DRBG_MAX_GENERATE_LENGTH};
+    static uint8_t out[CTR_DRBG_MAX_GENERATE_LENGTH];
+    static uint8_t ref_out[CTR_DRBG_MAX_GENERATE_LENGTH];
+    uint8_t entropy[CTR_DRBG_ENTROPY_LEN];
+    uint8_t additional_in[CTR_DRBG_ENTROPY_LEN];
+    CTR_DRBG_STATE drbg;
+    CTR_DRBG_STATE ref;
+    int res = SUCCESS;
+
+    CTR_DRBG_POOL *pool = CTR_DRBG_pool_new(POOL_TEST_WORKERS);
+    if (NULL == pool) {
+        printf("ERROR: CTR_DRBG_pool_new failed\n");
+        return ERROR;
+    }
+
+    for (uint32_t i = 0; i < sizeof(entropy); i++) {
+        entropy[i] = (uint8_t)(7 * i + 2);
+        additional_in[i] = (uint8_t)(5 * i + 9);
+    }
+
+    init_with_impl(&drbg, impl, entropy, NULL, 0);
+    memcpy(&ref, &drbg, sizeof(ref));
+
+    const uint32_t num_lens = sizeof(lens) / sizeof(lens[0]);
+    for (uint32_t i = 0; (SUCCESS == res) && (i < 2 * num_lens); i++) {
+        const uint32_t len = lens[i % num_lens];
+        const size_t ad_len = (i < num_lens) ? 0 : CTR_DRBG_seed_len(&drbg);
+
+        CTR_DRBG_generate_parallel(&drbg, out, len, additional_in, ad_len,
+                                   pool);
+        CTR_DRBG_generate(&ref, ref_out, len, additional_in, ad_len);
+
+        if ((SUCCESS != equal(out, ref_out, len)) ||
+            (SUCCESS != equal((uint8_t*)&drbg, (uint8_t*)&ref, sizeof(ref)))) {
+            printf("ERROR: CTR_DRBG_generate_parallel mismatch for %u bytes\n",
+                   len);
+            res = ERROR;
+        }
+    }
+
+    CTR_DRBG_pool_free(pool);
+    CTR_DRBG_clear(&drbg);
+    CTR_DRBG_clear(&ref);
+
+    return res;
+}
+
+// Not a multiple of the entropy input lengths, so that requests span both
+// buffers of the pool.
+#define PR_TEST_POOL_SIZE 100
+#define PR_TEST_REQUESTS 24
+
+// A deterministic entropy source: byte i of its output stream is
+// stub_byte(i). It fails once it would exceed limit bytes.
+typedef struct stub_source_s {
+    uint64_t pos;
+    uint64_t limit;
+} stub_source_t;
+
+_INLINE_ uint8_t stub_byte(IN const uint64_t i)
+{
+    return (uint8_t)((i ^ (i >> 8)) * 13 + 5);
+}
+
+static int stub_fill(OUT uint8_t *buf, IN size_t len, IN void *ctx)
+{
+    stub_source_t *stub = (stub_source_t *)ctx;
+
+    if (stub->pos + len > stub->limit) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = stub_byte(stub->pos++);
+    }
+    return 1;
+}
+
+// Initialise |drbg| with the key size of |impl|, with or without the
+// derivation function.
+_INLINE_ void init_pr_test(OUT CTR_DRBG_STATE *drbg,
+                           IN const aes_impl_t *impl,
+                           IN const int use_df)
+{
+    uint8_t entropy[CTR_DRBG_ENTROPY_LEN];
+
+    for (uint32_t i = 0; i < sizeof(entropy); i++) {
+        entropy[i] = (uint8_t)(5 * i + 7);
+    }
+
+    if (use_df) {
+        CTR_DRBG_init_df(drbg, impl_key_size(impl), entropy, impl->key_len,
+                         &entropy[impl->key_len], MAX_NONCE_LEN, NULL, 0);
+        CTR_DRBG_set_impl(drbg, impl);
+    } else {
+        init_with_impl(drbg, impl, entropy, NULL, 0);
+    }
+}
+
+// CTR_DRBG_generate_pr must match a reseed with the next bytes of the entropy
+// source followed by CTR_DRBG_generate, with and without the derivation
+// function. A pool whose source fails must fail the requests.
+_INLINE_ int test_generate_pr(IN const aes_impl_t *impl)
+{
+    static const uint32_t lens[] = {0, 16, 33, 300, 5000};
+    uint8_t additional_in[CTR_DRBG_ENTROPY_LEN];
+    uint8_t entropy[CTR_DRBG_ENTROPY_LEN];
+    uint8_t out[5000];
+    uint8_t ref_out[5000];
+    CTR_DRBG_STATE drbg;
+    CTR_DRBG_STATE ref;
+
+    for (uint32_t i = 0; i < sizeof(additional_in); i++) {
+        additional_in[i] = (uint8_t)(9 * i + 4);
+    }
+
+    for (int use_df = 0; use_df < 2; use_df++) {
+        stub_source_t stub = {0, UINT64_MAX};
+        const entropy_source_t src = {"stub", stub_fill, &stub};
+        uint64_t ref_pos = 0;
+
+        init_pr_test(&drbg, impl, use_df);
+        memcpy(&ref, &drbg, sizeof(ref));
+        const size_t entropy_len = use_df ? impl->key_len
+                                          : CTR_DRBG_seed_len(&drbg);
+
+        ENTROPY_POOL *pool = entropy_pool_new(&src, PR_TEST_POOL_SIZE);
+        if (NULL == pool) {
+            printf("ERROR: entropy_pool_new failed\n");
+            return ERROR;
+        }
+
+        for (uint32_t r = 0; r < PR_TEST_REQUESTS; r++) {
+            const uint32_t len = lens[r % (sizeof(lens) / sizeof(lens[0]))];
+            const size_t ad_len = (r & 1) ? CTR_DRBG_seed_len(&drbg) : 0;
+
+            if (1 != CTR_DRBG_generate_pr(&drbg, out, len, additional_in,
+                                          ad_len, pool)) {
+                printf("ERROR: CTR_DRBG_generate_pr failed\n");
+                entropy_pool_free(pool);
+                return ERROR;
+            }
+
+            for (uint32_t i = 0; i < entropy_len; i++) {
+                entropy[i] = stub_byte(ref_pos++);
+            }
+            if (use_df) {
+                CTR_DRBG_reseed_df(&ref, entropy, entropy_len, additional_in,
+                                   ad_len);
+            } else {
+                CTR_DRBG_reseed(&ref, entropy, additional_in, ad_len);
+            }
+            CTR_DRBG_generate(&ref, ref_out, len, NULL, 0);
+
+            if ((SUCCESS != equal(out, ref_out, len)) ||
+                (SUCCESS != equal((uint8_t*)&drbg, (uint8_t*)&ref,
+                                  sizeof(ref)))) {
+                printf("ERROR: CTR_DRBG_generate_pr mismatch (df %d) for "
+                       "request %u\n", use_df, r);
+                entropy_pool_free(pool);
+                return ERROR;
+            }
+        }
+
+        // Too much additional input fails before it takes entropy, so the
+        // next request still matches the reference.
+        if (!use_df) {
+            const size_t seed_len = CTR_DRBG_seed_len(&drbg);
+            int ok = !CTR_DRBG_generate_pr(&drbg, out, 16, additional_in,
+                                           seed_len + 1, pool) &&
+                     CTR_DRBG_generate_pr(&drbg, out, 16, NULL, 0, pool);
+
+            for (uint32_t i = 0; i < entropy_len; i++) {
+                entropy[i] = stub_byte(ref_pos++);
+            }
+            CTR_DRBG_reseed(&ref, entropy, NULL, 0);
+            CTR_DRBG_generate(&ref, ref_out, 16, NULL, 0);
+
+            if (!ok || (SUCCESS != equal(out, ref_out, 16))) {
+                printf("ERROR: CTR_DRBG_generate_pr took entropy for a bad "
+                       "request\n");
+                entropy_pool_free(pool);
+                return ERROR;
+            }
+        }
+        entropy_pool_free(pool);
+
+        // Only the first buffer can be filled, requests fail afterwards, or
+        // as soon as the filler found the source failed.
+        stub.pos = 0;
+        stub.limit = PR_TEST_POOL_SIZE;
+        pool = entropy_pool_new(&src, PR_TEST_POOL_SIZE);
+        if (NULL == pool) {
+            printf("ERROR: entropy_pool_new failed\n");
+            return ERROR;
+        }
+
+        uint32_t served = 0;
+        for (uint32_t r = 0; r < PR_TEST_REQUESTS; r++) {
+            served += (uint32_t)CTR_DRBG_generate_pr(&drbg, out, 16, NULL, 0,
+                                                     pool);
+        }
+
+        // A failed request leaves nothing in its output.
+        memset(entropy, 0xa5, sizeof(entropy));
+        const int got = entropy_pool_get(pool, entropy, entropy_len);
+        entropy_pool_free(pool);
+
+        if (served > PR_TEST_POOL_SIZE / entropy_len) {
+            printf("ERROR: CTR_DRBG_generate_pr served %u requests without "
+                   "entropy\n", served);
+            return ERROR;
+        }
+        for (uint32_t i = 0; i < entropy_len; i++) {
+            if (got || (0 != entropy[i])) {
+                printf("ERROR: entropy_pool_get failure left output\n");
+                return ERROR;
+            }
+        }
+    }
+
+    CTR_DRBG_clear(&drbg);
+    CTR_DRBG_clear(&ref);
+
+    return SUCCESS;
+}
+
+#define BUFFER_TEST_SIZE 256
+#define BUFFER_TEST_REFILLS 8
+
+// The output of CTR_DRBG_buffer_generate, for requests shorter than the
+// cache, is the concatenation of cache sized CTR_DRBG_generate outputs.
+_INLINE_ int test_buffer()
+{
+    static const uint32_t lens[] = {1, 15, 16, 17, 32, 48, 64, 5, 100, 255};
+    CTR_DRBG_BUFFER b;
+    CTR_DRBG_STATE ref;
+    uint8_t storage[BUFFER_TEST_SIZE];
+    uint8_t entropy[CTR_DRBG_ENTROPY_LEN];
+    uint8_t stream[BUFFER_TEST_SIZE * BUFFER_TEST_REFILLS];
+    uint8_t out[BUFFER_TEST_SIZE];
+    uint32_t served = 0;
+
+    for (uint32_t i = 0; i < sizeof(entropy); i++) {
+        entropy[i] = (uint8_t)(11 * i + 2);
+    }
+
+    CTR_DRBG_init(&ref, entropy, NULL, 0);
+    for (uint32_t i = 0; i < BUFFER_TEST_REFILLS; i++) {
+        CTR_DRBG_generate(&ref, &stream[BUFFER_TEST_SIZE * i],
+                          BUFFER_TEST_SIZE, NULL, 0);
+    }
+
+    GUARD(!CTR_DRBG_buffer_init(&b, storage, sizeof(storage), entropy, NULL, 0));
+
+    for (uint32_t i = 0; served + lens[i] <= sizeof(stream);
+         i = (i + 1) % (sizeof(lens) / sizeof(lens[0]))) {
+        GUARD(!CTR_DRBG_buffer_generate(&b, out, lens[i]));
+
+        if (SUCCESS != equal(out, &stream[served], lens[i])) {
+            printf("ERROR: CTR_DRBG_buffer_generate mismatch at %u\n", served);
+            return ERROR;
+        }
+        served += lens[i];
+
+        // The served bytes must have been erased from the cache.
+        for (uint32_t j = 0; j < b.pos; j++) {
+            if (0 != storage[j]) {
+                printf("ERROR: CTR_DRBG_buffer_generate left served bytes\n");
+                return ERROR;
+            }
+        }
+    }
+
+    // Leave BUFFER_TEST_SIZE - 2 bytes in the cache, then make the refill
+    // fail. The drained bytes must not be left in out.
+    GUARD(!CTR_DRBG_buffer_generate(&b, out, b.size - b.pos));
+    GUARD(!CTR_DRBG_buffer_generate(&b, out, 2));
+    memset(out, 0xa5, sizeof(out));
+    b.drbg.reseed_counter = (UINT64_C(1) << 48) + 1;
+    GUARD(CTR_DRBG_buffer_generate(&b, out, BUFFER_TEST_SIZE - 1));
+    for (uint32_t j = 0; j < BUFFER_TEST_SIZE - 2; j++) {
+        if (0 != out[j]) {
+            printf("ERROR: CTR_DRBG_buffer_generate failure left output\n");
+            return ERROR;
+        }
+    }
+
+    CTR_DRBG_buffer_clear(&b);
+    CTR_DRBG_clear(&ref);
+
+    // Clearing after a failed init must not touch the (unset) cache.
+    memset(&b, 0xa5, sizeof(b));
+    GUARD(CTR_DRBG_buffer_init(&b, storage, 1, entropy, NULL, 0));
+    CTR_DRBG_buffer_clear(&b);
+
+    return SUCCESS;
+}
+
+#define RAND_TEST_THREADS 4
+#define RAND_TEST_LEN 64
+
+static void *rand_test_thread(void *out)
+{
+    // Two calls, so that the second one uses the existing instance.
+    if (!drbg_rand_bytes((uint8_t *)out, RAND_TEST_LEN / 2) ||
+        !drbg_rand_bytes((uint8_t *)out + RAND_TEST_LEN / 2, RAND_TEST_LEN / 2)) {
+        memset(out, 0, RAND_TEST_LEN);
+    }
+    return NULL;
+}
+
+// Every thread must get its own, independently seeded, DRBG.
+_INLINE_ int test_rand_threads()
+{
+    static const uint8_t zero[RAND_TEST_LEN] = {0};
+    uint8_t out[RAND_TEST_THREADS + 1][RAND_TEST_LEN];
+    pthread_t threads[RAND_TEST_THREADS];
+
+    for (uint32_t i = 0; i < RAND_TEST_THREADS; i++) {
+        if (0 != pthread_create(&threads[i], NULL, rand_test_thread, out[i])) {
+            printf("ERROR: pthread_create failed\n");
+            return ERROR;
+        }
+    }
+    rand_test_thread(out[RAND_TEST_THREADS]);
+
+    for (uint32_t i = 0; i < RAND_TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    drbg_rand_thread_cleanup();
+
+    for (uint32_t i = 0; i <= RAND_TEST_THREADS; i++) {
+        if (SUCCESS == equal(out[i], zero, RAND_TEST_LEN)) {
+            printf("ERROR: drbg_rand_bytes failed\n");
+            return ERROR;
+        }
+        for (uint32_t j = 0; j < i; j++) {
+            if (SUCCESS == equal(out[i], out[j], RAND_TEST_LEN)) {
+                printf("ERROR: drbg_rand_bytes threads share a stream\n");
+                return ERROR;
+            }
+        }
+    }
+
+    return SUCCESS;
+}
+
+#define SCHED_TEST_CALLS 200
+#define SCHED_TEST_WAIT_MS 2000
+
+// Checks the consumer side of a scheduler fed by a stub source: the output
+// of every call must come from the state instantiated with the k-th chunk
+// of the stub, where k is the number of switches so far.
+typedef struct sched_test_s {
+    CTR_DRBG_SCHED *s;
+    CTR_DRBG_STATE ref;
+    aes_key_size_t key_size;
+    size_t entropy_len;
+    uint64_t ref_reseeds;
+    uint32_t call;
+} sched_test_t;
+
+_INLINE_ void sched_test_ref_init(IN OUT sched_test_t *t,
+                                  IN const uint8_t *pers,
+                                  IN const size_t pers_len)
+{
+    uint8_t entropy[CTR_DRBG_ENTROPY_LEN];
+    const uint64_t first = t->ref_reseeds * t->entropy_len;
+
+    for (uint32_t i = 0; i < t->entropy_len; i++) {
+        entropy[i] = stub_byte(first + i);
+    }
+    CTR_DRBG_init_key_size(&t->ref, t->key_size, entropy, pers, pers_len);
+}
+
+_INLINE_ void sleep_ms(IN const uint32_t ms)
+{
+    const struct timespec ts = {0, (long)ms * 1000000};
+    nanosleep(&ts, NULL);
+}
+
+// Run one call and compare it to the reference. It returns 0 if the call
+// failed, 1 if it matched and -1 on a mismatch.
+_INLINE_ int sched_test_call(IN OUT sched_test_t *t,
+                             IN const uint8_t *pers,
+                             IN const size_t pers_len)
+{
+    static const uint32_t lens[] = {16, 1, 64, 33, 1000};
+    uint8_t additional_in[CTR_DRBG_ENTROPY_LEN];
+    uint8_t out[1000];
+    uint8_t ref_out[1000];
+
+    const uint32_t len = lens[t->call % (sizeof(lens) / sizeof(lens[0]))];
+    const size_t ad_len = (t->call & 1) ? t->entropy_len : 0;
+    t->call++;
+
+    for (uint32_t i = 0; i < sizeof(additional_in); i++) {
+        additional_in[i] = (uint8_t)(3 * i + t->call);
+    }
+
+    if (!CTR_DRBG_sched_generate(t->s, out, len, additional_in, ad_len)) {
+        return 0;
+    }
+
+    const uint64_t reseeds = CTR_DRBG_sched_reseeds(t->s);
+    if (reseeds != t->ref_reseeds) {
+        if (reseeds != t->ref_reseeds + 1) {
+            printf("ERROR: CTR_DRBG_sched_generate skipped a state\n");
+            return -1;
+        }
+        t->ref_reseeds = reseeds;
+        sched_test_ref_init(t, pers, pers_len);
+    }
+
+    CTR_DRBG_generate(&t->ref, ref_out, len, additional_in, ad_len);
+    if (SUCCESS != equal(out, ref_out, len)) {
+        printf("ERROR: CTR_DRBG_sched_generate mismatch for call %u\n",
+               t->call);
+        return -1;
+    }
+
+    return 1;
+}
+
+// Run |calls| calls, and then more, one per millisecond, until the
+// scheduler switched |min_reseeds| times.
+_INLINE_ int sched_test_run(IN OUT sched_test_t *t,
+                            IN const uint32_t calls,
+                            IN const uint64_t min_reseeds,
+                            IN const uint8_t *pers,
+                            IN const size_t pers_len)
+{
+    for (uint32_t i = 0; i < calls; i++) {
+        if (1 != sched_test_call(t, pers, pers_len)) {
+            printf("ERROR: CTR_DRBG_sched_generate failed\n");
+            return ERROR;
+        }
+    }
+
+    for (uint32_t i = 0; CTR_DRBG_sched_reseeds(t->s) < min_reseeds; i++) {
+        if ((i == SCHED_TEST_WAIT_MS) ||
+            (1 != sched_test_call(t, pers, pers_len))) {
+            printf("ERROR: CTR_DRBG_sched_generate did not reseed\n");
+            return ERROR;
+        }
+        sleep_ms(1);
+    }
+
+    return SUCCESS;
+}
+
+// The reseed scheduler must switch to states instantiated from consecutive
+// entropy inputs, on the call and on the age limit, and must fail once a
+// reseed is due and its source failed.
+_INLINE_ int test_reseed_sched()
+{
+    static const uint8_t pers[] = "reseed scheduler";
+
+    for (uint32_t k = 0; k < AES_KEY_SIZE_COUNT; k++) {
+        const CTR_DRBG_RESEED_POLICY by_calls = {0, 5, 0};
+        const CTR_DRBG_RESEED_POLICY by_bytes = {4096, 0, 0};
+        const CTR_DRBG_RESEED_POLICY by_age = {0, 0, 1};
+        const CTR_DRBG_RESEED_POLICY *policies[] = {&by_calls, &by_bytes,
+                                                    &by_age};
+        sched_test_t t = {0};
+
+        t.key_size = (aes_key_size_t)k;
+        t.entropy_len = CTR_DRBG_SEED_LEN(aes_impl_default(t.key_size)->key_len);
+
+        for (uint32_t p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+            stub_source_t stub = {0, UINT64_MAX};
+            const entropy_source_t src = {"stub", stub_fill, &stub};
+
+            t.s = CTR_DRBG_sched_new(&src, t.key_size, policies[p], pers,
+                                     sizeof(pers));
+            if (NULL == t.s) {
+                printf("ERROR: CTR_DRBG_sched_new failed\n");
+                return ERROR;
+            }
+            t.ref_reseeds = 0;
+            sched_test_ref_init(&t, pers, sizeof(pers));
+
+            const status_t res = sched_test_run(&t, SCHED_TEST_CALLS, 3,
+                                                pers, sizeof(pers));
+            CTR_DRBG_sched_free(t.s);
+            GUARD(res);
+        }
+
+        // The source has entropy for two states only. Once the second one
+        // is due, the calls must fail.
+        stub_source_t stub = {0, 2 * t.entropy_len};
+        const entropy_source_t src = {"stub", stub_fill, &stub};
+
+        t.s = CTR_DRBG_sched_new(&src, t.key_size, &by_calls, NULL, 0);
+        if (NULL == t.s) {
+            printf("ERROR: CTR_DRBG_sched_new failed\n");
+            return ERROR;
+        }
+        t.ref_reseeds = 0;
+        sched_test_ref_init(&t, NULL, 0);
+
+        int ret = 1;
+        for (uint32_t i = 0; (1 == ret) && (i < SCHED_TEST_WAIT_MS); i++) {
+            ret = sched_test_call(&t, NULL, 0);
+            sleep_ms(1);
+        }
+        const uint64_t reseeds = CTR_DRBG_sched_reseeds(t.s);
+        CTR_DRBG_sched_free(t.s);
+        CTR_DRBG_clear(&t.ref);
+
+        if ((0 != ret) || (1 != reseeds)) {
+            printf("ERROR: CTR_DRBG_sched_generate did not fail closed\n");
+            return ERROR;
+        }
+    }
+
+    return SUCCESS;
+}
+
+// The power-on self-test passed at load time (or no instance could have
+// been created for the tests above), and passes again.
+_INLINE_ int test_self_test()
+{
+    if (!CTR_DRBG_self_test_passed() || !CTR_DRBG_self_test() ||
+        !CTR_DRBG_self_test_passed()) {
+        printf("ERROR: the power-on self-test failed\n");
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+// The cache file of test_tune, created in $TMPDIR (or /tmp).
+#define TUNE_TEST_CACHE "ctr_drbg_tune_XXXXXX"
+
+// Rewrites the cache file written by aes_tune_all with the given lines after
+// its header line.
+_INLINE_ int rewrite_tune_cache(IN const char *path, IN const char *lines)
+{
+    char header[128];
+    FILE *f = fopen(path, "r");
+
+    if ((NULL == f) || (NULL == fgets(header, sizeof(header), f)) ||
+        (0 != strncmp(header, "ctr_drbg-tune ", 14))) {
+        printf("ERROR: the autotuner did not write its cache file\n");
+        if (NULL != f) {
+            fclose(f);
+        }
+        return ERROR;
+    }
+    fclose(f);
+
+    f = fopen(path, "w");
+    if (NULL == f) {
+        return ERROR;
+    }
+    fprintf(f, "%s%s", header, lines);
+    fclose(f);
+
+    return SUCCESS;
+}
+
+// The autotuner uses the choices of the valid cache file at path. The cached
+// choices (lines) then generate the same output as the reference.
+_INLINE_ int test_tune_cache(IN const char *path, IN const char *lines)
+{
+    setenv(AES_TUNE_CACHE_ENV_VAR, path, 1);
+    aes_tune_all();
+    GUARD(rewrite_tune_cache(path, lines));
+    aes_tune_all();
+
+    for (uint32_t id = 0; id < AES_IMPL_COUNT * AES_KEY_SIZE_COUNT; id++) {
+        const aes_impl_t *impl =
+            aes_impl_get((aes_impl_id_t)(id / AES_KEY_SIZE_COUNT),
+                         (aes_key_size_t)(id % AES_KEY_SIZE_COUNT));
+        if (NULL == impl) {
+            continue;
+        }
+
+        if ((AES_CTR_I4 != impl->ctr_variant[AES_CTR_CLASS_SMALL]) ||
+            (AES_CTR_I16 != impl->ctr_variant[AES_CTR_CLASS_MEDIUM]) ||
+            (AES_CTR_I8 != impl->ctr_variant[AES_CTR_CLASS_LARGE]) ||
+            (256 != impl->chunk_blocks)) {
+            printf("ERROR: the %s cached choices were not installed\n",
+                   impl->name);
+            return ERROR;
+        }
+        GUARD(test_generate_lengths(impl));
+    }
+
+    // An invalid cache is ignored and replaced. So is a chunk length the
+    // tuner does not try.
+    GUARD(rewrite_tune_cache(path, "aesni 5 8 8 0\n"));
+    aes_tune_all();
+    GUARD(rewrite_tune_cache(path, "aesni 4 16 8 100\n"));
+    aes_tune_all();
+    if (100 == aes_impl_get(AES_IMPL_AESNI, AES_KEY_256)->chunk_blocks) {
+        printf("ERROR: the autotuner used an invalid cached chunk length\n");
+        return ERROR;
+    }
+
+    return rewrite_tune_cache(path, "");
+}
+
+// The autotuner only installs variants that pass the checks, and uses the
+// choices of a valid cache file, see test_tune_cache. The cached choices are
+// the narrowest small kernel, the widest medium one, and 256 block chunks.
+_INLINE_ int test_tune()
+{
+    char lines[256] = {0};
+    aes_tune_result_t res;
+
+    for (uint32_t id = 0; id < AES_IMPL_COUNT; id++) {
+        const aes_impl_t *impl = aes_impl_get((aes_impl_id_t)id, AES_KEY_256);
+        if (NULL == impl) {
+            continue;
+        }
+
+        if (((1U << AES_CTR_VARIANT_COUNT) - 1 != aes_tune_kat((aes_impl_id_t)id)) ||
+            (SUCCESS != aes_tune_impl((aes_impl_id_t)id, &res))) {
+            printf("ERROR: the %s kernel variants failed the checks\n",
+                   impl->name);
+            return ERROR;
+        }
+
+        for (uint32_t cls = 0; cls < AES_CTR_CLASS_COUNT; cls++) {
+            if (impl->ctr_variant[cls] != res.variant[cls] ||
+                impl->ctr_enc_tuned[cls] !=
+                impl->ctr_enc_variants[res.variant[cls]]) {
+                printf("ERROR: the %s tuned kernels were not installed\n",
+                       impl->name);
+                return ERROR;
+            }
+        }
+
+        printf("Tuned %s: %.2f/%.2f/%.2f cycles per block, chunk %u.\n",
+               impl->name, res.cycles_per_block[AES_CTR_CLASS_SMALL],
+               res.cycles_per_block[AES_CTR_CLASS_MEDIUM],
+               res.cycles_per_block[AES_CTR_CLASS_LARGE], res.chunk_blocks);
+
+        snprintf(&lines[strlen(lines)], sizeof(lines) - strlen(lines),
+                 "%s 4 16 8 256\n", impl->name);
+    }
+
+    // The cache file is created empty, which the autotuner replaces.
+    const char *tmp_dir = getenv("TMPDIR");
+    char path[512];
+    snprintf(path, sizeof(path), "%s/" TUNE_TEST_CACHE,
+             ((NULL == tmp_dir) || ('\0' == tmp_dir[0])) ? "/tmp" : tmp_dir);
+    const int fd = mkstemp(path);
+    if (fd < 0) {
+        printf("ERROR: cannot create %s\n", path);
+        return ERROR;
+    }
+    close(fd);
+
+    const int ret = test_tune_cache(path, lines);
+
+    unsetenv(AES_TUNE_CACHE_ENV_VAR);
+    unlink(path);
+    aes_tune_all();
+
+    return ret;
+}
+
+// The CAVP files, with (.txt) and without (.rsp) the intermediate values.
+// Each has 16 groups of 15 vectors for AES-128, AES-192 and AES-256,
+// without and with the derivation function.
+static const char *const kKatFiles[] = {
+    "KATs/CTR_DRBG_pr_false.txt",
+    "KATs/CTR_DRBG_pr_false.rsp",
+};
+#define KAT_SECTIONS (2 * AES_KEY_SIZE_COUNT * 16)
+#define KAT_VECTORS (KAT_SECTIONS * 15)
+
+_INLINE_ int test_hex_decode()
+{
+    static const char digits[] = "0123456789abcdef0123456789ABCDEF";
+    char hex[2 * MAX_RETURNED_BITS_LEN + 2];
+    uint8_t in[MAX_RETURNED_BITS_LEN];
+    uint8_t out[MAX_RETURNED_BITS_LEN + 1];
+
+    for (uint32_t len = 0; len <= MAX_RETURNED_BITS_LEN; len++) {
+        for (uint32_t i = 0; i < len; i++) {
+            in[i] = (uint8_t)(37 * i + len);
+            // Mix the cases.
+            hex[2 * i] = digits[(in[i] >> 4) + 16 * (i % 2)];
+            hex[2 * i + 1] = digits[(in[i] & 0xf) + 16 * (len % 2)];
+        }
+        if ((SUCCESS != kat_hex_decode(out, hex, 2 * len)) ||
+            (SUCCESS != equal(out, in, len))) {
+            printf("ERROR: kat_hex_decode of %u bytes\n", len);
+            return ERROR;
+        }
+
+        // Any character that is not a hex digit, at any position, and an
+        // odd length must fail.
+        for (uint32_t i = 0; i < 2 * len; i++) {
+            const char c = hex[i];
+            for (uint32_t bad = 0; bad < 256; bad++) {
+                if (NULL != memchr(digits, (int)bad, 32)) {
+                    continue;
+                }
+                hex[i] = (char)bad;
+                if (SUCCESS == kat_hex_decode(out, hex, 2 * len)) {
+                    printf("ERROR: kat_hex_decode accepted 0x%02x\n", bad);
+                    return ERROR;
+                }
+            }
+            hex[i] = c;
+        }
+        if (SUCCESS == kat_hex_decode(out, hex, 2 * len + 1)) {
+            printf("ERROR: kat_hex_decode accepted an odd length\n");
+            return ERROR;
+        }
+    }
+
+    return SUCCESS;
+}
+
+// Run every AES vector of the CAVP files with every implementation this
+// CPU supports.
+_INLINE_ int test_kats()
+{
+    for (uint32_t i = 0; i < sizeof(kKatFiles) / sizeof(kKatFiles[0]); i++)
     {
-        perror("Error while opening the file.\n");
-        return 1;
-    }
-
-    while ((!feof(txt_fp)) && 
-           (SUCCESS == goto_AES256_test(txt_fp, "[AES-256 no df]\n")))
-    { 
-        GUARD(read_pr(txt_fp, &pr));
-        GUARD(read_uint_in_bytes(txt_fp, &entropy_in_len, 
-                                 "[EntropyInputLen = %u]\n"));
-        GUARD(read_uint_in_bytes(txt_fp, &nonce_len, "[NonceLen = %u]\n"));
-        GUARD(read_uint_in_bytes(txt_fp, &personalization_string_len, 
-                                 "[PersonalizationStringLen = %u]\n"));
-        GUARD(read_uint_in_bytes(txt_fp, &additional_in_len, 
-                                 "[AdditionalInputLen = %u]\n"));
-        GUARD(read_uint_in_bytes(txt_fp, &returned_bits_len, 
-                                 "[ReturnedBitsLen = %u]\n"));
-        
-        if((nonce_len > MAX_NONCE_LEN) ||
-           (entropy_in_len > MAX_ENTROPY_LEN) ||
-           (additional_in_len > MAX_ADITIONAL_INPUT_LEN) ||
-           (returned_bits_len > MAX_RETURNED_BITS_LEN) || 
-           (personalization_string_len > MAX_PERSONALIZATION_STRING_LEN))
-        {
-            printf("ERROR: length is too big\n");
+        kat_stats_t stats;
+
+        if (SUCCESS != kat_run_file(kKatFiles[i], 0, &stats)) {
+            printf("ERROR: %u of %u KAT runs of %s failed\n",
+                   stats.failures, stats.runs, kKatFiles[i]);
             return ERROR;
         }
 
-        if(entropy_in_len + nonce_len > sizeof(entropy_t))
-        {
-            printf("ERROR: (entropy_in_len + nonce_len) will cause overflow\n");
+        if ((KAT_SECTIONS != stats.sections) ||
+            (KAT_VECTORS != stats.vectors)) {
+            printf("ERROR: %s has %u AES sections and %u vectors\n",
+                   kKatFiles[i], stats.sections, stats.vectors);
             return ERROR;
         }
 
-        for(uint8_t i=0 ; i < NIST_TEST_COUNT; i++)
+        printf("Passed %u KAT runs (%u vectors, %u sections) of %s.\n",
+               stats.runs, stats.vectors, stats.sections, kKatFiles[i]);
+    }
+
+    return SUCCESS;
+}
+
+// Run the kernel and KAT tests with every implementation this CPU supports,
+// for every key size.
+_INLINE_ int test_all_impls()
+{
+    for (uint32_t id = 0; id < AES_IMPL_COUNT * AES_KEY_SIZE_COUNT; id++)
+    {
+        const aes_impl_t *impl =
+            aes_impl_get((aes_impl_id_t)(id / AES_KEY_SIZE_COUNT),
+                         (aes_key_size_t)(id % AES_KEY_SIZE_COUNT));
+        if (NULL == impl)
         {
-            GUARD(test_ctr_drbg_init(txt_fp, &drbg, entropy_in_len, 
-                                     nonce_len, personalization_string_len));
-            
-            GUARD(test_ctr_drbg_reseed(txt_fp, &drbg, entropy_in_len, 
-                                       additional_in_len));
-            
-            GUARD(test_ctr_drbg_gen1(txt_fp, &drbg, additional_in_len));
-            
-            GUARD(test_ctr_drbg_gen2(txt_fp, &drbg, additional_in_len, 
-                                     returned_bits_len));
-            
-            CTR_DRBG_clear(&drbg);
-        }
-    }
-    fclose(txt_fp);
+            continue;
+        }
+
+        printf("Testing the %s AES-%u kernels.\n", impl->name,
+               8 * impl->key_len);
+        GUARD(test_ctr_kernel(impl));
+        GUARD(test_ctr_kernel_x4(impl));
+        GUARD(test_key_expansion_batch(impl));
+        GUARD(test_bcc(impl));
+        GUARD(test_generate_lengths(impl));
+        GUARD(test_generate_batch(impl));
+        GUARD(test_generate_parallel(impl));
+        GUARD(test_counter_wrap(impl));
+        GUARD(test_generate_stream(impl));
+        GUARD(test_generate_pr(impl));
+    }
+
+    GUARD(test_tune());
+    GUARD(test_self_test());
+    GUARD(test_hex_decode());
+    GUARD(test_kats());
+
+    GUARD(test_buffer());
+    GUARD(test_rand_threads());
+    GUARD(test_reseed_sched());
 
     printf("All tests passed.\n");
 
@@ -272,6 +1553,6 @@ int main()
 #ifdef PERF
     return measure();
 #else
-    return test_kats();
+    return test_all_impls();
 #endif
 }
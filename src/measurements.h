@@ -95,6 +95,43 @@ for(RDTSC_OUTER_ITERATOR=0;RDTSC_OUTER_ITERATOR<OUTER_REPEAT; RDTSC_OUTER_ITERAT
 printf("%s", msg); \
 printf(" took %0.2f cycles\n", RDTSC_total_clk );
 
-#define MEASURE(msg, x) RDTSC_MEASURE(msg, x)
+#ifdef PERF_EVENTS
+    #include <stdio.h>
+    #include "perf_counters.h"
+
+    static perf_counters_t perf_events;
+    // 0 before the first measurement, 1 if counters are open, -1 if not.
+    static int perf_events_state = 0;
+
+/* 
+In addition, when PERF_EVENTS is defined, this MACRO runs "x" REPEAT more
+times with the hardware counters of perf_counters.h enabled, and prints the
+counts per iteration of "x" and the IPC. The counters are read outside the
+timed loops.
+*/
+    #define PERF_EVENTS_MEASURE(x)                                                                \
+    if (0 == perf_events_state)                                                                   \
+    {                                                                                             \
+        perf_events_state = (0 != perf_counters_open(&perf_events)) ? 1 : -1;                    \
+        if (-1 == perf_events_state)                                                              \
+        {                                                                                         \
+            printf("    perf_event_open is not available, no counters.\n");                      \
+        }                                                                                         \
+    }                                                                                             \
+    if (1 == perf_events_state)                                                                   \
+    {                                                                                             \
+        perf_counters_start(&perf_events);                                                        \
+        for (RDTSC_MEASURE_ITERATOR = 0; RDTSC_MEASURE_ITERATOR < REPEAT; RDTSC_MEASURE_ITERATOR++) \
+        {                                                                                         \
+            {x};                                                                                  \
+        }                                                                                         \
+        perf_counters_stop(&perf_events);                                                         \
+        perf_counters_print(&perf_events, REPEAT);                                                \
+    }
+#else
+    #define PERF_EVENTS_MEASURE(x)
+#endif
+
+#define MEASURE(msg, x) RDTSC_MEASURE(msg, x) PERF_EVENTS_MEASURE(x)
 
 #endif //COUNT_INSTRUCTIONS
@@ -0,0 +1,194 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <cpuid.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "perf_counters.h"
+
+// Raw Intel events: umask << 8 | event.
+#define INTEL_UOPS_ISSUED_ANY          0x010eULL
+#define INTEL_UOPS_DISPATCHED_PORT_0   0x01a1ULL
+
+const char *const perf_counter_names[PERF_CNT_COUNT] = {
+    "instructions",
+    "cycles",
+    "ref_cycles",
+    "uops",
+    "port0_uops",
+};
+
+// The value a counter read returns with the read_format below.
+typedef struct perf_read_s {
+    uint64_t value;
+    uint64_t time_enabled;
+    uint64_t time_running;
+} perf_read_t;
+
+_INLINE_ int is_intel(void)
+{
+    uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+    // "GenuineIntel"
+    return __get_cpuid(0, &eax, &ebx, &ecx, &edx) &&
+           (0x756e6547 == ebx) && (0x49656e69 == edx) && (0x6c65746e == ecx);
+}
+
+// Open an event in the group of leader, or as the leader of a new group if
+// leader is -1. Only the leader starts disabled; the other events follow it.
+_INLINE_ int open_event(IN const uint32_t type,
+                        IN const uint64_t config,
+                        IN const int leader)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = (-1 == leader);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    const int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+
+    return (fd < 0) ? -1 : fd;
+}
+
+uint32_t perf_counters_open(OUT perf_counters_t *pc)
+{
+    const int intel = is_intel();
+    const struct {
+        uint32_t type;
+        uint64_t config;
+        int available;
+    } events[PERF_CNT_COUNT] = {
+        [PERF_CNT_INSTRUCTIONS] = {PERF_TYPE_HARDWARE,
+                                   PERF_COUNT_HW_INSTRUCTIONS, 1},
+        [PERF_CNT_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 1},
+        [PERF_CNT_REF_CYCLES] = {PERF_TYPE_HARDWARE,
+                                 PERF_COUNT_HW_REF_CPU_CYCLES, 1},
+        [PERF_CNT_UOPS] = {PERF_TYPE_RAW, INTEL_UOPS_ISSUED_ANY, intel},
+        [PERF_CNT_PORT0_UOPS] = {PERF_TYPE_RAW, INTEL_UOPS_DISPATCHED_PORT_0,
+                                 intel},
+    };
+    uint32_t n = 0;
+
+    // The counters form one group, so that they are scheduled together and
+    // count the same instructions. The first one that opens leads it.
+    pc->leader = -1;
+    for (uint32_t i = 0; i < PERF_CNT_COUNT; i++)
+    {
+        pc->fd[i] = events[i].available ? open_event(events[i].type,
+                                                     events[i].config,
+                                                     pc->leader) : -1;
+        if (-1 == pc->fd[i])
+        {
+            continue;
+        }
+        if (-1 == pc->leader)
+        {
+            pc->leader = pc->fd[i];
+        }
+        pc->value[i] = 0;
+        n++;
+    }
+
+    return n;
+}
+
+void perf_counters_start(IN OUT perf_counters_t *pc)
+{
+    if (-1 != pc->leader)
+    {
+        ioctl(pc->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(pc->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+void perf_counters_stop(IN OUT perf_counters_t *pc)
+{
+    perf_read_t r;
+
+    if (-1 != pc->leader)
+    {
+        ioctl(pc->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    for (uint32_t i = 0; i < PERF_CNT_COUNT; i++)
+    {
+        if (-1 == pc->fd[i])
+        {
+            continue;
+        }
+
+        if ((sizeof(r) != read(pc->fd[i], &r, sizeof(r))) ||
+            (0 == r.time_running))
+        {
+            pc->value[i] = 0;
+            continue;
+        }
+
+        // Scale up if the group was multiplexed with other events.
+        pc->value[i] = (double)r.value *
+                       ((double)r.time_enabled / (double)r.time_running);
+    }
+}
+
+void perf_counters_print(IN const perf_counters_t *pc, IN const double calls)
+{
+    printf("   ");
+    for (uint32_t i = 0; i < PERF_CNT_COUNT; i++)
+    {
+        if (-1 != pc->fd[i])
+        {
+            printf(" %s %0.1f", perf_counter_names[i], pc->value[i] / calls);
+        }
+    }
+
+    if ((-1 != pc->fd[PERF_CNT_INSTRUCTIONS]) &&
+        (-1 != pc->fd[PERF_CNT_CYCLES]) && (0 != pc->value[PERF_CNT_CYCLES]))
+    {
+        printf(" IPC %0.2f", pc->value[PERF_CNT_INSTRUCTIONS] /
+                             pc->value[PERF_CNT_CYCLES]);
+    }
+    printf("\n");
+}
+
+void perf_counters_close(IN OUT perf_counters_t *pc)
+{
+    for (uint32_t i = 0; i < PERF_CNT_COUNT; i++)
+    {
+        if (-1 != pc->fd[i])
+        {
+            close(pc->fd[i]);
+            pc->fd[i] = -1;
+        }
+    }
+    pc->leader = -1;
+}
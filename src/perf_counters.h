@@ -0,0 +1,85 @@
+/***************************************************************************
+* Written by Nir Drucker and Shay Gueron
+* AWS Cryptographic Algorithms Group
+* (ndrucker@amazon.com, gueron@amazon.com)
+*
+* Copyright 2019 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*  
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*  
+*     http://www.apache.org/licenses/LICENSE-2.0
+*  
+* or in the "license" file accompanying this file. This file is distributed 
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either 
+* express or implied. See the License for the specific language governing 
+* permissions and limitations under the License.
+* The license is detailed in the file LICENSE.txt, and applies to this file.
+* ***************************************************************************/
+
+#pragma once
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "defs.h"
+
+// Hardware performance counters of the calling thread, through Linux
+// perf_event_open. Only user space is counted, so the counters work with
+// the default perf_event_paranoid setting of 2. The generic events are
+// available on most CPUs (and hypervisors that expose a PMU). The uops and
+// port 0 uops events are raw Intel events (UOPS_ISSUED.ANY and
+// UOPS_DISPATCHED.PORT_0), and are opened on Intel CPUs only. AESENC and
+// VAESENC execute on port 0 from Skylake on, but port 0 also runs other
+// vector and integer uops, so the count is an upper bound for AES. All the
+// counters are opened as one group.
+typedef enum
+{
+    PERF_CNT_INSTRUCTIONS=0,
+    PERF_CNT_CYCLES,
+    PERF_CNT_REF_CYCLES,
+    PERF_CNT_UOPS,
+    PERF_CNT_PORT0_UOPS,
+    PERF_CNT_COUNT
+} perf_counter_id_t;
+
+// The name of each counter, as used in reports.
+extern const char *const perf_counter_names[PERF_CNT_COUNT];
+
+typedef struct perf_counters_s {
+    // -1 for the counters that could not be opened.
+    int fd[PERF_CNT_COUNT];
+    // The fd of the group leader, -1 if no counter could be opened.
+    int leader;
+    // The values of the last start/stop interval, scaled up when the kernel
+    // multiplexed the counter. Valid when fd is not -1.
+    double value[PERF_CNT_COUNT];
+} perf_counters_t;
+
+// Open the counters. It returns the number of counters that could be
+// opened, 0 if perf_event_open is not available.
+uint32_t perf_counters_open(OUT perf_counters_t *pc);
+
+_INLINE_ int perf_counter_valid(IN const perf_counters_t *pc,
+                                IN const perf_counter_id_t id)
+{
+    return (-1 != pc->fd[id]);
+}
+
+// Reset and start all the open counters.
+void perf_counters_start(IN OUT perf_counters_t *pc);
+
+// Stop all the open counters and read their values.
+void perf_counters_stop(IN OUT perf_counters_t *pc);
+
+// Print the values of the open counters divided by calls, and the IPC.
+void perf_counters_print(IN const perf_counters_t *pc, IN const double calls);
+
+void perf_counters_close(IN OUT perf_counters_t *pc);
+
+#if defined(__cplusplus)
+}  // extern C
+#endif
@@ -25,30 +25,6 @@
 #include <stdio.h>
 #include "defs.h"
 
-typedef enum
-{
-  PredictionResistance=0,
-  NoPredictionResistance
-} pr_t;
-
-status_t goto_AES256_test(IN OUT FILE *f, 
-                          IN const char* str);
-
-status_t read_op(IN OUT FILE *f, 
-                 IN const char* str);
-
-status_t read_pr(IN OUT FILE *f, 
-                 OUT pr_t* pr);
-
-status_t read_uint_in_bytes(IN OUT FILE *f, 
-                            OUT uint32_t* val, 
-                            IN const char* str);
-
-status_t read_hex(IN OUT FILE *f, 
-                  OUT uint8_t *val, 
-                  IN const char *prefix, 
-                  IN const uint32_t len);
-
 status_t equal(IN const uint8_t* a, 
                IN const uint8_t* b, 
                IN const uint32_t len);